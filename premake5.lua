@@ -123,6 +123,31 @@ project "Test"
         "test/doctest.h",
         "test/Test.cc",
     }
+    configuration { "gmake*", "linux" }
+        links {
+            "pthread",
+        }
+
+-- The same tests, with the statistics (see Cmdline::Stats) enabled.
+project "TestStats"
+    language "C++"
+    kind "ConsoleApp"
+    defines {
+        "CL_ENABLE_STATS=1",
+    }
+    includedirs {
+        "src/",
+    }
+    files {
+        "src/**.*",
+        "test/doctest.cc",
+        "test/doctest.h",
+        "test/Test.cc",
+    }
+    configuration { "gmake*", "linux" }
+        links {
+            "pthread",
+        }
 
 project "Example"
     language "C++"
@@ -134,3 +159,17 @@ project "Example"
         "src/**.*",
         "test/Example.cc",
     }
+
+--------------------------------------------------------------------------------
+group "Benchmarks"
+
+project "Benchmark"
+    language "C++"
+    kind "ConsoleApp"
+    includedirs {
+        "src/",
+    }
+    files {
+        "src/**.*",
+        "test/Benchmark.cc",
+    }
@@ -21,6 +21,8 @@ static_assert(sizeof(wchar_t) == 2, "Invalid configuration");
 static_assert(sizeof(wchar_t) == 4, "Invalid configuration");
 #endif
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cerrno>
 #include <climits>
@@ -32,7 +34,10 @@ static_assert(sizeof(wchar_t) == 4, "Invalid configuration");
 #include <iosfwd>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -41,6 +46,67 @@ static_assert(sizeof(wchar_t) == 4, "Invalid configuration");
 #include <windows.h>
 #endif
 
+// Collect statistics while parsing? See Cmdline::Stats().
+#ifndef CL_ENABLE_STATS
+#define CL_ENABLE_STATS 0
+#endif
+
+#if CL_ENABLE_STATS
+#include <chrono>
+#endif
+
+#ifndef CL_HAS_SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CL_HAS_SSE2 1
+#endif
+#endif
+
+#ifndef CL_HAS_NEON
+#if defined(__ARM_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+#define CL_HAS_NEON 1
+#endif
+#endif
+
+#ifndef CL_HAS_LITTLE_ENDIAN
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || defined(_MSC_VER)
+#define CL_HAS_LITTLE_ENDIAN 1
+#endif
+#endif
+
+#ifndef CL_HAS_MMAP
+#if defined(__unix__) || defined(__APPLE__)
+#define CL_HAS_MMAP 1
+#endif
+#endif
+
+#if CL_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Are strtod_l & co. available? Used for parsing floating-point numbers
+// independently of the current locale.
+#ifndef CL_HAS_STRTOD_L
+#if defined(_MSC_VER) || (defined(__GLIBC__) && defined(__USE_GNU)) || defined(__APPLE__) || defined(__FreeBSD__)
+#define CL_HAS_STRTOD_L 1
+#endif
+#endif
+
+#if CL_HAS_STRTOD_L
+#include <locale.h>
+#if defined(__APPLE__)
+#include <xlocale.h>
+#endif
+#endif
+
+#if CL_HAS_SSE2
+#include <emmintrin.h>
+#elif CL_HAS_NEON
+#include <arm_neon.h>
+#endif
+
 #if __cpp_lib_string_view >= 201606
 #define CL_HAS_STD_STRING_VIEW 1
 #include <string_view>
@@ -50,6 +116,18 @@ static_assert(sizeof(wchar_t) == 4, "Invalid configuration");
 #define CL_HAS_STD_INVOCABLE 1
 #endif
 
+#ifndef CL_HAS_STD_MEMORY_RESOURCE
+#if defined(__has_include)
+#if __has_include(<memory_resource>) && (__cplusplus >= 201703L || _MSVC_LANG >= 201703L)
+#define CL_HAS_STD_MEMORY_RESOURCE 1
+#endif
+#endif
+#endif
+
+#if CL_HAS_STD_MEMORY_RESOURCE
+#include <memory_resource>
+#endif
+
 #if __cpp_deduction_guides >= 201606
 #define CL_HAS_DEDUCTION_GUIDES 1
 #endif
@@ -58,6 +136,13 @@ static_assert(sizeof(wchar_t) == 4, "Invalid configuration");
 #define CL_HAS_FOLD_EXPRESSIONS 1
 #endif
 
+#if __cpp_constexpr >= 201304 || _MSC_VER >= 1910
+#define CL_HAS_CONSTEXPR14 1
+#define CL_CONSTEXPR14 constexpr
+#else
+#define CL_CONSTEXPR14 inline
+#endif
+
 //#if __cpp_lib_to_chars >= 201611 || (_MSC_VER >= 1920 && defined(_HAS_CXX17))
 //#define CL_HAS_STD_CHARCONV 1
 //#include <charconv>
@@ -81,6 +166,7 @@ static_assert(sizeof(wchar_t) == 4, "Invalid configuration");
 namespace cl {
 
 class Cmdline;
+class Schema;
 
 //==================================================================================================
 //
@@ -285,6 +371,213 @@ inline std::ostream& operator<<(std::ostream& os, string_view sv) {
 }
 #endif
 
+//==================================================================================================
+// Memory resources
+//==================================================================================================
+
+#if CL_HAS_STD_MEMORY_RESOURCE
+using memory_resource = std::pmr::memory_resource;
+using monotonic_buffer_resource = std::pmr::monotonic_buffer_resource;
+using std::pmr::new_delete_resource;
+template <typename T>
+using polymorphic_allocator = std::pmr::polymorphic_allocator<T>;
+#else
+class memory_resource { // A minimal std::pmr::memory_resource replacement
+    static constexpr size_t kMaxAlign = alignof(std::max_align_t);
+
+public:
+    virtual ~memory_resource() = default;
+
+    void* allocate(size_t bytes, size_t alignment = kMaxAlign) {
+        return do_allocate(bytes, alignment);
+    }
+
+    void deallocate(void* p, size_t bytes, size_t alignment = kMaxAlign) {
+        do_deallocate(p, bytes, alignment);
+    }
+
+    bool is_equal(memory_resource const& other) const noexcept {
+        return do_is_equal(other);
+    }
+
+private:
+    virtual void* do_allocate(size_t bytes, size_t alignment) = 0;
+    virtual void do_deallocate(void* p, size_t bytes, size_t alignment) = 0;
+    virtual bool do_is_equal(memory_resource const& other) const noexcept = 0;
+};
+
+inline bool operator==(memory_resource const& lhs, memory_resource const& rhs) noexcept {
+    return &lhs == &rhs || lhs.is_equal(rhs);
+}
+
+inline bool operator!=(memory_resource const& lhs, memory_resource const& rhs) noexcept {
+    return !(lhs == rhs);
+}
+
+namespace impl {
+
+class NewDeleteResource final : public memory_resource {
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        CL_ASSERT(alignment <= alignof(std::max_align_t) && "over-aligned types are not supported");
+        static_cast<void>(alignment);
+        return ::operator new(bytes);
+    }
+
+    void do_deallocate(void* p, size_t /*bytes*/, size_t /*alignment*/) override {
+        ::operator delete(p);
+    }
+
+    bool do_is_equal(memory_resource const& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+} // namespace impl
+
+inline memory_resource* new_delete_resource() noexcept {
+    static impl::NewDeleteResource resource;
+    return &resource;
+}
+
+// A minimal std::pmr::monotonic_buffer_resource replacement.
+// Memory is only released when the resource is destroyed (or release() is called).
+class monotonic_buffer_resource : public memory_resource {
+    struct Chunk {
+        Chunk* next;
+        size_t size; // Size of the allocation, including this header
+    };
+
+    memory_resource* upstream_;
+    Chunk* chunks_ = nullptr;
+    char* initial_buffer_ = nullptr;
+    size_t initial_size_ = 0;
+    size_t next_size_ = 1024;
+    char* curr_ = nullptr;
+    size_t space_ = 0;
+
+public:
+    explicit monotonic_buffer_resource(memory_resource* upstream = cl::new_delete_resource())
+        : upstream_(upstream)
+    {
+    }
+
+    explicit monotonic_buffer_resource(size_t initial_size, memory_resource* upstream = cl::new_delete_resource())
+        : upstream_(upstream)
+        , next_size_(initial_size > 0 ? initial_size : 1)
+    {
+    }
+
+    monotonic_buffer_resource(void* buffer, size_t buffer_size, memory_resource* upstream = cl::new_delete_resource())
+        : upstream_(upstream)
+        , initial_buffer_(static_cast<char*>(buffer))
+        , initial_size_(buffer_size)
+        , next_size_(buffer_size > 0 ? 2 * buffer_size : 1024)
+        , curr_(static_cast<char*>(buffer))
+        , space_(buffer_size)
+    {
+    }
+
+    monotonic_buffer_resource(monotonic_buffer_resource const&) = delete;
+    monotonic_buffer_resource& operator=(monotonic_buffer_resource const&) = delete;
+
+    ~monotonic_buffer_resource() override {
+        release();
+    }
+
+    // Releases all allocated memory.
+    void release() {
+        while (chunks_ != nullptr) {
+            Chunk* const next = chunks_->next;
+            upstream_->deallocate(chunks_, chunks_->size, alignof(std::max_align_t));
+            chunks_ = next;
+        }
+
+        curr_ = initial_buffer_;
+        space_ = initial_size_;
+    }
+
+    memory_resource* upstream_resource() const {
+        return upstream_;
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        CL_ASSERT(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+        size_t const pad = (alignment - reinterpret_cast<uintptr_t>(curr_) % alignment) % alignment;
+        if (curr_ == nullptr || pad + bytes > space_) {
+            size_t const header = (sizeof(Chunk) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+            size_t size = next_size_;
+            while (size < header + bytes + alignment) {
+                size *= 2;
+            }
+
+            auto const chunk = static_cast<Chunk*>(upstream_->allocate(size, alignof(std::max_align_t)));
+            chunk->next = chunks_;
+            chunk->size = size;
+            chunks_ = chunk;
+
+            next_size_ = 2 * size;
+            curr_ = reinterpret_cast<char*>(chunk) + header;
+            space_ = size - header;
+
+            return do_allocate(bytes, alignment);
+        }
+
+        void* const p = curr_ + pad;
+        curr_ += pad + bytes;
+        space_ -= pad + bytes;
+        return p;
+    }
+
+    void do_deallocate(void* /*p*/, size_t /*bytes*/, size_t /*alignment*/) override {
+    }
+
+    bool do_is_equal(memory_resource const& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// A minimal std::pmr::polymorphic_allocator replacement.
+template <typename T>
+class polymorphic_allocator {
+    template <typename U> friend class polymorphic_allocator;
+
+    memory_resource* resource_;
+
+public:
+    using value_type = T;
+
+    polymorphic_allocator() noexcept : resource_(cl::new_delete_resource()) {}
+    polymorphic_allocator(memory_resource* resource) noexcept : resource_(resource) {} // NOLINT: implicit
+
+    template <typename U>
+    polymorphic_allocator(polymorphic_allocator<U> const& other) noexcept : resource_(other.resource_) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(resource_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        resource_->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    memory_resource* resource() const noexcept {
+        return resource_;
+    }
+
+    template <typename U>
+    friend bool operator==(polymorphic_allocator const& lhs, polymorphic_allocator<U> const& rhs) noexcept {
+        return *lhs.resource() == *rhs.resource();
+    }
+
+    template <typename U>
+    friend bool operator!=(polymorphic_allocator const& lhs, polymorphic_allocator<U> const& rhs) noexcept {
+        return !(lhs == rhs);
+    }
+};
+#endif
+
 //==================================================================================================
 //
 //==================================================================================================
@@ -405,14 +698,14 @@ struct OptionFlags {
 // Because of Arg; e.g.:
 //  Arg::no  ==  Arg::yes | Arg::no  !=  Arg::no | Arg::yes  ==  Arg::yes
 
-inline /*constexpr*/ OptionFlags operator|(OptionFlags f, Required       v) { f.required        = v; return f; }
-inline /*constexpr*/ OptionFlags operator|(OptionFlags f, Multiple       v) { f.multiple        = v; return f; }
-inline /*constexpr*/ OptionFlags operator|(OptionFlags f, Arg            v) { f.arg             = v; return f; }
-inline /*constexpr*/ OptionFlags operator|(OptionFlags f, MayJoin        v) { f.may_join        = v; return f; }
-inline /*constexpr*/ OptionFlags operator|(OptionFlags f, MayGroup       v) { f.may_group       = v; return f; }
-inline /*constexpr*/ OptionFlags operator|(OptionFlags f, Positional     v) { f.positional      = v; return f; }
-inline /*constexpr*/ OptionFlags operator|(OptionFlags f, CommaSeparated v) { f.comma_separated = v; return f; }
-inline /*constexpr*/ OptionFlags operator|(OptionFlags f, StopParsing    v) { f.stop_parsing    = v; return f; }
+CL_CONSTEXPR14 OptionFlags operator|(OptionFlags f, Required       v) { f.required        = v; return f; }
+CL_CONSTEXPR14 OptionFlags operator|(OptionFlags f, Multiple       v) { f.multiple        = v; return f; }
+CL_CONSTEXPR14 OptionFlags operator|(OptionFlags f, Arg            v) { f.arg             = v; return f; }
+CL_CONSTEXPR14 OptionFlags operator|(OptionFlags f, MayJoin        v) { f.may_join        = v; return f; }
+CL_CONSTEXPR14 OptionFlags operator|(OptionFlags f, MayGroup       v) { f.may_group       = v; return f; }
+CL_CONSTEXPR14 OptionFlags operator|(OptionFlags f, Positional     v) { f.positional      = v; return f; }
+CL_CONSTEXPR14 OptionFlags operator|(OptionFlags f, CommaSeparated v) { f.comma_separated = v; return f; }
+CL_CONSTEXPR14 OptionFlags operator|(OptionFlags f, StopParsing    v) { f.stop_parsing    = v; return f; }
 
 // Provides information about the argument and the command line parser which
 // is currently parsing the arguments.
@@ -422,10 +715,30 @@ struct ParseContext {
     string_view arg;            // Option argument                    (only valid in callback!)
     int index = 0;              // Current index in the argv array
     Cmdline* cmdline = nullptr; // The command line parser which currently parses the argument list (never null)
+    void* target = nullptr;     // The object set by Cmdline::SetTarget (may be null)
+};
+
+namespace impl {
+
+// Values of an option which are converted independently of each other, and
+// stored later, in order. See OptionBase::MakeArgSlots().
+class ArgSlots {
+public:
+    virtual ~ArgSlots() = default;
+
+    // Converts the argument in CTX into slot I. Returns false if the argument
+    // is invalid. Might be called concurrently for different slots.
+    virtual bool Convert(size_t i, ParseContext const& ctx) = 0;
+
+    // Stores the value converted into slot I.
+    virtual void Store(size_t i) = 0;
 };
 
+} // namespace impl
+
 class OptionBase {
     friend class Cmdline;
+    friend class Schema;
 
     // The name of the option.
     string_view name_;
@@ -433,8 +746,10 @@ class OptionBase {
     string_view descr_;
     // Flags controlling how the option may/must be specified.
     OptionFlags flags_;
-    // The number of times this option was specified on the command line
-    int count_ = 0;
+    // Index of this option in the Schema it has been added to, or -1
+    int id_ = -1;
+    // The Schema this option has been added to, or null. See Count().
+    Schema const* schema_ = nullptr;
 
 protected:
     explicit OptionBase(char const* name, char const* descr, OptionFlags flags);
@@ -463,20 +778,55 @@ public:
     bool HasFlag(CommaSeparated f) const { return flags_.comma_separated == f; }
     bool HasFlag(StopParsing    f) const { return flags_.stop_parsing    == f; }
 
-    // Returns the number of times this option was specified on the command line
-    int Count() const { return count_; }
+    // Returns the index of this option in the Schema it has been added to, or
+    // -1 if the option has not yet been added to a Schema.
+    int Id() const { return id_; }
 
-private:
-    bool IsOccurrenceAllowed() const;
-    bool IsOccurrenceRequired() const;
+    // Returns the number of times this option has been specified on the
+    // command line, if it has been added to a Cmdline with its own Schema.
+    [[deprecated("Use Cmdline::Count(opt) instead")]]
+    int Count() const;
 
+private:
     // Parse the given value from NAME and/or ARG and store the result.
     // Return true on success, false otherwise.
-    virtual bool Parse(ParseContext const& ctx) = 0;
+    // Might be called concurrently from multiple threads. See Schema.
+    // The default implementation calls the non-const overload below, for
+    // subclasses which have been written before this function became const.
+    virtual bool Parse(ParseContext const& ctx) const;
+
+    // Deprecated: Override the const Parse() instead.
+    // Only called by the default implementation of the const Parse(). Such
+    // subclasses must not be used by multiple threads concurrently.
+    virtual bool Parse(ParseContext const& ctx);
+
+    // Parse all elements of the comma-separated list in CTX.ARG at once and
+    // store the results. COUNT receives the number of elements which have been
+    // stored. Returns false if element number COUNT is invalid.
+    // Only called for options with CanParseList() == true.
+    virtual bool ParseList(ParseContext const& ctx, size_t& count) const;
+
+    // Returns whether this option supports ParseList.
+    virtual bool CanParseList() const;
+
+    // Prepares the parser for COUNT more values, if it supports this (e.g.
+    // Append() reserves space in its container).
+    virtual void Reserve(size_t count) const;
+
+    // Returns COUNT slots for converting arguments independently of each other,
+    // if the parser supports this (e.g. Append()), or null.
+    // Used by Cmdline::Convert(Executor).
+    virtual std::unique_ptr<cl::impl::ArgSlots> MakeArgSlots(size_t count) const;
+
+    // Appends the valid arguments which start with PREFIX to VALUES, if they
+    // are known (e.g. the keys of a Map()). Used for shell completion.
+    virtual void CompleteArgument(string_view prefix, std::vector<string_view>& values) const;
 };
 
 template <typename ParserT>
 class Option final : public OptionBase {
+    friend class Schema;
+
 #if CL_HAS_STD_INVOCABLE
     static_assert(std::is_invocable_r<bool, ParserT, ParseContext&>::value ||
                   std::is_invocable_r<void, ParserT, ParseContext&>::value,
@@ -484,7 +834,10 @@ class Option final : public OptionBase {
         "and the return type must be 'bool' or 'void'");
 #endif
 
-    ParserT /*const*/ parser_;
+    // Mutable, so that parsers which are only callable as non-const objects
+    // (e.g. mutable lambdas) can still be called from the const Parse().
+    // Such parsers must not be used by multiple threads concurrently.
+    mutable ParserT parser_;
 
 public:
     template <typename ParserInit>
@@ -494,14 +847,31 @@ public:
     ParserT& Parser() { return parser_; }
 
 private:
+    bool Parse(ParseContext const& ctx) const override;
     bool Parse(ParseContext const& ctx) override;
+    bool ParseList(ParseContext const& ctx, size_t& count) const override;
+    bool CanParseList() const override;
+    void Reserve(size_t count) const override;
+    std::unique_ptr<cl::impl::ArgSlots> MakeArgSlots(size_t count) const override;
+    void CompleteArgument(string_view prefix, std::vector<string_view>& values) const override;
+
+    // Calls the parser as a const object, if possible.
+    template <typename P = ParserT>
+    auto CallParser(ParseContext const& ctx, int /*prefer const*/) const -> decltype(std::declval<P const&>()(ctx)) {
+        return static_cast<P const&>(parser_)(ctx);
+    }
 
-    bool DoParse(ParseContext const& ctx, std::true_type /*parser_ returns bool*/) {
+    template <typename P = ParserT>
+    auto CallParser(ParseContext const& ctx, long) const -> decltype(std::declval<P&>()(ctx)) {
         return parser_(ctx);
     }
 
-    bool DoParse(ParseContext const& ctx, std::false_type /*parser_ returns bool*/) {
-        parser_(ctx);
+    bool DoParse(ParseContext const& ctx, std::true_type /*parser_ returns bool*/) const {
+        return CallParser(ctx, 0);
+    }
+
+    bool DoParse(ParseContext const& ctx, std::false_type /*parser_ returns bool*/) const {
+        CallParser(ctx, 0);
         return true;
     }
 };
@@ -532,6 +902,92 @@ struct Diagnostic {
     }
 };
 
+// A candidate for the argument being completed. See Cmdline::Complete.
+struct Completion {
+    enum Kind : uint8_t {
+        name,        // The name of an option, including the dashes
+        value,       // An argument of an option
+        placeholder, // A placeholder "<name>" for a positional option
+        command,     // The name of a sub-command
+    };
+
+    Kind kind = Kind::name;
+    std::string text;
+    OptionBase const* option = nullptr; // The option this completion belongs to (null for sub-commands)
+
+    Completion() = default;
+    Completion(Kind kind_, std::string text_, OptionBase const* option_)
+        : kind(kind_)
+        , text(std::move(text_))
+        , option(option_)
+    {
+    }
+};
+
+#if CL_ENABLE_STATS
+// Counters and timings collected by a Cmdline if CL_ENABLE_STATS is set.
+// All times are in nanoseconds. See Cmdline::Stats().
+struct ParseStats {
+    struct OptionStats {
+        string_view name;
+        uint64_t calls = 0; // Number of calls of the option's parser
+        uint64_t ns = 0;    // Time spent in the option's parser
+    };
+
+    uint64_t add_ns = 0;             // Time spent in Cmdline::Add
+    uint64_t parse_ns = 0;           // Time spent in Cmdline::Parse, including the parsers
+    uint64_t callback_ns = 0;        // Time spent in the parsers of the options
+    uint64_t help_ns = 0;            // Time spent formatting help messages
+    uint64_t num_parse_calls = 0;    // Number of calls of Cmdline::Parse
+    uint64_t num_args = 0;           // Number of arguments parsed
+    uint64_t find_option_calls = 0;  // Number of option lookups
+    uint64_t find_option_probes = 0; // Number of hash table slots inspected
+    uint64_t prefix_fallbacks = 0;   // Arguments handled as "-Idir" candidates
+    uint64_t group_fallbacks = 0;    // Arguments handled as "-xvf" candidates
+    uint64_t utf8_bytes = 0;         // Number of bytes converted to UTF-8
+    uint64_t diagnostics = 0;        // Number of diagnostics emitted
+    std::vector<OptionStats> options; // Indexed by OptionBase::Id()
+
+    // Returns the statistics as a JSON object.
+    // Only options whose parser has been called are included.
+    std::string ToJSON() const;
+};
+
+namespace impl {
+
+// The number of hash table slots inspected by Schema::FindOption.
+using ProbeCount = size_t;
+
+// Adds the time between construction and destruction to NS.
+class StatsTimer {
+    using Clock = std::chrono::steady_clock;
+
+    uint64_t& ns_;
+    Clock::time_point start_;
+
+public:
+    explicit StatsTimer(uint64_t& ns) : ns_(ns), start_(Clock::now()) {}
+    StatsTimer(StatsTimer const&) = delete;
+    StatsTimer& operator=(StatsTimer const&) = delete;
+
+    ~StatsTimer() {
+        auto const elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_);
+        ns_ += static_cast<uint64_t>(elapsed.count());
+    }
+};
+
+} // namespace impl
+#else
+namespace impl {
+
+// Discards the number of hash table slots inspected by Schema::FindOption.
+struct ProbeCount {
+    void operator++() {}
+};
+
+} // namespace impl
+#endif
+
 // Check for missing options in Cmdline::Parse?
 enum class CheckMissingOptions : uint8_t {
     // Do not emit errors if required options have not been specified on the command line.
@@ -540,2436 +996,8180 @@ enum class CheckMissingOptions : uint8_t {
     yes,
 };
 
-class Cmdline final {
-    struct NameOptionPair {
-        string_view name; // Points into option->name_
-        OptionBase* option = nullptr;
+// Store diagnostic messages in Cmdline::EmitDiag?
+enum class CollectDiagnostics : uint8_t {
+    // Discard all diagnostics. Cmdline::Diag() is always empty.
+    no,
+    // Store the diagnostics.
+    yes,
+};
 
-        NameOptionPair() = default;
-        NameOptionPair(string_view name_, OptionBase* option_) : name(name_), option(option_) {}
-    };
+// Convert the option arguments while parsing?
+enum class DeferConversion : uint8_t {
+    // Call the parsers of the options while parsing the command line.
+    // This is the default.
+    no,
+    // Only record the arguments while parsing. The parsers are called by
+    // Cmdline::Convert().
+    yes,
+};
 
-    using Diagnostics   = std::vector<Diagnostic>;
-    using UniqueOptions = std::vector<std::unique_ptr<OptionBase>>;
-    using Options       = std::vector<NameOptionPair>;
+// Expand response files ("@file") in Cmdline::Parse?
+enum class ResponseFiles : uint8_t {
+    // "@file" is an ordinary argument.
+    no,
+    // Replace "@file" with the arguments in FILE, using Bash-style escaping (see TokenizeUnix).
+    unix_quoting,
+    // Replace "@file" with the arguments in FILE, using Windows-style escaping (see TokenizeWindows).
+    windows_quoting,
+};
 
-    string_view name_;             // Program/sub-command name
-    string_view descr_;
-    Diagnostics diag_;             // List of diagnostic messages
-    UniqueOptions unique_options_; // Option storage.
-    Options options_;              // List of options. Includes the positional options (in order).
-    int max_prefix_len_ = 0;       // Maximum length of the names of all prefix options
-    int curr_positional_ = 0;      // The current positional argument - if any
-    int curr_index_ = 0;           // Index of the current argument
-    bool dashdash_ = false;        // "--" seen?
+// The output format of Schema::FormatHelp and Schema::WriteHelp.
+enum class HelpStyle : uint8_t {
+    // Plain text, wrapped to HelpFormat::line_length. This is the default.
+    // Lines are wrapped by display width (wide characters count as two
+    // columns, combining marks as zero) and long words are broken between
+    // codepoints. Trailing spaces are dropped. If the block after a tab is
+    // narrower than 8 columns, the text continues at the description indent.
+    text,
+    // A man page, in roff format. Not wrapped.
+    man,
+    // Markdown, e.g. for generated documentation. Not wrapped.
+    markdown,
+};
 
-public:
-    // Note:
-    // Option and Cmdline names
-    //  - must not be empty,
-    //  - must not start with a '-',
-    //  - must not contain an '=' sign.
+//==================================================================================================
+// Suggestions
+//==================================================================================================
 
-    explicit Cmdline(char const* name, char const* descr);
-    Cmdline(Cmdline const&) = delete;
-    Cmdline(Cmdline&&) = delete;
-    Cmdline& operator=(Cmdline const&) = delete;
-    Cmdline& operator=(Cmdline&&) = delete;
-    ~Cmdline();
+namespace impl {
 
-    // Returns the name of the program or sub-command
-    string_view Name() const { return name_; }
+// Returns the Levenshtein distance between A and B if it is at most MAX_DIST,
+// or MAX_DIST + 1 otherwise. ROW is used as scratch space.
+inline size_t EditDistance(string_view a, string_view b, size_t max_dist, std::vector<size_t>& row) {
+    size_t const n = a.size();
+    size_t const m = b.size();
+    size_t const inf = max_dist + 1;
 
-    // Returns the description of the program or sub-command
-    string_view Descr() const { return descr_; }
+    if ((n > m ? n - m : m - n) > max_dist) {
+        return inf;
+    }
 
-    // Returns the diagnostic messages
-    std::vector<Diagnostic> const& Diag() const { return diag_; }
+    // Only the cells (i, j) with |i - j| <= MAX_DIST are computed. All other
+    // cells are > MAX_DIST.
+    row.resize(m + 1);
+    for (size_t j = 0; j <= m; ++j) {
+        row[j] = j <= max_dist ? j : inf;
+    }
 
-    // Adds a diagnostic message.
-    // Every argument must be explicitly convertible to string_view.
-    template <typename... Args>
-    void EmitDiag(Diagnostic::Type type, int index, Args&&... args);
+    for (size_t i = 1; i <= n; ++i) {
+        size_t const lo = i > max_dist ? i - max_dist : 1;
+        size_t const hi = i + max_dist < m ? i + max_dist : m;
 
-    // Add an option to the command line.
-    // Returns a pointer to the newly created option.
-    // The Cmdline object owns this option.
-    template <typename ParserInit>
-    Option<std::decay_t<ParserInit>>* Add(char const* name, char const* descr, OptionFlags flags, ParserInit&& parser);
+        size_t diag = row[lo - 1]; // Cell (i - 1, j - 1)
+        row[lo - 1] = (lo == 1) ? (i <= max_dist ? i : inf) : inf;
 
-    // Add an option to the commond line.
-    // The Cmdline object takes ownership.
-    OptionBase* Add(std::unique_ptr<OptionBase> opt);
+        size_t row_min = row[lo - 1];
+        for (size_t j = lo; j <= hi; ++j) {
+            size_t const above = row[j];
+            size_t d = diag + (a[i - 1] == b[j - 1] ? 0 : 1);
+            if (d > above + 1) {
+                d = above + 1;
+            }
+            if (d > row[j - 1] + 1) {
+                d = row[j - 1] + 1;
+            }
+            if (d > inf) {
+                d = inf;
+            }
+            diag = above;
+            row[j] = d;
+            if (row_min > d) {
+                row_min = d;
+            }
+        }
 
-    // Add an option to the commond line.
-    // The Cmdline object does not own this option.
-    OptionBase* Add(OptionBase* opt);
+        if (row_min > max_dist) {
+            return inf;
+        }
+    }
 
-    // Resets the parser. Sets the COUNT members of all registered options to 0.
-    void Reset();
+    return row[m];
+}
 
-    template <typename It>
-    struct ParseResult {
-        It next = It{};
-        bool success = false;
+// Returns the maximum edit distance of a suggestion for the misspelled WORD.
+inline size_t MaxSuggestionDistance(string_view word) {
+    if (word.size() < 3) {
+        return 0;
+    }
+    if (word.size() < 6) {
+        return 1;
+    }
+    return word.size() < 10 ? 2 : 3;
+}
 
-        ParseResult() = default;
-        ParseResult(It next_, bool success_) : next(next_), success(success_) {}
+// An index of strings, used to find the nearest matches of a misspelled
+// option name or argument without computing the edit distance to all
+// candidates.
+//
+// Strings within edit distance K of each other share at least L - 2 - 3K of
+// their trigrams, where L is the length of the longer string. The index maps
+// the (hashed) trigrams to the strings containing them, so that only the
+// strings passing this test need to be compared.
+class SuggestionIndex {
+    enum { kNumBuckets = 1024 };
+
+    // Not owned.
+    std::vector<string_view> keys_;
+    // postings_[bucket_starts_[b] ... bucket_starts_[b + 1]) are the indices
+    // of the keys containing a trigram in bucket B. Built by Build().
+    std::vector<uint32_t> bucket_starts_;
+    std::vector<uint32_t> postings_;
+
+    static size_t Bucket(char c0, char c1, char c2) {
+        uint32_t const t = (uint32_t{static_cast<uint8_t>(c0)} << 16) | (uint32_t{static_cast<uint8_t>(c1)} << 8) | static_cast<uint8_t>(c2);
+        return (t * 2654435761u) >> (32 - 10);
+    }
 
-        // Test for success.
-        explicit operator bool() const { return success; }
-    };
+public:
+    // Returns the number of keys.
+    size_t size() const { return keys_.size(); }
+
+    // Adds KEY to the index. KEY must outlive this index.
+    // Build() must be called before the next call to Suggest().
+    void Insert(string_view key) {
+        if (keys_.empty() || keys_.back() != key) {
+            keys_.push_back(key);
+        }
+    }
 
-    // Parse the command line arguments in [CURR, LAST).
-    // Emits an error for unknown options.
-    template <typename It, typename EndIt>
-    ParseResult<It> Parse(It curr, EndIt last, CheckMissingOptions check_missing = CheckMissingOptions::yes);
+    // Builds the trigram index for all keys.
+    void Build() {
+        static_assert(kNumBuckets == 1 << 10, "Bucket() returns 10 bits");
 
-    // Parse the command line arguments in ARGS.
-    // Emits an error for unknown options.
-    template <typename Container>
-    bool ParseArgs(Container const& args, CheckMissingOptions check_missing = CheckMissingOptions::yes);
+        bucket_starts_.assign(kNumBuckets + 1, 0);
+        for (auto const key : keys_) {
+            for (size_t i = 2; i < key.size(); ++i) {
+                ++bucket_starts_[Bucket(key[i - 2], key[i - 1], key[i]) + 1];
+            }
+        }
+        for (size_t b = 0; b < kNumBuckets; ++b) {
+            bucket_starts_[b + 1] += bucket_starts_[b];
+        }
 
-    // Returns whether all required options have been parsed since the last call
-    // to Parse() and emits errors for all missing options.
-    // Returns true if any required options have not yet been (successfully) parsed.
-    // Emits errors for ALL missing options.
-    bool AnyMissing();
+        postings_.resize(bucket_starts_[kNumBuckets]);
+        std::vector<uint32_t> next(bucket_starts_.begin(), bucket_starts_.end() - 1);
+        for (size_t k = 0; k < keys_.size(); ++k) {
+            auto const key = keys_[k];
+            for (size_t i = 2; i < key.size(); ++i) {
+                postings_[next[Bucket(key[i - 2], key[i - 1], key[i])]++] = static_cast<uint32_t>(k);
+            }
+        }
+    }
 
-    // Prints error messages to stderr.
-    void PrintDiag() const;
+    // Appends the (at most MAX_RESULTS) keys nearest to WORD to OUT, the
+    // nearest first. Keys with the same distance are ordered by insertion.
+    // Only keys within MaxSuggestionDistance(WORD) are considered.
+    void Suggest(string_view word, size_t max_results, std::vector<string_view>& out) const {
+        struct Match {
+            size_t dist;
+            size_t key;
+        };
+
+        size_t max_dist = cl::impl::MaxSuggestionDistance(word);
+        if (keys_.empty() || max_results == 0 || max_dist == 0) {
+            return;
+        }
 
-    struct HelpFormat {
-        size_t indent;
-        size_t descr_indent;
-        size_t line_length;
+        CL_ASSERT(bucket_starts_.size() == kNumBuckets + 1 && "Build() not called");
+
+        // Count the trigrams each key shares with WORD. Hash collisions only
+        // increase the counts, which is safe.
+        std::vector<uint32_t> shared(keys_.size());
+        std::vector<uint32_t> touched; // Keys with shared > 0
+        for (size_t i = 2; i < word.size(); ++i) {
+            auto const b = Bucket(word[i - 2], word[i - 1], word[i]);
+            for (size_t p = bucket_starts_[b]; p != bucket_starts_[b + 1]; ++p) {
+                if (shared[postings_[p]]++ == 0) {
+                    touched.push_back(postings_[p]);
+                }
+            }
+        }
 
-        HelpFormat() : indent(2), descr_indent(27), line_length(100) {}
-    };
+        std::vector<size_t> row;
+        std::vector<Match> best; // Sorted
 
-    // Returns a short help message listing all registered options.
-    std::string FormatHelp(HelpFormat const& fmt = {}) const;
+        auto const consider = [&](size_t k) {
+            auto const key = keys_[k];
 
-    // Prints the help message to stderr
-    void PrintHelp(HelpFormat const& fmt = {}) const;
+            size_t const longest = key.size() > word.size() ? key.size() : word.size();
+            if (longest >= 3 + 3 * max_dist && shared[k] < longest - 2 - 3 * max_dist) {
+                return;
+            }
 
-private:
-    void DebugCheck() const;
+            size_t const dist = cl::impl::EditDistance(word, key, max_dist, row);
+            if (dist > max_dist) {
+                return;
+            }
 
-    enum class Status : uint8_t {
-        success,
-        done,
-        error,
-        ignored
-    };
+            auto const it = std::upper_bound(best.begin(), best.end(), Match{dist, k}, [](Match const& lhs, Match const& rhs) {
+                return lhs.dist < rhs.dist || (lhs.dist == rhs.dist && lhs.key < rhs.key);
+            });
+            best.insert(it, Match{dist, k});
+            if (best.size() > max_results) {
+                best.pop_back();
+            }
+            if (best.size() == max_results) {
+                // Later matches must be at least as good.
+                max_dist = best.back().dist;
+            }
+        };
 
-    OptionBase* FindOption(string_view name) const;
+        if (word.size() >= 3 + 3 * max_dist) {
+            // All matches share at least one trigram with WORD.
+            for (auto const k : touched) {
+                consider(k);
+            }
+        } else {
+            for (size_t k = 0; k < keys_.size(); ++k) {
+                consider(k);
+            }
+        }
 
-    template <typename It, typename EndIt>
-    Status Handle1(string_view optstr, It& curr, EndIt last);
+        for (auto const& m : best) {
+            out.push_back(keys_[m.key]);
+        }
+    }
+};
 
-    // <file>
-    Status HandlePositional(string_view optstr);
+} // namespace impl
 
-    // -f
-    // -f <file>
-    template <typename It, typename EndIt>
-    Status HandleStandardOption(string_view optstr, It& curr, EndIt last);
+//==================================================================================================
+// Option tables
+//==================================================================================================
 
-    // -f=<file>
-    Status HandleOption(string_view optstr);
+namespace impl {
 
-    // -I<dir>
-    Status HandlePrefix(string_view optstr);
+// Slot in the open-addressing hash table which maps option names to their
+// index in the list of all option names.
+struct NameSlot {
+    uint32_t hash = 0;
+    int index = -1; // Index of the name, or -1 if this slot is empty.
+};
 
-    // -xvf <file>
-    // -xvf=<file>
-    // -xvf<file>
-    template <typename It, typename EndIt>
-    Status HandleGroup(string_view optstr, It& curr, EndIt last);
+// The hash of the empty string. See HashName.
+constexpr uint32_t kHashSeed = 2166136261u;
 
-    template <typename It, typename EndIt>
-    Status HandleOccurrence(OptionBase* opt, string_view name, It& curr, EndIt last);
-    Status HandleOccurrence(OptionBase* opt, string_view name, string_view arg);
+// Appends CH to the string with hash H. See HashName.
+constexpr uint32_t HashNameStep(uint32_t h, char ch) {
+    return (h ^ static_cast<uint8_t>(ch)) * 16777619u;
+}
 
-    Status ParseOptionArgument(OptionBase* opt, string_view name, string_view arg);
+// The 64-bit FNV-1a hash of the empty string. See Schema::Fingerprint.
+constexpr uint64_t kHashSeed64 = 14695981039346656037ull;
 
-    template <typename Fn>
-    bool ForEachUniqueOption(Fn fn) const;
+// Appends the byte B to the string with the 64-bit hash H.
+constexpr uint64_t HashStep64(uint64_t h, uint8_t b) {
+    return (h ^ b) * 1099511628211ull;
+}
 
-    void EmitDiagImpl(Diagnostic::Type type, int index, string_view const* strings, int num_strings);
-};
+// Returns the 32-bit FNV-1a hash of the given string.
+CL_CONSTEXPR14 uint32_t HashName(char const* str, size_t len) {
+    uint32_t h = kHashSeed;
+    for (size_t i = 0; i < len; ++i) {
+        h = cl::impl::HashNameStep(h, str[i]);
+    }
 
-//==================================================================================================
-// Unicode support
-//==================================================================================================
+    return h;
+}
 
-namespace impl {
+// A set of (8-bit) characters.
+struct CharSet {
+    uint64_t bits[4] = {0, 0, 0, 0};
 
-constexpr char32_t kInvalidCodepoint = 0xFFFFFFFF;
-constexpr char32_t kReplacementCharacter = 0xFFFD;
+    void Insert(char ch) {
+        auto const c = static_cast<uint8_t>(ch);
+        bits[c / 64] |= uint64_t{1} << (c % 64);
+    }
 
-inline bool IsValidCodepoint(char32_t U) {
-    // 1. Characters with values greater than 0x10FFFF cannot be encoded in
-    //    UTF-16.
-    // 2. Values between 0xD800 and 0xDFFF are specifically reserved for use
-    //    with UTF-16, and don't have any characters assigned to them.
-    return U < 0xD800 || (U > 0xDFFF && U <= 0x10FFFF);
+    bool Contains(char ch) const {
+        auto const c = static_cast<uint8_t>(ch);
+        return (bits[c / 64] & (uint64_t{1} << (c % 64))) != 0;
+    }
+};
+
+// Returns the number of slots in the name index for the given number of names.
+// The load factor of the index is <= 1/2.
+CL_CONSTEXPR14 size_t NumNameSlots(size_t num_names) {
+    size_t n = 16;
+    while (n < 2 * num_names) {
+        n *= 2;
+    }
+
+    return n;
 }
 
-constexpr uint32_t kUTF8Accept = 0;
-constexpr uint32_t kUTF8Reject = 1;
+// Calling this function from a constant expression results in a compile-time error.
+inline void InvalidOptionTable(char const* msg) {
+    static_cast<void>(msg);
+    CL_ASSERT(false && "invalid option table");
+}
 
-inline uint32_t DecodeUTF8Step(uint32_t state, uint8_t byte, char32_t& U) {
-    // Copyright (c) 2008-2009 Bjoern Hoehrmann <bjoern@hoehrmann.de>
-    // See http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ for details.
+} // namespace impl
 
-    static constexpr uint8_t kUTF8Decoder[] = {
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 00..1f
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 20..3f
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 40..5f
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 60..7f
-        1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9, // 80..9f
-        7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7, // a0..bf
-        8,8,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2, // c0..df
-        0xa,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x4,0x3,0x3, // e0..ef
-        0xb,0x6,0x6,0x6,0x5,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8, // f0..ff
+// Describes an option. Used to build option tables at compile time.
+struct OptionSpec {
+    char const* name = "";  // Option names, separated by '|'
+    char const* descr = ""; // The description of this option
+    OptionFlags flags;      // Flags controlling how the option may/must be specified
+};
 
-        0x0,0x1,0x2,0x3,0x5,0x8,0x7,0x1,0x1,0x1,0x4,0x6,0x1,0x1,0x1,0x1, // s0..s0
-        1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,0,1,1,1,1,1,0,1,0,1,1,1,1,1,1, // s1..s2
-        1,2,1,1,1,1,1,2,1,2,1,1,1,1,1,1,1,1,1,1,1,1,1,2,1,1,1,1,1,1,1,1, // s3..s4
-        1,2,1,1,1,1,1,1,1,2,1,1,1,1,1,1,1,1,1,1,1,1,1,3,1,3,1,1,1,1,1,1, // s5..s6
-        1,3,1,1,1,1,1,3,1,3,1,1,1,1,1,1,1,3,1,1,1,1,1,1,1,1,1,1,1,1,1,1, // s7..s8
+// A precomputed list of options.
+// Contains the option names (split at '|') and the name index used by the
+// Cmdline to look up options. Use MakeOptionTable() to create a table.
+template <size_t NumOptions, size_t NumNames>
+struct OptionTable {
+    static constexpr size_t kNumSlots = cl::impl::NumNameSlots(NumNames);
+
+    struct Name {
+        char const* data = nullptr; // Points into specs[option].name
+        size_t size = 0;
+        uint32_t hash = 0;
+        int option = -1;            // Index into specs
     };
 
-    uint8_t const type = kUTF8Decoder[byte];
-
-    // NB:
-    // The conditional here will likely be optimized out in the loop below.
+    OptionSpec specs[NumOptions];
+    Name names[NumNames];
+    impl::NameSlot slots[kNumSlots];
+};
 
-    if (state != kUTF8Accept) {
-        U = (U << 6) | (byte & 0x3Fu);
-    } else {
-        U = byte & (0xFFu >> type);
+template <size_t NumOptions, size_t NumNames>
+constexpr size_t OptionTable<NumOptions, NumNames>::kNumSlots;
+
+// Returns the total number of option names in SPECS.
+template <size_t NumOptions>
+CL_CONSTEXPR14 size_t CountOptionNames(OptionSpec const (&specs)[NumOptions]) {
+    size_t n = 0;
+    for (size_t i = 0; i < NumOptions; ++i) {
+        ++n;
+        for (auto p = specs[i].name; *p != '\0'; ++p) {
+            if (*p == '|') {
+                ++n;
+            }
+        }
     }
 
-    state = kUTF8Decoder[256 + state * 16 + type];
-    return state;
+    return n;
 }
 
-template <typename It>
-It DecodeUTF8Sequence(It next, It last, char32_t& U) {
-    CL_ASSERT(next != last);
+// Builds an option table from the given list of options.
+// If the result is used to initialize a constexpr variable, the options are
+// validated at compile-time, e.g.:
+//
+//  static constexpr cl::OptionSpec kSpecs[] = {
+//      {"v|verbose", "Verbose output", cl::Multiple::yes},
+//      {"o|output",  "Output file",    cl::Arg::required},
+//  };
+//  static constexpr auto kTable = cl::MakeOptionTable<cl::CountOptionNames(kSpecs)>(kSpecs);
+//
+template <size_t NumNames, size_t NumOptions>
+CL_CONSTEXPR14 OptionTable<NumOptions, NumNames> MakeOptionTable(OptionSpec const (&specs)[NumOptions]) {
+    using Table = OptionTable<NumOptions, NumNames>;
 
-    // Always consume the first byte.
-    // The following bytes will only be consumed while the UTF-8 sequence is still valid.
-    uint8_t const b1 = static_cast<uint8_t>(*next);
-    ++next;
+    static_assert(NumOptions > 0, "An option table must not be empty");
 
-    char32_t W = 0;
-    uint32_t state = DecodeUTF8Step(kUTF8Accept, b1, W);
+    Table table{};
 
-    if (state == kUTF8Reject) {
-        U = kInvalidCodepoint;
-        return next;
-    }
+    size_t num_names = 0;
+    for (size_t i = 0; i < NumOptions; ++i) {
+        table.specs[i] = specs[i];
 
-    while (state != kUTF8Accept) {
-        if (next == last) {
-            U = kInvalidCodepoint;
-            return next;
-        }
+        auto const name = specs[i].name;
+        size_t first = 0;
+        for (size_t k = 0; ; ++k) {
+            if (name[k] != '|' && name[k] != '\0') {
+                continue;
+            }
 
-        state = DecodeUTF8Step(state, static_cast<uint8_t>(*next), W);
-        if (state == kUTF8Reject) {
-            U = kInvalidCodepoint;
-            return next;
-        }
+            if (num_names == NumNames) {
+                cl::impl::InvalidOptionTable("NumNames does not match the number of option names");
+                return table;
+            }
 
-        ++next;
-    }
+            auto& n = table.names[num_names];
+            n.data = name + first;
+            n.size = k - first;
+            n.hash = cl::impl::HashName(n.data, n.size);
+            n.option = static_cast<int>(i);
 
-    U = W;
-    return next;
-}
+            if (n.size == 0) {
+                cl::impl::InvalidOptionTable("Empty option names are not allowed");
+            } else if (n.data[0] == '-') {
+                cl::impl::InvalidOptionTable("Option names must not start with a '-'");
+            }
+            for (size_t j = 0; j < n.size; ++j) {
+                if (n.data[j] == '"') {
+                    cl::impl::InvalidOptionTable("An option name must not contain an '\"'");
+                }
+            }
 
-template <typename PutChar>
-void EncodeUTF8(char32_t U, PutChar put) {
-    CL_ASSERT(IsValidCodepoint(U));
+            // Insert the name into the index.
+            // Same as Cmdline::StoreSlot.
+            size_t s = n.hash & (Table::kNumSlots - 1);
+            while (table.slots[s].index >= 0) {
+                auto const& other = table.names[static_cast<size_t>(table.slots[s].index)];
+                if (other.hash == n.hash && other.size == n.size) {
+                    size_t j = 0;
+                    while (j < n.size && other.data[j] == n.data[j]) {
+                        ++j;
+                    }
+                    if (j == n.size) {
+                        cl::impl::InvalidOptionTable("Option already exists");
+                    }
+                }
+                s = (s + 1) & (Table::kNumSlots - 1);
+            }
+            table.slots[s].hash = n.hash;
+            table.slots[s].index = static_cast<int>(num_names);
 
-    if (U <= 0x7F) {
-        put( static_cast<char>(static_cast<uint8_t>( U )) );
-    } else if (U <= 0x7FF) {
-        put( static_cast<char>(static_cast<uint8_t>( 0xC0 | ((U >>  6)       ) )) );
-        put( static_cast<char>(static_cast<uint8_t>( 0x80 | ((U      ) & 0x3F) )) );
-    } else if (U <= 0xFFFF) {
-        put( static_cast<char>(static_cast<uint8_t>( 0xE0 | ((U >> 12)       ) )) );
-        put( static_cast<char>(static_cast<uint8_t>( 0x80 | ((U >>  6) & 0x3F) )) );
-        put( static_cast<char>(static_cast<uint8_t>( 0x80 | ((U      ) & 0x3F) )) );
-    } else {
-        put( static_cast<char>(static_cast<uint8_t>( 0xF0 | ((U >> 18) & 0x3F) )) );
-        put( static_cast<char>(static_cast<uint8_t>( 0x80 | ((U >> 12) & 0x3F) )) );
-        put( static_cast<char>(static_cast<uint8_t>( 0x80 | ((U >>  6) & 0x3F) )) );
-        put( static_cast<char>(static_cast<uint8_t>( 0x80 | ((U      ) & 0x3F) )) );
-    }
-}
+            ++num_names;
 
-template <typename It, typename PutChar32>
-bool ForEachUTF8EncodedCodepoint(It next, It last, PutChar32 put) {
-    while (next != last) {
-        char32_t U = 0;
-        next = cl::impl::DecodeUTF8Sequence(next, last, U);
-        if (!put(U)) {
-            return false;
+            if (name[k] == '\0') {
+                break;
+            }
+            first = k + 1;
         }
     }
 
-    return true;
+    if (num_names != NumNames) {
+        cl::impl::InvalidOptionTable("NumNames does not match the number of option names");
+    }
+
+    return table;
 }
 
-template <typename It>
-It DecodeUTF16Sequence(It next, It last, char32_t& U) {
-    CL_ASSERT(next != last);
+//==================================================================================================
+//
+//==================================================================================================
 
-    // Always consume the first UCN.
-    // The second UCN - if any - will only be consumed if the UTF16-sequence is valid.
-    char32_t const W1 = static_cast<char16_t>(*next);
-    ++next;
+// A fixed set of options with statically known parser types, stored
+// contiguously in a tuple.
+// Adding an OptionSet to a Schema binds each option to its parser at compile
+// time. The parse loop still makes an indirect call through a table of
+// function pointers, but the call of the parser inside that function is not
+// virtual and can be inlined. Options added one by one need an additional
+// virtual call.
+// The Schema does not own the options. The OptionSet must outlive the Schema
+// and must not be moved after it has been added (which is checked by an
+// assertion).
+template <typename... ParserT>
+class OptionSet final {
+    friend class Schema;
+
+    std::tuple<Option<ParserT>...> options_;
 
-    if (W1 < 0xD800 || W1 > 0xDFFF) {
-        U = W1;
-        return next;
+public:
+    // The I-th parser is used for the I-th option in SPECS.
+    template <typename... ParserInit>
+    explicit OptionSet(OptionSpec const (&specs)[sizeof...(ParserT)], ParserInit&&... parsers)
+        : OptionSet(std::index_sequence_for<ParserT...>{}, specs, std::forward<ParserInit>(parsers)...)
+    {
     }
 
-    if (W1 > 0xDBFF) {
-        U = kInvalidCodepoint; // Invalid high surrogate
-        return next;
-    }
+    OptionSet(OptionSet const&) = delete;
 
-    if (next == last) {
-        U = kInvalidCodepoint; // Incomplete UTF-16 sequence
-        return next;
+    // Only valid before the set has been added to a Schema, e.g. for returning
+    // the set from MakeOptionSet().
+    OptionSet(OptionSet&& rhs)
+        : options_(std::move(rhs.options_))
+    {
+        CL_ASSERT(!rhs.IsAdded(std::index_sequence_for<ParserT...>{}) && "OptionSet moved after it has been added to a Schema");
     }
 
-    char32_t const W2 = static_cast<char16_t>(*next);
-
-    if (W2 < 0xDC00 || W2 > 0xDFFF) {
-        U = kInvalidCodepoint; // Invalid low surrogate
-        return next;
-    }
+    OptionSet& operator=(OptionSet const&) = delete;
+    OptionSet& operator=(OptionSet&&) = delete;
 
-    ++next;
+    // Returns the number of options in this set.
+    static constexpr size_t size() { return sizeof...(ParserT); }
 
-    U = (((W1 & 0x3FF) << 10) | (W2 & 0x3FF)) + 0x10000;
-    return next;
-}
+    // Returns the I-th option.
+    template <size_t I>
+    auto& Get() { return std::get<I>(options_); }
 
-template <typename PutChar16>
-void EncodeUTF16(char32_t U, PutChar16 put) {
-    CL_ASSERT(IsValidCodepoint(U));
+    template <size_t I>
+    auto const& Get() const { return std::get<I>(options_); }
 
-    if (U < 0x10000) {
-        put( static_cast<char16_t>(U) );
-    } else {
-        char32_t const Up = U - 0x10000;
-        put( static_cast<char16_t>(0xD800 + ((Up >> 10) & 0x3FF)) );
-        put( static_cast<char16_t>(0xDC00 + ((Up      ) & 0x3FF)) );
+private:
+    template <size_t... Is, typename... ParserInit>
+    OptionSet(std::index_sequence<Is...>, OptionSpec const (&specs)[sizeof...(ParserT)], ParserInit&&... parsers)
+        : options_(Option<ParserT>(specs[Is].name, specs[Is].descr, specs[Is].flags, std::forward<ParserInit>(parsers))...)
+    {
     }
-}
 
-template <typename It, typename PutChar32>
-bool ForEachUTF16EncodedCodepoint(It next, It last, PutChar32 put) {
-    while (next != last) {
-        char32_t U = 0;
-        next = cl::impl::DecodeUTF16Sequence(next, last, U);
-        if (!put(U)) {
-            return false;
-        }
+    // Returns whether any option has been added to a Schema.
+    template <size_t... Is>
+    bool IsAdded(std::index_sequence<Is...>) const {
+        bool const added[] = {false, (std::get<Is>(options_).Id() >= 0)...};
+        return std::find(std::begin(added), std::end(added), true) != std::end(added);
     }
+};
 
-    return true;
-}
-
-template <typename It, typename PutChar32>
-bool ForEachUTF32EncodedCodepoint(It next, It last, PutChar32 put) {
-    while (next != last) {
-        char32_t const U = static_cast<char32_t>(*next);
-        ++next;
-        if (!put(IsValidCodepoint(U) ? U : kInvalidCodepoint)) {
-            return false;
-        }
-    }
+// Returns an OptionSet for the given options.
+// The I-th parser is used for the I-th option in SPECS.
+template <size_t N, typename... ParserInit>
+OptionSet<std::decay_t<ParserInit>...> MakeOptionSet(OptionSpec const (&specs)[N], ParserInit&&... parsers) {
+    static_assert(sizeof...(ParserInit) == N,
+        "MakeOptionSet() requires exactly one parser for each option");
 
-    return true;
+    return OptionSet<std::decay_t<ParserInit>...>(specs, std::forward<ParserInit>(parsers)...);
 }
 
-// Convert to UTF-8.
-// The internal encoding used by the library is UTF-8.
+//==================================================================================================
+//
+//==================================================================================================
 
-template <typename It>
-bool IsUTF8(It next, It last) {
-    return cl::impl::ForEachUTF8EncodedCodepoint(next, last, [](char32_t U) { return U != cl::impl::kInvalidCodepoint; });
-}
+namespace impl {
 
-template <typename It>
-std::string ToUTF8_dispatch(It next, It last, char const* /*tag*/, std::input_iterator_tag /*cat*/) {
-    std::string s;
+class ConfigSnapshot;
 
-    cl::impl::ForEachUTF8EncodedCodepoint(next, last, [&](char32_t U) {
-        if (U == kInvalidCodepoint) {
-            U = kReplacementCharacter;
-        }
-        cl::impl::EncodeUTF8(U, [&](char ch) { s.push_back(ch); });
-        return true;
-    });
+// A unique address for each type T.
+template <typename T>
+struct TypeTag {
+    static char const id;
+};
 
-    return s;
-}
+template <typename T>
+char const TypeTag<T>::id = 0;
 
-template <typename It>
-std::string ToUTF8_dispatch(It next, It last, char const* /*tag*/, std::forward_iterator_tag /*cat*/) {
-    std::string s;
-//  s.reserve(std::distance(next, last));
+// A value converted by Cmdline::Get().
+class LazyValueBase {
+public:
+    virtual ~LazyValueBase() = default;
+};
 
-    while (next != last) {
-        char32_t U = 0;
-        auto const I = cl::impl::DecodeUTF8Sequence(next, last, U);
+template <typename T>
+class LazyValue final : public LazyValueBase {
+public:
+    T value{};
+    bool ok = false;
+};
 
-        if (U == kInvalidCodepoint) {
-            s.append("\xEF\xBF\xBD", 3);
-        } else {
-            s.append(next, I);
-        }
+// Adds the options of a sub-command to a Cmdline. See Schema::AddSubcommand.
+class SubcommandInitBase {
+public:
+    virtual ~SubcommandInitBase() = default;
+    virtual void Init(Cmdline& sub) const = 0;
+};
 
-        next = I;
-    }
+template <typename InitT>
+class SubcommandInit final : public SubcommandInitBase {
+    InitT init_;
 
-    return s;
-}
+public:
+    template <typename Init>
+    explicit SubcommandInit(Init&& init) : init_(std::forward<Init>(init)) {}
 
-template <typename It>
-std::string ToUTF8_dispatch(It next, It last, char const* tag) {
-    using Cat = typename std::iterator_traits<It>::iterator_category;
+    void Init(Cmdline& sub) const override { init_(sub); }
+};
 
-    return cl::impl::ToUTF8_dispatch(next, last, tag, Cat{});
-}
+struct HelpLayout;
+class HelpWriter;
 
-template <typename It>
-std::string ToUTF8_dispatch(It next, It last, char16_t const* /*tag*/) {
-    std::string s;
+} // namespace impl
 
-    cl::impl::ForEachUTF16EncodedCodepoint(next, last, [&](char32_t U) {
-        if (U == kInvalidCodepoint) {
-            U = kReplacementCharacter;
-        }
-        cl::impl::EncodeUTF8(U, [&](char ch) { s.push_back(ch); });
-        return true;
-    });
+// The options of a command line, and the tables used to look them up.
+//
+// A Schema may be shared between multiple Cmdline objects (see
+// Cmdline::Cmdline(Schema const&)). All state which changes while parsing a
+// command line lives in the Cmdline objects.
+//
+// Thread safety:
+// Parsing never modifies a Schema or its options. Once all options have been
+// added, any number of threads may concurrently parse command lines using the
+// same Schema, provided that
+//  - each thread uses its own Cmdline object, and
+//  - the parsers of the options may be called concurrently. This is the case
+//    for parsers which only write to the ParseContext::target object (see
+//    Field()), but not for parsers writing to shared variables (like Var()).
+// Adding options to a Schema while it is being used by another thread is not
+// allowed. Formatting the help message is thread-safe.
+class Schema final {
+    friend class Cmdline;
+    friend class OptionBase;
 
-    return s;
-}
+    struct NameOptionPair {
+        string_view name; // Points into option->name_
+        OptionBase* option = nullptr;
+        uint32_t hash = 0; // Hash of name
 
-template <typename It>
-std::string ToUTF8_dispatch(It next, It last, char32_t const* /*tag*/) {
-    std::string s;
+        NameOptionPair() = default;
+        NameOptionPair(string_view name_, OptionBase* option_, uint32_t hash_) : name(name_), option(option_), hash(hash_) {}
+    };
 
-    cl::impl::ForEachUTF32EncodedCodepoint(next, last, [&](char32_t U) {
-        if (U == kInvalidCodepoint) {
-            U = kReplacementCharacter;
-        }
-        cl::impl::EncodeUTF8(U, [&](char ch) { s.push_back(ch); });
-        return true;
-    });
+    // Destroys options allocated from a memory_resource.
+    // Uses delete if RESOURCE is null.
+    struct OptionDeleter {
+        memory_resource* resource = nullptr;
+        size_t size = 0;
+        size_t alignment = 0;
 
-    return s;
-}
+        void operator()(OptionBase* opt) const;
+    };
 
-template <typename It>
-CL_FORCE_INLINE std::string ToUTF8_dispatch(It next, It last, wchar_t const* /*tag*/) {
-#if _WIN32
-    return cl::impl::ToUTF8_dispatch(next, last, static_cast<char16_t const*>(nullptr));
-#else
-    return cl::impl::ToUTF8_dispatch(next, last, static_cast<char32_t const*>(nullptr));
-#endif
-}
+    template <typename T>
+    using Vector = std::vector<T, polymorphic_allocator<T>>;
+
+    using OptionPtr     = std::unique_ptr<OptionBase, OptionDeleter>;
+    using UniqueOptions = Vector<OptionPtr>;
+    using Options       = Vector<NameOptionPair>;
+    using NameIndex     = Vector<impl::NameSlot>;
+
+    // Node in the prefix tree of the names of all options which may join
+    // their argument.
+    struct PrefixNode {
+        int first_child = -1;  // Index into prefixes_, or -1
+        int next_sibling = -1; // Index into prefixes_, or -1
+        int index = -1;        // Index into options_ if a name ends at this node, or -1
+        char ch = '\0';
+
+        PrefixNode() = default;
+        explicit PrefixNode(char ch_) : ch(ch_) {}
+    };
 
-template <typename It, typename T>
-std::string ToUTF8_dispatch(It next, It last, T const* /*tag*/) = delete;
+    using PrefixTree    = Vector<PrefixNode>;
 
-template <typename It>
-CL_FORCE_INLINE std::string ToUTF8(It next, It last) {
-    using CharT = std::remove_reference_t<decltype(*next)>;
+    // The result of scanning a (dash-less) option string. See Scan().
+    struct ScanResult {
+        uint32_t hash = 0;              // Hash of the whole string
+        uint32_t eq_hash = 0;           // Hash of the part before the first '='
+        size_t eq = string_view::npos;  // Position of the first '=', or npos
+        int prefix = -1;                // Index into options_ of the longest prefix which may join its argument, or -1
+        size_t prefix_len = 0;          // Length of this prefix
+    };
 
-    return cl::impl::ToUTF8_dispatch(next, last, static_cast<CharT const*>(nullptr));
-}
+    struct SubcommandEntry {
+        char const* name = "";
+        char const* descr = "";
+        uint32_t hash = 0; // Hash of name
+        std::unique_ptr<impl::SubcommandInitBase> init;
+        // Owns the Schema of the sub-command, built on first use. See SubcommandSchema().
+        mutable std::unique_ptr<Cmdline> schema_owner;
+    };
 
-template <typename StringT>
-CL_FORCE_INLINE std::string ToUTF8(StringT const& str) {
-    return cl::impl::ToUTF8(str.begin(), str.end());
-}
+    using Subcommands   = Vector<SubcommandEntry>;
 
-template <typename ElemT>
-CL_FORCE_INLINE std::string ToUTF8(ElemT* const& c_str) {
-    using CharT = std::remove_const_t<ElemT>;
+    // Calls OptionBase::Parse for a single option.
+    using ParseFn       = bool (*)(OptionBase const* opt, ParseContext const& ctx);
+    using ParseFns      = Vector<ParseFn>;
+    using OptionList    = Vector<OptionBase*>;
+    using FlagList      = Vector<OptionFlags>;
+    using IdList        = Vector<int>;
 
-    auto const len = (c_str != nullptr)
-                         ? std::char_traits<CharT>::length(c_str)
-                         : 0u;
+    memory_resource* resource_;    // Used for all allocations below
+    string_view name_;             // Program/sub-command name
+    string_view descr_;
+    UniqueOptions unique_options_; // Option storage.
+    Options options_;              // List of options. Includes the positional options (in order).
+    NameIndex index_;              // Hash table for options_. The size is always a power of 2 (or 0).
+    PrefixTree prefixes_;          // Names of all options which may join their argument. prefixes_[0] is the root.
+    impl::CharSet first_chars_;    // The first characters of all option names.
+    impl::CharSet join_chars_;     // The first characters of the names in prefixes_.
+    int short_ids_[256];           // The ids of the options with single-character names (indexed by that character), or -1
+    int num_ids_ = 0;              // Number of (unique) options. See OptionBase::Id().
+    Cmdline const* owner_ = nullptr; // The Cmdline which owns this Schema, or null. See OptionBase::Count().
+    uint64_t fingerprint_ = impl::kHashSeed64; // See Fingerprint()
+    // The hot per-option data, stored in parallel arrays indexed by
+    // OptionBase::Id(), so that the parser does not need to touch the option
+    // objects when looking for positional or missing options.
+    ParseFns parse_fns_;
+    OptionList id_options_;
+    FlagList id_flags_;
+    IdList positionals_;           // Ids of the positional options (in order).
+    Subcommands subcommands_;      // List of sub-commands.
+    NameIndex subcommand_index_;   // Hash table for subcommands_. The size is always a power of 2 (or 0).
+
+    struct HelpCacheEntry;
+
+    // Formatted help messages, cleared when an option is added.
+    mutable std::vector<HelpCacheEntry> help_cache_;
+    // The tokenized descriptions used to format the help messages. Reset when an option is added.
+    mutable std::shared_ptr<impl::HelpLayout const> help_layout_;
+    // Indices into options_, sorted by name. Built on demand.
+    mutable std::vector<size_t> sorted_names_;
+    // The names of all non-positional options. Built on demand.
+    mutable impl::SuggestionIndex suggestions_;
+    mutable size_t num_suggested_names_ = 0; // Number of names in options_ when suggestions_ was built
+    // Guards the caches above.
+    mutable std::mutex cache_mutex_;
+    // Guards SubcommandEntry::schema_owner.
+    mutable std::mutex subcommand_mutex_;
 
-    return cl::impl::ToUTF8(c_str, c_str + len);
-}
+public:
+    // Note:
+    // Option and Schema names
+    //  - must not be empty,
+    //  - must not start with a '-',
+    //  - must not contain an '=' sign.
 
-} // namespace impl
+    // All memory for the options (and the lookup tables) is allocated from
+    // RESOURCE, which must outlive this Schema object.
+    explicit Schema(char const* name, char const* descr, memory_resource* resource = cl::new_delete_resource());
+    Schema(Schema const&) = delete;
+    Schema(Schema&&) = delete;
+    Schema& operator=(Schema const&) = delete;
+    Schema& operator=(Schema&&) = delete;
+    ~Schema();
 
-//==================================================================================================
-// Split strings
-//==================================================================================================
+    // Returns the name of the program or sub-command
+    string_view Name() const { return name_; }
 
-namespace impl {
+    // Returns the description of the program or sub-command
+    string_view Descr() const { return descr_; }
 
-// Return type for delimiters. Returned by the ByX delimiters.
-//
-// +-----+-----+------------+
-// ^ tok ^     ^    rest    ^
-//       f     f+c
-//
-// Either FIRST or COUNT must be non-zero.
-struct DelimiterResult {
-    size_t first;
-    size_t count;
-};
+    // Returns the number of (unique) options.
+    int NumUniqueOptions() const { return num_ids_; }
 
-struct ByChar {
-    char const ch;
+    // Returns a hash of the names, flags and ids of all options and of the
+    // names of all sub-commands. Schemas built by the same sequence of Add()
+    // calls have the same fingerprint.
+    uint64_t Fingerprint() const { return fingerprint_; }
 
-    explicit ByChar(char ch_) : ch(ch_) {}
+    // Add an option to the schema.
+    // Returns a pointer to the newly created option.
+    // The Schema object owns this option.
+    template <typename ParserInit>
+    Option<std::decay_t<ParserInit>>* Add(char const* name, char const* descr, OptionFlags flags, ParserInit&& parser);
 
-    DelimiterResult operator()(string_view str) const {
-        return {str.find(ch), 1};
-    }
-};
+    // Add an option to the schema.
+    // The Schema object takes ownership.
+    OptionBase* Add(std::unique_ptr<OptionBase> opt);
 
-// Breaks a string into lines, i.e. searches for "\n" or "\r" or "\r\n".
-struct ByLines {
-    DelimiterResult operator()(string_view str) const {
-        auto const first = str.begin();
-        auto const last = str.end();
+    // Add an option to the schema.
+    // The Schema object does not own this option.
+    // An option may only be added to a single Schema.
+    OptionBase* Add(OptionBase* opt);
 
-        // Find the position of the first CR or LF
-        auto p = first;
-        while (p != last && (*p != '\n' && *p != '\r')) {
-            ++p;
-        }
+    // Add all the options from a precomputed option table.
+    // The I-th parser is used for the I-th option in the table.
+    // The names in the table must not conflict with names already added to this Schema.
+    template <size_t NumOptions, size_t NumNames, typename... ParserInit>
+    void Add(OptionTable<NumOptions, NumNames> const& table, ParserInit&&... parsers);
 
-        if (p == last) {
-            return {string_view::npos, 0};
-        }
+    // Add all the options from an option set.
+    // The Schema object does not own these options. See OptionSet.
+    template <typename... ParserT>
+    void Add(OptionSet<ParserT...>& set);
 
-        auto const index = static_cast<size_t>(p - first);
+    // Returns the option with the given name, or null.
+    OptionBase const* FindOption(string_view name) const;
 
-        // If this is CRLF, skip the other half.
-        if (*p == '\r' && ++p != last && *p == '\n') {
-            return {index, 2};
-        }
+#if CL_ENABLE_STATS
+    // Returns the option with the given name, or null.
+    // PROBES receives the number of hash table slots inspected.
+    OptionBase const* FindOption(string_view name, size_t& probes) const;
+#endif
 
-        return {index, 1};
-    }
-};
+    // Appends the names of at most MAX_RESULTS (non-positional) options which
+    // are similar to NAME to OUT, the most similar first.
+    void SuggestOptions(string_view name, size_t max_results, std::vector<string_view>& out) const;
+
+    // Add a sub-command.
+    // If NAME is found where a positional argument is expected, the remaining
+    // arguments are parsed by a separate Cmdline for the sub-command. This
+    // Cmdline is only created for the selected sub-command. When the
+    // sub-command is first selected, INIT(Cmdline&) is called once to add its
+    // options to a Schema, which is owned by this Schema, uses its
+    // memory_resource, and is shared by all Cmdline objects using this Schema.
+    // Only the options (and sub-commands) added by INIT are used. The options
+    // of this Schema remain available as global options.
+    // INIT must be copy-constructible and callable as a const object.
+    template <typename Init>
+    void AddSubcommand(char const* name, char const* descr, Init&& init);
+
+    // Returns the index of the sub-command with the given name, or -1.
+    int FindSubcommand(string_view name) const;
+
+    // Returns the Schema of the sub-command with the given index, which is
+    // built on first use. See AddSubcommand().
+    Schema const& SubcommandSchema(size_t index) const;
 
-// Breaks a string into words, i.e. searches for the first whitespace preceding
-// the given length. If there is no whitespace, breaks a single word at length
-// characters.
-struct ByWords {
-    size_t const length;
+    struct HelpFormat {
+        size_t indent;
+        size_t descr_indent;
+        size_t line_length;
+        HelpStyle style;
 
-    explicit ByWords(size_t length_)
-        : length(length_)
-    {
-        CL_ASSERT(length != 0 && "invalid parameter");
-    }
+        HelpFormat() : indent(2), descr_indent(27), line_length(100), style(HelpStyle::text) {}
+    };
 
-    DelimiterResult operator()(string_view str) const {
-        // If the string fits into the current line, just return this last line.
-        if (str.size() <= length) {
-            return {string_view::npos, 0};
-        }
+    // Returns a short help message listing all registered options.
+    // The message is cached for each HelpFormat until the next option is added.
+    std::string FormatHelp(HelpFormat const& fmt = {}) const;
 
-        // Otherwise, search for the first space preceding the line length.
-        auto const last_ws = str.find_last_of(" \t", length);
+    // Writes the help message to SINK, which is called with string_view's.
+    template <typename Sink, std::enable_if_t<!std::is_convertible<Sink, HelpFormat const&>::value, int> = 0>
+    void FormatHelp(Sink&& sink, HelpFormat const& fmt = {}) const;
 
-        if (last_ws != string_view::npos) {
-            // TODO:
-            // Further remove trailing whitespace?!
-            return {last_ws, 1};
-        }
+    // Writes the help message to SINK, which is called with string_view's.
+    // Unlike FormatHelp, the message is not cached, but written in chunks in
+    // a single pass over the descriptions. The descriptions are broken into
+    // words only once (until the next option is added) for all formats.
+    template <typename Sink>
+    void WriteHelp(Sink&& sink, HelpFormat const& fmt = {}) const;
 
-        return {length, 0}; // No space in current line, break at length.
-    }
-};
+    // Prints the help message to stderr
+    void PrintHelp(HelpFormat const& fmt = {}) const;
 
-struct DoSplitResult {
-    string_view tok; // The current token.
-    string_view str; // The rest of the string.
-    bool last = false;
-};
+private:
+    void DebugCheck() const;
 
-inline bool DoSplit(DoSplitResult& res, string_view str, DelimiterResult del) {
-    if (del.first == string_view::npos) {
-        res.tok = str;
-        //res.str = {};
-        res.last = true;
-        return true;
-    }
+    std::shared_ptr<std::string const> CachedHelp(HelpFormat const& fmt) const;
+    std::string BuildHelp(impl::HelpLayout const& layout, HelpFormat const& fmt) const;
 
-    CL_ASSERT(del.first + del.count >= del.first);
-    CL_ASSERT(del.first + del.count <= str.size());
+    std::shared_ptr<impl::HelpLayout const> GetHelpLayout() const;
+    void EmitHelp(impl::HelpWriter& out, impl::HelpLayout const& layout, HelpFormat const& fmt) const;
+    void WriteSynopsis(impl::HelpWriter& out, impl::HelpLayout const& layout) const;
+    void WriteTextHelp(impl::HelpWriter& out, impl::HelpLayout const& layout, HelpFormat const& fmt) const;
+    void WriteManHelp(impl::HelpWriter& out, impl::HelpLayout const& layout) const;
+    void WriteMarkdownHelp(impl::HelpWriter& out, impl::HelpLayout const& layout) const;
 
-    auto const off = del.first + del.count;
-    CL_ASSERT(off > 0 && "invalid delimiter result");
+    // Calls FN(name, option) for all option names which start with PREFIX, in sorted order.
+    template <typename Fn>
+    void ForEachNameWithPrefix(string_view prefix, Fn fn) const;
 
-    res.tok = string_view(str.data(), del.first);
-    res.str = string_view(str.data() + off, str.size() - off);
-    return true;
-}
+    void InsertName(size_t index);
+    void RebuildIndex(size_t num_slots);
+    void StoreSlot(size_t index);
 
-// Split the string STR into substrings using the Delimiter (or Tokenizer) SPLIT
-// and call FN for each substring.
-// FN must return bool. If FN returns false, this method stops splitting
-// the input string and returns false, too. Otherwise, returns true.
-template <typename Splitter, typename Function>
-bool Split(string_view str, Splitter&& split, Function&& fn) {
-    CL_ASSERT(cl::impl::IsUTF8(str.begin(), str.end()));
+    void InsertNameChars(size_t index);
 
-    DoSplitResult curr;
+    // Adds the name options_[INDEX] and its option to fingerprint_.
+    void UpdateFingerprint(size_t index);
+    void UpdateFingerprint(string_view str);
 
-    curr.tok = string_view();
-    curr.str = str;
-    curr.last = false;
+    void InsertPrefix(size_t index);
 
-    for (;;) {
-        if (!cl::impl::DoSplit(curr, curr.str, split(curr.str))) {
-            return true;
-        }
+    OptionBase const* FindOption(string_view name, uint32_t hash, cl::impl::ProbeCount& probes) const;
 
-        CL_ASSERT(cl::impl::IsUTF8(curr.tok.begin(), curr.tok.end()));
-        CL_ASSERT(cl::impl::IsUTF8(curr.str.begin(), curr.str.end()));
+    // Scans OPTSTR once, computing the hashes required for looking up OPTSTR
+    // and "-name=value" and, if FIND_PREFIX is true, the longest prefix which
+    // may join its argument.
+    ScanResult Scan(string_view optstr, bool find_prefix) const;
 
-        if (!fn(curr.tok)) {
-            return false;
-        }
-        if (curr.last) {
-            return true;
-        }
-    }
-}
+    void StoreSubcommandSlot(size_t index);
 
-} // namespace impl
+    template <typename OptionT, typename... Args>
+    OptionT* NewOption(Args&&... args);
 
-//==================================================================================================
-//
-//==================================================================================================
+    OptionBase* AddOption(OptionBase* opt, ParseFn parse_fn);
+    void AssignId(OptionBase* opt, ParseFn parse_fn);
 
-namespace impl {
+    // Parse functions for options of known type (non-virtual) and for all
+    // other options.
+    template <typename OptionT>
+    static bool ParseStatic(OptionBase const* opt, ParseContext const& ctx);
+    static bool ParseDynamic(OptionBase const* opt, ParseContext const& ctx);
 
-template <typename...> struct AlwaysVoid { using type = void; };
-template <typename... Ts> using Void_t = typename AlwaysVoid<Ts...>::type;
+    template <typename... ParserT, size_t... Is>
+    void AddSet(OptionSet<ParserT...>& set, std::index_sequence<Is...>);
 
-template <typename T, typename /*Enable*/ = void>
-struct IsStreamExtractable
-    : std::false_type
-{
+    template <typename ParserInit>
+    OptionBase* MakeOption(OptionSpec const& spec, ParserInit&& parser);
+
+    template <size_t NumOptions, size_t NumNames, size_t... Is, typename... ParserInit>
+    void AddTable(OptionTable<NumOptions, NumNames> const& table, std::index_sequence<Is...>, ParserInit&&... parsers);
+
+    template <typename Fn>
+    bool ForEachUniqueOption(Fn fn) const;
 };
 
-template <typename T>
-struct IsStreamExtractable<T, Void_t< decltype(std::declval<std::istream&>() >> std::declval<T&>()) >>
-    : std::true_type
-{
+// Parses command lines using the options of a Schema.
+// A Cmdline object must not be used by multiple threads at the same time.
+class Cmdline final {
+    friend class Schema;
+
+    using Diagnostics = std::vector<Diagnostic>;
+    using Counts      = std::vector<int>;
+
+    // A diagnostic message in compact form.
+    // The message text is only copied into a Diagnostic when requested by Diag().
+    struct DiagRecord {
+        Diagnostic::Type type;
+        int index;
+        size_t offset;  // Start of the message in diag_text_
+        size_t length;  // Length of the message
+    };
+
+    // An option argument recorded for Convert() and Get().
+    // The name and the argument either point into the caller's arguments (see
+    // PersistArg), or have been copied into deferred_text_.
+    struct DeferredArg {
+        OptionBase const* option;
+        void* target;
+        int index;
+        int prev;            // Previous argument of the same option in deferred_, or -1
+        char const* name_data; // The option name in the caller's arguments, or null
+        size_t name_offset;  // Start of the option name in deferred_text_, unless name_data is set
+        size_t name_length;
+        char const* arg_data;  // The argument in the caller's arguments, or null
+        size_t arg_offset;   // Start of the argument in deferred_text_, unless arg_data is set
+        size_t arg_length;
+        bool failed;         // Conversion failed, and the occurrence is no longer counted. See Serialize().
+    };
+
+    // A value memoized by Get() or GetAll().
+    struct LazyEntry {
+        int id;              // OptionBase::Id()
+        void const* type;    // &TypeTag<T>::id
+        bool all;            // GetAll()?
+        int last;            // Last argument converted, index into deferred_
+        std::unique_ptr<cl::impl::LazyValueBase> value;
+    };
+
+    std::unique_ptr<Schema> own_schema_; // Null if constructed from a shared schema
+    Schema const* schema_;         // Points to *own_schema_ or to a shared schema
+    std::vector<DiagRecord> diag_records_; // List of diagnostic messages
+    std::string diag_text_;        // Concatenated texts of all diagnostic messages
+    mutable Diagnostics diag_;     // The formatted diagnostic messages, see Diag()
+    size_t num_diag_ = 0;          // Number of diagnostics emitted since the last Reset(), including discarded ones
+    CollectDiagnostics collect_diag_ = CollectDiagnostics::yes;
+    Counts counts_;                // The number of times each option was specified on the command line, indexed by OptionBase::Id()
+    void* target_ = nullptr;       // See SetTarget()
+    int curr_positional_ = 0;      // The current positional argument - if any. Index into Schema::positionals_
+    int curr_index_ = 0;           // Index of the current argument
+    int max_response_file_depth_ = 16;
+    int response_file_depth_ = 0;  // Nesting level of the response file currently being parsed
+    ResponseFiles response_files_ = ResponseFiles::no;
+    std::vector<std::string> unparsed_file_args_; // See UnparsedFileArgs()
+    OptionBase const* pending_option_ = nullptr; // Option still waiting for its argument (see Complete)
+    bool dashdash_ = false;        // "--" seen?
+    bool dry_run_ = false;         // Only count the options, do not call their parsers (see Complete)
+    Cmdline* parent_ = nullptr;    // The parser of the enclosing command, if this parses a sub-command
+    std::unique_ptr<Cmdline> sub_; // The parser of the most recently selected sub-command
+    int sub_index_ = -1;           // The sub-command sub_ has been created for, or -1
+    bool sub_active_ = false;      // Sub-command selected since the last Reset()?
+    DeferConversion defer_ = DeferConversion::no;
+    std::vector<DeferredArg> deferred_; // Arguments recorded since the last Reset()
+    std::string deferred_text_;    // Concatenated names and arguments of deferred_, which are not in the caller's storage
+    std::vector<int> last_deferred_; // Last argument of each option in deferred_, or -1, indexed by OptionBase::Id()
+    size_t num_converted_ = 0;     // Number of arguments in deferred_ already converted by Convert()
+    std::vector<LazyEntry> lazy_values_; // Values memoized by Get() and GetAll()
+    string_view stable_arg_;       // The current argument, if it points into the caller's storage
+    std::vector<std::unique_ptr<char[]>> arg_copies_; // See PersistArg()
+#if CL_ENABLE_STATS
+    mutable ParseStats stats_;     // See Stats()
+#endif
+
+public:
+    using HelpFormat = Schema::HelpFormat;
+
+    // Constructs a parser with its own Schema.
+    // See Schema::Schema().
+    explicit Cmdline(char const* name, char const* descr, memory_resource* resource = cl::new_delete_resource());
+
+    // Constructs a parser for a shared Schema, which must outlive this Cmdline
+    // object. Options cannot be added to this Cmdline.
+    explicit Cmdline(Schema const& schema);
+
+    Cmdline(Cmdline const&) = delete;
+    Cmdline(Cmdline&&) = delete;
+    Cmdline& operator=(Cmdline const&) = delete;
+    Cmdline& operator=(Cmdline&&) = delete;
+    ~Cmdline();
+
+    // Returns the options of this parser.
+    Schema const& GetSchema() const { return *schema_; }
+
+    // Returns the name of the program or sub-command
+    string_view Name() const { return schema_->Name(); }
+
+    // Returns the description of the program or sub-command
+    string_view Descr() const { return schema_->Descr(); }
+
+    // Returns the diagnostic messages.
+    // The message texts are concatenated into a single buffer when they are
+    // emitted. The Diagnostic objects are only created when Diag() is called.
+    // The returned reference is valid until the next call to a non-const
+    // member function.
+    std::vector<Diagnostic> const& Diag() const;
+
+    // Sets whether diagnostic messages are stored (the default) or discarded.
+    // Discarding diagnostics makes the error path cheaper if Diag() and
+    // PrintDiag() are not used.
+    void SetCollectDiagnostics(CollectDiagnostics collect) { collect_diag_ = collect; }
+
+    // Sets whether the parsers of the options are called while parsing (the
+    // default), or later by Convert().
+    // In deferred mode, Parse() only checks the syntax of the command line,
+    // counts the options, and records their arguments. Arguments which remain
+    // valid after Parse() returns (see PersistArg) are recorded without being
+    // copied; they must remain valid until Reset() is called.
+    // The recorded arguments can be converted by Convert(), or on demand by
+    // Get() and GetAll().
+    void SetDeferConversion(DeferConversion defer) { defer_ = defer; }
+
+    // Calls the parsers for all the arguments recorded since the last call to
+    // Convert() or Reset(), in order. See SetDeferConversion().
+    // The diagnostics have the index of the original argument.
+    // Returns false if any argument is invalid.
+    bool Convert();
+
+    // Like Convert(), but the arguments of different options may be converted
+    // concurrently. The arguments of a single option are converted in order,
+    // by a single task, unless the parser converts them independently of each
+    // other (e.g. Append(); see OptionBase::MakeArgSlots). Then each argument
+    // is converted by its own task, and the values are stored in order after
+    // all tasks have completed.
+    // EXECUTOR(n, task) must call task(i) exactly once for each i in [0, n),
+    // possibly concurrently, and must return when all calls have completed.
+    // The parsers of different options must not share any state, and the
+    // predicates of Append() must be thread-safe. The parsers are called with
+    // a temporary Cmdline for the same Schema as ParseContext::cmdline, which
+    // collects the diagnostics of the task. The temporary Cmdlines are reused
+    // by later tasks, so only as many are created as tasks run concurrently.
+    template <typename Executor>
+    bool Convert(Executor&& executor);
+
+    // Converts the argument of the last occurrence of the option NAME to a T,
+    // using the same conversion as Var(). The result is memoized until the
+    // option occurs again or Reset() is called.
+    // Requires DeferConversion::yes. The parser of the option is not called.
+    // Returns null if the option has not been specified or if its argument is
+    // invalid. The returned pointer is valid until the next call to Reset().
+    template <typename T>
+    T const* Get(string_view name);
+
+    // Like Get(), but converts the arguments of all occurrences of the option,
+    // in order. Returns an empty vector if the option has not been specified,
+    // and null if any argument is invalid.
+    template <typename T>
+    std::vector<T> const* GetAll(string_view name);
+
+    // Appends a compact binary form of the parse state to OUT: the number of
+    // occurrences of each option, and all arguments recorded since the last
+    // Reset(). The blob is tagged with the fingerprint of the schema.
+    // Requires DeferConversion::yes. Returns false if a sub-command has been
+    // selected, since its arguments are not included.
+    bool Serialize(std::string& out) const;
+
+    // Restores a parse state written by Serialize(), without tokenizing or
+    // parsing the command line. Like Parse(), the recorded arguments are
+    // either converted immediately or recorded for Convert(), depending on
+    // SetDeferConversion(). Options which are missing are not reported.
+    // BLOB need not be aligned and is only read during this call, so it may
+    // point into a memory-mapped file.
+    // Returns false if BLOB is invalid, has been written for a schema with a
+    // different fingerprint, or contains invalid arguments.
+    bool Replay(string_view blob);
+
+    // Adds a diagnostic message.
+    // Every argument must be explicitly convertible to string_view.
+    template <typename... Args>
+    void EmitDiag(Diagnostic::Type type, int index, Args&&... args);
+
+    // Add an option to the command line. See Schema::Add.
+    // Requires that this Cmdline owns its schema.
+    template <typename ParserInit>
+    Option<std::decay_t<ParserInit>>* Add(char const* name, char const* descr, OptionFlags flags, ParserInit&& parser);
+
+    // Add an option to the command line. See Schema::Add.
+    // Requires that this Cmdline owns its schema.
+    OptionBase* Add(std::unique_ptr<OptionBase> opt);
+
+    // Add an option to the command line. See Schema::Add.
+    // Requires that this Cmdline owns its schema.
+    OptionBase* Add(OptionBase* opt);
+
+    // Add all the options from a precomputed option table. See Schema::Add.
+    // Requires that this Cmdline owns its schema.
+    template <size_t NumOptions, size_t NumNames, typename... ParserInit>
+    void Add(OptionTable<NumOptions, NumNames> const& table, ParserInit&&... parsers);
+
+    // Add all the options from an option set. See Schema::Add.
+    // Requires that this Cmdline owns its schema.
+    template <typename... ParserT>
+    void Add(OptionSet<ParserT...>& set);
+
+    // Add a sub-command. See Schema::AddSubcommand.
+    // Requires that this Cmdline owns its schema.
+    template <typename Init>
+    void AddSubcommand(char const* name, char const* descr, Init&& init);
+
+    // Returns the parser of the sub-command selected since the last call to
+    // Reset(), or null. Diagnostics of the sub-command are emitted to this
+    // Cmdline.
+    Cmdline* Subcommand() { return sub_active_ ? sub_.get() : nullptr; }
+    Cmdline const* Subcommand() const { return sub_active_ ? sub_.get() : nullptr; }
+
+    // Resets the parser. Sets the counts of all options to 0 and clears the
+    // diagnostics. The target (see SetTarget) is not changed.
+    void Reset();
+
+    // Returns the number of times the option was specified on the command line
+    // since the last call to Reset().
+    int Count(OptionBase const* opt) const;
+
+    // Returns the number of times the option with the given name was specified
+    // on the command line since the last call to Reset(), or -1 if there is no
+    // such option.
+    int Count(string_view name) const;
+
+    // Sets the object passed as ParseContext::target to the parsers.
+    // This allows to share a Schema and to store the parsed values into a
+    // different object for each call to Parse (see Field()).
+    void SetTarget(void* target) { target_ = target; }
+
+    // Returns a view of STR, which must be (a part of) ParseContext::arg, that
+    // remains valid after the parser returns.
+    // If the arguments passed to Parse() are owned by the caller (e.g. main's
+    // argv, see impl::HasPersistentArgs), this is STR itself, which is valid
+    // as long as the caller's arguments are. Otherwise STR is copied into
+    // storage owned by this Cmdline, which is valid until the next call to
+    // Reset() (see ReleasePersistedArgs()).
+    // Used for string_view targets, like Var(string_view&).
+    string_view PersistArg(string_view str);
+
+    // Moves the copies made by PersistArg() to OUT, so that they remain valid
+    // after Reset().
+    void ReleasePersistedArgs(std::vector<std::unique_ptr<char[]>>& out);
+
+    // Enables expansion of response files in Parse().
+    // An argument "@file" is replaced with the arguments read from FILE.
+    // Response files may contain "@file" arguments themselves, up to the given
+    // nesting level.
+    void SetResponseFiles(ResponseFiles quoting, int max_depth = 16);
+
+    // Returns the arguments from response files which have not been parsed by
+    // the last call to Parse(), because parsing stopped at an option with
+    // StopParsing::yes inside a response file. ParseResult::next then points
+    // past the "@file" argument, and the remaining arguments of the file (and
+    // of any enclosing response files) are returned here, in order.
+    // Empty otherwise.
+    std::vector<std::string> const& UnparsedFileArgs() const { return unparsed_file_args_; }
+
+    template <typename It>
+    struct ParseResult {
+        It next = It{};
+        bool success = false;
+
+        ParseResult() = default;
+        ParseResult(It next_, bool success_) : next(next_), success(success_) {}
+
+        // Test for success.
+        explicit operator bool() const { return success; }
+    };
+
+    // Parse the command line arguments in [CURR, LAST).
+    // Emits an error for unknown options.
+    template <typename It, typename EndIt>
+    ParseResult<It> Parse(It curr, EndIt last, CheckMissingOptions check_missing = CheckMissingOptions::yes);
+
+    // Parse the command line arguments in ARGS.
+    // Emits an error for unknown options.
+    template <typename Container>
+    bool ParseArgs(Container const& args, CheckMissingOptions check_missing = CheckMissingOptions::yes);
+
+    // Returns whether all required options have been parsed since the last call
+    // to Parse() and emits errors for all missing options.
+    // Returns true if any required options have not yet been (successfully) parsed.
+    // Emits errors for ALL missing options.
+    bool AnyMissing();
+
+    // Sets the options which have not been specified so far (Count() == 0)
+    // from environment variables.
+    // The variable for an option is PREFIX followed by the name of the option
+    // in upper case, with '-' and '.' replaced by '_'. E.g., the variable for
+    // "output-dir" is "TOOL_OUTPUT_DIR" for the prefix "TOOL_". All the names
+    // of an option are tried, in order.
+    // Options which do not accept an argument are specified if the variable
+    // has a value like "1" or "yes", and are ignored for values like "0" or
+    // "no".
+    //
+    // To give the command line precedence, parse it first using
+    // CheckMissingOptions::no, then call ParseEnv/ParseConfig, then AnyMissing().
+    // Returns false on error.
+    bool ParseEnv(string_view prefix);
+
+    // Sets the options which have not been specified so far (Count() == 0)
+    // from the contents of a config file (see impl::ForEachConfigEntry).
+    // Keys are option names; keys in a "[section]" are prefixed with
+    // "section.". SOURCE is used in diagnostic messages. See ParseEnv.
+    // Returns false on error.
+    bool ParseConfig(string_view text, string_view source = "config");
+
+    // Reads the config file PATH and calls ParseConfig.
+    // If CACHE_PATH is not null, the parsed contents of the file are stored
+    // there in a compact binary snapshot. The snapshot is used instead of the
+    // file as long as the modification time and size of the file do not
+    // change. Files with syntax errors are not cached.
+    // Returns false on error.
+    bool ParseConfigFile(char const* path, char const* cache_path = nullptr);
+
+    // Returns the candidates for the (partial) argument at position CURSOR in
+    // [FIRST, LAST), or for an empty argument if CURSOR is at LAST.
+    // The arguments before CURSOR are parsed without calling the parsers of
+    // the options. Response files are not expanded.
+    // Resets the parser state (see Reset()).
+    template <typename It>
+    std::vector<Completion> Complete(It first, It last, size_t cursor);
+
+    // Prints error messages to stderr.
+    void PrintDiag() const;
+
+    // Returns a short help message listing all registered options.
+    std::string FormatHelp(HelpFormat const& fmt = {}) const;
+
+    // Writes the help message to SINK. See Schema::FormatHelp.
+    template <typename Sink, std::enable_if_t<!std::is_convertible<Sink, HelpFormat const&>::value, int> = 0>
+    void FormatHelp(Sink&& sink, HelpFormat const& fmt = {}) const;
+
+    // Writes the help message to SINK, without caching it. See Schema::WriteHelp.
+    template <typename Sink>
+    void WriteHelp(Sink&& sink, HelpFormat const& fmt = {}) const;
+
+    // Prints the help message to stderr
+    void PrintHelp(HelpFormat const& fmt = {}) const;
+
+#if CL_ENABLE_STATS
+    // Returns the statistics collected since the construction of this
+    // Cmdline, or since the last call to ResetStats().
+    // Reset() does not reset the statistics.
+    ParseStats const& Stats() const { return stats_; }
+
+    // Resets all statistics.
+    void ResetStats() { stats_ = {}; }
+#endif
+
+private:
+    enum class Status : uint8_t {
+        success,
+        done,
+        error,
+        ignored
+    };
+
+    Schema& MutableSchema();
+
+    OptionBase const* FindOption(string_view name);
+    OptionBase const* FindOption(string_view name, uint32_t hash);
+
+#if CL_ENABLE_STATS
+    void ResizeStats();
+#endif
+
+    // Calls FN(), which calls the parser of OPT.
+    template <typename Fn>
+    bool CallParser(OptionBase const* opt, Fn fn);
+
+    bool IsOccurrenceAllowed(OptionBase const* opt) const;
+    bool IsOccurrenceAllowed(size_t id) const;
+
+    template <typename It, typename EndIt>
+    Status ParseRange(It& curr, EndIt last);
+
+    template <typename It, typename EndIt>
+    Status ParseArg(It& curr, EndIt last, std::string& buf);
+
+    // @file
+    Status HandleResponseFile(string_view path);
+
+    // Calls FN(counts) with the current option counts. Used for ParseEnv etc.
+    template <typename Fn>
+    bool ParseSource(Fn fn);
+
+    // Sets OPT from an environment variable or a config file, unless it had
+    // been specified before (see COUNTS).
+    Status HandleSourceOption(Counts const& counts, OptionBase const* opt, string_view name, string_view value);
+
+    bool ApplyConfigEntry(Counts const& counts, string_view key, string_view value, size_t line, string_view source);
+
+    // Parses the config file TEXT. Adds the entries to SNAPSHOT, if not null.
+    // SYNTAX_OK receives whether TEXT is well-formed.
+    bool ParseConfigText(Counts const& counts, string_view text, string_view source, cl::impl::ConfigSnapshot* snapshot, bool& syntax_ok);
+
+    void EmitConfigNote(string_view source, size_t line);
+
+    template <typename It, typename EndIt>
+    Status Handle1(string_view optstr, It& curr, EndIt last);
+
+    // Steps 1-4 of Handle1. OPTSTR is the option without the leading dashes.
+    //  -f
+    //  -f <file>
+    //  -f=<file>
+    //  -I<dir>
+    //  and option groups (see HandleGroup)
+    template <typename It, typename EndIt>
+    Status HandleNamedOption(string_view optstr, bool is_short, It& curr, EndIt last);
+
+    // Passes OPTSTR to the parser of the selected sub-command.
+    template <typename It, typename EndIt>
+    Status HandleSubcommandArg(string_view optstr, It& curr, EndIt last);
+
+    // If OPTSTR is the name of a sub-command, select it.
+    bool SelectSubcommand(string_view optstr);
+
+    // <file>
+    Status HandlePositional(string_view optstr);
+
+    // -xvf <file>
+    // -xvf=<file>
+    // -xvf<file>
+    template <typename It, typename EndIt>
+    Status HandleGroup(string_view optstr, It& curr, EndIt last);
+
+    // Sets stable_arg_ to ARG if it points into the caller's storage, i.e. not
+    // into BUF or into a response file.
+    template <typename It>
+    void SetStableArg(string_view arg, std::string const& buf);
+
+    // Returns whether STR is a part of stable_arg_.
+    bool IsStableArg(string_view str) const;
+
+    // Records an argument for Convert(). NAME and ARG are copied, unless they
+    // are stable (see IsStableArg).
+    void DeferArg(OptionBase const* opt, string_view name, string_view arg);
+
+    // Emits "did you mean" notes for the unknown option NAME, which has been
+    // specified with the given DASHES.
+    void EmitSuggestions(string_view name, string_view dashes);
+
+    // Returns the context for calling the parser of D. The offsets in D are
+    // relative to TEXT.
+    ParseContext DeferredContext(string_view text, DeferredArg const& d);
+
+    // Calls FN() with stable_arg_ set to the argument of D, if it points into
+    // the caller's storage, so that PersistArg need not copy it.
+    template <typename Fn>
+    bool WithDeferredArg(DeferredArg const& d, Fn fn);
+
+    // Calls the parser for D. The offsets in D are relative to TEXT.
+    bool ConvertDeferred(string_view text, DeferredArg const& d);
+
+    // Converts the argument of D into slot I of SLOTS.
+    bool ConvertDeferred(string_view text, DeferredArg const& d, cl::impl::ArgSlots& slots, size_t i);
+
+    // Calls PARSE(ctx) for D and emits a diagnostic if it fails.
+    template <typename Fn>
+    bool ConvertDeferredWith(string_view text, DeferredArg const& d, Fn parse);
+
+    // Converts the argument of D to a T.
+    template <typename T>
+    bool ConvertLazy(DeferredArg const& d, T& value);
+
+    // Returns the memoized value of type T for the option OPT, calling
+    // CONVERT(value) if the option has occurred since the value was memoized.
+    template <typename T, typename Fn>
+    cl::impl::LazyValue<T> const* Memoize(OptionBase const* opt, bool all, Fn convert);
+
+    template <typename It, typename EndIt>
+    Status HandleOccurrence(OptionBase const* opt, string_view name, It& curr, EndIt last);
+    Status HandleOccurrence(OptionBase const* opt, string_view name, string_view arg);
+
+    Status ParseOptionArgument(OptionBase const* opt, string_view name, string_view arg);
+    Status ParseOptionList(OptionBase const* opt, string_view name, string_view arg);
+
+    void CompleteArgument(string_view arg, OptionBase const* pending, std::vector<Completion>& out) const;
+
+    void EmitDiagImpl(Diagnostic::Type type, int index, string_view const* strings, int num_strings);
 };
 
-template <typename T>
-struct RemoveCVRec {
-    using type = std::remove_cv_t<T>;
+//==================================================================================================
+// Batch parsing
+//==================================================================================================
+
+struct BatchOptions {
+    // Number of threads, including the calling thread. 0 means
+    // std::thread::hardware_concurrency().
+    size_t num_threads = 0;
+    // Number of command lines a thread takes at a time.
+    size_t chunk_size = 64;
+    CheckMissingOptions check_missing = CheckMissingOptions::yes;
+};
+
+// The results of ParseBatch, one entry per command line.
+struct BatchResults {
+    // success[i] != 0 iff command line I has been parsed successfully.
+    std::vector<uint8_t> success;
+    // The diagnostics of command line I are diags[diag_offsets[i], diag_offsets[i + 1]).
+    std::vector<size_t> diag_offsets;
+    std::vector<Diagnostic> diags;
+    // Storage for the arguments of string_view targets, which have been
+    // copied by Cmdline::PersistArg (e.g. the tokens of ParseBatch).
+    // Valid until RESULTS is reused.
+    std::vector<std::unique_ptr<char[]>> arg_copies;
+
+    // Returns the number of command lines.
+    size_t size() const { return success.size(); }
+
+    // Returns the number of diagnostics of command line I.
+    size_t NumDiags(size_t i) const { return diag_offsets[i + 1] - diag_offsets[i]; }
+
+    // Returns the J-th diagnostic of command line I.
+    Diagnostic const& Diag(size_t i, size_t j) const { return diags[diag_offsets[i] + j]; }
 };
 
-template <template <typename...> class T, typename... Args>
-struct RemoveCVRec<T<Args...>> {
-    using type = T<typename RemoveCVRec<Args>::type...>;
-};
+// Tokenizes (using Bash-style escaping, see TokenizeUnix) and parses the
+// command lines LINES[0], ..., LINES[N-1], which must be convertible to
+// string_view, concurrently.
+// Each thread reuses a single Cmdline for SCHEMA and a single buffer for the
+// tokenizer. The target of the parsers (see Cmdline::SetTarget) for command
+// line I is TARGET(I). The parsers must be safe to call concurrently (see
+// Schema), e.g. by only writing to the target.
+// RESULTS is overwritten and may be reused across calls.
+template <typename Lines, typename TargetFn>
+void ParseBatch(Schema const& schema, Lines const& lines, TargetFn target, BatchResults& results, BatchOptions const& options = {});
+
+// Like ParseBatch, but LINES[I] are already tokenized: each is a container of
+// arguments which can be passed to Cmdline::ParseArgs.
+template <typename ArgLists, typename TargetFn>
+void ParseBatchArgs(Schema const& schema, ArgLists const& lines, TargetFn target, BatchResults& results, BatchOptions const& options = {});
+
+//==================================================================================================
+// Unicode support
+//==================================================================================================
+
+namespace impl {
+
+constexpr char32_t kInvalidCodepoint = 0xFFFFFFFF;
+constexpr char32_t kReplacementCharacter = 0xFFFD;
+
+inline bool IsValidCodepoint(char32_t U) {
+    // 1. Characters with values greater than 0x10FFFF cannot be encoded in
+    //    UTF-16.
+    // 2. Values between 0xD800 and 0xDFFF are specifically reserved for use
+    //    with UTF-16, and don't have any characters assigned to them.
+    return U < 0xD800 || (U > 0xDFFF && U <= 0x10FFFF);
+}
+
+constexpr uint32_t kUTF8Accept = 0;
+constexpr uint32_t kUTF8Reject = 1;
+
+inline uint32_t DecodeUTF8Step(uint32_t state, uint8_t byte, char32_t& U) {
+    // Copyright (c) 2008-2009 Bjoern Hoehrmann <bjoern@hoehrmann.de>
+    // See http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ for details.
+
+    static constexpr uint8_t kUTF8Decoder[] = {
+        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 00..1f
+        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 20..3f
+        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 40..5f
+        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // 60..7f
+        1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9, // 80..9f
+        7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7, // a0..bf
+        8,8,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2, // c0..df
+        0xa,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x3,0x4,0x3,0x3, // e0..ef
+        0xb,0x6,0x6,0x6,0x5,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8,0x8, // f0..ff
+
+        0x0,0x1,0x2,0x3,0x5,0x8,0x7,0x1,0x1,0x1,0x4,0x6,0x1,0x1,0x1,0x1, // s0..s0
+        1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,0,1,1,1,1,1,0,1,0,1,1,1,1,1,1, // s1..s2
+        1,2,1,1,1,1,1,2,1,2,1,1,1,1,1,1,1,1,1,1,1,1,1,2,1,1,1,1,1,1,1,1, // s3..s4
+        1,2,1,1,1,1,1,1,1,2,1,1,1,1,1,1,1,1,1,1,1,1,1,3,1,3,1,1,1,1,1,1, // s5..s6
+        1,3,1,1,1,1,1,3,1,3,1,1,1,1,1,1,1,3,1,1,1,1,1,1,1,1,1,1,1,1,1,1, // s7..s8
+    };
+
+    uint8_t const type = kUTF8Decoder[byte];
+
+    // NB:
+    // The conditional here will likely be optimized out in the loop below.
+
+    if (state != kUTF8Accept) {
+        U = (U << 6) | (byte & 0x3Fu);
+    } else {
+        U = byte & (0xFFu >> type);
+    }
+
+    state = kUTF8Decoder[256 + state * 16 + type];
+    return state;
+}
+
+template <typename It>
+It DecodeUTF8Sequence(It next, It last, char32_t& U) {
+    CL_ASSERT(next != last);
+
+    // Always consume the first byte.
+    // The following bytes will only be consumed while the UTF-8 sequence is still valid.
+    uint8_t const b1 = static_cast<uint8_t>(*next);
+    ++next;
+
+    char32_t W = 0;
+    uint32_t state = DecodeUTF8Step(kUTF8Accept, b1, W);
+
+    if (state == kUTF8Reject) {
+        U = kInvalidCodepoint;
+        return next;
+    }
+
+    while (state != kUTF8Accept) {
+        if (next == last) {
+            U = kInvalidCodepoint;
+            return next;
+        }
+
+        state = DecodeUTF8Step(state, static_cast<uint8_t>(*next), W);
+        if (state == kUTF8Reject) {
+            U = kInvalidCodepoint;
+            return next;
+        }
+
+        ++next;
+    }
+
+    U = W;
+    return next;
+}
+
+template <typename PutChar>
+void EncodeUTF8(char32_t U, PutChar put) {
+    CL_ASSERT(IsValidCodepoint(U));
+
+    if (U <= 0x7F) {
+        put( static_cast<char>(static_cast<uint8_t>( U )) );
+    } else if (U <= 0x7FF) {
+        put( static_cast<char>(static_cast<uint8_t>( 0xC0 | ((U >>  6)       ) )) );
+        put( static_cast<char>(static_cast<uint8_t>( 0x80 | ((U      ) & 0x3F) )) );
+    } else if (U <= 0xFFFF) {
+        put( static_cast<char>(static_cast<uint8_t>( 0xE0 | ((U >> 12)       ) )) );
+        put( static_cast<char>(static_cast<uint8_t>( 0x80 | ((U >>  6) & 0x3F) )) );
+        put( static_cast<char>(static_cast<uint8_t>( 0x80 | ((U      ) & 0x3F) )) );
+    } else {
+        put( static_cast<char>(static_cast<uint8_t>( 0xF0 | ((U >> 18) & 0x3F) )) );
+        put( static_cast<char>(static_cast<uint8_t>( 0x80 | ((U >> 12) & 0x3F) )) );
+        put( static_cast<char>(static_cast<uint8_t>( 0x80 | ((U >>  6) & 0x3F) )) );
+        put( static_cast<char>(static_cast<uint8_t>( 0x80 | ((U      ) & 0x3F) )) );
+    }
+}
+
+template <typename It, typename PutChar32>
+bool ForEachUTF8EncodedCodepoint(It next, It last, PutChar32 put) {
+    while (next != last) {
+        char32_t U = 0;
+        next = cl::impl::DecodeUTF8Sequence(next, last, U);
+        if (!put(U)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <typename It>
+It DecodeUTF16Sequence(It next, It last, char32_t& U) {
+    CL_ASSERT(next != last);
+
+    // Always consume the first UCN.
+    // The second UCN - if any - will only be consumed if the UTF16-sequence is valid.
+    char32_t const W1 = static_cast<char16_t>(*next);
+    ++next;
+
+    if (W1 < 0xD800 || W1 > 0xDFFF) {
+        U = W1;
+        return next;
+    }
+
+    if (W1 > 0xDBFF) {
+        U = kInvalidCodepoint; // Invalid high surrogate
+        return next;
+    }
+
+    if (next == last) {
+        U = kInvalidCodepoint; // Incomplete UTF-16 sequence
+        return next;
+    }
+
+    char32_t const W2 = static_cast<char16_t>(*next);
+
+    if (W2 < 0xDC00 || W2 > 0xDFFF) {
+        U = kInvalidCodepoint; // Invalid low surrogate
+        return next;
+    }
+
+    ++next;
+
+    U = (((W1 & 0x3FF) << 10) | (W2 & 0x3FF)) + 0x10000;
+    return next;
+}
+
+template <typename PutChar16>
+void EncodeUTF16(char32_t U, PutChar16 put) {
+    CL_ASSERT(IsValidCodepoint(U));
+
+    if (U < 0x10000) {
+        put( static_cast<char16_t>(U) );
+    } else {
+        char32_t const Up = U - 0x10000;
+        put( static_cast<char16_t>(0xD800 + ((Up >> 10) & 0x3FF)) );
+        put( static_cast<char16_t>(0xDC00 + ((Up      ) & 0x3FF)) );
+    }
+}
+
+template <typename It, typename PutChar32>
+bool ForEachUTF16EncodedCodepoint(It next, It last, PutChar32 put) {
+    while (next != last) {
+        char32_t U = 0;
+        next = cl::impl::DecodeUTF16Sequence(next, last, U);
+        if (!put(U)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <typename It, typename PutChar32>
+bool ForEachUTF32EncodedCodepoint(It next, It last, PutChar32 put) {
+    while (next != last) {
+        char32_t const U = static_cast<char32_t>(*next);
+        ++next;
+        if (!put(IsValidCodepoint(U) ? U : kInvalidCodepoint)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Returns a pointer to the first non-ASCII character in [NEXT, LAST), or LAST
+// if all characters are ASCII characters.
+inline char const* SkipASCII(char const* next, char const* last) {
+#if CL_HAS_SSE2
+    for (; last - next >= 16; next += 16) {
+        __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(next));
+        if (_mm_movemask_epi8(v) != 0) {
+            break;
+        }
+    }
+#elif CL_HAS_NEON
+    for (; last - next >= 16; next += 16) {
+        uint8x16_t const v = vld1q_u8(reinterpret_cast<uint8_t const*>(next));
+        if (vmaxvq_u8(v) >= 0x80) {
+            break;
+        }
+    }
+#endif
+
+    for (; last - next >= 8; next += 8) {
+        uint64_t v;
+        std::memcpy(&v, next, 8);
+        if ((v & 0x8080808080808080ull) != 0) {
+            break;
+        }
+    }
+
+    while (next != last && static_cast<uint8_t>(*next) < 0x80) {
+        ++next;
+    }
+
+    return next;
+}
+
+// Returns a pointer to the first code unit >= 0x80 in [NEXT, LAST), or LAST.
+// ASCII characters are appended to S.
+template <typename CharT>
+CharT* CopyASCII(std::string& s, CharT* next, CharT* last) {
+    static_assert(sizeof(CharT) == 2, "Invalid code unit type");
+
+#if CL_HAS_SSE2
+    for (; last - next >= 8; next += 8) {
+        __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(next));
+        __m128i const hi = _mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xFF80)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(hi, _mm_setzero_si128())) != 0xFFFF) {
+            break;
+        }
+
+        char buf[8];
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(buf), _mm_packus_epi16(v, v));
+        s.append(buf, 8);
+    }
+#elif CL_HAS_NEON
+    for (; last - next >= 8; next += 8) {
+        uint16x8_t const v = vld1q_u16(reinterpret_cast<uint16_t const*>(next));
+        if (vmaxvq_u16(v) >= 0x80) {
+            break;
+        }
+
+        char buf[8];
+        vst1_u8(reinterpret_cast<uint8_t*>(buf), vmovn_u16(v));
+        s.append(buf, 8);
+    }
+#endif
+
+    while (next != last && static_cast<char16_t>(*next) < 0x80) {
+        s.push_back(static_cast<char>(*next));
+        ++next;
+    }
+
+    return next;
+}
+
+// Convert to UTF-8.
+// The internal encoding used by the library is UTF-8.
+
+template <typename It>
+bool IsUTF8(It next, It last) {
+    return cl::impl::ForEachUTF8EncodedCodepoint(next, last, [](char32_t U) { return U != cl::impl::kInvalidCodepoint; });
+}
+
+inline bool IsUTF8(char const* next, char const* last) {
+    for (;;) {
+        next = cl::impl::SkipASCII(next, last);
+        if (next == last) {
+            return true;
+        }
+
+        char32_t U = 0;
+        next = cl::impl::DecodeUTF8Sequence(next, last, U);
+        if (U == kInvalidCodepoint) {
+            return false;
+        }
+    }
+}
+
+inline bool IsUTF8(char* next, char* last) {
+    return cl::impl::IsUTF8(static_cast<char const*>(next), static_cast<char const*>(last));
+}
+
+template <typename It>
+void AppendUTF8_dispatch(std::string& s, It next, It last, char const* /*tag*/, std::input_iterator_tag /*cat*/) {
+    cl::impl::ForEachUTF8EncodedCodepoint(next, last, [&](char32_t U) {
+        if (U == kInvalidCodepoint) {
+            U = kReplacementCharacter;
+        }
+        cl::impl::EncodeUTF8(U, [&](char ch) { s.push_back(ch); });
+        return true;
+    });
+}
+
+template <typename It>
+void AppendUTF8_dispatch(std::string& s, It next, It last, char const* /*tag*/, std::forward_iterator_tag /*cat*/) {
+//  s.reserve(std::distance(next, last));
+
+    while (next != last) {
+        char32_t U = 0;
+        auto const I = cl::impl::DecodeUTF8Sequence(next, last, U);
+
+        if (U == kInvalidCodepoint) {
+            s.append("\xEF\xBF\xBD", 3);
+        } else {
+            s.append(next, I);
+        }
+
+        next = I;
+    }
+}
+
+template <typename It>
+void AppendUTF8_dispatch(std::string& s, It next, It last, char const* tag) {
+    using Cat = typename std::iterator_traits<It>::iterator_category;
+
+    cl::impl::AppendUTF8_dispatch(s, next, last, tag, Cat{});
+}
+
+inline void AppendUTF8_fromUTF8(std::string& s, char const* next, char const* last) {
+    s.reserve(s.size() + static_cast<size_t>(last - next));
+
+    for (;;) {
+        // Copy runs of ASCII characters in one go.
+        auto const I = cl::impl::SkipASCII(next, last);
+        s.append(next, I);
+        next = I;
+
+        if (next == last) {
+            break;
+        }
+
+        char32_t U = 0;
+        auto const J = cl::impl::DecodeUTF8Sequence(next, last, U);
+
+        if (U == kInvalidCodepoint) {
+            s.append("\xEF\xBF\xBD", 3);
+        } else {
+            s.append(next, J);
+        }
+
+        next = J;
+    }
+}
+
+template <typename CharT>
+void AppendUTF8_dispatch(std::string& s, CharT* next, CharT* last, char const* /*tag*/) {
+    cl::impl::AppendUTF8_fromUTF8(s, next, last);
+}
+
+template <typename It>
+void AppendUTF8_dispatch(std::string& s, It next, It last, char16_t const* /*tag*/) {
+    cl::impl::ForEachUTF16EncodedCodepoint(next, last, [&](char32_t U) {
+        if (U == kInvalidCodepoint) {
+            U = kReplacementCharacter;
+        }
+        cl::impl::EncodeUTF8(U, [&](char ch) { s.push_back(ch); });
+        return true;
+    });
+}
+
+template <typename CharT>
+void AppendUTF8_dispatch(std::string& s, CharT* next, CharT* last, char16_t const* /*tag*/) {
+    s.reserve(s.size() + static_cast<size_t>(last - next));
+
+    for (;;) {
+        // Convert runs of ASCII characters in one go.
+        next = cl::impl::CopyASCII(s, next, last);
+
+        if (next == last) {
+            break;
+        }
+
+        char32_t U = 0;
+        next = cl::impl::DecodeUTF16Sequence(next, last, U);
+
+        if (U == kInvalidCodepoint) {
+            U = kReplacementCharacter;
+        }
+        cl::impl::EncodeUTF8(U, [&](char ch) { s.push_back(ch); });
+    }
+}
+
+template <typename It>
+void AppendUTF8_dispatch(std::string& s, It next, It last, char32_t const* /*tag*/) {
+    cl::impl::ForEachUTF32EncodedCodepoint(next, last, [&](char32_t U) {
+        if (U == kInvalidCodepoint) {
+            U = kReplacementCharacter;
+        }
+        cl::impl::EncodeUTF8(U, [&](char ch) { s.push_back(ch); });
+        return true;
+    });
+}
+
+template <typename It>
+CL_FORCE_INLINE void AppendUTF8_dispatch(std::string& s, It next, It last, wchar_t const* /*tag*/) {
+#if _WIN32
+    cl::impl::AppendUTF8_dispatch(s, next, last, static_cast<char16_t const*>(nullptr));
+#else
+    cl::impl::AppendUTF8_dispatch(s, next, last, static_cast<char32_t const*>(nullptr));
+#endif
+}
+
+template <typename It, typename T>
+void AppendUTF8_dispatch(std::string& s, It next, It last, T const* /*tag*/) = delete;
+
+// Converts the string [NEXT, LAST) to UTF-8 and appends the result to S.
+// Invalid code points are replaced with U+FFFD.
+template <typename It>
+CL_FORCE_INLINE void AppendUTF8(std::string& s, It next, It last) {
+    using CharT = std::remove_reference_t<decltype(*next)>;
+
+    cl::impl::AppendUTF8_dispatch(s, next, last, static_cast<CharT const*>(nullptr));
+}
+
+template <typename StringT>
+CL_FORCE_INLINE void AppendUTF8(std::string& s, StringT const& str) {
+    cl::impl::AppendUTF8(s, str.begin(), str.end());
+}
+
+template <typename ElemT>
+CL_FORCE_INLINE void AppendUTF8(std::string& s, ElemT* const& c_str) {
+    using CharT = std::remove_const_t<ElemT>;
+
+    auto const len = (c_str != nullptr)
+                         ? std::char_traits<CharT>::length(c_str)
+                         : 0u;
+
+    cl::impl::AppendUTF8(s, c_str, c_str + len);
+}
+
+template <typename It>
+CL_FORCE_INLINE std::string ToUTF8(It next, It last) {
+    std::string s;
+    cl::impl::AppendUTF8(s, next, last);
+    return s;
+}
+
+template <typename StringT>
+CL_FORCE_INLINE std::string ToUTF8(StringT const& str) {
+    std::string s;
+    cl::impl::AppendUTF8(s, str);
+    return s;
+}
+
+template <typename ElemT>
+CL_FORCE_INLINE std::string ToUTF8(ElemT* const& c_str) {
+    std::string s;
+    cl::impl::AppendUTF8(s, c_str);
+    return s;
+}
+
+template <typename T>
+struct IsNarrowString
+    : std::false_type
+{
+};
+
+template <>
+struct IsNarrowString<char*>
+    : std::true_type
+{
+};
+
+template <>
+struct IsNarrowString<char const*>
+    : std::true_type
+{
+};
+
+template <typename Traits, typename Alloc>
+struct IsNarrowString<std::basic_string<char, Traits, Alloc>>
+    : std::true_type
+{
+};
+
+template <>
+struct IsNarrowString<string_view>
+    : std::true_type
+{
+};
+
+// Determines whether the strings returned by *It (for any It in the range
+// [first, last)) may be used without making a copy, i.e. are narrow strings
+// which are still valid after incrementing the iterator.
+//
+// This is the case for arrays of C-strings (like main's argv). Or if It is a
+// forward iterator returning references to strings.
+template <typename It, typename R = decltype(*std::declval<It&>())>
+struct HasStableArgs
+    : std::integral_constant<bool,
+        std::is_pointer<std::decay_t<R>>::value
+            ? IsNarrowString<std::decay_t<R>>::value
+            : (std::is_reference<R>::value &&
+               IsNarrowString<std::decay_t<R>>::value &&
+               std::is_base_of<std::forward_iterator_tag, typename std::iterator_traits<It>::iterator_category>::value)>
+{
+};
+
+// Determines whether the strings returned by *It remain valid after Parse()
+// returns, as long as the caller's arguments are. See Cmdline::PersistArg.
+template <typename It>
+struct HasPersistentArgs
+    : HasStableArgs<It>
+{
+};
+
+inline string_view ArgView(char const* c_str) {
+    return c_str != nullptr ? string_view(c_str) : string_view();
+}
+
+template <typename Traits, typename Alloc>
+string_view ArgView(std::basic_string<char, Traits, Alloc> const& str) {
+    return string_view(str.data(), str.size());
+}
+
+inline string_view ArgView(string_view str) {
+    return str;
+}
+
+template <typename It>
+string_view ArgToUTF8(It const& it, std::string& buf, std::true_type /*HasStableArgs*/) {
+    auto const view = cl::impl::ArgView(*it);
+    if (cl::impl::IsUTF8(view.data(), view.data() + view.size())) {
+        return view;
+    }
+
+    buf.clear();
+    cl::impl::AppendUTF8(buf, view.data(), view.data() + view.size());
+    return buf;
+}
+
+template <typename It>
+string_view ArgToUTF8(It const& it, std::string& buf, std::false_type /*HasStableArgs*/) {
+    buf.clear();
+    cl::impl::AppendUTF8(buf, *it);
+    return buf;
+}
+
+// Returns the UTF-8 representation of the command line argument *IT.
+// If the argument is a valid UTF-8 string which remains valid while the
+// arguments are parsed, returns a view into the caller's storage. Otherwise
+// converts the argument into BUF and returns a view of BUF.
+template <typename It>
+string_view ArgToUTF8(It const& it, std::string& buf) {
+    return cl::impl::ArgToUTF8(it, buf, HasStableArgs<It>{});
+}
+
+} // namespace impl
+
+//==================================================================================================
+// Split strings
+//==================================================================================================
+
+namespace impl {
+
+// Return type for delimiters. Returned by the ByX delimiters.
+//
+// +-----+-----+------------+
+// ^ tok ^     ^    rest    ^
+//       f     f+c
+//
+// Either FIRST or COUNT must be non-zero.
+struct DelimiterResult {
+    size_t first;
+    size_t count;
+};
+
+struct ByChar {
+    char const ch;
+
+    explicit ByChar(char ch_) : ch(ch_) {}
+
+    DelimiterResult operator()(string_view str) const {
+        return {str.find(ch), 1};
+    }
+};
+
+// Breaks a string into lines, i.e. searches for "\n" or "\r" or "\r\n".
+struct ByLines {
+    DelimiterResult operator()(string_view str) const {
+        auto const first = str.begin();
+        auto const last = str.end();
+
+        // Find the position of the first CR or LF
+        auto p = first;
+        while (p != last && (*p != '\n' && *p != '\r')) {
+            ++p;
+        }
+
+        if (p == last) {
+            return {string_view::npos, 0};
+        }
+
+        auto const index = static_cast<size_t>(p - first);
+
+        // If this is CRLF, skip the other half.
+        if (*p == '\r' && ++p != last && *p == '\n') {
+            return {index, 2};
+        }
+
+        return {index, 1};
+    }
+};
+
+// Breaks a string into words, i.e. searches for the first whitespace preceding
+// the given length. If there is no whitespace, breaks a single word at length
+// characters.
+struct ByWords {
+    size_t const length;
+
+    explicit ByWords(size_t length_)
+        : length(length_)
+    {
+        CL_ASSERT(length != 0 && "invalid parameter");
+    }
+
+    DelimiterResult operator()(string_view str) const {
+        // If the string fits into the current line, just return this last line.
+        if (str.size() <= length) {
+            return {string_view::npos, 0};
+        }
+
+        // Otherwise, search for the first space preceding the line length.
+        auto const last_ws = str.find_last_of(" \t", length);
+
+        if (last_ws != string_view::npos) {
+            // TODO:
+            // Further remove trailing whitespace?!
+            return {last_ws, 1};
+        }
+
+        return {length, 0}; // No space in current line, break at length.
+    }
+};
+
+struct DoSplitResult {
+    string_view tok; // The current token.
+    string_view str; // The rest of the string.
+    bool last = false;
+};
+
+inline bool DoSplit(DoSplitResult& res, string_view str, DelimiterResult del) {
+    if (del.first == string_view::npos) {
+        res.tok = str;
+        //res.str = {};
+        res.last = true;
+        return true;
+    }
+
+    CL_ASSERT(del.first + del.count >= del.first);
+    CL_ASSERT(del.first + del.count <= str.size());
+
+    auto const off = del.first + del.count;
+    CL_ASSERT(off > 0 && "invalid delimiter result");
+
+    res.tok = string_view(str.data(), del.first);
+    res.str = string_view(str.data() + off, str.size() - off);
+    return true;
+}
+
+// Split the string STR into substrings using the Delimiter (or Tokenizer) SPLIT
+// and call FN for each substring.
+// FN must return bool. If FN returns false, this method stops splitting
+// the input string and returns false, too. Otherwise, returns true.
+template <typename Splitter, typename Function>
+bool Split(string_view str, Splitter&& split, Function&& fn) {
+    CL_ASSERT(cl::impl::IsUTF8(str.begin(), str.end()));
+
+    DoSplitResult curr;
+
+    curr.tok = string_view();
+    curr.str = str;
+    curr.last = false;
+
+    for (;;) {
+        if (!cl::impl::DoSplit(curr, curr.str, split(curr.str))) {
+            return true;
+        }
+
+        CL_ASSERT(cl::impl::IsUTF8(curr.tok.begin(), curr.tok.end()));
+        CL_ASSERT(cl::impl::IsUTF8(curr.str.begin(), curr.str.end()));
+
+        if (!fn(curr.tok)) {
+            return false;
+        }
+        if (curr.last) {
+            return true;
+        }
+    }
+}
+
+} // namespace impl
+
+//==================================================================================================
+//
+//==================================================================================================
+
+namespace impl {
+
+template <typename...> struct AlwaysVoid { using type = void; };
+template <typename... Ts> using Void_t = typename AlwaysVoid<Ts...>::type;
+
+template <typename T, typename /*Enable*/ = void>
+struct IsStreamExtractable
+    : std::false_type
+{
+};
+
+template <typename T>
+struct IsStreamExtractable<T, Void_t< decltype(std::declval<std::istream&>() >> std::declval<T&>()) >>
+    : std::true_type
+{
+};
+
+template <typename T>
+struct RemoveCVRec {
+    using type = std::remove_cv_t<T>;
+};
+
+template <template <typename...> class T, typename... Args>
+struct RemoveCVRec<T<Args...>> {
+    using type = T<typename RemoveCVRec<Args>::type...>;
+};
+
+template <typename T>
+using RemoveCVRec_t = typename RemoveCVRec<T>::type;
+
+template <typename T, typename /*Enable*/ = void>
+struct IsContainerImpl
+    : std::false_type
+{
+};
+
+template <typename T>
+struct IsContainerImpl<T, Void_t< decltype( std::declval<T&>().insert(std::declval<T&>().end(), std::declval<typename T::value_type>()) ) >>
+    : std::true_type
+{
+};
+
+template <typename T>
+struct IsContainer
+    : IsContainerImpl<T>
+{
+};
+
+// Do not handle strings as containers.
+template <typename Elem, typename Traits, typename Alloc>
+struct IsContainer<std::basic_string<Elem, Traits, Alloc>>
+    : std::false_type
+{
+};
+
+template <typename T>
+using IsContainer_t = typename IsContainer<std::decay_t<T>>::type;
+
+template <typename T, typename /*Enable*/ = void>
+struct HasReserve
+    : std::false_type
+{
+};
+
+template <typename T>
+struct HasReserve<T, Void_t< decltype( std::declval<T&>().reserve(std::declval<T&>().capacity()) ) >>
+    : std::true_type
+{
+};
+
+template <typename T, typename /*Enable*/ = void>
+struct HasRangeInsert
+    : std::false_type
+{
+};
+
+template <typename T>
+struct HasRangeInsert<T, Void_t< decltype( std::declval<T&>().insert(std::declval<T&>().end(), std::declval<typename T::value_type const*>(), std::declval<typename T::value_type const*>()) ) >>
+    : std::true_type
+{
+};
+
+template <typename T, typename /*Enable*/ = void>
+struct HasParseList
+    : std::false_type
+{
+};
+
+template <typename T>
+struct HasParseList<T, Void_t< decltype( std::declval<T const&>().ParseList(std::declval<ParseContext const&>(), std::declval<size_t&>()) ) >>
+    : std::true_type
+{
+};
+
+template <typename ParserT>
+bool ParseList(ParserT const& parser, ParseContext const& ctx, size_t& count, std::true_type /*HasParseList*/) {
+    return parser.ParseList(ctx, count);
+}
+
+template <typename ParserT>
+bool ParseList(ParserT const& /*parser*/, ParseContext const& /*ctx*/, size_t& count, std::false_type /*HasParseList*/) {
+    CL_ASSERT(false && "ParseList not supported");
+    count = 0;
+    return false;
+}
+
+template <typename T, typename /*Enable*/ = void>
+struct HasReserveHint
+    : std::false_type
+{
+};
+
+template <typename T>
+struct HasReserveHint<T, Void_t< decltype( std::declval<T const&>().Reserve(std::declval<size_t>()) ) >>
+    : std::true_type
+{
+};
+
+template <typename ParserT>
+void ReserveHint(ParserT const& parser, size_t count, std::true_type /*HasReserveHint*/) {
+    parser.Reserve(count);
+}
+
+template <typename ParserT>
+void ReserveHint(ParserT const& /*parser*/, size_t /*count*/, std::false_type /*HasReserveHint*/) {
+}
+
+template <typename T, typename /*Enable*/ = void>
+struct HasArgSlots
+    : std::false_type
+{
+};
+
+template <typename T>
+struct HasArgSlots<T, Void_t< decltype( std::declval<T const&>().MakeArgSlots(std::declval<size_t>()) ) >>
+    : std::true_type
+{
+};
+
+template <typename ParserT>
+std::unique_ptr<ArgSlots> MakeArgSlots(ParserT const& parser, size_t count, std::true_type /*HasArgSlots*/) {
+    return parser.MakeArgSlots(count);
+}
+
+template <typename ParserT>
+std::unique_ptr<ArgSlots> MakeArgSlots(ParserT const& /*parser*/, size_t /*count*/, std::false_type /*HasArgSlots*/) {
+    return nullptr;
+}
+
+template <typename T, typename /*Enable*/ = void>
+struct HasCompleteArgument
+    : std::false_type
+{
+};
+
+template <typename T>
+struct HasCompleteArgument<T, Void_t< decltype( std::declval<T const&>().CompleteArgument(std::declval<string_view>(), std::declval<std::vector<string_view>&>()) ) >>
+    : std::true_type
+{
+};
+
+template <typename ParserT>
+void CompleteArgument(ParserT const& parser, string_view prefix, std::vector<string_view>& values, std::true_type /*HasCompleteArgument*/) {
+    parser.CompleteArgument(prefix, values);
+}
+
+template <typename ParserT>
+void CompleteArgument(ParserT const& /*parser*/, string_view /*prefix*/, std::vector<string_view>& /*values*/, std::false_type /*HasCompleteArgument*/) {
+}
+
+// Integral types for which comma-separated lists are parsed in bulk.
+template <typename T>
+struct IsListInteger
+    : std::integral_constant<bool, std::is_integral<T>::value
+                                   && !std::is_same<T, bool>::value
+                                   && !std::is_same<T, char>::value
+                                   && !std::is_same<T, wchar_t>::value
+                                   && !std::is_same<T, char16_t>::value
+                                   && !std::is_same<T, char32_t>::value>
+{
+};
+
+#if CL_HAS_FOLD_EXPRESSIONS
+
+template <typename Lhs, typename... Rhs>
+CL_FORCE_INLINE bool IsAnyOf(Lhs const& lhs, Rhs&&... rhs) {
+    return (false || ... || (lhs == std::forward<Rhs>(rhs)));
+}
+
+#else
+
+template <typename Lhs>
+CL_FORCE_INLINE bool IsAnyOf(Lhs const& /*lhs*/) {
+    return false;
+}
+
+template <typename Lhs, typename Rhs1, typename... Rhs>
+CL_FORCE_INLINE bool IsAnyOf(Lhs const& lhs, Rhs1&& rhs1, Rhs&&... rhs) {
+    return (lhs == std::forward<Rhs1>(rhs1))
+        ? true
+        : cl::impl::IsAnyOf(lhs, std::forward<Rhs>(rhs)...);
+}
+
+#endif
+
+inline bool StartsWith(string_view str, string_view prefix) {
+    return str.size() >= prefix.size() && str.substr(0, prefix.size()) == prefix;
+}
+
+inline bool IsWhitespace(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\v' || ch == '\f' || ch == '\r';
+}
+
+template <typename It>
+It SkipWhitespace(It next, It last) {
+    while (next != last && IsWhitespace(*next)) {
+        ++next;
+    }
+
+    return next;
+}
+
+inline string_view TrimWhitespace(string_view str) {
+    while (!str.empty() && IsWhitespace(str[0])) {
+        str.remove_prefix(1);
+    }
+    while (!str.empty() && IsWhitespace(str[str.size() - 1])) {
+        str.remove_suffix(1);
+    }
+
+    return str;
+}
+
+} // namespace impl
+
+//==================================================================================================
+// Parser
+//==================================================================================================
+
+namespace impl {
+
+// Convert the string representation in CTX.ARG into an object of type T.
+// Possibly emits diagnostics on error.
+template <typename T = void, typename /*Enable*/ = void>
+struct ConvertTo {
+    static_assert(cl::impl::IsStreamExtractable<T>::value,
+        "The default implementation of 'ConvertTo<T>' requires the type 'T' is stream-extractable");
+
+    template <typename Stream = std::istringstream>
+    bool operator()(ParseContext const& ctx, T& value) const {
+        Stream stream{std::string(ctx.arg)};
+        stream >> value;
+        // This function should fail if there are any characters left in the
+        // input stream, but there are cases for which all characters have been
+        // extracted and the eofbit is not set yet.
+        return !stream.fail() && (stream.rdbuf()->in_avail() == 0);
+    }
+};
+
+template <>
+struct ConvertTo<bool> {
+    bool operator()(ParseContext const& ctx, bool& value) const {
+        if (cl::impl::IsAnyOf(ctx.arg, string_view{}, "1", "y", "yes", "Yes", "on", "On", "true", "True")) {
+            value = true;
+        } else if (cl::impl::IsAnyOf(ctx.arg, "0", "n", "no", "No", "off", "Off", "false", "False")) {
+            value = false;
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+};
+
+enum class ParseNumberStatus {
+    success,
+    syntax_error,
+    overflow,
+};
+
+struct ParseNumberResult {
+    char const* ptr;
+    ParseNumberStatus ec;
+
+    // Test for successful conversion.
+    explicit operator bool() const {
+        return ec == ParseNumberStatus::success;
+    }
+};
+
+// Returns the decimal value for the given hexadecimal character.
+// Returns UINT8_MAX, if the given character is not a hexadecimal character.
+inline uint8_t HexDigitValue(char ch)
+{
+    enum : uint8_t { N = UINT8_MAX };
+    static constexpr uint8_t kMap[256] = {
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, N, N, N, N, N, N,
+        N, 10,11,12,13,14,15,N, N, N, N, N, N, N, N, N,
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+        N, 10,11,12,13,14,15,N, N, N, N, N, N, N, N, N,
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    };
+
+    return kMap[static_cast<uint8_t>(ch)];
+}
+
+inline bool IsHexDigit(char ch) {
+    return HexDigitValue(ch) != UINT8_MAX;
+}
+
+inline ParseNumberResult ParseU64(char const* next, char const* last, uint64_t& value) {
+    CL_ASSERT(next != last);
+
+    uint64_t max_pre_multiply;
+    uint32_t base;
+
+    // Determine base and optionally skip prefix.
+    if (*next == '0') {
+        ++next;
+        if (next == last) { // literal "0"
+            value = 0;
+            return {next, ParseNumberStatus::success};
+        }
+
+        switch (*next) {
+        case 'x':
+        case 'X':
+            ++next;
+            max_pre_multiply = UINT64_MAX / 16;
+            base = 16;
+            break;
+        case 'b':
+        case 'B':
+            ++next;
+            max_pre_multiply = UINT64_MAX / 2;
+            base = 2;
+            break;
+        case 'o':
+        case 'O':
+            ++next;
+            // fall through
+        default:
+            max_pre_multiply = UINT64_MAX / 8;
+            base = 8;
+            break;
+        }
+    }
+    else
+    {
+        max_pre_multiply = UINT64_MAX / 10;
+        base = 10;
+    }
+
+    uint64_t v = 0;
+    for (;;) {
+        if (next == last) {
+            break;
+        }
+        uint32_t const d = HexDigitValue(*next);
+        if (d >= base) {
+            break;
+        }
+        if (v > max_pre_multiply || d > UINT64_MAX - base * v) {
+            return {next, ParseNumberStatus::overflow};
+        }
+        v = base * v + d;
+        ++next;
+    }
+
+    value = v;
+    return {next, ParseNumberStatus::success};
+}
+
+inline ParseNumberResult StrToU64(char const* next, char const* last, uint64_t& value) {
+    next = SkipWhitespace(next, last);
+
+    if (next == last) {
+        return {next, ParseNumberStatus::syntax_error};
+    }
+
+    // Skip optional '+' sign.
+    // A leading minus sign is considered invalid while parsing *unsigned* integers
+    // and will result in a syntax_error in ParseU64.
+    if (*next == '+') {
+        ++next;
+        if (next == last) {
+            return {next, ParseNumberStatus::syntax_error};
+        }
+    }
+
+    return ParseU64(next, last, value);
+}
+
+inline ParseNumberResult StrToI64(char const* next, char const* last, int64_t& value) {
+    next = SkipWhitespace(next, last);
+
+    if (next == last) {
+        return {next, ParseNumberStatus::syntax_error};
+    }
+
+    bool const is_negative = (*next == '-');
+
+    // Skip optional '+' or '-' sign.
+    if (is_negative || *next == '+') {
+        ++next;
+        if (next == last) {
+            return {next, ParseNumberStatus::syntax_error};
+        }
+    }
+
+    uint64_t v;
+    auto const res = ParseU64(next, last, v);
+    if (res) {
+        // The number fits into an uint64_t. Check if it fits into an int64_t, too.
+        // Assuming 2's complement.
+
+        constexpr uint64_t Limit = 9223372036854775808ull; // -INT64_MIN
+
+        if (is_negative && v == Limit) {
+            value = INT64_MIN;
+        } else if (v >= Limit) {
+            return {next, ParseNumberStatus::overflow};
+        } else {
+            value = static_cast<int64_t>(is_negative ? (0 - v) : v);
+        }
+    }
+
+    return res;
+}
+
+struct ConvertToInt {
+    template <typename T>
+    bool operator()(ParseContext const& ctx, T& value) const {
+        auto const next = ctx.arg.data();
+        auto const last = ctx.arg.data() + ctx.arg.size();
+
+        int64_t v = 0;
+        auto const res = StrToI64(next, last, v);
+
+        if (res && res.ptr == last && v >= (std::numeric_limits<T>::min)() && v <= (std::numeric_limits<T>::max)()) {
+            value = static_cast<T>(v);
+            return true;
+        }
+
+        return false;
+    }
+};
+
+struct ConvertToUnsignedInt {
+    template <typename T>
+    bool operator()(ParseContext const& ctx, T& value) const {
+        auto const next = ctx.arg.data();
+        auto const last = ctx.arg.data() + ctx.arg.size();
+
+        uint64_t v = 0;
+        auto const res = StrToU64(next, last, v);
+
+        if (res && res.ptr == last && v <= (std::numeric_limits<T>::max)()) {
+            value = static_cast<T>(v);
+            return true;
+        }
+
+        return false;
+    }
+};
+
+template <> struct ConvertTo< signed char        > : cl::impl::ConvertToInt {};
+template <> struct ConvertTo< signed short       > : cl::impl::ConvertToInt {};
+template <> struct ConvertTo< signed int         > : cl::impl::ConvertToInt {};
+template <> struct ConvertTo< signed long        > : cl::impl::ConvertToInt {};
+template <> struct ConvertTo< signed long long   > : cl::impl::ConvertToInt {};
+template <> struct ConvertTo< unsigned char      > : cl::impl::ConvertToUnsignedInt {};
+template <> struct ConvertTo< unsigned short     > : cl::impl::ConvertToUnsignedInt {};
+template <> struct ConvertTo< unsigned int       > : cl::impl::ConvertToUnsignedInt {};
+template <> struct ConvertTo< unsigned long      > : cl::impl::ConvertToUnsignedInt {};
+template <> struct ConvertTo< unsigned long long > : cl::impl::ConvertToUnsignedInt {};
+
+// Returns a pointer to the first character in [NEXT, LAST) which is not a
+// decimal digit, or LAST.
+inline char const* SkipDigits(char const* next, char const* last) {
+#if CL_HAS_SSE2
+    for (; last - next >= 16; next += 16) {
+        __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(next));
+        __m128i const lt = _mm_cmplt_epi8(v, _mm_set1_epi8('0'));
+        __m128i const gt = _mm_cmpgt_epi8(v, _mm_set1_epi8('9'));
+        if (_mm_movemask_epi8(_mm_or_si128(lt, gt)) != 0) {
+            break;
+        }
+    }
+#elif CL_HAS_NEON
+    for (; last - next >= 16; next += 16) {
+        uint8x16_t const v = vld1q_u8(reinterpret_cast<uint8_t const*>(next));
+        if (vmaxvq_u8(vsubq_u8(v, vdupq_n_u8('0'))) > 9) {
+            break;
+        }
+    }
+#endif
+
+    for (; last - next >= 8; next += 8) {
+        uint64_t v;
+        std::memcpy(&v, next, 8);
+        if (((v & 0xF0F0F0F0F0F0F0F0ull) | (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) != 0x3333333333333333ull) {
+            break;
+        }
+    }
+
+    while (next != last && static_cast<unsigned>(*next - '0') < 10) {
+        ++next;
+    }
+
+    return next;
+}
+
+#if CL_HAS_LITTLE_ENDIAN
+// Returns the value of the 8 decimal digits starting at P.
+inline uint64_t Parse8Digits(char const* p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    v -= 0x3030303030303030ull;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+         (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+    return v;
+}
+#endif
+
+template <typename T>
+bool ListIntegerFromU64(uint64_t v, bool is_negative, T& value, std::true_type /*is_signed*/) {
+    if (is_negative) {
+        // -(min + 1) is representable in T.
+        if (v > static_cast<uint64_t>(-((std::numeric_limits<T>::min)() + 1)) + 1) {
+            return false;
+        }
+        value = (v == 0) ? T(0) : static_cast<T>(-static_cast<T>(v - 1) - 1);
+    } else {
+        if (v > static_cast<uint64_t>((std::numeric_limits<T>::max)())) {
+            return false;
+        }
+        value = static_cast<T>(v);
+    }
+
+    return true;
+}
+
+template <typename T>
+bool ListIntegerFromU64(uint64_t v, bool /*is_negative*/, T& value, std::false_type /*is_signed*/) {
+    if (v > static_cast<uint64_t>((std::numeric_limits<T>::max)())) {
+        return false;
+    }
+    value = static_cast<T>(v);
+
+    return true;
+}
+
+// Fast path for parsing a single element of a comma-separated list of integers.
+// Handles decimal numbers with an optional '-' sign (for signed types) which
+// are followed by a ',' or LAST.
+// Returns a pointer past the number, or null if the element must be parsed
+// using ConvertTo (e.g. because of a prefix, or if the number is out of range).
+template <typename T>
+char const* ParseListInteger(char const* next, char const* last, T& value) {
+    bool const is_negative = std::is_signed<T>::value && next != last && *next == '-';
+    if (is_negative) {
+        ++next;
+    }
+
+    char const* const digits_end = cl::impl::SkipDigits(next, last);
+    auto const num_digits = digits_end - next;
+
+    // At most 19 digits, so that the value fits into an uint64_t.
+    // A leading '0' denotes an octal number.
+    if (num_digits == 0 || num_digits > 19 || (*next == '0' && num_digits > 1)) {
+        return nullptr;
+    }
+    if (digits_end != last && *digits_end != ',') {
+        return nullptr;
+    }
+
+    uint64_t v = 0;
+#if CL_HAS_LITTLE_ENDIAN
+    for (; digits_end - next >= 8; next += 8) {
+        v = v * 100000000 + cl::impl::Parse8Digits(next);
+    }
+#endif
+    for (; next != digits_end; ++next) {
+        v = v * 10 + static_cast<uint64_t>(*next - '0');
+    }
+
+    if (!cl::impl::ListIntegerFromU64(v, is_negative, value, std::is_signed<T>{})) {
+        return nullptr;
+    }
+
+    return digits_end;
+}
+
+// Returns a pointer to the first ',' in [NEXT, LAST), or LAST.
+inline char const* FindComma(char const* next, char const* last) {
+    if (next == last) {
+        return last;
+    }
+
+    auto const p = static_cast<char const*>(std::memchr(next, ',', static_cast<size_t>(last - next)));
+    return p != nullptr ? p : last;
+}
+
+#if CL_HAS_STD_CHARCONV
+template <typename T>
+inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, T& value) {
+    std::chars_format fmt;
+
+    // std::from_chars does not automatically determine the base (and does not skip any prefixes).
+    bool const is_hex = (last - next >= 2) && (next[0] == '0') && (next[1] == 'x' || next[1] == 'X');
+    if (is_hex) {
+        fmt = std::chars_format::hex;
+        next += 2; // Skip prefix ('0x' or '0X')
+    } else {
+        fmt = std::chars_format::general;
+    }
+
+    if (next == last) {
+        return {next, ParseNumberStatus::syntax_error};
+    }
+
+    auto const res = std::from_chars(next, last, value, fmt);
+    switch (res.ec) {
+    case std::errc{}:
+        return {res.ptr, ParseNumberStatus::success};
+    case std::errc::result_out_of_range:
+        // XXX:
+        // Is result_out_of_range actually ever returned from from_chars for floating-point?!?!
+#if 1
+        return {res.ptr, ParseNumberStatus::success};
+#else
+        return {res.ptr, ParseNumberStatus::overflow};
+#endif
+    default:
+        return {res.ptr, ParseNumberStatus::syntax_error};
+    }
+}
+
+//template <typename T>
+//inline ParseNumberResult StrToFloatingPoint(string_view sv, T& value) {
+//    return cl::impl::StrToFloatingPoint(sv.data(), sv.data() + sv.size(), value);
+//}
+#else // ^^^ CL_HAS_STD_CHARCONV ^^^
+template <typename T>
+struct FloatFastPath;
+
+template <>
+struct FloatFastPath<float> {
+    static constexpr uint64_t kMaxMantissa = uint64_t{1} << 24;
+    static constexpr int kMaxExponent = 10;
+};
+
+template <>
+struct FloatFastPath<double> {
+    static constexpr uint64_t kMaxMantissa = uint64_t{1} << 53;
+    static constexpr int kMaxExponent = 22;
+};
+
+template <>
+struct FloatFastPath<long double> {
+    // Only integers are exact in the fast path, since the powers of 10 are
+    // computed in (at least) double precision.
+    static constexpr uint64_t kMaxMantissa = uint64_t{1} << 53;
+    static constexpr int kMaxExponent = 0;
+};
+
+// Converts simple decimal numbers, like "-1.25e3", which can be computed
+// exactly using a single floating-point multiplication or division, such
+// that the result is correctly rounded (Clinger's fast path).
+// Returns false if the number in [NEXT, LAST) is not of this form.
+template <typename T>
+bool StrToFloatingPointFast(char const* next, char const* last, char const*& ptr, T& value) {
+    static constexpr double kPow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+
+    bool const is_negative = (next != last && *next == '-');
+    if (next != last && (*next == '-' || *next == '+')) {
+        ++next;
+    }
+
+    uint64_t m = 0;
+    int num_digits = 0; // Number of significant digits
+    int exponent = 0;
+    bool any_digits = false;
+
+    for (; next != last && static_cast<unsigned>(*next - '0') <= 9; ++next) {
+        any_digits = true;
+        if (m != 0 || *next != '0') {
+            m = 10 * m + static_cast<unsigned>(*next - '0');
+            ++num_digits;
+        }
+        if (num_digits > 19) {
+            return false;
+        }
+    }
+
+    if (next != last && *next == '.') {
+        ++next;
+        for (; next != last && static_cast<unsigned>(*next - '0') <= 9; ++next) {
+            any_digits = true;
+            if (m != 0 || *next != '0') {
+                m = 10 * m + static_cast<unsigned>(*next - '0');
+                ++num_digits;
+            }
+            if (num_digits > 19) {
+                return false;
+            }
+            --exponent;
+        }
+    }
+
+    if (!any_digits) { // "inf", "nan", "." etc.
+        return false;
+    }
+
+    if (next != last && (*next == 'e' || *next == 'E')) {
+        auto p = next + 1;
+
+        bool const exp_negative = (p != last && *p == '-');
+        if (p != last && (*p == '-' || *p == '+')) {
+            ++p;
+        }
+
+        if (p != last && static_cast<unsigned>(*p - '0') <= 9) {
+            int e = 0;
+            for (; p != last && static_cast<unsigned>(*p - '0') <= 9; ++p) {
+                if (e > 10000) {
+                    return false;
+                }
+                e = 10 * e + (*p - '0');
+            }
+            exponent += exp_negative ? -e : e;
+            next = p;
+        }
+    }
+
+    if (next != last && (*next == 'x' || *next == 'X' || *next == 'p' || *next == 'P')) { // hexadecimal
+        return false;
+    }
+
+    constexpr auto kMaxMantissa = FloatFastPath<T>::kMaxMantissa;
+    constexpr auto kMaxExponent = FloatFastPath<T>::kMaxExponent;
+
+    if (m > kMaxMantissa) {
+        return false;
+    }
+
+    T v;
+    if (m == 0) {
+        v = T(0);
+    } else if (exponent >= 0 && exponent <= kMaxExponent) {
+        v = static_cast<T>(m) * static_cast<T>(kPow10[exponent]);
+    } else if (exponent < 0 && exponent >= -kMaxExponent) {
+        v = static_cast<T>(m) / static_cast<T>(kPow10[-exponent]);
+    } else if (exponent > kMaxExponent && exponent <= kMaxExponent + 19) {
+        // The mantissa might still be exact after shifting some of the
+        // exponent into it, e.g. "1e25" = "1000e22".
+        for (; exponent > kMaxExponent; --exponent) {
+            m *= 10;
+            if (m > kMaxMantissa) {
+                return false;
+            }
+        }
+        v = static_cast<T>(m) * static_cast<T>(kPow10[exponent]);
+    } else {
+        return false;
+    }
+
+    ptr = next;
+    value = is_negative ? -v : v;
+    return true;
+}
+
+#if CL_HAS_STRTOD_L
+// Returns the "C" locale, for strtod_l & co.
+#if defined(_MSC_VER)
+inline _locale_t CLocale() {
+    static _locale_t const loc = _create_locale(LC_NUMERIC, "C");
+    return loc;
+}
+#else
+inline locale_t CLocale() {
+    static locale_t const loc = newlocale(LC_NUMERIC_MASK, "C", locale_t{});
+    return loc;
+}
+#endif
+#else
+// The maximum length of the decimal point of a locale.
+constexpr size_t kMaxDecimalPoint = 8;
+
+// Stores the decimal point of the current locale, as used by strtod & co., in
+// POINT and returns its length. Unlike localeconv(), snprintf is thread-safe.
+inline size_t LocaleDecimalPoint(char (&point)[kMaxDecimalPoint]) {
+    char buf[32];
+    int const n = std::snprintf(buf, sizeof(buf), "%.1f", 0.5);
+    if (n < 3 || static_cast<size_t>(n - 2) > kMaxDecimalPoint || buf[0] != '0' || buf[n - 1] != '5') {
+        point[0] = '.';
+        return 1;
+    }
+
+    auto const len = static_cast<size_t>(n - 2);
+    std::memcpy(point, buf + 1, len);
+    return len;
+}
+
+// Returns whether CH may be part of a floating-point number in the "C" locale.
+inline bool IsFloatingPointChar(char ch) {
+    return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+           ch == '+' || ch == '-' || ch == '.' || ch == '(' || ch == ')' || ch == '_' || (ch == ' ' || (ch >= '\t' && ch <= '\r'));
+}
+#endif
+
+template <typename T, typename Fn>
+inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, T& value, Fn fn) {
+    if (next == last) {
+        return {next, ParseNumberStatus::syntax_error};
+    }
+
+    char const* ptr = nullptr;
+    if (cl::impl::StrToFloatingPointFast(next, last, ptr, value)) {
+        return {ptr, ParseNumberStatus::success};
+    }
+
+    // Fall back to strtod_l & co., using the "C" locale, or to strtod & co.
+    // These require null-terminated strings, so copy the string into a local
+    // buffer - if possible.
+#if CL_HAS_STRTOD_L
+    constexpr size_t kExtra = 0;
+#else
+    constexpr size_t kExtra = cl::impl::kMaxDecimalPoint; // See below
+#endif
+    char local_buffer[128 + kExtra];
+    std::string heap_buffer;
+
+    auto const len = static_cast<size_t>(last - next);
+
+    char* str;
+    if (len < sizeof(local_buffer) - kExtra) {
+        str = local_buffer;
+    } else {
+        heap_buffer.resize(len + kExtra);
+        str = &heap_buffer[0];
+    }
+    std::memcpy(str, next, len);
+    str[len] = '\0';
+
+#if !CL_HAS_STRTOD_L
+    // strtod & co. use the current locale. Only pass the characters which
+    // may be part of a number in the "C" locale, so that e.g. "1,5" is not
+    // accepted in a locale with a ',' as the decimal point. And replace the
+    // '.' with the decimal point of the current locale.
+    size_t num_chars = 0;
+    while (num_chars < len && cl::impl::IsFloatingPointChar(str[num_chars])) {
+        ++num_chars;
+    }
+    str[num_chars] = '\0';
+
+    size_t point_pos = SIZE_MAX;
+    size_t point_len = 1;
+    if (auto const p = static_cast<char*>(std::memchr(str, '.', num_chars))) {
+        char point[cl::impl::kMaxDecimalPoint];
+        point_len = cl::impl::LocaleDecimalPoint(point);
+        point_pos = static_cast<size_t>(p - str);
+        if (point_len != 1 || point[0] != '.') {
+            std::memmove(p + point_len, p + 1, num_chars - point_pos); // Including the '\0'
+            std::memcpy(p, point, point_len);
+        }
+    }
+#endif
+
+    char const* begin = str;
+    char* end = nullptr;
+
+#if 0
+    // Seems that std::from_chars doesn't return std::errc::result_out_of_range even
+    // if finite non-zero numbers round to infinity or 0.0.
+    // So we ignore errno here... :-/
+    auto const val = fn(begin, &end);
+    next += end - begin;
+#else
+    int& ec = errno;
+
+    auto const ec0 = std::exchange(ec, 0);
+    auto const val = fn(begin, &end);
+    auto const ec1 = std::exchange(ec, ec0);
+
+    auto num_parsed = static_cast<size_t>(end - begin);
+#if !CL_HAS_STRTOD_L
+    if (point_pos != SIZE_MAX && num_parsed > point_pos) {
+        num_parsed -= point_len - 1;
+    }
+#endif
+    next += num_parsed;
+
+    if (ec1 == ERANGE) {
+        return {next, ParseNumberStatus::overflow};
+    }
+#endif
+
+    value = val;
+    return {next, ParseNumberStatus::success};
+}
+
+#if CL_HAS_STRTOD_L && defined(_MSC_VER)
+inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, float& value) {
+    return cl::impl::StrToFloatingPoint(next, last, value, [](char const* p, char** end) { return _strtof_l(p, end, cl::impl::CLocale()); });
+}
+
+inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, double& value) {
+    return cl::impl::StrToFloatingPoint(next, last, value, [](char const* p, char** end) { return _strtod_l(p, end, cl::impl::CLocale()); });
+}
+
+inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, long double& value) {
+    return cl::impl::StrToFloatingPoint(next, last, value, [](char const* p, char** end) { return _strtold_l(p, end, cl::impl::CLocale()); });
+}
+#elif CL_HAS_STRTOD_L
+inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, float& value) {
+    return cl::impl::StrToFloatingPoint(next, last, value, [](char const* p, char** end) { return strtof_l(p, end, cl::impl::CLocale()); });
+}
+
+inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, double& value) {
+    return cl::impl::StrToFloatingPoint(next, last, value, [](char const* p, char** end) { return strtod_l(p, end, cl::impl::CLocale()); });
+}
+
+inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, long double& value) {
+    return cl::impl::StrToFloatingPoint(next, last, value, [](char const* p, char** end) { return strtold_l(p, end, cl::impl::CLocale()); });
+}
+#else
+inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, float& value) {
+    return cl::impl::StrToFloatingPoint(next, last, value, [](char const* p, char** end) { return std::strtof(p, end); });
+}
+
+inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, double& value) {
+    return cl::impl::StrToFloatingPoint(next, last, value, [](char const* p, char** end) { return std::strtod(p, end); });
+}
+
+inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, long double& value) {
+    return cl::impl::StrToFloatingPoint(next, last, value, [](char const* p, char** end) { return std::strtold(p, end); });
+}
+#endif
+
+//template <typename T>
+//inline ParseNumberResult StrToFloatingPoint(string_view sv, T& value) {
+//    return cl::impl::StrToFloatingPoint(sv.data(), sv.data() + sv.size(), value);
+//}
+#endif // ^^^ !CL_HAS_STD_CHARCONV ^^^
+
+struct ConvertToFloatingPoint {
+    template <typename T>
+    bool operator()(ParseContext const& ctx, T& value) {
+        auto const next = ctx.arg.data();
+        auto const last = ctx.arg.data() + ctx.arg.size();
+
+        T v = 0;
+        auto const res = StrToFloatingPoint(next, last, v);
+
+        if (res && res.ptr == last) {
+            value = v;
+            return true;
+        }
+
+        return false;
+    }
+};
+
+template <> struct ConvertTo< float       > : cl::impl::ConvertToFloatingPoint {};
+template <> struct ConvertTo< double      > : cl::impl::ConvertToFloatingPoint {};
+template <> struct ConvertTo< long double > : cl::impl::ConvertToFloatingPoint {};
+
+// Single characters.
+// The argument must consist of a single code point, which must be
+// representable as a single code unit of type T.
+struct ConvertToCharacter {
+    template <typename T>
+    bool operator()(ParseContext const& ctx, T& value) const {
+        if (ctx.arg.empty()) {
+            return false;
+        }
+
+        auto const last = ctx.arg.data() + ctx.arg.size();
+
+        char32_t U = 0;
+        auto const next = cl::impl::DecodeUTF8Sequence(ctx.arg.data(), last, U);
+
+        // NB: ctx.arg is well-formed UTF-8.
+        if (next != last || static_cast<uint32_t>(U) > static_cast<uint32_t>((std::numeric_limits<T>::max)())) {
+            return false;
+        }
+
+        if (sizeof(T) == 1 && U >= 0x80) { // Not a single code unit in UTF-8
+            return false;
+        }
+
+        value = static_cast<T>(U);
+        return true;
+    }
+};
+
+template <> struct ConvertTo< char     > : cl::impl::ConvertToCharacter {};
+template <> struct ConvertTo< char16_t > : cl::impl::ConvertToCharacter {};
+template <> struct ConvertTo< char32_t > : cl::impl::ConvertToCharacter {};
+template <> struct ConvertTo< wchar_t  > : cl::impl::ConvertToCharacter {};
+
+template <typename Traits, typename Alloc>
+struct ConvertTo<std::basic_string<char, Traits, Alloc>> {
+    bool operator()(ParseContext const& ctx, std::basic_string<char, Traits, Alloc>& value) const {
+        // We know that ctx.arg is well-formed UTF-8 already.
+        // No need to re-check here.
+        value.assign(ctx.arg.begin(), ctx.arg.end());
+        return true;
+    }
+};
+
+template <typename Traits, typename Alloc>
+struct ConvertTo<std::basic_string<char16_t, Traits, Alloc>> {
+    bool operator()(ParseContext const& ctx, std::basic_string<char16_t, Traits, Alloc>& value) const {
+        value.clear();
+
+        // We know that ctx.arg is well-formed UTF-8 already.
+        cl::impl::ForEachUTF8EncodedCodepoint(ctx.arg.begin(), ctx.arg.end(), [&](char32_t U) {
+            CL_ASSERT(cl::impl::IsValidCodepoint(U));
+            cl::impl::EncodeUTF16(U, [&](char16_t code_unit) { value.push_back(code_unit); });
+            return true;
+        });
+
+        return true;
+    }
+};
+
+template <typename Traits, typename Alloc>
+struct ConvertTo<std::basic_string<char32_t, Traits, Alloc>> {
+    bool operator()(ParseContext const& ctx, std::basic_string<char32_t, Traits, Alloc>& value) const {
+        value.clear();
+
+        // We know that ctx.arg is well-formed UTF-8 already.
+        cl::impl::ForEachUTF8EncodedCodepoint(ctx.arg.begin(), ctx.arg.end(), [&](char32_t U) {
+            CL_ASSERT(cl::impl::IsValidCodepoint(U));
+            value.push_back(U);
+            return true;
+        });
+
+        return true;
+    }
+};
+
+template <typename Traits, typename Alloc>
+struct ConvertTo<std::basic_string<wchar_t, Traits, Alloc>> {
+    bool operator()(ParseContext const& ctx, std::basic_string<wchar_t, Traits, Alloc>& value) const {
+        value.clear();
+
+        // We know that ctx.arg is well-formed UTF-8 already.
+        cl::impl::ForEachUTF8EncodedCodepoint(ctx.arg.begin(), ctx.arg.end(), [&](char32_t U) {
+            CL_ASSERT(cl::impl::IsValidCodepoint(U));
+#if _WIN32
+            cl::impl::EncodeUTF16(U, [&](char16_t code_unit) { value.push_back(static_cast<wchar_t>(code_unit)); });
+#else
+            value.push_back(static_cast<wchar_t>(U));
+#endif
+            return true;
+        });
+
+        return true;
+    }
+};
+
+// Stores a view of the argument instead of a copy. See Cmdline::PersistArg.
+template <>
+struct ConvertTo<string_view> {
+    bool operator()(ParseContext const& ctx, string_view& value) const;
+};
+
+template <>
+struct ConvertTo<void> {
+    template <typename T>
+    bool operator()(ParseContext const& ctx, T& value) const {
+        return ConvertTo<T>{}(ctx, value);
+    }
+};
+
+} // namespace impl
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace check {
+
+// Returns a function object which checks whether a given value is in the range [lower, upper].
+template <typename T, typename U>
+auto InRange(T lower, U upper) {
+    return [=](ParseContext const& /*ctx*/, auto const& value) {
+        return !(value < lower) && !(upper < value);
+    };
+}
+
+// Returns a function object which checks whether a given value is > lower.
+template <typename T>
+auto GreaterThan(T lower) {
+    return [=](ParseContext const& /*ctx*/, auto const& value) {
+        return lower < value;
+    };
+}
+
+// Returns a function object which checks whether a given value is >= lower.
+template <typename T>
+auto GreaterEqual(T lower) {
+    return [=](ParseContext const& /*ctx*/, auto const& value) {
+        return !(value < lower); // value >= lower
+    };
+}
+
+// Returns a function object which checks whether a given value is < upper.
+template <typename T>
+auto LessThan(T upper) {
+    return [=](ParseContext const& /*ctx*/, auto const& value) {
+        return value < upper;
+    };
+}
+
+// Returns a function object which checks whether a given value is <= upper.
+template <typename T>
+auto LessEqual(T upper) {
+    return [=](ParseContext const& /*ctx*/, auto const& value) {
+        return !(upper < value); // upper >= value
+    };
+}
+
+} // namespace check
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+#if !CL_HAS_FOLD_EXPRESSIONS
+namespace impl {
+
+// Calls f(CTX, VALUE) for all f in FUNCS (in order) until the first f returns false.
+// Returns true iff all f return true.
+template <typename T, typename... Funcs>
+bool ApplyFuncs(ParseContext const& ctx_, T& value_, Funcs&&... funcs) {
+    static_cast<void>(ctx_);   // may be unused if funcs is empty
+    static_cast<void>(value_); // may be unused if funcs is empty
+
+    bool res = true;
+    bool const unused[] = {(res = res && funcs(ctx_, value_))..., false};
+    static_cast<void>(unused);
+    return res;
+}
+
+} // namespace impl
+#endif
+
+// Default parser for scalar types.
+// Uses an instance of Parser<> to convert the string.
+template <typename T, typename... Predicates>
+auto Assign(T& target, Predicates&&... preds) {
+    static_assert(!std::is_const<T>::value,
+        "Assign() requires mutable lvalue-references");
+    static_assert(std::is_default_constructible<T>::value,
+        "Assign() requires default-constructible types");
+    static_assert(std::is_move_assignable<T>::value,
+        "Assign() requires move-assignable types");
+
+    return [=, &target](ParseContext const& ctx) {
+        // Parse into a local variable so that target is not assigned if any of the predicates returns false.
+        T temp;
+#if CL_HAS_FOLD_EXPRESSIONS
+        if ((cl::impl::ConvertTo<>{}(ctx, temp) && ... && preds(ctx, temp))) {
+#else
+        if (cl::impl::ApplyFuncs(ctx, temp, cl::impl::ConvertTo<>{}, preds...)) {
+#endif
+            target = std::move(temp);
+            return true;
+        }
+        return false;
+    };
+}
+
+namespace impl {
+
+// Reserves space for COUNT more elements. Grows geometrically, so that
+// repeated calls take amortized constant time.
+template <typename T>
+void ReserveFor(T& container, size_t count, std::true_type /*HasReserve*/) {
+    if (container.capacity() - container.size() < count) {
+        size_t const n = container.size() + count;
+        container.reserve(n < 2 * container.capacity() ? 2 * container.capacity() : n);
+    }
+}
+
+template <typename T>
+void ReserveFor(T& /*container*/, size_t /*count*/, std::false_type /*HasReserve*/) {
+}
+
+template <typename T, typename V>
+void AppendRange(T& container, V const* first, V const* last, std::true_type /*HasRangeInsert*/) {
+    container.insert(container.end(), first, last);
+}
+
+template <typename T, typename V>
+void AppendRange(T& container, V const* first, V const* last, std::false_type /*HasRangeInsert*/) {
+    for (; first != last; ++first) {
+        container.insert(container.end(), *first);
+    }
+}
+
+// The parser returned by Append().
+template <typename T, typename... Predicates>
+class AppendParser {
+    using V = cl::impl::RemoveCVRec_t<typename T::value_type>;
+
+    T* container_;
+    std::tuple<Predicates...> preds_;
+
+public:
+    template <typename... Args>
+    explicit AppendParser(T& container, Args&&... preds)
+        : container_(&container)
+        , preds_(std::forward<Args>(preds)...)
+    {
+    }
+
+    bool operator()(ParseContext const& ctx) const {
+        V temp;
+        if (Convert(ctx, temp, std::index_sequence_for<Predicates...>{})) {
+            container_->insert(container_->end(), std::move(temp));
+            return true;
+        }
+        return false;
+    }
+
+    // Reserves space for COUNT more elements, if the container supports it.
+    void Reserve(size_t count) const {
+        cl::impl::ReserveFor(*container_, count, cl::impl::HasReserve<T>{});
+    }
+
+    // Converts COUNT values independently of each other, and appends them in
+    // the order of the slots. The predicates might be called concurrently.
+    std::unique_ptr<cl::impl::ArgSlots> MakeArgSlots(size_t count) const {
+        return std::unique_ptr<cl::impl::ArgSlots>(new Slots(*this, count));
+    }
+
+    // Parses a comma-separated list of integers at once.
+    // Plain decimal numbers are parsed here, all other elements are passed to
+    // ConvertTo. The container is reserved once and the values are appended
+    // in batches.
+    template <typename U = V, std::enable_if_t<cl::impl::IsListInteger<U>::value, int> = 0>
+    bool ParseList(ParseContext const& ctx, size_t& count) const {
+        char const* next = ctx.arg.data();
+        char const* const last = ctx.arg.data() + ctx.arg.size();
+
+        size_t num_elements = 1;
+        for (char const* p = next; (p = cl::impl::FindComma(p, last)) != last; ++p) {
+            ++num_elements;
+        }
+        cl::impl::ReserveFor(*container_, num_elements, cl::impl::HasReserve<T>{});
+
+        enum { kBatchSize = 64 };
+        V batch[kBatchSize];
+        size_t batch_size = 0;
+
+        count = 0;
+        auto const flush = [&] {
+            cl::impl::AppendRange(*container_, batch, batch + batch_size, cl::impl::HasRangeInsert<T>{});
+            count += batch_size;
+            batch_size = 0;
+        };
+
+        ParseContext elem = ctx;
+        for (;;) {
+            V value;
+            char const* end = cl::impl::ParseListInteger(next, last, value);
+            if (end == nullptr) {
+                end = cl::impl::FindComma(next, last);
+                elem.arg = string_view(next, static_cast<size_t>(end - next));
+                if (!cl::impl::ConvertTo<V>{}(elem, value)) {
+                    flush();
+                    return false;
+                }
+            }
+
+            if (sizeof...(Predicates) != 0) {
+                elem.arg = string_view(next, static_cast<size_t>(end - next));
+                if (!Check(elem, value, std::index_sequence_for<Predicates...>{})) {
+                    flush();
+                    return false;
+                }
+            }
+
+            batch[batch_size++] = value;
+            if (batch_size == kBatchSize) {
+                flush();
+            }
+
+            if (end == last) {
+                break;
+            }
+            next = end + 1;
+        }
+
+        flush();
+        return true;
+    }
+
+private:
+    class Slots final : public cl::impl::ArgSlots {
+        AppendParser const& parser_;
+        std::unique_ptr<V[]> values_; // Not a std::vector, which might be a proxy (std::vector<bool>)
+
+    public:
+        explicit Slots(AppendParser const& parser, size_t count)
+            : parser_(parser)
+            , values_(new V[count]())
+        {
+        }
+
+        bool Convert(size_t i, ParseContext const& ctx) override {
+            return parser_.Convert(ctx, values_[i], std::index_sequence_for<Predicates...>{});
+        }
+
+        void Store(size_t i) override {
+            parser_.container_->insert(parser_.container_->end(), std::move(values_[i]));
+        }
+    };
+
+    template <size_t... I>
+    bool Convert(ParseContext const& ctx, V& value, std::index_sequence<I...>) const {
+#if CL_HAS_FOLD_EXPRESSIONS
+        return (cl::impl::ConvertTo<>{}(ctx, value) && ... && std::get<I>(preds_)(ctx, value));
+#else
+        return cl::impl::ApplyFuncs(ctx, value, cl::impl::ConvertTo<>{}, std::get<I>(preds_)...);
+#endif
+    }
+
+    template <size_t... I>
+    bool Check(ParseContext const& ctx, V& value, std::index_sequence<I...>) const {
+#if CL_HAS_FOLD_EXPRESSIONS
+        return (true && ... && std::get<I>(preds_)(ctx, value));
+#else
+        return cl::impl::ApplyFuncs(ctx, value, std::get<I>(preds_)...);
+#endif
+    }
+};
+
+} // namespace impl
+
+// Default parser for list types.
+// Uses an instance of Parser<> to convert the string and then inserts the
+// converted value into the container.
+// Predicates apply to the currently parsed value, not the whole list.
+// Comma-separated lists of integers are parsed in bulk.
+template <typename T, typename... Predicates>
+auto Append(T& container, Predicates&&... preds) {
+    static_assert(!std::is_const<T>::value,
+        "Append() requires mutable lvalue-references");
+    static_assert(cl::impl::IsContainer_t<T>::value,
+        "Append() requires STL-style container types");
+    static_assert(std::is_default_constructible<cl::impl::RemoveCVRec_t<typename T::value_type>>::value,
+        "Append() requires default-constructible value_type's");
+
+    return cl::impl::AppendParser<T, std::decay_t<Predicates>...>(container, std::forward<Predicates>(preds)...);
+}
+
+namespace impl {
+
+template <typename T, typename... Predicates>
+auto Var(std::false_type /*IsContainer*/, T& var, Predicates&&... preds) {
+    return cl::Assign(var, std::forward<Predicates>(preds)...);
+}
+
+template <typename T, typename... Predicates>
+auto Var(std::true_type /*IsContainer*/, T& var, Predicates&&... preds) {
+    return cl::Append(var, std::forward<Predicates>(preds)...);
+}
+
+} // namespace impl
+
+// Default parser.
+// Can be used as a replacement for Assign or PushBack (in almost all cases).
+template <typename T, typename... Predicates>
+auto Var(T& var, Predicates&&... preds) {
+    return cl::impl::Var(cl::impl::IsContainer_t<T>{}, var, std::forward<Predicates>(preds)...);
+}
+
+namespace impl {
+
+// The keys of a Map(), indexed for suggestions on first use.
+// Shared by all copies of a MapParser.
+struct MapSuggestions {
+    std::mutex mutex;
+    SuggestionIndex index;
+    bool built = false;
+};
+
+// The parser returned by Map().
+// The keys are sorted once on construction and looked up using binary search.
+template <typename T, typename... Predicates>
+class MapParser {
+    // Maximum number of "could be" notes emitted for an invalid argument.
+    enum { kMaxNotes = 8 };
+    // Maximum number of nearest matches listed for an invalid argument.
+    enum { kMaxSuggestions = 3 };
+
+    T* value_;
+    // The (key, value) pairs in the order they have been specified.
+    std::vector<std::pair<string_view, T>> entries_;
+    // Indices into entries_, sorted by key.
+    // Equal keys are ordered by index, so that the first matching entry wins.
+    std::vector<size_t> sorted_;
+    std::shared_ptr<MapSuggestions> suggestions_;
+    std::tuple<Predicates...> preds_;
+
+public:
+    template <typename... Args>
+    MapParser(T& value, std::vector<std::pair<string_view, T>> entries, Args&&... preds)
+        : value_(&value)
+        , entries_(std::move(entries))
+        , suggestions_(std::make_shared<MapSuggestions>())
+        , preds_(std::forward<Args>(preds)...)
+    {
+        sorted_.resize(entries_.size());
+        for (size_t i = 0; i < sorted_.size(); ++i) {
+            sorted_[i] = i;
+        }
+
+        std::stable_sort(sorted_.begin(), sorted_.end(), [&](size_t lhs, size_t rhs) {
+            return entries_[lhs].first < entries_[rhs].first;
+        });
+    }
+
+    bool operator()(ParseContext const& ctx) const {
+        auto const it = std::lower_bound(sorted_.begin(), sorted_.end(), ctx.arg, [&](size_t lhs, string_view key) {
+            return entries_[lhs].first < key;
+        });
+
+        if (it != sorted_.end() && entries_[*it].first == ctx.arg) {
+            // Parse into a local variable to allow the predicates to modify the value.
+            T temp = entries_[*it].second;
+            if (Check(ctx, temp, std::index_sequence_for<Predicates...>{})) {
+                *value_ = std::move(temp);
+                return true;
+            }
+        }
+
+        ctx.cmdline->EmitDiag(Diagnostic::error, ctx.index, "invalid argument '", ctx.arg, "' for option '", ctx.name, "'");
+
+        if (entries_.size() <= kMaxNotes) {
+            for (auto const& p : entries_) {
+                ctx.cmdline->EmitDiag(Diagnostic::note, ctx.index, "could be '", p.first, "'");
+            }
+        } else if (auto const num_matches = EmitSuggestions(ctx)) {
+            ctx.cmdline->EmitDiag(Diagnostic::note, ctx.index, "(", std::to_string(sorted_.size() - num_matches), " more)");
+        } else {
+            // List only the keys next to the position where the argument would
+            // have been found.
+            size_t const pos = static_cast<size_t>(it - sorted_.begin());
+            size_t first = pos < kMaxNotes / 2 ? 0 : pos - kMaxNotes / 2;
+            if (first > sorted_.size() - kMaxNotes) {
+                first = sorted_.size() - kMaxNotes;
+            }
+
+            for (size_t i = first; i != first + kMaxNotes; ++i) {
+                ctx.cmdline->EmitDiag(Diagnostic::note, ctx.index, "could be '", entries_[sorted_[i]].first, "'");
+            }
+
+            ctx.cmdline->EmitDiag(Diagnostic::note, ctx.index, "(", std::to_string(sorted_.size() - kMaxNotes), " more)");
+        }
+
+        return false;
+    }
+
+    // Appends the keys which start with PREFIX to VALUES, in sorted order.
+    void CompleteArgument(string_view prefix, std::vector<string_view>& values) const {
+        auto it = std::lower_bound(sorted_.begin(), sorted_.end(), prefix, [&](size_t lhs, string_view key) {
+            return entries_[lhs].first < key;
+        });
+
+        for (; it != sorted_.end() && cl::impl::StartsWith(entries_[*it].first, prefix); ++it) {
+            auto const key = entries_[*it].first;
+            if (values.empty() || values.back() != key) {
+                values.push_back(key);
+            }
+        }
+    }
+
+private:
+    // Emits "could be" notes for the keys nearest to CTX.ARG.
+    // Returns the number of notes.
+    size_t EmitSuggestions(ParseContext const& ctx) const {
+        std::vector<string_view> keys;
+        {
+            std::lock_guard<std::mutex> lock(suggestions_->mutex);
+
+            if (!suggestions_->built) {
+                // In sorted order, so that equally near keys are listed in sorted order.
+                for (auto const i : sorted_) {
+                    suggestions_->index.Insert(entries_[i].first);
+                }
+                suggestions_->index.Build();
+                suggestions_->built = true;
+            }
+
+            suggestions_->index.Suggest(ctx.arg, kMaxSuggestions, keys);
+        }
+
+        for (auto const key : keys) {
+            ctx.cmdline->EmitDiag(Diagnostic::note, ctx.index, "could be '", key, "'");
+        }
+
+        return keys.size();
+    }
+
+    template <size_t... I>
+    bool Check(ParseContext const& ctx, T& value, std::index_sequence<I...>) const {
+#if CL_HAS_FOLD_EXPRESSIONS
+        return (true && ... && std::get<I>(preds_)(ctx, value));
+#else
+        return cl::impl::ApplyFuncs(ctx, value, std::get<I>(preds_)...);
+#endif
+    }
+};
+
+} // namespace impl
+
+// Default parser for enum types.
+// Look up the key in the map and if it exists, returns the mapped value.
+template <typename T, typename... Predicates>
+auto Map(T& value, std::initializer_list<std::pair<char const*, T>> ilist, Predicates&&... preds) {
+    static_assert(!std::is_const<T>::value,
+        "Map() requires mutable lvalue-references");
+    static_assert(std::is_copy_constructible<T>::value,
+        "Map() requires copy-constructible types");
+    static_assert(std::is_move_assignable<T>::value,
+        "Map() requires move-assignable types");
+
+    using MapType = std::vector<std::pair<string_view, T>>;
+
+    return cl::impl::MapParser<T, std::decay_t<Predicates>...>(value, MapType(ilist.begin(), ilist.end()), std::forward<Predicates>(preds)...);
+}
+
+// Same as above, for key sets which are only known at runtime.
+// The keys must outlive the option.
+template <typename T, typename... Predicates>
+auto Map(T& value, std::vector<std::pair<string_view, T>> entries, Predicates&&... preds) {
+    static_assert(!std::is_const<T>::value,
+        "Map() requires mutable lvalue-references");
+    static_assert(std::is_copy_constructible<T>::value,
+        "Map() requires copy-constructible types");
+    static_assert(std::is_move_assignable<T>::value,
+        "Map() requires move-assignable types");
+
+    return cl::impl::MapParser<T, std::decay_t<Predicates>...>(value, std::move(entries), std::forward<Predicates>(preds)...);
+}
+
+// For (boolean) flags.
+// Parses the options' argument and stores the result in 'var'.
+// If the options' name starts with 'inverse_prefix', inverts the parsed value, using operator!.
+template <typename T>
+auto Flag(T& var, char const* inverse_prefix = "no-") {
+    static_assert(!std::is_const<T>::value,
+        "Flag() requires mutable lvalue-references");
+
+    return [=, &var](ParseContext const& ctx) {
+        if (!cl::impl::ConvertTo<>{}(ctx, var)) {
+            return false;
+        }
+        if (cl::impl::StartsWith(ctx.name, inverse_prefix)) {
+            var = !var;
+        }
+        return true;
+    };
+}
+
+// Parser for a member of the object set by Cmdline::SetTarget.
+// Uses Var() to parse into the member.
+//
+// This allows to share the options (see Schema) between multiple parsers, each
+// storing the parsed values into a different object.
+template <typename Struct, typename T, typename... Predicates>
+auto Field(T Struct::*member, Predicates&&... preds) {
+    static_assert(!std::is_const<T>::value,
+        "Field() requires mutable members");
+
+    return [=](ParseContext const& ctx) {
+        CL_ASSERT(ctx.target != nullptr && "Field() requires a target. See Cmdline::SetTarget");
+
+        auto& var = static_cast<Struct*>(ctx.target)->*member;
+        return cl::Var(var, preds...)(ctx);
+    };
+}
+
+//==================================================================================================
+// Tokenize
+//==================================================================================================
+
+namespace impl {
+
+// Writes unescaped arguments back into the input buffer.
+// This works because an unescaped argument is never longer than its escaped
+// form, i.e. the output never overtakes the input.
+struct InPlaceWriter {
+    char* out;
+
+    void push_back(char ch) {
+        *out++ = ch;
+    }
+
+    void append(size_t count, char ch) {
+        std::memset(out, ch, count);
+        out += count;
+    }
+};
+
+// Parses a single argument from [NEXT, LAST) and writes the unescaped
+// argument to ARG, which must provide push_back(char) and append(count, char).
+// HAS_ARG is set to false if there was no argument to parse.
+
+template <typename It, typename Out>
+It ParseArgUnix(It next, It last, Out& arg, bool& has_arg) {
+    // See:
+    // http://www.gnu.org/software/bash/manual/bashref.html#Quoting
+    // http://wiki.bash-hackers.org/syntax/quoting
+
+    char quote_char = '\0';
+
+    next = cl::impl::SkipWhitespace(next, last);
+
+    for (; next != last; ++next) {
+        auto const ch = *next;
+
+        if (quote_char == '\\') { // Quoting a single character using the backslash?
+            arg.push_back(ch);
+            quote_char = '\0';
+        } else if (quote_char != '\0' && ch != quote_char) { // Currently quoting using ' or "?
+            arg.push_back(ch);
+        } else if (ch == '\'' || ch == '"' || ch == '\\') { // Toggle quoting?
+            quote_char = (quote_char != '\0') ? '\0' : ch;
+        } else if (cl::impl::IsWhitespace(ch)) { // Arguments are separated by whitespace
+            ++next;
+            break;
+        } else {
+            arg.push_back(ch);
+        }
+    }
+
+    has_arg = true;
+
+    return next;
+}
+
+template <typename It, typename Out>
+It ParseProgramNameWindows(It next, It last, Out& arg, bool& has_arg) {
+    // TODO?!
+    //
+    // If the input string is empty, return a single command line argument
+    // consisting of the absolute path of the executable...
+
+    if (next != last && !cl::impl::IsWhitespace(*next)) {
+        bool const quoting = (*next == '"');
+
+        if (quoting) {
+            ++next;
+        }
+
+        for (; next != last; ++next) {
+            auto const ch = *next;
+            if ((quoting && ch == '"') || (!quoting && cl::impl::IsWhitespace(ch))) {
+                ++next;
+                break;
+            }
+            arg.push_back(ch);
+        }
+    }
+
+    has_arg = true;
+
+    return next;
+}
+
+template <typename It, typename Out>
+It ParseArgWindows(It next, It last, Out& arg, bool& has_arg) {
+    bool arg_empty = true;
+    bool quoting = false;
+    bool recently_closed = false;
+    size_t num_backslashes = 0;
+
+    next = cl::impl::SkipWhitespace(next, last);
+
+    for (; next != last; ++next) {
+        auto const ch = *next;
+
+        if (ch == '"' && recently_closed) {
+            recently_closed = false;
+
+            // If a closing " is followed immediately by another ", the 2nd
+            // " is accepted literally and added to the parameter.
+            //
+            // See:
+            // http://www.daviddeley.com/autohotkey/parameters/parameters.htm#WINCRULESDOC
+
+            arg.push_back('"');
+            arg_empty = false;
+        } else if (ch == '"') {
+            // If an even number of backslashes is followed by a double
+            // quotation mark, one backslash is placed in the argv array for
+            // every pair of backslashes, and the double quotation mark is
+            // interpreted as a string delimiter.
+            //
+            // If an odd number of backslashes is followed by a double
+            // quotation mark, one backslash is placed in the argv array for
+            // every pair of backslashes, and the double quotation mark is
+            // "escaped" by the remaining backslash, causing a literal
+            // double quotation mark (") to be placed in argv.
+
+            bool const even = (num_backslashes % 2) == 0;
+
+            if (num_backslashes >= 2) {
+                arg.append(num_backslashes / 2, '\\');
+                arg_empty = false;
+            }
+            num_backslashes = 0;
+
+            if (even) {
+                recently_closed = quoting; // Remember if this is a closing "
+                quoting = !quoting;
+            } else {
+                arg.push_back('"');
+                arg_empty = false;
+            }
+        } else if (ch == '\\') {
+            recently_closed = false;
+
+            ++num_backslashes;
+        } else {
+            recently_closed = false;
+
+            // Backslashes are interpreted literally, unless they
+            // immediately precede a double quotation mark.
+
+            if (num_backslashes > 0) {
+                arg.append(num_backslashes, '\\');
+                arg_empty = false;
+            }
+            num_backslashes = 0;
+
+            if (!quoting && cl::impl::IsWhitespace(ch)) {
+                // Arguments are delimited by white space, which is either a
+                // space or a tab.
+                //
+                // A string surrounded by double quotation marks ("string")
+                // is interpreted as single argument, regardless of white
+                // space contained within. A quoted string can be embedded
+                // in an argument.
+                ++next;
+                break;
+            }
+
+            arg.push_back(ch);
+            arg_empty = false;
+        }
+    }
+
+    has_arg = !arg_empty || quoting || recently_closed;
+
+    return next;
+}
+
+enum class QuotingStyle : uint8_t {
+    unix_shell,
+    windows,
+};
+
+} // namespace impl
+
+enum class ParseProgramName : uint8_t {
+    no,
+    yes,
+};
+
+// Iterates over the arguments in a command line string.
+//
+// The arguments are unescaped in place, i.e. the string is overwritten while
+// iterating. The string_view's returned by operator* point into the string
+// and remain valid after incrementing the iterator (as long as the string is
+// not modified otherwise). This allows Cmdline::Parse to use the arguments
+// without making any copies.
+class TokenIterator {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type        = string_view;
+    using reference         = string_view;
+    using pointer           = string_view const*;
+    using difference_type   = std::ptrdiff_t;
+
+private:
+    char* next_ = nullptr;
+    char* last_ = nullptr;
+    char const* source_ = nullptr; // Start of the current argument in the original string
+    string_view arg_;
+    impl::QuotingStyle quoting_ = impl::QuotingStyle::unix_shell;
+    bool done_ = true;
+
+public:
+    // Constructs an end-iterator.
+    TokenIterator() = default;
+
+    TokenIterator(char* first, char* last, impl::QuotingStyle quoting, ParseProgramName parse_program_name = ParseProgramName::no)
+        : next_(first)
+        , last_(last)
+        , quoting_(quoting)
+        , done_(false)
+    {
+        if (parse_program_name == ParseProgramName::yes) {
+            CL_ASSERT(quoting_ == impl::QuotingStyle::windows);
+
+            cl::impl::InPlaceWriter out{next_};
+            bool has_arg = false;
+            char* const arg_first = next_;
+            source_ = next_;
+            next_ = cl::impl::ParseProgramNameWindows(next_, last_, out, has_arg);
+            arg_ = string_view(arg_first, static_cast<size_t>(out.out - arg_first));
+        } else {
+            Next();
+        }
+    }
+
+    string_view operator*() const {
+        CL_ASSERT(!done_);
+        return arg_;
+    }
+
+    pointer operator->() const {
+        CL_ASSERT(!done_);
+        return &arg_;
+    }
+
+    // Returns a pointer to the start of the current argument in the original
+    // string. Note that the original string has been overwritten up to (and
+    // possibly including) this position.
+    char const* Source() const {
+        CL_ASSERT(!done_);
+        return source_;
+    }
+
+    TokenIterator& operator++() {
+        Next();
+        return *this;
+    }
+
+    TokenIterator operator++(int) {
+        auto t = *this;
+        Next();
+        return t;
+    }
+
+    friend bool operator==(TokenIterator const& lhs, TokenIterator const& rhs) {
+        if (lhs.done_ || rhs.done_) {
+            return lhs.done_ == rhs.done_;
+        }
+        return lhs.arg_.data() == rhs.arg_.data();
+    }
+
+    friend bool operator!=(TokenIterator const& lhs, TokenIterator const& rhs) {
+        return !(lhs == rhs);
+    }
+
+private:
+    void Next() {
+        while (next_ != last_) {
+            // NB: Each argument is written in place, starting at NEXT_, i.e. over
+            // the whitespace preceding it and its own source text. The output
+            // never overtakes the input, since unquoting only removes
+            // characters. The previous arguments are not moved.
+            char* const arg_first = next_;
+
+            cl::impl::InPlaceWriter out{arg_first};
+            bool has_arg = false;
+            next_ = cl::impl::SkipWhitespace(next_, last_);
+            source_ = next_;
+            if (quoting_ == impl::QuotingStyle::unix_shell) {
+                next_ = cl::impl::ParseArgUnix(next_, last_, out, has_arg);
+            } else {
+                next_ = cl::impl::ParseArgWindows(next_, last_, out, has_arg);
+            }
+
+            if (has_arg) {
+                arg_ = string_view(arg_first, static_cast<size_t>(out.out - arg_first));
+                return;
+            }
+        }
+
+        done_ = true;
+        arg_ = {};
+    }
+};
+
+namespace impl {
+
+template <>
+struct HasStableArgs<TokenIterator>
+    : std::true_type
+{
+};
+
+// The tokens are only valid while the tokenizer buffer is (which is often
+// reused for the next command line, e.g. by ParseBatch), so PersistArg must
+// copy them.
+template <>
+struct HasPersistentArgs<TokenIterator>
+    : std::false_type
+{
+};
+
+} // namespace impl
+
+// The arguments of a command line string. See TokenIterator.
+class TokenRange {
+    TokenIterator first_;
+
+public:
+    explicit TokenRange(TokenIterator first) : first_(first) {}
+
+    TokenIterator begin() const { return first_; }
+    TokenIterator end() const { return {}; }
+};
+
+// Parse arguments from the command line string [FIRST, LAST) in place.
+// Using Bash-style escaping.
+inline TokenRange TokenizeUnixInPlace(char* first, char* last) {
+    return TokenRange(TokenIterator(first, last, impl::QuotingStyle::unix_shell));
+}
+
+// Parse arguments from the command line string [FIRST, LAST) in place.
+// Using Windows-style escaping.
+inline TokenRange TokenizeWindowsInPlace(char* first, char* last, ParseProgramName parse_program_name = ParseProgramName::yes) {
+    return TokenRange(TokenIterator(first, last, impl::QuotingStyle::windows, parse_program_name));
+}
+
+// Parse arguments from a command line string.
+// Using Bash-style escaping.
+//
+// The arguments are stored in BUFFER, which may be reused to tokenize multiple
+// command lines without allocating memory for each of them.
+inline TokenRange TokenizeUnix(string_view str, std::string& buffer) {
+    buffer.assign(str.data(), str.size());
+    return cl::TokenizeUnixInPlace(&buffer[0], &buffer[0] + buffer.size());
+}
+
+// Parse arguments from a command line string.
+// Using Windows-style escaping.
+//
+// The arguments are stored in BUFFER, which may be reused to tokenize multiple
+// command lines without allocating memory for each of them.
+inline TokenRange TokenizeWindows(string_view str, std::string& buffer, ParseProgramName parse_program_name = ParseProgramName::yes) {
+    buffer.assign(str.data(), str.size());
+    return cl::TokenizeWindowsInPlace(&buffer[0], &buffer[0] + buffer.size(), parse_program_name);
+}
+
+// Parse arguments from a command line string into an argv-array.
+// Using Bash-style escaping.
+inline std::vector<std::string> TokenizeUnix(string_view str) {
+    std::vector<std::string> argv;
+
+    std::string buffer;
+    for (auto const arg : cl::TokenizeUnix(str, buffer)) {
+        argv.emplace_back(arg.data(), arg.size());
+    }
+
+    return argv;
+}
+
+// Parse arguments from a command line string into an argv-array.
+// Using Windows-style escaping.
+inline std::vector<std::string> TokenizeWindows(string_view str, ParseProgramName parse_program_name = ParseProgramName::yes) {
+    std::vector<std::string> argv;
+
+    std::string buffer;
+    for (auto const arg : cl::TokenizeWindows(str, buffer, parse_program_name)) {
+        argv.emplace_back(arg.data(), arg.size());
+    }
+
+    return argv;
+}
+
+#if CL_HAS_STD_STRING_VIEW
+inline std::vector<std::string> TokenizeWindows(std::wstring_view str, ParseProgramName parse_program_name = ParseProgramName::yes) {
+    return cl::TokenizeWindows(cl::impl::ToUTF8(str.begin(), str.end()), parse_program_name);
+}
+#else
+inline std::vector<std::string> TokenizeWindows(wchar_t const* wstr, ParseProgramName parse_program_name = ParseProgramName::yes) {
+    return cl::TokenizeWindows(cl::impl::ToUTF8(wstr), parse_program_name);
+}
+
+inline std::vector<std::string> TokenizeWindows(wchar_t const* wstr, size_t wlen, ParseProgramName parse_program_name = ParseProgramName::yes) {
+    return cl::TokenizeWindows(cl::impl::ToUTF8(wstr, wstr + wlen), parse_program_name);
+}
+#endif
+
+//==================================================================================================
+// Response files
+//==================================================================================================
+
+namespace impl {
+
+// A private, writable copy of a file's contents.
+// Uses a copy-on-write mapping of the file if available.
+class FileContents {
+    char* data_ = nullptr;
+    size_t size_ = 0;
+#if CL_HAS_MMAP
+    bool mapped_ = false;
+#endif
+    std::string buffer_;
+
+public:
+    FileContents() = default;
+    FileContents(FileContents const&) = delete;
+    FileContents& operator=(FileContents const&) = delete;
+
+    ~FileContents() {
+#if CL_HAS_MMAP
+        if (mapped_) {
+            ::munmap(data_, size_);
+        }
+#endif
+    }
+
+    char* data() { return data_; }
+    size_t size() const { return size_; }
+
+    // Returns false if the file could not be read.
+    bool Read(char const* path) {
+#if CL_HAS_MMAP
+        int const fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            ::close(fd);
+            return false;
+        }
+
+        if (st.st_size > 0) {
+            void* const p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                data_ = static_cast<char*>(p);
+                size_ = static_cast<size_t>(st.st_size);
+                mapped_ = true;
+            }
+        }
+
+        ::close(fd);
+
+        if (mapped_ || st.st_size == 0) {
+            return true;
+        }
+#endif
+
+        return ReadStdio(path);
+    }
+
+private:
+    bool ReadStdio(char const* path) {
+#if _MSC_VER
+        std::FILE* file = nullptr;
+        if (fopen_s(&file, path, "rb") != 0) {
+            file = nullptr;
+        }
+#else
+        std::FILE* const file = std::fopen(path, "rb");
+#endif
+        if (file == nullptr) {
+            return false;
+        }
+
+        char chunk[4096];
+        for (;;) {
+            size_t const n = std::fread(chunk, 1, sizeof(chunk), file);
+            buffer_.append(chunk, n);
+            if (n < sizeof(chunk)) {
+                break;
+            }
+        }
+
+        bool const ok = std::ferror(file) == 0;
+        std::fclose(file);
+
+        data_ = &buffer_[0];
+        size_ = buffer_.size();
+
+        return ok;
+    }
+};
+
+} // namespace impl
+
+//==================================================================================================
+// Config files
+//==================================================================================================
+
+namespace impl {
+
+// Identifies a version of a config file. See ConfigSnapshot.
+struct FileStamp {
+    uint64_t mtime_ns = 0;
+    uint64_t size = 0;
+    uint32_t path_hash = 0;
+};
+
+// Returns false if the modification time of the file is not available.
+inline bool GetFileStamp(char const* path, FileStamp& stamp) {
+#if CL_HAS_MMAP
+    struct stat st;
+    if (::stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+
+#if defined(__APPLE__)
+    auto const nsec = static_cast<uint64_t>(st.st_mtimespec.tv_nsec);
+#elif defined(__linux__)
+    auto const nsec = static_cast<uint64_t>(st.st_mtim.tv_nsec);
+#else
+    uint64_t const nsec = 0;
+#endif
+
+    stamp.mtime_ns = static_cast<uint64_t>(st.st_mtime) * 1000000000u + nsec;
+    stamp.size = static_cast<uint64_t>(st.st_size);
+    stamp.path_hash = cl::impl::HashName(path, std::strlen(path));
+    return true;
+#else
+    static_cast<void>(path);
+    static_cast<void>(stamp);
+    return false;
+#endif
+}
+
+// Appends the bytes of VALUE to DATA.
+template <typename T>
+void AppendBinary(std::string& data, T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    data.append(bytes, sizeof(T));
+}
+
+// Reads a T from BLOB at POS and advances POS.
+// The caller must check that BLOB is large enough.
+template <typename T>
+T ReadBinary(string_view blob, size_t& pos) {
+    T value;
+    std::memcpy(&value, blob.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+}
+
+// The parsed entries of a config file in a compact binary form.
+// The snapshot is only valid for the file version given by its FileStamp.
+// Snapshots are not portable between machines (native byte order).
+//
+// Layout:
+//  "CLcf", version, mtime_ns, size, path_hash, number of entries,
+//  then for each entry: line, key size, value size, key, value.
+class ConfigSnapshot {
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kHeaderSize = 4 + 4 + 8 + 8 + 4 + 4;
+    static constexpr size_t kNumEntriesOffset = kHeaderSize - 4;
+
+    std::string data_;
+    uint32_t num_entries_ = 0;
+
+public:
+    explicit ConfigSnapshot(FileStamp const& stamp) {
+        data_.append("CLcf", 4);
+        Append(kVersion);
+        Append(stamp.mtime_ns);
+        Append(stamp.size);
+        Append(stamp.path_hash);
+        Append(uint32_t{0}); // Number of entries, see Write()
+    }
+
+    void Add(string_view key, string_view value, size_t line) {
+        ++num_entries_;
+        Append(static_cast<uint32_t>(line));
+        Append(static_cast<uint32_t>(key.size()));
+        Append(static_cast<uint32_t>(value.size()));
+        data_.append(key.data(), key.size());
+        data_.append(value.data(), value.size());
+    }
+
+    // Writes the snapshot to PATH.
+    // The file is replaced atomically if the platform allows.
+    bool Write(char const* path) {
+        std::memcpy(&data_[kNumEntriesOffset], &num_entries_, 4);
+
+        std::string const tmp = std::string(path) + ".tmp";
+
+#if _MSC_VER
+        std::FILE* file = nullptr;
+        if (fopen_s(&file, tmp.c_str(), "wb") != 0) {
+            file = nullptr;
+        }
+#else
+        std::FILE* const file = std::fopen(tmp.c_str(), "wb");
+#endif
+        if (file == nullptr) {
+            return false;
+        }
+
+        bool ok = std::fwrite(data_.data(), 1, data_.size(), file) == data_.size();
+        ok = (std::fclose(file) == 0) && ok;
+
+#if _WIN32
+        std::remove(path);
+#endif
+        if (!ok || std::rename(tmp.c_str(), path) != 0) {
+            std::remove(tmp.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    // Calls FN(key, value, line) for all entries in the snapshot BLOB.
+    // Returns false, without calling FN, if BLOB is not a valid snapshot for
+    // the given file version.
+    template <typename Fn>
+    static bool ForEach(string_view blob, FileStamp const& stamp, Fn fn) {
+        if (blob.size() < kHeaderSize || blob.substr(0, 4) != "CLcf") {
+            return false;
+        }
+
+        size_t pos = 4;
+        if (Read<uint32_t>(blob, pos) != kVersion ||
+            Read<uint64_t>(blob, pos) != stamp.mtime_ns ||
+            Read<uint64_t>(blob, pos) != stamp.size ||
+            Read<uint32_t>(blob, pos) != stamp.path_hash) {
+            return false;
+        }
+
+        auto const num_entries = Read<uint32_t>(blob, pos);
+        auto const first = pos;
+
+        // Validate all entries first.
+        for (uint32_t i = 0; i < num_entries; ++i) {
+            if (blob.size() - pos < 12) {
+                return false;
+            }
+            pos += 4;
+            size_t const key_size = Read<uint32_t>(blob, pos);
+            size_t const value_size = Read<uint32_t>(blob, pos);
+            if (blob.size() - pos < key_size + value_size) {
+                return false;
+            }
+            pos += key_size + value_size;
+        }
+
+        if (pos != blob.size()) {
+            return false;
+        }
+
+        pos = first;
+        for (uint32_t i = 0; i < num_entries; ++i) {
+            size_t const line = Read<uint32_t>(blob, pos);
+            size_t const key_size = Read<uint32_t>(blob, pos);
+            size_t const value_size = Read<uint32_t>(blob, pos);
+            fn(blob.substr(pos, key_size), blob.substr(pos + key_size, value_size), line);
+            pos += key_size + value_size;
+        }
+
+        return true;
+    }
+
+private:
+    template <typename T>
+    void Append(T value) {
+        cl::impl::AppendBinary(data_, value);
+    }
+
+    template <typename T>
+    static T Read(string_view blob, size_t& pos) {
+        return cl::impl::ReadBinary<T>(blob, pos);
+    }
+};
+
+// Parses a quoted or bare value at the start of STR into VALUE and removes it
+// from STR. A bare value ends at a '#' preceded by whitespace, or at one of
+// the characters in STOP.
+inline bool ParseConfigValue(string_view& str, std::string& value, string_view stop) {
+    value.clear();
+
+    if (!str.empty() && str[0] == '"') {
+        for (size_t i = 1; i < str.size(); ++i) {
+            char ch = str[i];
+            if (ch == '"') {
+                str.remove_prefix(i + 1);
+                return true;
+            }
+            if (ch == '\\') {
+                if (++i == str.size()) {
+                    break;
+                }
+                switch (str[i]) {
+                case '"':  ch = '"';  break;
+                case '\\': ch = '\\'; break;
+                case 'n':  ch = '\n'; break;
+                case 'r':  ch = '\r'; break;
+                case 't':  ch = '\t'; break;
+                default:
+                    return false;
+                }
+            }
+            value += ch;
+        }
+        return false; // Unterminated string
+    }
+
+    if (!str.empty() && str[0] == '\'') {
+        auto const close = str.find('\'', 1);
+        if (close == string_view::npos) {
+            return false;
+        }
+        value.assign(str.data() + 1, close - 1);
+        str.remove_prefix(close + 1);
+        return true;
+    }
+
+    size_t n = 0;
+    while (n < str.size() && stop.find(str[n]) == string_view::npos) {
+        if (str[n] == '#' && (n == 0 || cl::impl::IsWhitespace(str[n - 1]))) {
+            break;
+        }
+        ++n;
+    }
+
+    auto const bare = cl::impl::TrimWhitespace(str.substr(0, n));
+    value.assign(bare.data(), bare.size());
+    str.remove_prefix(n);
+    return true;
+}
+
+inline bool IsBlankOrComment(string_view str) {
+    str = cl::impl::TrimWhitespace(str);
+    return str.empty() || str[0] == '#';
+}
+
+// Parses TEXT as an INI/TOML-like config file:
+//
+//  # comment
+//  ; comment
+//  name = value
+//  name = "quoted value with \"escapes\""
+//  name = 'literal value'
+//  name = [1, 2, "three"]   # One value for each element
+//  [section]
+//  name = value             # Sets the option "section.name"
+//
+// Calls ENTRY(key, value, line) for each value and ERROR(message, line) for
+// each syntax error. Line numbers start at 1.
+// Returns false if TEXT contains syntax errors.
+template <typename EntryFn, typename ErrorFn>
+bool ForEachConfigEntry(string_view text, EntryFn entry, ErrorFn error) {
+    std::string section;
+    std::string key;
+    std::string value;
+
+    bool ok = true;
+    auto const fail = [&](char const* message, size_t line) {
+        error(message, line);
+        ok = false;
+    };
+
+    for (size_t line = 1; !text.empty(); ++line) {
+        auto const nl = text.find('\n');
+        auto curr = cl::impl::TrimWhitespace(text.substr(0, nl));
+        text = (nl == string_view::npos) ? string_view{} : text.substr(nl + 1);
+
+        if (curr.empty() || curr[0] == '#' || curr[0] == ';') {
+            continue;
+        }
+
+        if (curr[0] == '[') {
+            auto const close = curr.find(']');
+            if (close == string_view::npos || !cl::impl::IsBlankOrComment(curr.substr(close + 1))) {
+                fail("expected ']'", line);
+                continue;
+            }
+            auto const name = cl::impl::TrimWhitespace(curr.substr(1, close - 1));
+            section.assign(name.data(), name.size());
+            if (!section.empty()) {
+                section += '.';
+            }
+            continue;
+        }
+
+        auto const eq = curr.find('=');
+        auto const name = cl::impl::TrimWhitespace(curr.substr(0, eq));
+        if (eq == string_view::npos || name.empty()) {
+            fail("expected 'name = value'", line);
+            continue;
+        }
+
+        key = section;
+        key.append(name.data(), name.size());
+
+        auto rest = cl::impl::TrimWhitespace(curr.substr(eq + 1));
+        if (rest.empty() || rest[0] != '[') {
+            if (!cl::impl::ParseConfigValue(rest, value, {}) || !cl::impl::IsBlankOrComment(rest)) {
+                fail("invalid value", line);
+                continue;
+            }
+            entry(string_view(key), string_view(value), line);
+            continue;
+        }
+
+        // An array. A trailing comma is allowed.
+        bool valid = true;
+        rest.remove_prefix(1);
+        for (;;) {
+            rest = cl::impl::TrimWhitespace(rest);
+            if (!rest.empty() && rest[0] == ']') {
+                rest.remove_prefix(1);
+                break;
+            }
+            if (!cl::impl::ParseConfigValue(rest, value, ",]")) {
+                valid = false;
+                break;
+            }
+            entry(string_view(key), string_view(value), line);
+
+            rest = cl::impl::TrimWhitespace(rest);
+            if (!rest.empty() && rest[0] == ',') {
+                rest.remove_prefix(1);
+            } else if (!rest.empty() && rest[0] == ']') {
+                rest.remove_prefix(1);
+                break;
+            } else {
+                valid = false;
+                break;
+            }
+        }
+        if (!valid || !cl::impl::IsBlankOrComment(rest)) {
+            fail("invalid array", line);
+        }
+    }
+
+    return ok;
+}
+
+} // namespace impl
+
+//==================================================================================================
+//
+//==================================================================================================
+
+inline OptionBase::OptionBase(char const* name, char const* descr, OptionFlags flags)
+    : name_(name)
+    , descr_(descr)
+    , flags_(flags)
+{
+    CL_ASSERT(cl::impl::IsUTF8(name_.begin(), name_.end()));
+    CL_ASSERT(cl::impl::IsUTF8(descr_.begin(), descr_.end()));
+}
+
+inline OptionBase::~OptionBase() = default;
+
+inline bool OptionBase::Parse(ParseContext const& ctx) const {
+    return const_cast<OptionBase*>(this)->Parse(ctx);
+}
+
+inline bool OptionBase::Parse(ParseContext const& /*ctx*/) {
+    CL_ASSERT(false && "OptionBase subclasses must override Parse(ParseContext const&) const");
+    return false;
+}
+
+inline bool OptionBase::ParseList(ParseContext const& /*ctx*/, size_t& count) const {
+    CL_ASSERT(false && "ParseList not supported");
+    count = 0;
+    return false;
+}
+
+inline bool OptionBase::CanParseList() const {
+    return false;
+}
+
+inline void OptionBase::Reserve(size_t /*count*/) const {
+}
+
+inline int OptionBase::Count() const {
+    CL_ASSERT(schema_ != nullptr && schema_->owner_ != nullptr && "Option not added to a Cmdline; use Cmdline::Count(opt)");
+    return (schema_ != nullptr && schema_->owner_ != nullptr) ? schema_->owner_->Count(this) : 0;
+}
+
+inline std::unique_ptr<cl::impl::ArgSlots> OptionBase::MakeArgSlots(size_t /*count*/) const {
+    return nullptr;
+}
+
+inline void OptionBase::CompleteArgument(string_view /*prefix*/, std::vector<string_view>& /*values*/) const {
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+template <typename ParserT>
+template <typename ParserInit>
+inline Option<ParserT>::Option(char const* name, char const* descr, OptionFlags flags, ParserInit&& parser)
+    : OptionBase(name, descr, flags)
+    , parser_(std::forward<ParserInit>(parser))
+{
+}
+
+template <typename ParserT>
+bool Option<ParserT>::Parse(ParseContext const& ctx) const {
+    CL_ASSERT(cl::impl::IsUTF8(ctx.name.begin(), ctx.name.end()));
+    CL_ASSERT(cl::impl::IsUTF8(ctx.arg.begin(), ctx.arg.end()));
+
+    return DoParse(ctx, std::is_convertible<decltype(CallParser(ctx, 0)), bool>{});
+}
+
+template <typename ParserT>
+bool Option<ParserT>::Parse(ParseContext const& ctx) {
+    return static_cast<Option const*>(this)->Parse(ctx);
+}
+
+template <typename ParserT>
+bool Option<ParserT>::ParseList(ParseContext const& ctx, size_t& count) const {
+    CL_ASSERT(cl::impl::IsUTF8(ctx.name.begin(), ctx.name.end()));
+    CL_ASSERT(cl::impl::IsUTF8(ctx.arg.begin(), ctx.arg.end()));
+
+    return cl::impl::ParseList(parser_, ctx, count, cl::impl::HasParseList<ParserT>{});
+}
+
+template <typename ParserT>
+bool Option<ParserT>::CanParseList() const {
+    return cl::impl::HasParseList<ParserT>::value;
+}
+
+template <typename ParserT>
+void Option<ParserT>::Reserve(size_t count) const {
+    cl::impl::ReserveHint(parser_, count, cl::impl::HasReserveHint<ParserT>{});
+}
+
+template <typename ParserT>
+std::unique_ptr<cl::impl::ArgSlots> Option<ParserT>::MakeArgSlots(size_t count) const {
+    return cl::impl::MakeArgSlots(parser_, count, cl::impl::HasArgSlots<ParserT>{});
+}
+
+template <typename ParserT>
+void Option<ParserT>::CompleteArgument(string_view prefix, std::vector<string_view>& values) const {
+    cl::impl::CompleteArgument(parser_, prefix, values, cl::impl::HasCompleteArgument<ParserT>{});
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+#if CL_ENABLE_STATS
+inline std::string ParseStats::ToJSON() const {
+    std::string out;
+
+    auto const append_field = [&](char const* key, uint64_t value) {
+        out += '"';
+        out += key;
+        out += "\": ";
+        out += std::to_string(value);
+    };
+
+    out += '{';
+    append_field("add_ns", add_ns);
+    out += ", ";
+    append_field("parse_ns", parse_ns);
+    out += ", ";
+    append_field("callback_ns", callback_ns);
+    out += ", ";
+    append_field("help_ns", help_ns);
+    out += ", ";
+    append_field("num_parse_calls", num_parse_calls);
+    out += ", ";
+    append_field("num_args", num_args);
+    out += ", ";
+    append_field("find_option_calls", find_option_calls);
+    out += ", ";
+    append_field("find_option_probes", find_option_probes);
+    out += ", ";
+    append_field("prefix_fallbacks", prefix_fallbacks);
+    out += ", ";
+    append_field("group_fallbacks", group_fallbacks);
+    out += ", ";
+    append_field("utf8_bytes", utf8_bytes);
+    out += ", ";
+    append_field("diagnostics", diagnostics);
+    out += ", \"options\": [";
+
+    bool first = true;
+    for (auto const& o : options) {
+        if (o.calls == 0) {
+            continue;
+        }
+        if (!first) {
+            out += ", ";
+        }
+        first = false;
+
+        // Option names never contain a '"'. Escape everything else which is
+        // not allowed in a JSON string.
+        out += "{\"name\": \"";
+        for (char const ch : o.name) {
+            if (ch == '\\') {
+                out += "\\\\";
+            } else if (static_cast<unsigned char>(ch) < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(ch));
+                out += buf;
+            } else {
+                out += ch;
+            }
+        }
+        out += "\", ";
+        append_field("calls", o.calls);
+        out += ", ";
+        append_field("ns", o.ns);
+        out += '}';
+    }
+
+    out += "]}";
+    return out;
+}
+#endif
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+inline void Schema::OptionDeleter::operator()(OptionBase* opt) const {
+    if (resource == nullptr) {
+        delete opt;
+    } else {
+        opt->~OptionBase();
+        resource->deallocate(opt, size, alignment);
+    }
+}
+
+inline Schema::Schema(char const* name, char const* descr, memory_resource* resource)
+    : resource_(resource)
+    , name_(name)
+    , descr_(descr)
+    , unique_options_(resource)
+    , options_(resource)
+    , index_(resource)
+    , prefixes_(resource)
+    , parse_fns_(resource)
+    , id_options_(resource)
+    , id_flags_(resource)
+    , positionals_(resource)
+    , subcommands_(resource)
+    , subcommand_index_(resource)
+{
+    CL_ASSERT(resource_ != nullptr);
+
+    std::fill(std::begin(short_ids_), std::end(short_ids_), -1);
+}
+
+inline Schema::~Schema() = default;
+
+template <typename OptionT, typename... Args>
+OptionT* Schema::NewOption(Args&&... args) {
+    cl::impl::ReserveFor(unique_options_, 1, std::true_type{});
+
+    // Releases the memory if the constructor throws.
+    struct Guard {
+        memory_resource* resource;
+        void* mem;
+        ~Guard() {
+            if (mem != nullptr) {
+                resource->deallocate(mem, sizeof(OptionT), alignof(OptionT));
+            }
+        }
+    };
+
+    Guard guard{resource_, resource_->allocate(sizeof(OptionT), alignof(OptionT))};
+    auto const p = ::new (guard.mem) OptionT(std::forward<Args>(args)...);
+    guard.mem = nullptr;
+
+    unique_options_.emplace_back(p, OptionDeleter{resource_, sizeof(OptionT), alignof(OptionT)});
+    return p;
+}
+
+template <typename ParserInit>
+Option<std::decay_t<ParserInit>>* Schema::Add(char const* name, char const* descr, OptionFlags flags, ParserInit&& parser) {
+    auto const p = NewOption<Option<std::decay_t<ParserInit>>>(
+        name, descr, flags, std::forward<ParserInit>(parser));
+
+    AddOption(p, &Schema::ParseStatic<Option<std::decay_t<ParserInit>>>);
+    return p;
+}
+
+inline OptionBase* Schema::Add(std::unique_ptr<OptionBase> opt) {
+    cl::impl::ReserveFor(unique_options_, 1, std::true_type{});
+
+    auto const p = opt.release();
+    unique_options_.emplace_back(p, OptionDeleter{});
+    return Add(p);
+}
+
+inline OptionBase* Schema::Add(OptionBase* opt) {
+    return AddOption(opt, &Schema::ParseDynamic);
+}
+
+template <typename... ParserT>
+void Schema::Add(OptionSet<ParserT...>& set) {
+    AddSet(set, std::index_sequence_for<ParserT...>{});
+}
+
+template <typename... ParserT, size_t... Is>
+void Schema::AddSet(OptionSet<ParserT...>& set, std::index_sequence<Is...>) {
+    cl::impl::ReserveFor(options_, sizeof...(ParserT), std::true_type{});
+    cl::impl::ReserveFor(parse_fns_, sizeof...(ParserT), std::true_type{});
+    cl::impl::ReserveFor(id_options_, sizeof...(ParserT), std::true_type{});
+    cl::impl::ReserveFor(id_flags_, sizeof...(ParserT), std::true_type{});
+
+    int const unused[] = {0, (AddOption(&std::get<Is>(set.options_), &Schema::ParseStatic<Option<ParserT>>), 0)...};
+    static_cast<void>(unused);
+}
+
+template <typename OptionT>
+bool Schema::ParseStatic(OptionBase const* opt, ParseContext const& ctx) {
+    return static_cast<OptionT const*>(opt)->OptionT::Parse(ctx);
+}
+
+inline bool Schema::ParseDynamic(OptionBase const* opt, ParseContext const& ctx) {
+    return opt->Parse(ctx);
+}
+
+inline void Schema::AssignId(OptionBase* opt, ParseFn parse_fn) {
+    opt->id_ = num_ids_++;
+    opt->schema_ = this;
+
+    parse_fns_.push_back(parse_fn);
+    id_options_.push_back(opt);
+    id_flags_.push_back(opt->flags_);
+    if (opt->HasFlag(Positional::yes)) {
+        positionals_.push_back(opt->id_);
+    }
+}
+
+inline OptionBase* Schema::AddOption(OptionBase* opt, ParseFn parse_fn) {
+    CL_ASSERT(opt != nullptr);
+    CL_ASSERT(opt->id_ < 0 && "Option already added to a Schema");
+
+    AssignId(opt, parse_fn);
+    help_cache_.clear();
+    help_layout_.reset();
+
+    CL_ASSERT(cl::impl::IsUTF8(opt->name_.begin(), opt->name_.end()));
+    CL_ASSERT(cl::impl::IsUTF8(opt->descr_.begin(), opt->descr_.end()));
+
+    cl::impl::Split(opt->Name(), cl::impl::ByChar('|'), [&](string_view name) {
+        CL_ASSERT(!name.empty() && "Empty option names are not allowed");
+        CL_ASSERT(name[0] != '-' && "Option names must not start with a '-'");
+        CL_ASSERT(name.find('"') == string_view::npos && "An option name must not contain an '\"'");
+        // TODO:
+        // Abort/throw if an option with the given name already exists?
+        CL_ASSERT(FindOption(name) == nullptr && "Option already exists");
+
+        options_.emplace_back(name, opt, cl::impl::HashName(name.data(), name.size()));
+        InsertName(options_.size() - 1);
+        InsertNameChars(options_.size() - 1);
+        UpdateFingerprint(options_.size() - 1);
+
+        if (opt->HasFlag(MayJoin::yes)) {
+            InsertPrefix(options_.size() - 1);
+        }
+
+        return true;
+    });
+
+    return opt;
+}
+
+template <size_t NumOptions, size_t NumNames, typename... ParserInit>
+void Schema::Add(OptionTable<NumOptions, NumNames> const& table, ParserInit&&... parsers) {
+    static_assert(sizeof...(ParserInit) == NumOptions,
+        "Add() requires exactly one parser for each option in the table");
+
+    AddTable(table, std::make_index_sequence<NumOptions>{}, std::forward<ParserInit>(parsers)...);
+}
+
+template <typename ParserInit>
+OptionBase* Schema::MakeOption(OptionSpec const& spec, ParserInit&& parser) {
+    auto const opt = NewOption<Option<std::decay_t<ParserInit>>>(
+        spec.name, spec.descr, spec.flags, std::forward<ParserInit>(parser));
+
+    AssignId(opt, &Schema::ParseStatic<Option<std::decay_t<ParserInit>>>);
+    return opt;
+}
+
+template <size_t NumOptions, size_t NumNames, size_t... Is, typename... ParserInit>
+void Schema::AddTable(OptionTable<NumOptions, NumNames> const& table, std::index_sequence<Is...>, ParserInit&&... parsers) {
+    using Table = OptionTable<NumOptions, NumNames>;
+
+    help_cache_.clear();
+    help_layout_.reset();
+
+    cl::impl::ReserveFor(unique_options_, NumOptions, std::true_type{});
+    OptionBase* const opts[] = {MakeOption(table.specs[Is], std::forward<ParserInit>(parsers))...};
+
+    // The names have already been split and validated.
+    // If this Cmdline is still empty, the index can be copied from the table.
+    bool const copy_index = options_.empty();
+
+    cl::impl::ReserveFor(options_, NumNames, std::true_type{});
+    for (auto const& n : table.names) {
+        CL_ASSERT(FindOption(string_view(n.data, n.size)) == nullptr && "Option already exists");
+
+        options_.emplace_back(string_view(n.data, n.size), opts[static_cast<size_t>(n.option)], n.hash);
+        if (!copy_index) {
+            InsertName(options_.size() - 1);
+        }
+        InsertNameChars(options_.size() - 1);
+        UpdateFingerprint(options_.size() - 1);
+
+        if (table.specs[n.option].flags.may_join == MayJoin::yes) {
+            InsertPrefix(options_.size() - 1);
+        }
+    }
+
+    if (copy_index) {
+        index_.assign(table.slots, table.slots + Table::kNumSlots);
+    }
+}
+
+inline Cmdline::Cmdline(char const* name, char const* descr, memory_resource* resource)
+    : own_schema_(new Schema(name, descr, resource))
+    , schema_(own_schema_.get())
+{
+    own_schema_->owner_ = this;
+}
+
+inline Cmdline::Cmdline(Schema const& schema)
+    : schema_(&schema)
+{
+}
+
+inline Cmdline::~Cmdline() = default;
+
+template <typename... Args>
+CL_FORCE_INLINE void Cmdline::EmitDiag(Diagnostic::Type type, int index, Args&&... args) {
+    string_view strings[] = {args...};
+    EmitDiagImpl(type, index, strings, sizeof...(Args));
+}
+
+inline Schema& Cmdline::MutableSchema() {
+    CL_ASSERT(own_schema_ != nullptr && "Cannot add options to a shared Schema");
+    return *own_schema_;
+}
+
+inline OptionBase const* Cmdline::FindOption(string_view name) {
+    return FindOption(name, cl::impl::HashName(name.data(), name.size()));
+}
+
+inline OptionBase const* Cmdline::FindOption(string_view name, uint32_t hash) {
+    cl::impl::ProbeCount probes{};
+    auto const opt = schema_->FindOption(name, hash, probes);
+#if CL_ENABLE_STATS
+    ++stats_.find_option_calls;
+    stats_.find_option_probes += probes;
+#endif
+    return opt;
+}
+
+#if CL_ENABLE_STATS
+inline void Cmdline::ResizeStats() {
+    auto& options = stats_.options;
+    for (auto i = options.size(); i < static_cast<size_t>(schema_->num_ids_); ++i) {
+        options.emplace_back();
+        options.back().name = schema_->id_options_[i]->Name();
+    }
+}
+#endif
+
+template <typename Fn>
+bool Cmdline::CallParser(OptionBase const* opt, Fn fn) {
+#if CL_ENABLE_STATS
+    auto const id = static_cast<size_t>(opt->Id());
+    if (id >= stats_.options.size()) {
+        ResizeStats();
+    }
+
+    uint64_t ns = 0;
+    bool ok;
+    {
+        cl::impl::StatsTimer const timer(ns);
+        ok = fn();
+    }
+
+    auto& s = stats_.options[id];
+    ++s.calls;
+    s.ns += ns;
+    stats_.callback_ns += ns;
+    return ok;
+#else
+    static_cast<void>(opt);
+    return fn();
+#endif
+}
+
+inline std::string Cmdline::FormatHelp(HelpFormat const& fmt) const {
+#if CL_ENABLE_STATS
+    cl::impl::StatsTimer const timer(stats_.help_ns);
+#endif
+    return schema_->FormatHelp(fmt);
+}
+
+template <typename Sink, std::enable_if_t<!std::is_convertible<Sink, Cmdline::HelpFormat const&>::value, int>>
+void Cmdline::FormatHelp(Sink&& sink, HelpFormat const& fmt) const {
+#if CL_ENABLE_STATS
+    cl::impl::StatsTimer const timer(stats_.help_ns);
+#endif
+    schema_->FormatHelp(std::forward<Sink>(sink), fmt);
+}
+
+template <typename Sink>
+void Cmdline::WriteHelp(Sink&& sink, HelpFormat const& fmt) const {
+#if CL_ENABLE_STATS
+    cl::impl::StatsTimer const timer(stats_.help_ns);
+#endif
+    schema_->WriteHelp(std::forward<Sink>(sink), fmt);
+}
+
+inline void Cmdline::PrintHelp(HelpFormat const& fmt) const {
+#if CL_ENABLE_STATS
+    cl::impl::StatsTimer const timer(stats_.help_ns);
+#endif
+    schema_->PrintHelp(fmt);
+}
+
+template <typename ParserInit>
+Option<std::decay_t<ParserInit>>* Cmdline::Add(char const* name, char const* descr, OptionFlags flags, ParserInit&& parser) {
+#if CL_ENABLE_STATS
+    cl::impl::StatsTimer const timer(stats_.add_ns);
+#endif
+    return MutableSchema().Add(name, descr, flags, std::forward<ParserInit>(parser));
+}
+
+inline OptionBase* Cmdline::Add(std::unique_ptr<OptionBase> opt) {
+#if CL_ENABLE_STATS
+    cl::impl::StatsTimer const timer(stats_.add_ns);
+#endif
+    return MutableSchema().Add(std::move(opt));
+}
+
+inline OptionBase* Cmdline::Add(OptionBase* opt) {
+#if CL_ENABLE_STATS
+    cl::impl::StatsTimer const timer(stats_.add_ns);
+#endif
+    return MutableSchema().Add(opt);
+}
+
+template <size_t NumOptions, size_t NumNames, typename... ParserInit>
+void Cmdline::Add(OptionTable<NumOptions, NumNames> const& table, ParserInit&&... parsers) {
+#if CL_ENABLE_STATS
+    cl::impl::StatsTimer const timer(stats_.add_ns);
+#endif
+    MutableSchema().Add(table, std::forward<ParserInit>(parsers)...);
+}
+
+template <typename... ParserT>
+void Cmdline::Add(OptionSet<ParserT...>& set) {
+#if CL_ENABLE_STATS
+    cl::impl::StatsTimer const timer(stats_.add_ns);
+#endif
+    MutableSchema().Add(set);
+}
+
+template <typename Init>
+void Cmdline::AddSubcommand(char const* name, char const* descr, Init&& init) {
+    MutableSchema().AddSubcommand(name, descr, std::forward<Init>(init));
+}
+
+inline void Cmdline::SetResponseFiles(ResponseFiles quoting, int max_depth) {
+    CL_ASSERT(max_depth >= 0);
+
+    response_files_ = quoting;
+    max_response_file_depth_ = max_depth;
+}
+
+inline std::vector<Diagnostic> const& Cmdline::Diag() const {
+    for (size_t i = diag_.size(); i < diag_records_.size(); ++i) {
+        auto const& r = diag_records_[i];
+        diag_.emplace_back(r.type, r.index, diag_text_.substr(r.offset, r.length));
+    }
+
+    return diag_;
+}
+
+inline void Cmdline::Reset() {
+    diag_records_.clear();
+    diag_text_.clear();
+    diag_.clear();
+    num_diag_ = 0;
+    sub_active_ = false;
+    deferred_.clear();
+    deferred_text_.clear();
+    last_deferred_.clear();
+    num_converted_ = 0;
+    lazy_values_.clear();
+    stable_arg_ = {};
+    arg_copies_.clear();
+    unparsed_file_args_.clear();
+    counts_.assign(counts_.size(), 0);
+    curr_positional_ = 0;
+    curr_index_ = 0;
+    dashdash_ = false;
+}
+
+inline int Cmdline::Count(OptionBase const* opt) const {
+    CL_ASSERT(opt != nullptr);
+    CL_ASSERT(opt->Id() >= 0 && opt->Id() < schema_->num_ids_);
+
+    auto const id = static_cast<size_t>(opt->Id());
+    return id < counts_.size() ? counts_[id] : 0;
+}
+
+inline int Cmdline::Count(string_view name) const {
+    auto const opt = schema_->FindOption(name);
+    return opt != nullptr ? Count(opt) : -1;
+}
+
+inline bool Cmdline::IsOccurrenceAllowed(OptionBase const* opt) const {
+    if (opt->HasFlag(Multiple::no)) {
+        return Count(opt) == 0;
+    }
+
+    return true;
+}
+
+inline bool Cmdline::IsOccurrenceAllowed(size_t id) const {
+    if (schema_->id_flags_[id].multiple == Multiple::no) {
+        return id >= counts_.size() || counts_[id] == 0;
+    }
+
+    return true;
+}
+
+template <typename It, typename EndIt>
+Cmdline::ParseResult<It> Cmdline::Parse(It curr, EndIt last, CheckMissingOptions check_missing) {
+    CL_ASSERT(curr_positional_ >= 0);
+    CL_ASSERT(curr_index_ >= 0);
+
+#if CL_ENABLE_STATS
+    cl::impl::StatsTimer const timer(stats_.parse_ns);
+    ++stats_.num_parse_calls;
+#endif
+
+    // Options might have been added since the last call to Parse().
+    counts_.resize(static_cast<size_t>(schema_->num_ids_));
+
+    unparsed_file_args_.clear();
+
+    if (ParseRange(curr, last) == Status::error) {
+        return {curr, false};
+    }
+
+    bool const success = (check_missing == CheckMissingOptions::yes)
+                             ? !AnyMissing()
+                             : true;
+
+    return {curr, success};
+}
+
+// Returns Status::done if parsing should stop, Status::error on error, and
+// Status::success otherwise.
+template <typename It, typename EndIt>
+Cmdline::Status Cmdline::ParseRange(It& curr, EndIt last) {
+    std::string buf;
+
+    while (curr != last) {
+        Status const res = ParseArg(curr, last, buf);
+        if (res == Status::done && curr != last) {
+            ++curr;
+        }
+        if (res != Status::success) {
+            return res;
+        }
+
+        // ParseArg might have changed CURR.
+        // Need to recheck if we're done.
+        if (curr == last) {
+            break;
+        }
+
+        ++curr;
+        ++curr_index_;
+    }
+
+    return Status::success;
+}
+
+// Parse the argument at CURR (and possibly the following arguments).
+// On return, CURR points to the last argument which has been consumed.
+template <typename It, typename EndIt>
+Cmdline::Status Cmdline::ParseArg(It& curr, EndIt last, std::string& buf) {
+    // Make a copy of the current value - if required.
+    // NB: This is actually only needed for InputIterator's and for
+    // arguments which are not UTF-8 encoded...
+    auto const arg = cl::impl::ArgToUTF8(curr, buf);
+    SetStableArg<It>(arg, buf);
+
+#if CL_ENABLE_STATS
+    ++stats_.num_args;
+    if (arg.data() == buf.data()) {
+        stats_.utf8_bytes += arg.size();
+    }
+#endif
+
+    bool const is_response_file = response_files_ != ResponseFiles::no && !dashdash_ && arg.size() > 1 && arg[0] == '@';
+
+    Status const res = is_response_file
+                           ? HandleResponseFile(arg.substr(1))
+                           : Handle1(arg, curr, last);
+    switch (res) {
+    case Status::success:
+        break;
+    case Status::done:
+        break;
+    case Status::error:
+        break;
+    case Status::ignored:
+        EmitDiag(Diagnostic::error, curr_index_, "unknown option '", arg, "'");
+        if (arg.size() >= 2 && arg[0] == '-') {
+            size_t const num_dashes = arg[1] == '-' ? 2 : 1;
+            auto const name = arg.substr(num_dashes);
+            EmitSuggestions(name.substr(0, name.find('=')), arg.substr(0, num_dashes));
+        }
+        return Status::error;
+    }
+
+    return res;
+}
+
+inline void Cmdline::EmitSuggestions(string_view name, string_view dashes) {
+    // Maximum number of suggestions for an unknown option.
+    constexpr size_t kMaxSuggestions = 3;
+
+    if (collect_diag_ == CollectDiagnostics::no) {
+        return;
+    }
+
+    std::vector<string_view> names;
+    schema_->SuggestOptions(name, kMaxSuggestions, names);
+
+    for (auto const n : names) {
+        EmitDiag(Diagnostic::note, curr_index_, "did you mean '", dashes, n, "'?");
+    }
+}
+
+template <typename Container>
+bool Cmdline::ParseArgs(Container const& args, CheckMissingOptions check_missing) {
+    using std::begin; // using ADL!
+    using std::end;   // using ADL!
+
+    return Parse(begin(args), end(args), check_missing).success;
+}
+
+inline bool Cmdline::AnyMissing() {
+    auto const& flags = schema_->id_flags_;
+
+    bool res = false;
+    for (size_t id = 0; id < flags.size(); ++id) {
+        if (flags[id].required == Required::yes && (id >= counts_.size() || counts_[id] == 0)) {
+            EmitDiag(Diagnostic::error, -1, "option '", schema_->id_options_[id]->Name(), "' is missing");
+            res = true;
+        }
+    }
+
+    if (auto const sub = Subcommand()) {
+        if (sub->AnyMissing()) {
+            res = true;
+        }
+    }
+
+    return res;
+}
 
-template <typename T>
-using RemoveCVRec_t = typename RemoveCVRec<T>::type;
+#if CL_WINDOWS_CONSOLE_COLORS && _WIN32
 
-template <typename T, typename /*Enable*/ = void>
-struct IsContainerImpl
-    : std::false_type
-{
-};
+inline void Cmdline::PrintDiag() const {
+    if (diag_records_.empty()) {
+        return;
+    }
 
-template <typename T>
-struct IsContainerImpl<T, Void_t< decltype( std::declval<T&>().insert(std::declval<T&>().end(), std::declval<typename T::value_type>()) ) >>
-    : std::true_type
-{
-};
+    auto const stderr_handle = GetStdHandle(STD_ERROR_HANDLE);
+    if (stderr_handle == NULL) {
+        return; // No console.
+    }
 
-template <typename T>
-struct IsContainer
-    : IsContainerImpl<T>
-{
-};
+    if (stderr_handle == INVALID_HANDLE_VALUE) {
+        return; // Error (Print without colors?!)
+    }
 
-// Do not handle strings as containers.
-template <typename Elem, typename Traits, typename Alloc>
-struct IsContainer<std::basic_string<Elem, Traits, Alloc>>
-    : std::false_type
-{
-};
+    CONSOLE_SCREEN_BUFFER_INFO sbi;
+    GetConsoleScreenBufferInfo(stderr_handle, &sbi);
 
-template <typename T>
-using IsContainer_t = typename IsContainer<std::decay_t<T>>::type;
+    auto const old_attributes = sbi.wAttributes;
 
-#if CL_HAS_FOLD_EXPRESSIONS
+    for (auto const& d : diag_records_) {
+        fflush(stderr);
 
-template <typename Lhs, typename... Rhs>
-CL_FORCE_INLINE bool IsAnyOf(Lhs const& lhs, Rhs&&... rhs) {
-    return (false || ... || (lhs == std::forward<Rhs>(rhs)));
+        fprintf(stderr, "%.*s: ", static_cast<int>(Name().size()), Name().data());
+        fflush(stderr);
+
+        switch (d.type) {
+        case Diagnostic::error:
+            SetConsoleTextAttribute(stderr_handle, FOREGROUND_RED | FOREGROUND_INTENSITY);
+            fprintf(stderr, "error:");
+            break;
+        case Diagnostic::warning:
+            SetConsoleTextAttribute(stderr_handle, FOREGROUND_RED | FOREGROUND_BLUE | FOREGROUND_INTENSITY);
+            fprintf(stderr, "warning:");
+            break;
+        case Diagnostic::note:
+            SetConsoleTextAttribute(stderr_handle, FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY);
+            fprintf(stderr, "note:");
+            break;
+        }
+        fflush(stderr);
+        SetConsoleTextAttribute(stderr_handle, old_attributes);
+        fprintf(stderr, " %.*s\n", static_cast<int>(d.length), diag_text_.data() + d.offset);
+    }
 }
 
 #else
 
-template <typename Lhs>
-CL_FORCE_INLINE bool IsAnyOf(Lhs const& /*lhs*/) {
-    return false;
-}
+#if CL_ANSI_CONSOLE_COLORS
+#define CL_VT100_RESET   "\x1B[0m"
+#define CL_VT100_RED     "\x1B[31;1m"
+#define CL_VT100_MAGENTA "\x1B[35;1m"
+#define CL_VT100_CYAN    "\x1B[36;1m"
+#else
+#define CL_VT100_RESET
+#define CL_VT100_RED
+#define CL_VT100_MAGENTA
+#define CL_VT100_CYAN
+#endif
 
-template <typename Lhs, typename Rhs1, typename... Rhs>
-CL_FORCE_INLINE bool IsAnyOf(Lhs const& lhs, Rhs1&& rhs1, Rhs&&... rhs) {
-    return (lhs == std::forward<Rhs1>(rhs1))
-        ? true
-        : cl::impl::IsAnyOf(lhs, std::forward<Rhs>(rhs)...);
+inline void Cmdline::PrintDiag() const {
+    for (auto const& d : diag_records_) {
+        fprintf(stderr, "%.*s: ", static_cast<int>(Name().size()), Name().data());
+
+        int const len = static_cast<int>(d.length);
+        char const* const text = diag_text_.data() + d.offset;
+
+        switch (d.type) {
+        case Diagnostic::error:
+            fprintf(stderr, CL_VT100_RED "error:" CL_VT100_RESET " %.*s\n", len, text);
+            break;
+        case Diagnostic::warning:
+            fprintf(stderr, CL_VT100_MAGENTA "warning:" CL_VT100_RESET " %.*s\n", len, text);
+            break;
+        case Diagnostic::note:
+            fprintf(stderr, CL_VT100_CYAN "note:" CL_VT100_RESET " %.*s\n", len, text);
+            break;
+        }
+    }
 }
 
+#undef CL_VT100_RESET
+#undef CL_VT100_RED
+#undef CL_VT100_MAGENTA
+#undef CL_VT100_CYAN
+
 #endif
 
-inline bool StartsWith(string_view str, string_view prefix) {
-    return str.size() >= prefix.size() && str.substr(0, prefix.size()) == prefix;
-}
+//==================================================================================================
+// Help layout
+//==================================================================================================
 
-inline bool IsWhitespace(char ch) {
-    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\v' || ch == '\f' || ch == '\r';
+namespace impl {
+
+// Returns the number of columns the codepoint U occupies on a terminal.
+inline size_t DisplayWidth(char32_t U) {
+    // Control characters.
+    if (U < 0x20 || (U >= 0x7F && U < 0xA0)) {
+        return 0;
+    }
+    // Combining marks and zero-width spaces.
+    if ((U >= 0x0300 && U <= 0x036F) || (U >= 0x1AB0 && U <= 0x1AFF) || (U >= 0x1DC0 && U <= 0x1DFF) ||
+        (U >= 0x200B && U <= 0x200F) || (U >= 0x20D0 && U <= 0x20FF) || (U >= 0xFE20 && U <= 0xFE2F)) {
+        return 0;
+    }
+    // East Asian wide and fullwidth characters, and emoji.
+    if ((U >= 0x1100 && U <= 0x115F) || (U >= 0x2E80 && U <= 0x303E) || (U >= 0x3041 && U <= 0xA4CF) ||
+        (U >= 0xAC00 && U <= 0xD7A3) || (U >= 0xF900 && U <= 0xFAFF) || (U >= 0xFE30 && U <= 0xFE4F) ||
+        (U >= 0xFF00 && U <= 0xFF60) || (U >= 0xFFE0 && U <= 0xFFE6) || (U >= 0x1F300 && U <= 0x1F64F) ||
+        (U >= 0x1F900 && U <= 0x1F9FF) || (U >= 0x20000 && U <= 0x3FFFD)) {
+        return 2;
+    }
+    return 1;
 }
 
-template <typename It>
-It SkipWhitespace(It next, It last) {
-    while (next != last && IsWhitespace(*next)) {
-        ++next;
+// Returns the number of columns the UTF-8 string STR occupies on a terminal.
+inline size_t DisplayWidth(string_view str) {
+    size_t width = 0;
+
+    char const* next = str.data();
+    char const* const last = next + str.size();
+    while (next != last) {
+        auto const b = static_cast<uint8_t>(*next);
+        if (b < 0x80) {
+            width += (b >= 0x20 && b != 0x7F) ? 1 : 0;
+            ++next;
+        } else {
+            char32_t U = 0;
+            next = cl::impl::DecodeUTF8Sequence(next, last, U);
+            width += cl::impl::DisplayWidth(U);
+        }
     }
 
-    return next;
+    return width;
 }
 
-} // namespace impl
+enum class HelpSpanKind : uint8_t {
+    word, // A sequence of non-whitespace characters
+    tab,  // A tab-character. Sets the indentation for the rest of the line.
+    line, // A line break
+};
 
-//==================================================================================================
-// Parser
-//==================================================================================================
+// A part of a description. The spans of a description are stored in order
+// and are only ever read sequentially, so they do not store their offset.
+// Spans are 8 bytes, so that a cache line holds 8 of them. Words which are
+// longer than UINT16_MAX bytes are stored as multiple spans.
+struct HelpSpan {
+    uint16_t gap;    // Number of spaces preceding this span
+    uint16_t length; // In bytes
+    uint16_t width;  // In columns
+    HelpSpanKind kind;
+};
 
-namespace impl {
+// An option or a sub-command, as listed in the help message.
+struct HelpEntry {
+    OptionBase const* option = nullptr; // nullptr for sub-commands
+    string_view name;
+    string_view descr;
+    size_t name_width = 0;
+    size_t first_span = 0; // Index into HelpLayout::spans
+    size_t last_span = 0;
+};
 
-// Convert the string representation in CTX.ARG into an object of type T.
-// Possibly emits diagnostics on error.
-template <typename T = void, typename /*Enable*/ = void>
-struct ConvertTo {
-    static_assert(cl::impl::IsStreamExtractable<T>::value,
-        "The default implementation of 'ConvertTo<T>' requires the type 'T' is stream-extractable");
+// The options and sub-commands of a Schema, in the order in which they are
+// listed in the help message, with their descriptions broken into spans.
+// The layout does not depend on the HelpFormat, so it is built once and then
+// used for all formats and styles.
+struct HelpLayout {
+    enum Section { kArguments, kOptions, kPositionals, kCommands, kNumSections };
 
-    template <typename Stream = std::istringstream>
-    bool operator()(ParseContext const& ctx, T& value) const {
-        Stream stream{std::string(ctx.arg)};
-        stream >> value;
-        // This function should fail if there are any characters left in the
-        // input stream, but there are cases for which all characters have been
-        // extracted and the eofbit is not set yet.
-        return !stream.fail() && (stream.rdbuf()->in_avail() == 0);
-    }
+    std::vector<HelpEntry> entries;
+    std::vector<HelpSpan> spans;
+    size_t section_begin[kNumSections + 1] = {}; // Indices into entries
+    HelpEntry program; // The name and the description of the Schema itself
+
+    // Returns an upper bound for the number of spans of DESCR.
+    static size_t MaxSpans(string_view descr);
+
+    // Breaks DESCR into spans and returns the entry. Does not add the entry.
+    HelpEntry Tokenize(OptionBase const* option, string_view name, string_view descr);
 };
 
-template <>
-struct ConvertTo<bool> {
-    bool operator()(ParseContext const& ctx, bool& value) const {
-        if (cl::impl::IsAnyOf(ctx.arg, string_view{}, "1", "y", "yes", "Yes", "on", "On", "true", "True")) {
-            value = true;
-        } else if (cl::impl::IsAnyOf(ctx.arg, "0", "n", "no", "No", "off", "Off", "false", "False")) {
-            value = false;
+inline size_t HelpLayout::MaxSpans(string_view descr) {
+    // Each span is either a whitespace character, or preceded by one, or the
+    // first span of the description, or a part of a very long word.
+    auto const num_ws = std::count_if(descr.begin(), descr.end(), [](char ch) { return static_cast<uint8_t>(ch) <= ' '; });
+    return 1 + static_cast<size_t>(num_ws) + descr.size() / UINT16_MAX;
+}
+
+inline HelpEntry HelpLayout::Tokenize(OptionBase const* option, string_view name, string_view descr) {
+    CL_ASSERT(cl::impl::IsUTF8(descr.begin(), descr.end()));
+
+    HelpEntry entry;
+    entry.option = option;
+    entry.name = name;
+    entry.descr = descr;
+    entry.name_width = cl::impl::DisplayWidth(name);
+    entry.first_span = spans.size();
+
+    char const* const last = descr.data() + descr.size();
+
+    auto const push = [&](size_t gap, size_t length, size_t width, HelpSpanKind kind) {
+        // Very long gaps are stored as empty words.
+        for ( ; gap > UINT16_MAX; gap -= UINT16_MAX) {
+            spans.push_back({UINT16_MAX, 0, 0, HelpSpanKind::word});
+        }
+        spans.push_back({static_cast<uint16_t>(gap), static_cast<uint16_t>(length), static_cast<uint16_t>(width), kind});
+    };
+
+    bool has_tab = false; // In the current line
+    char const* p = descr.data();
+    while (p != last) {
+        char const* const s = p;
+        while (p != last && *p == ' ') {
+            ++p;
+        }
+        if (p == last) {
+            break; // Trailing spaces are not shown.
+        }
+
+        auto const gap = static_cast<size_t>(p - s);
+        if (*p == '\n' || *p == '\r') {
+            // If this is CRLF, skip the other half.
+            size_t const length = (*p == '\r' && p + 1 != last && p[1] == '\n') ? 2 : 1;
+            push(gap, length, 0, HelpSpanKind::line);
+            has_tab = false;
+            p += length;
+        } else if (*p == '\t') {
+            CL_ASSERT(!has_tab && "Only a single tab-character per line is allowed");
+            push(gap, 1, 0, HelpSpanKind::tab);
+            has_tab = true;
+            ++p;
         } else {
-            return false;
+            char const* const w = p;
+            // Printable ASCII characters occupy one column each.
+            while (p != last && static_cast<uint8_t>(*p - 0x21) < 0x5E) {
+                ++p;
+            }
+            bool const ascii = (p == last || *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r');
+            if (!ascii) {
+                while (p != last && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+                    ++p;
+                }
+            }
+
+            auto length = static_cast<size_t>(p - w);
+            if (length <= UINT16_MAX) {
+                push(gap, length, ascii ? length : cl::impl::DisplayWidth(string_view(w, length)), HelpSpanKind::word);
+            } else {
+                // Split at codepoint boundaries.
+                size_t split_gap = gap;
+                for (char const* q = w; q != p; ) {
+                    char const* e = (p - q > UINT16_MAX) ? q + UINT16_MAX : p;
+                    while (e != p && (static_cast<uint8_t>(*e) & 0xC0) == 0x80) {
+                        --e;
+                    }
+                    length = static_cast<size_t>(e - q);
+                    push(split_gap, length, cl::impl::DisplayWidth(string_view(q, length)), HelpSpanKind::word);
+                    split_gap = 0;
+                    q = e;
+                }
+            }
         }
+    }
 
-        return true;
+    entry.last_span = spans.size();
+    return entry;
+}
+
+// Collects the help message in a fixed-size buffer and passes it to a sink in
+// chunks.
+class HelpWriter {
+public:
+    using FlushFn = void (*)(void* sink, string_view chunk);
+
+private:
+    static constexpr size_t kBufferSize = 1024;
+
+    char buf_[kBufferSize];
+    size_t size_ = 0;
+    void* sink_;
+    FlushFn flush_;
+
+public:
+    HelpWriter(void* sink, FlushFn flush) : sink_(sink), flush_(flush) {}
+
+    HelpWriter(HelpWriter const&) = delete;
+    HelpWriter& operator=(HelpWriter const&) = delete;
+
+    void Put(char ch) {
+        if (size_ == kBufferSize) {
+            Flush();
+        }
+        buf_[size_++] = ch;
     }
-};
 
-enum class ParseNumberStatus {
-    success,
-    syntax_error,
-    overflow,
-};
+    void Put(string_view str) {
+        if (str.size() > kBufferSize - size_) {
+            Flush();
+            if (str.size() >= kBufferSize) {
+                flush_(sink_, str);
+                return;
+            }
+        }
+        std::copy(str.begin(), str.end(), buf_ + size_);
+        size_ += str.size();
+    }
 
-struct ParseNumberResult {
-    char const* ptr;
-    ParseNumberStatus ec;
+    void PutSpaces(size_t count) {
+        while (count > 0) {
+            if (size_ == kBufferSize) {
+                Flush();
+            }
+            auto const n = std::min(count, kBufferSize - size_);
+            std::fill_n(buf_ + size_, n, ' ');
+            size_ += n;
+            count -= n;
+        }
+    }
 
-    // Test for successful conversion.
-    explicit operator bool() const {
-        return ec == ParseNumberStatus::success;
+    void Flush() {
+        if (size_ != 0) {
+            flush_(sink_, string_view(buf_, size_));
+            size_ = 0;
+        }
     }
 };
 
-// Returns the decimal value for the given hexadecimal character.
-// Returns UINT8_MAX, if the given character is not a hexadecimal character.
-inline uint8_t HexDigitValue(char ch)
-{
-    enum : uint8_t { N = UINT8_MAX };
-    static constexpr uint8_t kMap[256] = {
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
-        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, N, N, N, N, N, N,
-        N, 10,11,12,13,14,15,N, N, N, N, N, N, N, N, N,
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
-        N, 10,11,12,13,14,15,N, N, N, N, N, N, N, N, N,
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
-        N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+// Writes DESCR, given by the spans [FIRST, LAST), wrapped into lines of WIDTH columns
+// which are indented by INDENT columns.
+// Assumes: currently at column = 'indent'
+inline void WriteWrapped(HelpWriter& out, string_view descr, HelpSpan const* first, HelpSpan const* last, size_t indent, size_t width) {
+    // Minimum width of the indented block following a tab-character.
+    constexpr size_t kMinBlockWidth = 8;
+
+    CL_ASSERT(width > 0);
+
+    size_t const right = (width > SIZE_MAX - indent) ? SIZE_MAX : indent + width;
+    size_t margin = indent; // The indentation of the current line
+    size_t col = indent;
+    bool empty = true;      // No words in the current line (or block), yet
+    size_t pos = 0;         // The offset of the current span in DESCR
+
+    // Words which fit into the current line are written in runs, along with
+    // the spaces between them, which are part of DESCR.
+    size_t run_begin = 0;
+    size_t run_end = 0;
+
+    auto const flush_run = [&] {
+        out.Put(descr.substr(run_begin, run_end - run_begin));
+        run_begin = run_end;
+    };
+
+    auto const new_line = [&] {
+        flush_run();
+        out.Put('\n');
+        out.PutSpaces(margin);
+        col = margin;
     };
 
-    return kMap[static_cast<uint8_t>(ch)];
+    for (auto span = first; span != last; pos += span->length, ++span) {
+        pos += span->gap;
+
+        switch (span->kind) {
+        case HelpSpanKind::line:
+            margin = indent;
+            new_line();
+            empty = true;
+            break;
+
+        case HelpSpanKind::tab:
+            // The rest of the line is indented to the current column.
+            // Spaces preceding the tab-character are part of the first half.
+            flush_run();
+            if (col + span->gap <= right) {
+                out.PutSpaces(span->gap);
+                col += span->gap;
+            }
+            margin = indent + (col - indent) % width;
+            empty = (col == margin);
+            break;
+
+        case HelpSpanKind::word:
+            if (col + span->gap + span->width > right && margin != indent && right - margin < kMinBlockWidth && span->width > right - margin) {
+                // The block following the tab-character is too narrow for
+                // this word. Continue at the original indentation instead
+                // of breaking the word into tiny pieces.
+                margin = indent;
+                empty = false;
+            }
+
+            if (col + span->gap + span->width <= right) {
+                if (run_end != pos - span->gap) {
+                    flush_run();
+                    run_begin = pos - span->gap;
+                }
+                run_end = pos + span->length;
+                col += span->gap + span->width;
+            } else {
+                if (!empty) {
+                    new_line();
+                } else {
+                    flush_run();
+                }
+
+                // Break words which are too long for a single line.
+                // Each line contains at least one codepoint.
+                string_view rest = descr.substr(pos, span->length);
+                size_t rest_width = span->width;
+                while (col + rest_width > right) {
+                    size_t piece_width = 0;
+                    char const* p = rest.data();
+                    char const* const end = p + rest.size();
+                    while (p != end) {
+                        char32_t U = 0;
+                        auto const q = cl::impl::DecodeUTF8Sequence(p, end, U);
+                        auto const w = cl::impl::DisplayWidth(U);
+                        if (p != rest.data() && col + piece_width + w > right) {
+                            break;
+                        }
+                        piece_width += w;
+                        p = q;
+                    }
+
+                    auto const length = static_cast<size_t>(p - rest.data());
+                    out.Put(rest.substr(0, length));
+                    rest.remove_prefix(length);
+                    rest_width -= piece_width;
+                    if (rest.empty()) {
+                        col += piece_width;
+                        break;
+                    }
+                    new_line();
+                }
+
+                if (!rest.empty()) {
+                    out.Put(rest);
+                    col += rest_width;
+                }
+            }
+            empty = false;
+            break;
+        }
+    }
+
+    flush_run();
 }
 
-inline bool IsHexDigit(char ch) {
-    return HexDigitValue(ch) != UINT8_MAX;
-}
+// Writes the name of the option along with a short description of its
+// argument (if any). Returns the number of columns written.
+inline size_t WriteTextUsage(HelpWriter& out, HelpEntry const& e) {
+    if (e.option == nullptr) {
+        out.Put(e.name);
+        return e.name_width;
+    }
 
-inline ParseNumberResult ParseU64(char const* next, char const* last, uint64_t& value) {
-    CL_ASSERT(next != last);
+    auto const opt = e.option;
+    if (opt->HasFlag(Positional::yes)) {
+        out.Put('<');
+        out.Put(e.name);
+        out.Put('>');
+        if (opt->HasFlag(Multiple::yes)) {
+            out.Put("...");
+            return e.name_width + 5;
+        }
+        return e.name_width + 2;
+    }
 
-    uint64_t max_pre_multiply;
-    uint32_t base;
+    out.Put("--");
+    out.Put(e.name);
+    if (opt->HasFlag(Arg::required) && opt->HasFlag(MayJoin::yes)) {
+        out.Put("<arg>");
+        return e.name_width + 7;
+    }
+    if (opt->HasFlag(Arg::required)) {
+        out.Put(" <arg>");
+        return e.name_width + 8;
+    }
+    if (opt->HasFlag(Arg::optional)) {
+        out.Put("=<arg>");
+        return e.name_width + 8;
+    }
+    return e.name_width + 2;
+}
 
-    // Determine base and optionally skip prefix.
-    if (*next == '0') {
-        ++next;
-        if (next == last) { // literal "0"
-            value = 0;
-            return {next, ParseNumberStatus::success};
+// Writes STR, escaped for roff. AT_LINE_START must be true if STR starts a
+// new input line.
+inline void WriteRoff(HelpWriter& out, string_view str, bool at_line_start) {
+    if (at_line_start && !str.empty() && (str[0] == '.' || str[0] == '\'')) {
+        out.Put("\\&");
+    }
+    for (char const ch : str) {
+        if (ch == '\\') {
+            out.Put("\\e");
+        } else if (ch == '-') {
+            out.Put("\\-");
+        } else {
+            out.Put(ch);
         }
+    }
+}
 
-        switch (*next) {
-        case 'x':
-        case 'X':
-            ++next;
-            max_pre_multiply = UINT64_MAX / 16;
-            base = 16;
-            break;
-        case 'b':
-        case 'B':
-            ++next;
-            max_pre_multiply = UINT64_MAX / 2;
-            base = 2;
-            break;
-        case 'o':
-        case 'O':
-            ++next;
-            // fall through
-        default:
-            max_pre_multiply = UINT64_MAX / 8;
-            base = 8;
-            break;
+// Writes the name of the option along with a short description of its
+// argument (if any), formatted for roff.
+inline void WriteRoffUsage(HelpWriter& out, HelpEntry const& e) {
+    if (e.option == nullptr) {
+        out.Put("\\fB");
+        cl::impl::WriteRoff(out, e.name, /*at_line_start*/ false);
+        out.Put("\\fR");
+        return;
+    }
+
+    auto const opt = e.option;
+    if (opt->HasFlag(Positional::yes)) {
+        out.Put("\\fI");
+        cl::impl::WriteRoff(out, e.name, /*at_line_start*/ false);
+        out.Put("\\fR");
+        if (opt->HasFlag(Multiple::yes)) {
+            out.Put("...");
         }
+        return;
     }
-    else
-    {
-        max_pre_multiply = UINT64_MAX / 10;
-        base = 10;
+
+    out.Put("\\fB\\-\\-");
+    cl::impl::WriteRoff(out, e.name, /*at_line_start*/ false);
+    out.Put("\\fR");
+    if (opt->HasFlag(Arg::required) && opt->HasFlag(MayJoin::yes)) {
+        out.Put("\\fIarg\\fR");
+    } else if (opt->HasFlag(Arg::required)) {
+        out.Put(" \\fIarg\\fR");
+    } else if (opt->HasFlag(Arg::optional)) {
+        out.Put("[=\\fIarg\\fR]");
     }
+}
 
-    uint64_t v = 0;
-    for (;;) {
-        if (next == last) {
+// Writes STR, escaped for Markdown.
+inline void WriteMarkdown(HelpWriter& out, string_view str) {
+    for (char const ch : str) {
+        switch (ch) {
+        case '\\':
+        case '`':
+        case '*':
+        case '_':
+        case '[':
+        case ']':
+        case '<':
+        case '>':
+        case '|':
+            out.Put('\\');
             break;
         }
-        uint32_t const d = HexDigitValue(*next);
-        if (d >= base) {
+        out.Put(ch);
+    }
+}
+
+// Writes a description for a format which wraps lines itself: words are
+// separated by single spaces and explicit line breaks are written as
+// LINE_BREAK.
+template <typename WriteWord>
+void WriteFlowed(HelpWriter& out, HelpEntry const& e, HelpSpan const* spans, string_view line_break, WriteWord write_word) {
+    bool at_line_start = true;
+    bool pending_space = false;
+    size_t pos = 0; // The offset of the current span in E.DESCR
+
+    for (size_t i = e.first_span; i != e.last_span; pos += spans[i].length, ++i) {
+        auto const& span = spans[i];
+        pos += span.gap;
+
+        switch (span.kind) {
+        case HelpSpanKind::line:
+            out.Put(line_break);
+            at_line_start = true;
+            pending_space = false;
+            break;
+        case HelpSpanKind::tab:
+            pending_space = !at_line_start;
+            break;
+        case HelpSpanKind::word:
+            if (pending_space || (span.gap != 0 && !at_line_start)) {
+                out.Put(' ');
+            }
+            write_word(e.descr.substr(pos, span.length), at_line_start);
+            at_line_start = false;
+            pending_space = false;
             break;
         }
-        if (v > max_pre_multiply || d > UINT64_MAX - base * v) {
-            return {next, ParseNumberStatus::overflow};
-        }
-        v = base * v + d;
-        ++next;
     }
-
-    value = v;
-    return {next, ParseNumberStatus::success};
 }
 
-inline ParseNumberResult StrToU64(char const* next, char const* last, uint64_t& value) {
-    next = SkipWhitespace(next, last);
+} // namespace impl
 
-    if (next == last) {
-        return {next, ParseNumberStatus::syntax_error};
-    }
+struct Schema::HelpCacheEntry {
+    HelpFormat fmt;
+    std::shared_ptr<std::string const> text;
+};
 
-    // Skip optional '+' sign.
-    // A leading minus sign is considered invalid while parsing *unsigned* integers
-    // and will result in a syntax_error in ParseU64.
-    if (*next == '+') {
-        ++next;
-        if (next == last) {
-            return {next, ParseNumberStatus::syntax_error};
+inline std::shared_ptr<std::string const> Schema::CachedHelp(HelpFormat const& fmt) const {
+    // Maximum number of help messages kept in the cache.
+    constexpr size_t kMaxEntries = 4;
+
+    // Note: Must be called before locking the cache.
+    auto const layout = GetHelpLayout();
+
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+
+    for (auto const& e : help_cache_) {
+        if (e.fmt.indent == fmt.indent && e.fmt.descr_indent == fmt.descr_indent && e.fmt.line_length == fmt.line_length && e.fmt.style == fmt.style) {
+            return e.text;
         }
     }
 
-    return ParseU64(next, last, value);
+    if (help_cache_.size() >= kMaxEntries) {
+        help_cache_.erase(help_cache_.begin());
+    }
+
+    help_cache_.push_back({fmt, std::make_shared<std::string const>(BuildHelp(*layout, fmt))});
+    return help_cache_.back().text;
 }
 
-inline ParseNumberResult StrToI64(char const* next, char const* last, int64_t& value) {
-    next = SkipWhitespace(next, last);
+inline std::string Schema::FormatHelp(HelpFormat const& fmt) const {
+    return *CachedHelp(fmt);
+}
 
-    if (next == last) {
-        return {next, ParseNumberStatus::syntax_error};
+template <typename Fn>
+void Schema::ForEachNameWithPrefix(string_view prefix, Fn fn) const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+
+    // Options are only ever appended, so the index is up to date iff it has the same size.
+    if (sorted_names_.size() != options_.size()) {
+        sorted_names_.resize(options_.size());
+        for (size_t i = 0; i < sorted_names_.size(); ++i) {
+            sorted_names_[i] = i;
+        }
+
+        std::sort(sorted_names_.begin(), sorted_names_.end(), [&](size_t lhs, size_t rhs) {
+            return options_[lhs].name < options_[rhs].name;
+        });
     }
 
-    bool const is_negative = (*next == '-');
+    auto it = std::lower_bound(sorted_names_.begin(), sorted_names_.end(), prefix, [&](size_t lhs, string_view name) {
+        return options_[lhs].name < name;
+    });
 
-    // Skip optional '+' or '-' sign.
-    if (is_negative || *next == '+') {
-        ++next;
-        if (next == last) {
-            return {next, ParseNumberStatus::syntax_error};
-        }
+    for (; it != sorted_names_.end() && cl::impl::StartsWith(options_[*it].name, prefix); ++it) {
+        fn(options_[*it].name, static_cast<OptionBase const*>(options_[*it].option));
     }
+}
 
-    uint64_t v;
-    auto const res = ParseU64(next, last, v);
-    if (res) {
-        // The number fits into an uint64_t. Check if it fits into an int64_t, too.
-        // Assuming 2's complement.
-
-        constexpr uint64_t Limit = 9223372036854775808ull; // -INT64_MIN
+inline void Schema::SuggestOptions(string_view name, size_t max_results, std::vector<string_view>& out) const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
 
-        if (is_negative && v == Limit) {
-            value = INT64_MIN;
-        } else if (v >= Limit) {
-            return {next, ParseNumberStatus::overflow};
-        } else {
-            value = static_cast<int64_t>(is_negative ? (0 - v) : v);
+    // Options are only ever appended, so the index is up to date iff it has seen all names.
+    if (num_suggested_names_ != options_.size()) {
+        for (size_t i = num_suggested_names_; i < options_.size(); ++i) {
+            if (options_[i].option->HasFlag(Positional::no)) {
+                suggestions_.Insert(options_[i].name);
+            }
         }
+        suggestions_.Build();
+        num_suggested_names_ = options_.size();
     }
 
-    return res;
+    suggestions_.Suggest(name, max_results, out);
 }
 
-struct ConvertToInt {
-    template <typename T>
-    bool operator()(ParseContext const& ctx, T& value) const {
-        auto const next = ctx.arg.data();
-        auto const last = ctx.arg.data() + ctx.arg.size();
+template <typename Sink, std::enable_if_t<!std::is_convertible<Sink, Schema::HelpFormat const&>::value, int>>
+void Schema::FormatHelp(Sink&& sink, HelpFormat const& fmt) const {
+    // Keeps the message alive, even if another thread replaces the cache entry.
+    auto const text = CachedHelp(fmt);
+    sink(string_view(text->data(), text->size()));
+}
 
-        int64_t v = 0;
-        auto const res = StrToI64(next, last, v);
+inline std::shared_ptr<impl::HelpLayout const> Schema::GetHelpLayout() const {
+    using Layout = impl::HelpLayout;
 
-        if (res && res.ptr == last && v >= (std::numeric_limits<T>::min)() && v <= (std::numeric_limits<T>::max)()) {
-            value = static_cast<T>(v);
-            return true;
-        }
+    std::lock_guard<std::mutex> lock(cache_mutex_);
 
-        return false;
+    if (help_layout_ != nullptr) {
+        return help_layout_;
     }
-};
 
-struct ConvertToUnsignedInt {
-    template <typename T>
-    bool operator()(ParseContext const& ctx, T& value) const {
-        auto const next = ctx.arg.data();
-        auto const last = ctx.arg.data() + ctx.arg.size();
+    size_t num_spans = Layout::MaxSpans(Descr());
+    ForEachUniqueOption([&](OptionBase const* opt) {
+        num_spans += Layout::MaxSpans(opt->Descr());
+        return true;
+    });
+    for (auto const& entry : subcommands_) {
+        num_spans += Layout::MaxSpans(entry.descr);
+    }
 
-        uint64_t v = 0;
-        auto const res = StrToU64(next, last, v);
+    auto layout = std::make_shared<Layout>();
+    layout->spans.reserve(num_spans);
+    layout->entries.reserve(static_cast<size_t>(num_ids_) + subcommands_.size());
+    layout->program = layout->Tokenize(nullptr, Name(), Descr());
 
-        if (res && res.ptr == last && v <= (std::numeric_limits<T>::max)()) {
-            value = static_cast<T>(v);
-            return true;
+    // Required options, aka 'arguments', come first.
+    auto const section_of = [](OptionBase const* opt) {
+        if (!opt->HasFlag(Required::no)) {
+            return Layout::kArguments;
         }
+        return opt->HasFlag(Positional::yes) ? Layout::kPositionals : Layout::kOptions;
+    };
 
-        return false;
+    for (int section = Layout::kArguments; section < Layout::kCommands; ++section) {
+        layout->section_begin[section] = layout->entries.size();
+        ForEachUniqueOption([&](OptionBase const* opt) {
+            if (section_of(opt) == section) {
+                layout->entries.push_back(layout->Tokenize(opt, opt->Name(), opt->Descr()));
+            }
+            return true;
+        });
     }
-};
 
-template <> struct ConvertTo< signed char        > : cl::impl::ConvertToInt {};
-template <> struct ConvertTo< signed short       > : cl::impl::ConvertToInt {};
-template <> struct ConvertTo< signed int         > : cl::impl::ConvertToInt {};
-template <> struct ConvertTo< signed long        > : cl::impl::ConvertToInt {};
-template <> struct ConvertTo< signed long long   > : cl::impl::ConvertToInt {};
-template <> struct ConvertTo< unsigned char      > : cl::impl::ConvertToUnsignedInt {};
-template <> struct ConvertTo< unsigned short     > : cl::impl::ConvertToUnsignedInt {};
-template <> struct ConvertTo< unsigned int       > : cl::impl::ConvertToUnsignedInt {};
-template <> struct ConvertTo< unsigned long      > : cl::impl::ConvertToUnsignedInt {};
-template <> struct ConvertTo< unsigned long long > : cl::impl::ConvertToUnsignedInt {};
+    layout->section_begin[Layout::kCommands] = layout->entries.size();
+    for (auto const& entry : subcommands_) {
+        layout->entries.push_back(layout->Tokenize(nullptr, entry.name, entry.descr));
+    }
+    layout->section_begin[Layout::kNumSections] = layout->entries.size();
 
-#if CL_HAS_STD_CHARCONV
-template <typename T>
-inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, T& value) {
-    std::chars_format fmt;
+    help_layout_ = std::move(layout);
+    return help_layout_;
+}
 
-    // std::from_chars does not automatically determine the base (and does not skip any prefixes).
-    bool const is_hex = (last - next >= 2) && (next[0] == '0') && (next[1] == 'x' || next[1] == 'X');
-    if (is_hex) {
-        fmt = std::chars_format::hex;
-        next += 2; // Skip prefix ('0x' or '0X')
-    } else {
-        fmt = std::chars_format::general;
+inline void Schema::EmitHelp(impl::HelpWriter& out, impl::HelpLayout const& layout, HelpFormat const& fmt) const {
+    switch (fmt.style) {
+    case HelpStyle::text:
+        WriteTextHelp(out, layout, fmt);
+        break;
+    case HelpStyle::man:
+        WriteManHelp(out, layout);
+        break;
+    case HelpStyle::markdown:
+        WriteMarkdownHelp(out, layout);
+        break;
     }
+}
 
-    if (next == last) {
-        return {next, ParseNumberStatus::syntax_error};
+inline void Schema::WriteSynopsis(impl::HelpWriter& out, impl::HelpLayout const& layout) const {
+    using Layout = impl::HelpLayout;
+
+    out.Put(Name());
+    for (size_t i = layout.section_begin[Layout::kArguments]; i != layout.section_begin[Layout::kArguments + 1]; ++i) {
+        out.Put(' ');
+        cl::impl::WriteTextUsage(out, layout.entries[i]);
+    }
+    if (layout.section_begin[Layout::kOptions] != layout.section_begin[Layout::kOptions + 1]) {
+        out.Put(" [options]");
     }
+    if (!subcommands_.empty()) {
+        out.Put(" <command> [args...]");
+    }
+}
 
-    auto const res = std::from_chars(next, last, value, fmt);
-    switch (res.ec) {
-    case std::errc{}:
-        return {res.ptr, ParseNumberStatus::success};
-    case std::errc::result_out_of_range:
-        // XXX:
-        // Is result_out_of_range actually ever returned from from_chars for floating-point?!?!
-#if 1
-        return {res.ptr, ParseNumberStatus::success};
-#else
-        return {res.ptr, ParseNumberStatus::overflow};
-#endif
-    default:
-        return {res.ptr, ParseNumberStatus::syntax_error};
+inline void Schema::WriteTextHelp(impl::HelpWriter& out, impl::HelpLayout const& layout, HelpFormat const& fmt) const {
+    CL_ASSERT(fmt.descr_indent > fmt.indent);
+    CL_ASSERT(fmt.descr_indent < SIZE_MAX);
+
+    auto const line_length = (fmt.line_length == 0) ? SIZE_MAX : fmt.line_length;
+    CL_ASSERT(line_length > fmt.descr_indent);
+    auto const descr_width = line_length - fmt.descr_indent;
+
+    static constexpr char const* kTitles[] = {"\nArguments:\n", "\nOptions:\n", "\nPositional options:\n", "\nCommands:\n"};
+
+    out.Put(Name());
+    out.Put(" - ");
+    out.Put(Descr());
+    out.Put("\n\nUsage:\n");
+    out.PutSpaces(fmt.indent);
+    WriteSynopsis(out, layout);
+    out.Put('\n');
+
+    for (int section = 0; section < impl::HelpLayout::kNumSections; ++section) {
+        auto const first = layout.section_begin[section];
+        auto const last = layout.section_begin[section + 1];
+        if (first == last) {
+            continue;
+        }
+
+        out.Put(kTitles[section]);
+        for (size_t i = first; i != last; ++i) {
+            auto const& e = layout.entries[i];
+
+            // Note: not wrapped.
+            out.PutSpaces(fmt.indent);
+            auto const col = fmt.indent + cl::impl::WriteTextUsage(out, e);
+
+            if (e.first_span != e.last_span) {
+                // Move to column 'descr_indent'.
+                // Possibly on the next line.
+                if (col >= fmt.descr_indent) {
+                    out.Put('\n');
+                    out.PutSpaces(fmt.descr_indent);
+                } else {
+                    out.PutSpaces(fmt.descr_indent - col);
+                }
+
+                auto const spans = layout.spans.data();
+                cl::impl::WriteWrapped(out, e.descr, spans + e.first_span, spans + e.last_span, fmt.descr_indent, descr_width);
+            }
+
+            out.Put('\n');
+        }
     }
 }
 
-//template <typename T>
-//inline ParseNumberResult StrToFloatingPoint(string_view sv, T& value) {
-//    return cl::impl::StrToFloatingPoint(sv.data(), sv.data() + sv.size(), value);
-//}
-#else // ^^^ CL_HAS_STD_CHARCONV ^^^
-template <typename T, typename Fn>
-inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, T& value, Fn fn) {
-    if (next == last) {
-        return {next, ParseNumberStatus::syntax_error};
+inline void Schema::WriteManHelp(impl::HelpWriter& out, impl::HelpLayout const& layout) const {
+    using Layout = impl::HelpLayout;
+
+    static constexpr char const* kTitles[] = {".SH ARGUMENTS\n", ".SH OPTIONS\n", ".SH \"POSITIONAL OPTIONS\"\n", ".SH COMMANDS\n"};
+
+    auto const write_roff = [&](string_view word, bool at_line_start) {
+        cl::impl::WriteRoff(out, word, at_line_start);
+    };
+
+    out.Put(".TH \"");
+    cl::impl::WriteRoff(out, Name(), /*at_line_start*/ false);
+    out.Put("\" 1\n.SH NAME\n");
+    cl::impl::WriteRoff(out, Name(), /*at_line_start*/ true);
+    if (layout.program.first_span != layout.program.last_span) {
+        out.Put(" \\- ");
+        cl::impl::WriteFlowed(out, layout.program, layout.spans.data(), " ", [&](string_view word, bool /*at_line_start*/) {
+            cl::impl::WriteRoff(out, word, /*at_line_start*/ false);
+        });
+    }
+
+    out.Put("\n.SH SYNOPSIS\n\\fB");
+    cl::impl::WriteRoff(out, Name(), /*at_line_start*/ false);
+    out.Put("\\fR");
+    for (size_t i = layout.section_begin[Layout::kArguments]; i != layout.section_begin[Layout::kArguments + 1]; ++i) {
+        out.Put(' ');
+        cl::impl::WriteRoffUsage(out, layout.entries[i]);
+    }
+    if (layout.section_begin[Layout::kOptions] != layout.section_begin[Layout::kOptions + 1]) {
+        out.Put(" [\\fIoptions\\fR]");
+    }
+    if (!subcommands_.empty()) {
+        out.Put(" \\fIcommand\\fR [\\fIargs\\fR...]");
+    }
+    out.Put('\n');
+
+    for (int section = 0; section < Layout::kNumSections; ++section) {
+        auto const first = layout.section_begin[section];
+        auto const last = layout.section_begin[section + 1];
+        if (first == last) {
+            continue;
+        }
+
+        out.Put(kTitles[section]);
+        for (size_t i = first; i != last; ++i) {
+            auto const& e = layout.entries[i];
+
+            out.Put(".TP\n");
+            cl::impl::WriteRoffUsage(out, e);
+            out.Put('\n');
+            if (e.first_span != e.last_span) {
+                cl::impl::WriteFlowed(out, e, layout.spans.data(), "\n.br\n", write_roff);
+                out.Put('\n');
+            }
+        }
     }
+}
 
-    std::string str(next, last);
+inline void Schema::WriteMarkdownHelp(impl::HelpWriter& out, impl::HelpLayout const& layout) const {
+    using Layout = impl::HelpLayout;
 
-    char const* begin = str.c_str();
-    char* end = nullptr;
+    static constexpr char const* kTitles[] = {"\n## Arguments\n\n", "\n## Options\n\n", "\n## Positional options\n\n", "\n## Commands\n\n"};
 
-#if 0
-    // Seems that std::from_chars doesn't return std::errc::result_out_of_range even
-    // if finite non-zero numbers round to infinity or 0.0.
-    // So we ignore errno here... :-/
-    auto const val = fn(begin, &end);
-    next += end - begin;
-#else
-    int& ec = errno;
+    auto const write_markdown = [&](string_view word, bool /*at_line_start*/) {
+        cl::impl::WriteMarkdown(out, word);
+    };
 
-    auto const ec0 = std::exchange(ec, 0);
-    auto const val = fn(begin, &end);
-    auto const ec1 = std::exchange(ec, ec0);
-    next += end - begin;
+    out.Put("# ");
+    cl::impl::WriteMarkdown(out, Name());
+    out.Put('\n');
+    if (layout.program.first_span != layout.program.last_span) {
+        out.Put('\n');
+        cl::impl::WriteFlowed(out, layout.program, layout.spans.data(), "\\\n", write_markdown);
+        out.Put('\n');
+    }
 
-    if (ec1 == ERANGE) {
-        return {next, ParseNumberStatus::overflow};
+    out.Put("\n## Usage\n\n```\n");
+    WriteSynopsis(out, layout);
+    out.Put("\n```\n");
+
+    for (int section = 0; section < Layout::kNumSections; ++section) {
+        auto const first = layout.section_begin[section];
+        auto const last = layout.section_begin[section + 1];
+        if (first == last) {
+            continue;
+        }
+
+        out.Put(kTitles[section]);
+        for (size_t i = first; i != last; ++i) {
+            auto const& e = layout.entries[i];
+
+            out.Put("- `");
+            cl::impl::WriteTextUsage(out, e);
+            out.Put('`');
+            if (e.first_span != e.last_span) {
+                out.Put(": ");
+                cl::impl::WriteFlowed(out, e, layout.spans.data(), "\\\n  ", write_markdown);
+            }
+            out.Put('\n');
+        }
     }
-#endif
+}
 
-    value = val;
-    return {next, ParseNumberStatus::success};
+inline std::string Schema::BuildHelp(impl::HelpLayout const& layout, HelpFormat const& fmt) const {
+    std::string out;
+
+    impl::HelpWriter writer(&out, [](void* sink, string_view chunk) {
+        static_cast<std::string*>(sink)->append(chunk.data(), chunk.size());
+    });
+    EmitHelp(writer, layout, fmt);
+    writer.Flush();
+
+    CL_ASSERT(cl::impl::IsUTF8(out.begin(), out.end()));
+    return out;
 }
 
-inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, float& value) {
-    return cl::impl::StrToFloatingPoint(next, last, value, [](char const* p, char** end) { return std::strtof(p, end); });
+template <typename Sink>
+void Schema::WriteHelp(Sink&& sink, HelpFormat const& fmt) const {
+    using SinkT = std::remove_reference_t<Sink>;
+
+    // Keeps the layout alive, even if another thread replaces it.
+    auto const layout = GetHelpLayout();
+
+    impl::HelpWriter writer(const_cast<void*>(static_cast<void const*>(std::addressof(sink))), [](void* s, string_view chunk) {
+        (*static_cast<SinkT*>(s))(chunk);
+    });
+    EmitHelp(writer, *layout, fmt);
+    writer.Flush();
 }
 
-inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, double& value) {
-    return cl::impl::StrToFloatingPoint(next, last, value, [](char const* p, char** end) { return std::strtod(p, end); });
+inline void Schema::PrintHelp(HelpFormat const& fmt) const {
+    FormatHelp([](string_view msg) { fprintf(stderr, "%.*s\n", static_cast<int>(msg.size()), msg.data()); }, fmt);
 }
 
-inline ParseNumberResult StrToFloatingPoint(char const* next, char const* last, long double& value) {
-    return cl::impl::StrToFloatingPoint(next, last, value, [](char const* p, char** end) { return std::strtold(p, end); });
+inline void Schema::DebugCheck() const
+{
 }
 
-//template <typename T>
-//inline ParseNumberResult StrToFloatingPoint(string_view sv, T& value) {
-//    return cl::impl::StrToFloatingPoint(sv.data(), sv.data() + sv.size(), value);
-//}
-#endif // ^^^ !CL_HAS_STD_CHARCONV ^^^
+template <typename Init>
+void Schema::AddSubcommand(char const* name, char const* descr, Init&& init) {
+    CL_ASSERT(name != nullptr && name[0] != '\0' && name[0] != '-');
+    CL_ASSERT(FindSubcommand(name) < 0 && "Sub-command already exists");
+
+    help_cache_.clear();
+    help_layout_.reset();
+
+    SubcommandEntry entry;
+    entry.name = name;
+    entry.descr = descr;
+    entry.hash = cl::impl::HashName(name, std::strlen(name));
+    UpdateFingerprint("\x01subcommand");
+    UpdateFingerprint(name);
+    entry.init.reset(new impl::SubcommandInit<std::decay_t<Init>>(std::forward<Init>(init)));
+
+    subcommands_.push_back(std::move(entry));
+
+    // Keep the load factor <= 1/2.
+    if (2 * subcommands_.size() > subcommand_index_.size()) {
+        subcommand_index_.assign(cl::impl::NumNameSlots(subcommands_.size()), impl::NameSlot{});
+        for (size_t k = 0; k < subcommands_.size(); ++k) {
+            StoreSubcommandSlot(k);
+        }
+    } else {
+        StoreSubcommandSlot(subcommands_.size() - 1);
+    }
+}
 
-struct ConvertToFloatingPoint {
-    template <typename T>
-    bool operator()(ParseContext const& ctx, T& value) {
-        auto const next = ctx.arg.data();
-        auto const last = ctx.arg.data() + ctx.arg.size();
+inline Schema const& Schema::SubcommandSchema(size_t index) const {
+    CL_ASSERT(index < subcommands_.size());
+    auto const& entry = subcommands_[index];
+
+    std::lock_guard<std::mutex> lock(subcommand_mutex_);
+    if (entry.schema_owner == nullptr) {
+        std::unique_ptr<Cmdline> owner(new Cmdline(entry.name, entry.descr, resource_));
+        entry.init->Init(*owner);
+        // The owner never parses. See OptionBase::Count().
+        owner->own_schema_->owner_ = nullptr;
+        entry.schema_owner = std::move(owner);
+    }
 
-        T v = 0;
-        auto const res = StrToFloatingPoint(next, last, v);
+    return *entry.schema_owner->schema_;
+}
 
-        if (res && res.ptr == last) {
-            value = v;
-            return true;
-        }
+inline void Schema::StoreSubcommandSlot(size_t index) {
+    auto const h = subcommands_[index].hash;
+    auto const mask = subcommand_index_.size() - 1;
 
-        return false;
+    size_t i = h & mask;
+    while (subcommand_index_[i].index >= 0) {
+        i = (i + 1) & mask;
     }
-};
 
-template <> struct ConvertTo< float       > : cl::impl::ConvertToFloatingPoint {};
-template <> struct ConvertTo< double      > : cl::impl::ConvertToFloatingPoint {};
-template <> struct ConvertTo< long double > : cl::impl::ConvertToFloatingPoint {};
+    subcommand_index_[i].hash = h;
+    subcommand_index_[i].index = static_cast<int>(index);
+}
 
-template <typename Traits, typename Alloc>
-struct ConvertTo<std::basic_string<char, Traits, Alloc>> {
-    bool operator()(ParseContext const& ctx, std::basic_string<char, Traits, Alloc>& value) const {
-        // We know that ctx.arg is well-formed UTF-8 already.
-        // No need to re-check here.
-        value.assign(ctx.arg.begin(), ctx.arg.end());
-        return true;
+inline void Schema::UpdateFingerprint(string_view str) {
+    for (char const ch : str) {
+        fingerprint_ = cl::impl::HashStep64(fingerprint_, static_cast<uint8_t>(ch));
     }
-};
-
-template <typename Traits, typename Alloc>
-struct ConvertTo<std::basic_string<char16_t, Traits, Alloc>> {
-    bool operator()(ParseContext const& ctx, std::basic_string<char16_t, Traits, Alloc>& value) const {
-        value.clear();
+    // Separator.
+    fingerprint_ = cl::impl::HashStep64(fingerprint_, 0);
+}
 
-        // We know that ctx.arg is well-formed UTF-8 already.
-        cl::impl::ForEachUTF8EncodedCodepoint(ctx.arg.begin(), ctx.arg.end(), [&](char32_t U) {
-            CL_ASSERT(cl::impl::IsValidCodepoint(U));
-            cl::impl::EncodeUTF16(U, [&](char16_t code_unit) { value.push_back(code_unit); });
-            return true;
-        });
+inline void Schema::UpdateFingerprint(size_t index) {
+    auto const& entry = options_[index];
+    auto const opt = entry.option;
+    auto const& f = opt->flags_;
+
+    UpdateFingerprint(entry.name);
+
+    uint8_t const bytes[] = {
+        static_cast<uint8_t>(opt->id_),
+        static_cast<uint8_t>(opt->id_ >> 8),
+        static_cast<uint8_t>(opt->id_ >> 16),
+        static_cast<uint8_t>(opt->id_ >> 24),
+        static_cast<uint8_t>(f.required),
+        static_cast<uint8_t>(f.multiple),
+        static_cast<uint8_t>(f.arg),
+        static_cast<uint8_t>(f.may_join),
+        static_cast<uint8_t>(f.may_group),
+        static_cast<uint8_t>(f.positional),
+        static_cast<uint8_t>(f.comma_separated),
+        static_cast<uint8_t>(f.stop_parsing),
+    };
+    for (auto const b : bytes) {
+        fingerprint_ = cl::impl::HashStep64(fingerprint_, b);
+    }
+}
 
-        return true;
+inline int Schema::FindSubcommand(string_view name) const {
+    if (subcommand_index_.empty()) {
+        return -1;
     }
-};
 
-template <typename Traits, typename Alloc>
-struct ConvertTo<std::basic_string<char32_t, Traits, Alloc>> {
-    bool operator()(ParseContext const& ctx, std::basic_string<char32_t, Traits, Alloc>& value) const {
-        value.clear();
+    auto const h = cl::impl::HashName(name.data(), name.size());
+    auto const mask = subcommand_index_.size() - 1;
 
-        // We know that ctx.arg is well-formed UTF-8 already.
-        cl::impl::ForEachUTF8EncodedCodepoint(ctx.arg.begin(), ctx.arg.end(), [&](char32_t U) {
-            CL_ASSERT(cl::impl::IsValidCodepoint(U));
-            value.push_back(U);
-            return true;
-        });
+    for (size_t i = h & mask; /**/; i = (i + 1) & mask) {
+        auto const& slot = subcommand_index_[i];
+        if (slot.index < 0) {
+            return -1;
+        }
 
-        return true;
+        if (slot.hash == h && subcommands_[static_cast<size_t>(slot.index)].name == name) {
+            return slot.index;
+        }
     }
-};
+}
 
-template <typename Traits, typename Alloc>
-struct ConvertTo<std::basic_string<wchar_t, Traits, Alloc>> {
-    bool operator()(ParseContext const& ctx, std::basic_string<wchar_t, Traits, Alloc>& value) const {
-        value.clear();
+inline OptionBase const* Schema::FindOption(string_view name) const {
+    cl::impl::ProbeCount probes{};
+    return FindOption(name, cl::impl::HashName(name.data(), name.size()), probes);
+}
 
-        // We know that ctx.arg is well-formed UTF-8 already.
-        cl::impl::ForEachUTF8EncodedCodepoint(ctx.arg.begin(), ctx.arg.end(), [&](char32_t U) {
-            CL_ASSERT(cl::impl::IsValidCodepoint(U));
-#if _WIN32
-            cl::impl::EncodeUTF16(U, [&](char16_t code_unit) { value.push_back(static_cast<wchar_t>(code_unit)); });
-#else
-            value.push_back(static_cast<wchar_t>(U));
+#if CL_ENABLE_STATS
+inline OptionBase const* Schema::FindOption(string_view name, size_t& probes) const {
+    return FindOption(name, cl::impl::HashName(name.data(), name.size()), probes);
+}
 #endif
-            return true;
-        });
 
-        return true;
-    }
-};
+inline OptionBase const* Schema::FindOption(string_view name, uint32_t h, cl::impl::ProbeCount& probes) const {
+    // NB: Don't skip positional options.
+    // Positional options have a name and might still be provided
+    // in the form "--name=value".
 
-template <>
-struct ConvertTo<void> {
-    template <typename T>
-    bool operator()(ParseContext const& ctx, T& value) const {
-        return ConvertTo<T>{}(ctx, value);
+    if (index_.empty()) {
+        return nullptr;
     }
-};
 
-} // namespace impl
+    auto const mask = index_.size() - 1;
 
-//--------------------------------------------------------------------------------------------------
-//
-//--------------------------------------------------------------------------------------------------
+    // Linear probing.
+    // The table is never full, so this loop always terminates.
+    for (size_t i = h & mask; /**/; i = (i + 1) & mask) {
+        ++probes;
 
-namespace check {
+        auto const& slot = index_[i];
+        if (slot.index < 0) {
+            return nullptr;
+        }
 
-// Returns a function object which checks whether a given value is in the range [lower, upper].
-template <typename T, typename U>
-auto InRange(T lower, U upper) {
-    return [=](ParseContext const& /*ctx*/, auto const& value) {
-        return !(value < lower) && !(upper < value);
-    };
+        auto const& p = options_[static_cast<size_t>(slot.index)];
+        if (slot.hash == h && p.name == name) {
+            return p.option;
+        }
+    }
 }
 
-// Returns a function object which checks whether a given value is > lower.
-template <typename T>
-auto GreaterThan(T lower) {
-    return [=](ParseContext const& /*ctx*/, auto const& value) {
-        return lower < value;
-    };
+inline void Schema::InsertName(size_t index) {
+    // Keep the load factor <= 1/2.
+    if (2 * options_.size() > index_.size()) {
+        RebuildIndex(index_.empty() ? 16 : 2 * index_.size());
+    } else {
+        StoreSlot(index);
+    }
 }
 
-// Returns a function object which checks whether a given value is >= lower.
-template <typename T>
-auto GreaterEqual(T lower) {
-    return [=](ParseContext const& /*ctx*/, auto const& value) {
-        return !(value < lower); // value >= lower
-    };
-}
+inline void Schema::RebuildIndex(size_t num_slots) {
+    CL_ASSERT(num_slots != 0 && (num_slots & (num_slots - 1)) == 0 && "size must be a power of 2");
+    CL_ASSERT(num_slots >= 2 * options_.size());
 
-// Returns a function object which checks whether a given value is < upper.
-template <typename T>
-auto LessThan(T upper) {
-    return [=](ParseContext const& /*ctx*/, auto const& value) {
-        return value < upper;
-    };
-}
+    index_.assign(num_slots, impl::NameSlot{});
 
-// Returns a function object which checks whether a given value is <= upper.
-template <typename T>
-auto LessEqual(T upper) {
-    return [=](ParseContext const& /*ctx*/, auto const& value) {
-        return !(upper < value); // upper >= value
-    };
+    for (size_t k = 0; k < options_.size(); ++k) {
+        StoreSlot(k);
+    }
 }
 
-} // namespace check
+inline void Schema::StoreSlot(size_t index) {
+    auto const h = options_[index].hash;
+    auto const mask = index_.size() - 1;
 
-//--------------------------------------------------------------------------------------------------
-//
-//--------------------------------------------------------------------------------------------------
+    size_t i = h & mask;
+    while (index_[i].index >= 0) {
+        i = (i + 1) & mask;
+    }
 
-#if !CL_HAS_FOLD_EXPRESSIONS
-namespace impl {
+    index_[i].hash = h;
+    index_[i].index = static_cast<int>(index);
+}
 
-// Calls f(CTX, VALUE) for all f in FUNCS (in order) until the first f returns false.
-// Returns true iff all f return true.
-template <typename T, typename... Funcs>
-bool ApplyFuncs(ParseContext const& ctx_, T& value_, Funcs&&... funcs) {
-    static_cast<void>(ctx_);   // may be unused if funcs is empty
-    static_cast<void>(value_); // may be unused if funcs is empty
+inline void Schema::InsertNameChars(size_t index) {
+    auto const& p = options_[index];
+    CL_ASSERT(!p.name.empty());
 
-    bool res = true;
-    bool const unused[] = {(res = res && funcs(ctx_, value_))..., false};
-    static_cast<void>(unused);
-    return res;
+    first_chars_.Insert(p.name[0]);
+    if (p.name.size() == 1) {
+        short_ids_[static_cast<uint8_t>(p.name[0])] = p.option->Id();
+    }
 }
 
-} // namespace impl
-#endif
+inline void Schema::InsertPrefix(size_t index) {
+    if (prefixes_.empty()) {
+        prefixes_.emplace_back(); // root
+    }
 
-// Default parser for scalar types.
-// Uses an instance of Parser<> to convert the string.
-template <typename T, typename... Predicates>
-auto Assign(T& target, Predicates&&... preds) {
-    static_assert(!std::is_const<T>::value,
-        "Assign() requires mutable lvalue-references");
-    static_assert(std::is_default_constructible<T>::value,
-        "Assign() requires default-constructible types");
-    static_assert(std::is_move_assignable<T>::value,
-        "Assign() requires move-assignable types");
+    join_chars_.Insert(options_[index].name[0]);
 
-    return [=, &target](ParseContext const& ctx) {
-        // Parse into a local variable so that target is not assigned if any of the predicates returns false.
-        T temp;
-#if CL_HAS_FOLD_EXPRESSIONS
-        if ((cl::impl::ConvertTo<>{}(ctx, temp) && ... && preds(ctx, temp))) {
-#else
-        if (cl::impl::ApplyFuncs(ctx, temp, cl::impl::ConvertTo<>{}, preds...)) {
-#endif
-            target = std::move(temp);
-            return true;
+    int node = 0;
+    for (char const ch : options_[index].name) {
+        auto child = prefixes_[static_cast<size_t>(node)].first_child;
+        while (child >= 0 && prefixes_[static_cast<size_t>(child)].ch != ch) {
+            child = prefixes_[static_cast<size_t>(child)].next_sibling;
         }
-        return false;
-    };
+
+        if (child < 0) {
+            child = static_cast<int>(prefixes_.size());
+            prefixes_.emplace_back(ch);
+            prefixes_.back().next_sibling = prefixes_[static_cast<size_t>(node)].first_child;
+            prefixes_[static_cast<size_t>(node)].first_child = child;
+        }
+
+        node = child;
+    }
+
+    CL_ASSERT(node != 0 && "Empty option names are not allowed");
+    CL_ASSERT(prefixes_[static_cast<size_t>(node)].index < 0 && "Option already exists");
+    prefixes_[static_cast<size_t>(node)].index = static_cast<int>(index);
 }
 
-// Default parser for list types.
-// Uses an instance of Parser<> to convert the string and then inserts the
-// converted value into the container.
-// Predicates apply to the currently parsed value, not the whole list.
-template <typename T, typename... Predicates>
-auto Append(T& container, Predicates&&... preds) {
-    static_assert(!std::is_const<T>::value,
-        "Append() requires mutable lvalue-references");
-    static_assert(cl::impl::IsContainer_t<T>::value,
-        "Append() requires STL-style container types");
-    static_assert(std::is_default_constructible<cl::impl::RemoveCVRec_t<typename T::value_type>>::value,
-        "Append() requires default-constructible value_type's");
+inline Schema::ScanResult Schema::Scan(string_view optstr, bool find_prefix) const {
+    ScanResult res;
 
-    using V = cl::impl::RemoveCVRec_t<typename T::value_type>;
+    int node = (find_prefix && !prefixes_.empty()) ? 0 : -1;
 
-    return [=, &container](ParseContext const& ctx) {
-        V temp;
-#if CL_HAS_FOLD_EXPRESSIONS
-        if ((cl::impl::ConvertTo<>{}(ctx, temp) && ... && preds(ctx, temp))) {
-#else
-        if (cl::impl::ApplyFuncs(ctx, temp, cl::impl::ConvertTo<>{}, preds...)) {
-#endif
-            container.insert(container.end(), std::move(temp));
-            return true;
+    uint32_t h = cl::impl::kHashSeed;
+    for (size_t i = 0; i < optstr.size(); ++i) {
+        auto const ch = optstr[i];
+
+        if (ch == '=' && res.eq == string_view::npos) {
+            res.eq = i;
+            res.eq_hash = h;
+        }
+        h = cl::impl::HashNameStep(h, ch);
+
+        // Walk down the prefix tree.
+        if (node >= 0) {
+            auto child = prefixes_[static_cast<size_t>(node)].first_child;
+            while (child >= 0 && prefixes_[static_cast<size_t>(child)].ch != ch) {
+                child = prefixes_[static_cast<size_t>(child)].next_sibling;
+            }
+
+            node = child;
+            if (node >= 0 && prefixes_[static_cast<size_t>(node)].index >= 0) {
+                res.prefix = prefixes_[static_cast<size_t>(node)].index;
+                res.prefix_len = i + 1;
+            }
         }
-        return false;
-    };
+    }
+    res.hash = h;
+
+    return res;
 }
 
-namespace impl {
+inline Cmdline::Status Cmdline::HandleResponseFile(string_view path) {
+    CL_ASSERT(response_files_ != ResponseFiles::no);
 
-template <typename T, typename... Predicates>
-auto Var(std::false_type /*IsContainer*/, T& var, Predicates&&... preds) {
-    return cl::Assign(var, std::forward<Predicates>(preds)...);
-}
+    if (response_file_depth_ >= max_response_file_depth_) {
+        EmitDiag(Diagnostic::error, curr_index_, "response file '", path, "' is nested too deeply");
+        return Status::error;
+    }
 
-template <typename T, typename... Predicates>
-auto Var(std::true_type /*IsContainer*/, T& var, Predicates&&... preds) {
-    return cl::Append(var, std::forward<Predicates>(preds)...);
-}
+    std::string const path_str(path.data(), path.size());
 
-} // namespace impl
+    cl::impl::FileContents contents;
+    if (!contents.Read(path_str.c_str())) {
+        EmitDiag(Diagnostic::error, curr_index_, "cannot read response file '", path, "'");
+        return Status::error;
+    }
 
-// Default parser.
-// Can be used as a replacement for Assign or PushBack (in almost all cases).
-template <typename T, typename... Predicates>
-auto Var(T& var, Predicates&&... preds) {
-    return cl::impl::Var(cl::impl::IsContainer_t<T>{}, var, std::forward<Predicates>(preds)...);
-}
+    char* const first = contents.data();
+    char* const last = first + contents.size();
 
-// Default parser for enum types.
-// Look up the key in the map and if it exists, returns the mapped value.
-template <typename T, typename... Predicates>
-auto Map(T& value, std::initializer_list<std::pair<char const*, T>> ilist, Predicates&&... preds) {
-    static_assert(!std::is_const<T>::value,
-        "Map() requires mutable lvalue-references");
-    static_assert(std::is_copy_constructible<T>::value,
-        "Map() requires copy-constructible types");
-    static_assert(std::is_move_assignable<T>::value,
-        "Map() requires move-assignable types");
+    // The file is overwritten while tokenizing. Record the line breaks first to
+    // be able to report line numbers.
+    std::vector<size_t> line_breaks;
+    for (char const* p = first; p != last; ++p) {
+        p = static_cast<char const*>(std::memchr(p, '\n', static_cast<size_t>(last - p)));
+        if (p == nullptr) {
+            break;
+        }
+        line_breaks.push_back(static_cast<size_t>(p - first));
+    }
 
-    using MapType = std::vector<std::pair<string_view, T>>;
+    auto const args = (response_files_ == ResponseFiles::unix_quoting)
+                          ? cl::TokenizeUnixInPlace(first, last)
+                          : cl::TokenizeWindowsInPlace(first, last, ParseProgramName::no);
 
-    return [=, &value, map = MapType(ilist.begin(), ilist.end())](ParseContext const& ctx) {
-        for (auto const& p : map) {
-            if (p.first != ctx.arg) {
-                continue;
+    // All arguments from the file share the index of the "@file" argument.
+    int const index = curr_index_;
+    size_t line_index = 0;
+
+    ++response_file_depth_;
+
+    std::string buf;
+    Status res = Status::success;
+    for (auto curr = args.begin(), end = args.end(); curr != end; ++curr) {
+        curr_index_ = index;
+
+        auto const update_line = [&]() {
+            auto const pos = static_cast<size_t>(curr.Source() - first);
+            while (line_index < line_breaks.size() && line_breaks[line_index] < pos) {
+                ++line_index;
             }
+        };
+        update_line();
 
-            // Parse into a local variable to allow the predicates to modify the value.
-            T temp = p.second;
-#if CL_HAS_FOLD_EXPRESSIONS
-            if ((true && ... && preds(ctx, temp))) {
-#else
-            if (cl::impl::ApplyFuncs(ctx, temp, preds...)) {
-#endif
-                value = std::move(temp);
-                return true;
+        auto const num_diag = num_diag_;
+
+        res = ParseArg(curr, end, buf);
+
+        if (num_diag_ != num_diag && collect_diag_ == CollectDiagnostics::yes) {
+            // Report the line of the last argument consumed, which might have
+            // been the argument of the option.
+            if (curr != end) {
+                update_line();
             }
+            EmitDiag(Diagnostic::note, index, "in response file '", path, "', line ", std::to_string(line_index + 1));
+        }
 
+        if (res == Status::done) {
+            // The arguments following the option are not parsed, but they
+            // cannot be referred to by ParseResult::next. Keep them, after
+            // those of any nested response file.
+            if (curr != end) {
+                ++curr;
+            }
+            for (; curr != end; ++curr) {
+                unparsed_file_args_.emplace_back(curr->data(), curr->size());
+            }
             break;
         }
 
-        ctx.cmdline->EmitDiag(Diagnostic::error, ctx.index, "invalid argument '", ctx.arg, "' for option '", ctx.name, "'");
-        for (auto const& p : map) {
-            ctx.cmdline->EmitDiag(Diagnostic::note, ctx.index, "could be '", p.first, "'");
+        if (res != Status::success || curr == end) {
+            break;
         }
+    }
 
-        return false;
-    };
+    --response_file_depth_;
+    curr_index_ = index;
+
+    return res;
 }
 
-// For (boolean) flags.
-// Parses the options' argument and stores the result in 'var'.
-// If the options' name starts with 'inverse_prefix', inverts the parsed value, using operator!.
-template <typename T>
-auto Flag(T& var, char const* inverse_prefix = "no-") {
-    static_assert(!std::is_const<T>::value,
-        "Flag() requires mutable lvalue-references");
+template <typename Fn>
+bool Cmdline::ParseSource(Fn fn) {
+    // Options might have been added since the last call to Parse().
+    counts_.resize(static_cast<size_t>(schema_->num_ids_));
 
-    return [=, &var](ParseContext const& ctx) {
-        if (!cl::impl::ConvertTo<>{}(ctx, var)) {
-            return false;
+    // Only options which have not been specified before are set.
+    Counts const counts = counts_;
+
+    // Values from the environment or from config files are not stable.
+    stable_arg_ = {};
+
+    // The diagnostics do not refer to a command line argument.
+    int const index = curr_index_;
+    curr_index_ = -1;
+
+    bool const ok = fn(counts);
+
+    curr_index_ = index;
+    return ok;
+}
+
+inline Cmdline::Status Cmdline::HandleSourceOption(Counts const& counts, OptionBase const* opt, string_view name, string_view value) {
+    if (counts[static_cast<size_t>(opt->Id())] != 0) {
+        return Status::ignored;
+    }
+
+    if (opt->HasFlag(Positional::no) && opt->HasFlag(Arg::no)) {
+        if (cl::impl::IsAnyOf(value, "0", "n", "no", "No", "off", "Off", "false", "False")) {
+            return Status::ignored;
         }
-        if (cl::impl::StartsWith(ctx.name, inverse_prefix)) {
-            var = !var;
+        if (!cl::impl::IsAnyOf(value, string_view{}, "1", "y", "yes", "Yes", "on", "On", "true", "True")) {
+            EmitDiag(Diagnostic::error, curr_index_, "invalid argument '", value, "' for option '", name, "'");
+            return Status::error;
         }
-        return true;
-    };
+        value = {};
+    }
+
+    auto const res = ParseOptionArgument(opt, name, value);
+    return res == Status::done ? Status::success : res;
 }
 
-//==================================================================================================
-// Tokenize
-//==================================================================================================
+inline void Cmdline::EmitConfigNote(string_view source, size_t line) {
+    if (collect_diag_ == CollectDiagnostics::yes) {
+        EmitDiag(Diagnostic::note, curr_index_, "in config file '", source, "', line ", std::to_string(line));
+    }
+}
 
-namespace impl {
+inline bool Cmdline::ApplyConfigEntry(Counts const& counts, string_view key, string_view value, size_t line, string_view source) {
+    Status res = Status::error;
+    if (auto const opt = FindOption(key)) {
+        res = HandleSourceOption(counts, opt, key, value);
+    } else {
+        EmitDiag(Diagnostic::error, curr_index_, "unknown option '", key, "'");
+        EmitSuggestions(key, {});
+    }
 
-template <typename It, typename Fn>
-It ParseArgUnix(It next, It last, Fn fn) {
-    std::string arg;
+    if (res == Status::error) {
+        EmitConfigNote(source, line);
+        return false;
+    }
 
-    // See:
-    // http://www.gnu.org/software/bash/manual/bashref.html#Quoting
-    // http://wiki.bash-hackers.org/syntax/quoting
+    return true;
+}
 
-    char quote_char = '\0';
+inline bool Cmdline::ParseConfigText(Counts const& counts, string_view text, string_view source, cl::impl::ConfigSnapshot* snapshot, bool& syntax_ok) {
+    bool ok = true;
 
-    next = cl::impl::SkipWhitespace(next, last);
+    syntax_ok = cl::impl::ForEachConfigEntry(
+        text,
+        [&](string_view key, string_view value, size_t line) {
+            if (snapshot != nullptr) {
+                snapshot->Add(key, value, line);
+            }
+            if (!ApplyConfigEntry(counts, key, value, line, source)) {
+                ok = false;
+            }
+        },
+        [&](char const* message, size_t line) {
+            EmitDiag(Diagnostic::error, curr_index_, message);
+            EmitConfigNote(source, line);
+        });
 
-    for (; next != last; ++next) {
-        auto const ch = *next;
+    return syntax_ok && ok;
+}
 
-        if (quote_char == '\\') { // Quoting a single character using the backslash?
-            arg += ch;
-            quote_char = '\0';
-        } else if (quote_char != '\0' && ch != quote_char) { // Currently quoting using ' or "?
-            arg += ch;
-        } else if (ch == '\'' || ch == '"' || ch == '\\') { // Toggle quoting?
-            quote_char = (quote_char != '\0') ? '\0' : ch;
-        } else if (cl::impl::IsWhitespace(ch)) { // Arguments are separated by whitespace
-            ++next;
-            break;
-        } else {
-            arg += ch;
+inline bool Cmdline::ParseEnv(string_view prefix) {
+    return ParseSource([&](Counts const& counts) {
+        bool ok = true;
+
+        std::string var(prefix.data(), prefix.size());
+        for (auto const& p : schema_->options_) {
+            // Skip options which have already been set using one of their other names.
+            auto const id = static_cast<size_t>(p.option->Id());
+            if (counts_[id] != counts[id]) {
+                continue;
+            }
+
+            var.resize(prefix.size());
+            for (char const ch : p.name) {
+                if (ch == '-' || ch == '.') {
+                    var += '_';
+                } else if (ch >= 'a' && ch <= 'z') {
+                    var += static_cast<char>(ch - 'a' + 'A');
+                } else {
+                    var += ch;
+                }
+            }
+
+#if _MSC_VER
+#pragma warning(suppress : 4996) // getenv may be unsafe
+#endif
+            char const* const value = std::getenv(var.c_str());
+            if (value == nullptr) {
+                continue;
+            }
+
+            if (HandleSourceOption(counts, p.option, p.name, value) == Status::error) {
+                EmitDiag(Diagnostic::note, curr_index_, "in environment variable '", var, "'");
+                ok = false;
+            }
+        }
+
+        return ok;
+    });
+}
+
+inline bool Cmdline::ParseConfig(string_view text, string_view source) {
+    return ParseSource([&](Counts const& counts) {
+        bool syntax_ok = true;
+        return ParseConfigText(counts, text, source, nullptr, syntax_ok);
+    });
+}
+
+inline bool Cmdline::ParseConfigFile(char const* path, char const* cache_path) {
+    cl::impl::FileStamp stamp;
+    bool const use_cache = cache_path != nullptr && cl::impl::GetFileStamp(path, stamp);
+
+    if (use_cache) {
+        cl::impl::FileContents cache;
+        if (cache.Read(cache_path)) {
+            bool cached = false;
+            bool const ok = ParseSource([&](Counts const& counts) {
+                bool res = true;
+                cached = cl::impl::ConfigSnapshot::ForEach(
+                    string_view(cache.data(), cache.size()), stamp,
+                    [&](string_view key, string_view value, size_t line) {
+                        if (!ApplyConfigEntry(counts, key, value, line, path)) {
+                            res = false;
+                        }
+                    });
+                return res;
+            });
+
+            if (cached) {
+                return ok;
+            }
         }
     }
 
-    fn(std::move(arg));
+    cl::impl::FileContents contents;
+    if (!contents.Read(path)) {
+        EmitDiag(Diagnostic::error, -1, "cannot read config file '", path, "'");
+        return false;
+    }
 
-    return next;
+    auto const text = string_view(contents.data(), contents.size());
+    if (!use_cache) {
+        return ParseConfig(text, path);
+    }
+
+    cl::impl::ConfigSnapshot snapshot(stamp);
+
+    bool syntax_ok = true;
+    bool const ok = ParseSource([&](Counts const& counts) {
+        return ParseConfigText(counts, text, path, &snapshot, syntax_ok);
+    });
+
+    // Failing to write the cache is not an error.
+    if (syntax_ok) {
+        snapshot.Write(cache_path);
+    }
+
+    return ok;
 }
 
-template <typename It, typename Fn>
-It ParseProgramNameWindows(It next, It last, Fn fn) {
-    // TODO?!
-    //
-    // If the input string is empty, return a single command line argument
-    // consisting of the absolute path of the executable...
+template <typename It, typename EndIt>
+Cmdline::Status Cmdline::Handle1(string_view optstr, It& curr, EndIt last) {
+    CL_ASSERT(curr != last);
 
-    std::string arg;
+    // This cannot happen if we're parsing the main's argv[] array, but it might
+    // happen if we're parsing a user-supplied array of command line arguments.
+    if (optstr.empty()) {
+        return Status::success;
+    }
 
-    if (next != last && !cl::impl::IsWhitespace(*next)) {
-        bool const quoting = (*next == '"');
+    // All arguments after the name of a sub-command belong to the sub-command.
+    if (sub_active_) {
+        return HandleSubcommandArg(optstr, curr, last);
+    }
 
-        if (quoting) {
-            ++next;
-        }
+    // Stop parsing if "--" has been found
+    if (optstr == "--" && !dashdash_) {
+        dashdash_ = true;
+        return Status::success;
+    }
 
-        for (; next != last; ++next) {
-            auto const ch = *next;
-            if ((quoting && ch == '"') || (!quoting && cl::impl::IsWhitespace(ch))) {
-                ++next;
-                break;
-            }
-            arg += ch;
+    // This argument is considered to be positional if it doesn't start with
+    // '-', if it is "-" itself, or if we have seen "--" already, or if the
+    // argument doesn't look like a known option (see below).
+    bool const is_positional = (optstr[0] != '-' || optstr == "-" || dashdash_);
+    if (is_positional) {
+        if (!dashdash_ && SelectSubcommand(optstr)) {
+            return Status::success;
         }
+        return HandlePositional(optstr);
     }
 
-    fn(std::move(arg));
+    auto const optstr_orig = optstr;
 
-    return next;
-}
+    CL_ASSERT(optstr[0] == '-');
+    optstr.remove_prefix(1); // Remove the first dash.
 
-template <typename It, typename Fn>
-It ParseArgWindows(It next, It last, Fn fn) {
-    std::string arg;
+    // If the name starts with a single dash, this is a short option and might
+    // actually be an option group.
+    bool const is_short = (optstr[0] != '-');
+    if (!is_short) {
+        optstr.remove_prefix(1); // Remove the second dash.
+    }
 
-    bool quoting = false;
-    bool recently_closed = false;
-    size_t num_backslashes = 0;
+    Status res = HandleNamedOption(optstr, is_short, curr, last);
 
-    next = cl::impl::SkipWhitespace(next, last);
+    // The options of the enclosing commands are global options.
+    for (auto p = parent_; p != nullptr && res == Status::ignored; p = p->parent_) {
+        p->curr_index_ = curr_index_;
+        res = p->HandleNamedOption(optstr, is_short, curr, last);
+        curr_index_ = p->curr_index_;
+    }
 
-    for (; next != last; ++next) {
-        auto const ch = *next;
+    // Otherwise this is an unknown option.
+    //
+    // 5. Try to handle this option as a positional option.
+    //    If there are no more (hungry) positional options, this is an error.
+    if (res == Status::ignored) {
+        res = HandlePositional(optstr_orig);
+    }
 
-        if (ch == '"' && recently_closed) {
-            recently_closed = false;
+    return res;
+}
 
-            // If a closing " is followed immediately by another ", the 2nd
-            // " is accepted literally and added to the parameter.
-            //
-            // See:
-            // http://www.daviddeley.com/autohotkey/parameters/parameters.htm#WINCRULESDOC
+template <typename It, typename EndIt>
+Cmdline::Status Cmdline::HandleNamedOption(string_view optstr, bool is_short, It& curr, EndIt last) {
+    CL_ASSERT(!optstr.empty());
 
-            arg += '"';
-        } else if (ch == '"') {
-            // If an even number of backslashes is followed by a double
-            // quotation mark, one backslash is placed in the argv array for
-            // every pair of backslashes, and the double quotation mark is
-            // interpreted as a string delimiter.
-            //
-            // If an odd number of backslashes is followed by a double
-            // quotation mark, one backslash is placed in the argv array for
-            // every pair of backslashes, and the double quotation mark is
-            // "escaped" by the remaining backslash, causing a literal
-            // double quotation mark (") to be placed in argv.
+    // Arguments like "-3.5" do not even need a lookup.
+    bool const may_be_name = schema_->first_chars_.Contains(optstr[0]);
+    bool const may_be_prefix = schema_->join_chars_.Contains(optstr[0]);
 
-            bool const even = (num_backslashes % 2) == 0;
+    // Scan OPTSTR only once for steps 1-3.
+    Schema::ScanResult scan;
+    if (may_be_name || may_be_prefix) {
+        scan = schema_->Scan(optstr, may_be_prefix);
+    }
 
-            arg.append(num_backslashes / 2, '\\');
-            num_backslashes = 0;
+    if (may_be_name) {
+        // 1. Try to handle options like "-f" and "-f file"
+        //    If the option requires an argument, steal one from the command line.
+        if (auto const opt = FindOption(optstr, scan.hash)) {
+            return HandleOccurrence(opt, optstr, curr, last);
+        }
 
-            if (even) {
-                recently_closed = quoting; // Remember if this is a closing "
-                quoting = !quoting;
-            } else {
-                arg += '"';
+        // 2. Try to handle options like "-f=file"
+        if (scan.eq != string_view::npos) {
+            auto const name = optstr.substr(0, scan.eq);
+            if (auto const opt = FindOption(name, scan.eq_hash)) {
+                // Discard the equals sign if this option may NOT join its value.
+                auto const arg_start = opt->HasFlag(MayJoin::no) ? scan.eq + 1 : scan.eq;
+                return HandleOccurrence(opt, name, optstr.substr(arg_start));
             }
-        } else if (ch == '\\') {
-            recently_closed = false;
+        }
+    }
+
+    // 3. Try to handle options like "-Idir"
+    //    Use the longest prefix of OPTSTR which is the name of an option which
+    //    may join its argument. This allows different prefixes like e.g.
+    //    "-with" and "-without".
+#if CL_ENABLE_STATS
+    ++stats_.prefix_fallbacks;
+#endif
+    if (scan.prefix >= 0) {
+        auto const opt = schema_->options_[static_cast<size_t>(scan.prefix)].option;
+        auto const n = scan.prefix_len;
+        CL_ASSERT(n != 0);
+        CL_ASSERT(!opt->HasFlag(MayJoin::no));
+        return HandleOccurrence(opt, optstr.substr(0, n), optstr.substr(n));
+    }
+
+    // 4. Try to handle options like "-xvf=file" and "-xvf file"
+    if (is_short) {
+#if CL_ENABLE_STATS
+        ++stats_.group_fallbacks;
+#endif
+        return HandleGroup(optstr, curr, last);
+    }
 
-            ++num_backslashes;
-        } else {
-            recently_closed = false;
+    return Status::ignored;
+}
 
-            // Backslashes are interpreted literally, unless they
-            // immediately precede a double quotation mark.
+template <typename It, typename EndIt>
+Cmdline::Status Cmdline::HandleSubcommandArg(string_view optstr, It& curr, EndIt last) {
+    CL_ASSERT(sub_ != nullptr);
 
-            arg.append(num_backslashes, '\\');
-            num_backslashes = 0;
+    sub_->curr_index_ = curr_index_;
+    sub_->response_file_depth_ = response_file_depth_;
 
-            if (!quoting && cl::impl::IsWhitespace(ch)) {
-                // Arguments are delimited by white space, which is either a
-                // space or a tab.
-                //
-                // A string surrounded by double quotation marks ("string")
-                // is interpreted as single argument, regardless of white
-                // space contained within. A quoted string can be embedded
-                // in an argument.
-                ++next;
-                break;
-            }
+    auto const res = sub_->Handle1(optstr, curr, last);
 
-            arg += ch;
-        }
+    curr_index_ = sub_->curr_index_;
+    return res;
+}
+
+inline bool Cmdline::SelectSubcommand(string_view optstr) {
+    auto const index = schema_->FindSubcommand(optstr);
+    if (index < 0) {
+        return false;
     }
 
-    if (!arg.empty() || quoting || recently_closed) {
-        fn(std::move(arg));
+    // Only the most recently selected sub-command is kept.
+    if (sub_ == nullptr || sub_index_ != index) {
+        sub_index_ = -1;
+        sub_.reset(new Cmdline(schema_->SubcommandSchema(static_cast<size_t>(index))));
+        sub_->parent_ = this;
+        sub_index_ = index;
     }
 
-    return next;
+    sub_->Reset();
+    sub_->counts_.resize(static_cast<size_t>(sub_->schema_->num_ids_));
+    sub_->target_ = target_;
+    sub_->dry_run_ = dry_run_;
+    sub_->defer_ = defer_;
+
+    sub_active_ = true;
+    return true;
 }
 
-} // namespace impl
+inline Cmdline::Status Cmdline::HandlePositional(string_view optstr) {
+    auto const& positionals = schema_->positionals_;
 
-// Parse arguments from a command line string into an argv-array.
-// Using Bash-style escaping.
-inline std::vector<std::string> TokenizeUnix(string_view str) {
-    std::vector<std::string> argv;
+    auto const E = static_cast<int>(positionals.size());
+    CL_ASSERT(curr_positional_ >= 0);
+    CL_ASSERT(curr_positional_ <= E);
 
-    auto push_back = [&](std::string arg) {
-        argv.push_back(std::move(arg));
-    };
+    for (; curr_positional_ != E; ++curr_positional_) { // find_if
+        auto const id = static_cast<size_t>(positionals[static_cast<size_t>(curr_positional_)]);
 
-    auto next = str.data();
-    auto const last = str.data() + str.size();
+        if (!IsOccurrenceAllowed(id)) {
+            continue;
+        }
 
-    while (next != last) {
-        next = cl::impl::ParseArgUnix(next, last, push_back);
+        // The argument of a positional option is the value specified on the
+        // command line.
+        auto const opt = schema_->id_options_[id];
+        return HandleOccurrence(opt, opt->Name(), optstr);
     }
 
-    return argv;
+    return Status::ignored;
 }
 
-enum class ParseProgramName : uint8_t {
-    no,
-    yes,
-};
+template <typename It, typename EndIt>
+Cmdline::Status Cmdline::HandleGroup(string_view optstr, It& curr, EndIt last) {
+    auto const& short_ids = schema_->short_ids_;
+    auto const& flags = schema_->id_flags_;
 
-// Parse arguments from a command line string into an argv-array.
-// Using Windows-style escaping.
-inline std::vector<std::string> TokenizeWindows(string_view str, ParseProgramName parse_program_name = ParseProgramName::yes) {
-    std::vector<std::string> argv;
+    // First determine the largest prefix which is a valid option group.
+    // The options are looked up in the table of single-character names.
+    size_t group_size = 0;
+    while (group_size < optstr.size()) {
+        if (optstr[group_size] == '=') {
+            break;
+        }
 
-    auto push_back = [&](std::string arg) {
-        argv.push_back(std::move(arg));
-    };
+        auto const id = short_ids[static_cast<uint8_t>(optstr[group_size])];
+        if (id < 0 || flags[static_cast<size_t>(id)].may_group == MayGroup::no) {
+            return Status::ignored;
+        }
 
-    auto next = str.data();
-    auto const last = str.data() + str.size();
+        ++group_size;
 
-    if (parse_program_name == ParseProgramName::yes) {
-        next = cl::impl::ParseProgramNameWindows(next, last, push_back);
+        if (flags[static_cast<size_t>(id)].arg != Arg::no) {
+            // The option accepts an argument.
+            // This terminates the option group.
+            break;
+        }
     }
 
-    while (next != last) {
-        next = cl::impl::ParseArgWindows(next, last, push_back);
+    if (group_size == 0) { // "-=" is invalid
+        return Status::ignored;
     }
 
-    return argv;
-}
-
-#if CL_HAS_STD_STRING_VIEW
-inline std::vector<std::string> TokenizeWindows(std::wstring_view str, ParseProgramName parse_program_name = ParseProgramName::yes) {
-    return cl::TokenizeWindows(cl::impl::ToUTF8(str.begin(), str.end()), parse_program_name);
-}
-#else
-inline std::vector<std::string> TokenizeWindows(wchar_t const* wstr, ParseProgramName parse_program_name = ParseProgramName::yes) {
-    return cl::TokenizeWindows(cl::impl::ToUTF8(wstr), parse_program_name);
-}
+    // Then process all options.
+    for (size_t n = 0; n < group_size; ++n) {
+        auto const name = optstr.substr(n, 1);
+        auto const opt = schema_->id_options_[static_cast<size_t>(short_ids[static_cast<uint8_t>(optstr[n])])];
 
-inline std::vector<std::string> TokenizeWindows(wchar_t const* wstr, size_t wlen, ParseProgramName parse_program_name = ParseProgramName::yes) {
-    return cl::TokenizeWindows(cl::impl::ToUTF8(wstr, wstr + wlen), parse_program_name);
-}
-#endif
+        CL_ASSERT(opt != nullptr);
+        CL_ASSERT(opt->HasFlag(MayGroup::yes));
 
-//==================================================================================================
-//
-//==================================================================================================
+        if (n + 1 != group_size || group_size == optstr.size()) {
+            // This is either an option which does not allow an argument (which may
+            // or may not be the last option in the group), or it is the last option and
+            // an argument has not been provided.
+            // In case the option has the HasArg::required flag set, HandleOccurrence
+            // will try to get an argument from the command line.
+            if (Status::success != HandleOccurrence(opt, name, curr, last)) {
+                return Status::error;
+            }
+        } else {
+            // This is the last option in the group and the argument is the rest of optstr.
+            // In case an argument is not allowed, HandleOccurrence will emit an error.
+            size_t arg_start = n + 1;
 
-inline OptionBase::OptionBase(char const* name, char const* descr, OptionFlags flags)
-    : name_(name)
-    , descr_(descr)
-    , flags_(flags)
-{
-    CL_ASSERT(cl::impl::IsUTF8(name_.begin(), name_.end()));
-    CL_ASSERT(cl::impl::IsUTF8(descr_.begin(), descr_.end()));
-}
+            if (opt->HasFlag(MayJoin::no)) {
+                // The option may not join its argument.
+                // If the next character is an '=', this is like "--f=filename",
+                // so discard the equals sign.
+                // Otherwise this is an error.
+                if (optstr[arg_start] != '=') {
+                    EmitDiag(Diagnostic::error, curr_index_, "option '", name, "' must not join its argument");
+                    return Status::error;
+                }
 
-inline OptionBase::~OptionBase() = default;
+                ++arg_start;
+            }
 
-inline bool OptionBase::IsOccurrenceAllowed() const {
-    if (HasFlag(Multiple::no)) {
-        return Count() == 0;
+            return HandleOccurrence(opt, name, optstr.substr(arg_start));
+        }
     }
 
-    return true;
+    return Status::success;
 }
 
-inline bool OptionBase::IsOccurrenceRequired() const {
-    if (HasFlag(Required::yes)) {
-        return Count() == 0;
+template <typename It, typename EndIt>
+Cmdline::Status Cmdline::HandleOccurrence(OptionBase const* opt, string_view name, It& curr, EndIt last) {
+    CL_ASSERT(curr != last);
+
+    // We get here if no argument was specified.
+    // If an argument is required, try to steal one from the command line.
+
+    if (!opt->HasFlag(Arg::required)) {
+        return ParseOptionArgument(opt, name, {});
     }
 
-    return false;
-}
+    // If the option requires an argument, steal one from the command line.
+    // (Arguments read from response files share the index of the "@file" argument.)
+    ++curr;
+    if (response_file_depth_ == 0) {
+        ++curr_index_;
+    }
 
-//--------------------------------------------------------------------------------------------------
-//
-//--------------------------------------------------------------------------------------------------
+    if (curr != last) {
+        std::string buf;
+        auto const arg = cl::impl::ArgToUTF8(curr, buf);
+        SetStableArg<It>(arg, buf);
+
+#if CL_ENABLE_STATS
+        ++stats_.num_args;
+        if (arg.data() == buf.data()) {
+            stats_.utf8_bytes += arg.size();
+        }
+#endif
 
-template <typename ParserT>
-template <typename ParserInit>
-inline Option<ParserT>::Option(char const* name, char const* descr, OptionFlags flags, ParserInit&& parser)
-    : OptionBase(name, descr, flags)
-    , parser_(std::forward<ParserInit>(parser))
-{
-}
+#if 1
+        // If the string is of the form "--K=V" and "K" is the name of
+        // an option, emit a warning.
+        if (arg.size() >= 2 && arg[0] == '-') {
+            auto n = string_view(arg);
+            n.remove_prefix(1);
+            if (n[0] == '-') {
+                n.remove_prefix(1);
+            }
+            n = n.substr(0, n.find('='));
 
-template <typename ParserT>
-bool Option<ParserT>::Parse(ParseContext const& ctx) {
-    CL_ASSERT(cl::impl::IsUTF8(ctx.name.begin(), ctx.name.end()));
-    CL_ASSERT(cl::impl::IsUTF8(ctx.arg.begin(), ctx.arg.end()));
+            if (FindOption(n) != nullptr) {
+                EmitDiag(Diagnostic::warning, curr_index_, "option '", n, "' is used as an argument for option '", name, "'");
+                EmitDiag(Diagnostic::note, curr_index_, "use '--", name, opt->HasFlag(MayJoin::yes) ? "" : "=", arg, "' to suppress this warning");
+            }
+        }
+#endif
 
-    return DoParse(ctx, std::is_convertible<decltype(parser_(ctx)), bool>{});
-}
+        return ParseOptionArgument(opt, name, arg);
+    }
 
-//--------------------------------------------------------------------------------------------------
-//
-//--------------------------------------------------------------------------------------------------
+    // Used by Complete, which only runs on the top-level parser.
+    auto root = this;
+    while (root->parent_ != nullptr) {
+        root = root->parent_;
+    }
+    root->pending_option_ = opt;
 
-inline Cmdline::Cmdline(char const* name, char const* descr)
-    : name_(name)
-    , descr_(descr)
-{
+    EmitDiag(Diagnostic::error, curr_index_, "option '", name, "' requires an argument");
+    return Status::error;
 }
 
-inline Cmdline::~Cmdline() = default;
+inline Cmdline::Status Cmdline::HandleOccurrence(OptionBase const* opt, string_view name, string_view arg) {
+    // An argument was specified for OPT.
 
-template <typename... Args>
-CL_FORCE_INLINE void Cmdline::EmitDiag(Diagnostic::Type type, int index, Args&&... args) {
-    string_view strings[] = {args...};
-    EmitDiagImpl(type, index, strings, sizeof...(Args));
+    if (opt->HasFlag(Positional::no) && opt->HasFlag(Arg::no)) {
+        EmitDiag(Diagnostic::error, curr_index_, "option '", name, "' does not accept an argument");
+        return Status::error;
+    }
+
+    return ParseOptionArgument(opt, name, arg);
 }
 
-template <typename ParserInit>
-Option<std::decay_t<ParserInit>>* Cmdline::Add(char const* name, char const* descr, OptionFlags flags, ParserInit&& parser) {
-    auto opt = std::make_unique<Option<std::decay_t<ParserInit>>>(
-        name, descr, flags, std::forward<ParserInit>(parser));
+inline Cmdline::Status Cmdline::ParseOptionArgument(OptionBase const* opt, string_view name, string_view arg) {
+    auto Parse1 = [&](string_view arg1) {
+        if (!IsOccurrenceAllowed(opt)) {
+            // Use opt->Name() instead of name here.
+            // This gives slightly nicer error messages in case an option has
+            // multiple names.
+            EmitDiag(Diagnostic::error, curr_index_, "option '", opt->Name(), "' already specified");
+            return Status::error;
+        }
 
-    auto const p = opt.get();
-    Add(std::move(opt));
-    return p;
-}
+        ParseContext ctx;
 
-inline OptionBase* Cmdline::Add(std::unique_ptr<OptionBase> opt) {
-    auto const p = opt.get();
-    unique_options_.push_back(std::move(opt));
-    return Add(p);
-}
+        ctx.name = name;
+        ctx.arg = arg1;
+        ctx.index = curr_index_;
+        ctx.cmdline = this;
+        ctx.target = target_;
 
-inline OptionBase* Cmdline::Add(OptionBase* opt) {
-    CL_ASSERT(opt != nullptr);
-    CL_ASSERT(cl::impl::IsUTF8(opt->name_.begin(), opt->name_.end()));
-    CL_ASSERT(cl::impl::IsUTF8(opt->descr_.begin(), opt->descr_.end()));
+        //
+        // XXX:
+        // Implement a better way to determine if a diagnostic should be emitted here...
+        //
+        auto const num_diagnostics = num_diag_;
 
-    cl::impl::Split(opt->Name(), cl::impl::ByChar('|'), [&](string_view name) {
-        CL_ASSERT(!name.empty() && "Empty option names are not allowed");
-        CL_ASSERT(name[0] != '-' && "Option names must not start with a '-'");
-        CL_ASSERT(name.find('"') == string_view::npos && "An option name must not contain an '\"'");
-        // TODO:
-        // Abort/throw if an option with the given name already exists?
-        CL_ASSERT(FindOption(name) == nullptr && "Option already exists");
+        if (defer_ == DeferConversion::yes && !dry_run_) {
+            DeferArg(opt, name, arg1);
+        } else if (!dry_run_ && !CallParser(opt, [&] { return schema_->parse_fns_[static_cast<size_t>(opt->Id())](opt, ctx); })) {
+            bool const diagnostic_emitted = num_diag_ > num_diagnostics;
+            if (!diagnostic_emitted) {
+                EmitDiag(Diagnostic::error, curr_index_, "invalid argument '", arg1, "' for option '", name, "'");
+            }
+
+            return Status::error;
+        }
+
+        ++counts_[static_cast<size_t>(opt->Id())];
+        return Status::success;
+    };
+
+    Status res = Status::success;
+
+    if (opt->HasFlag(CommaSeparated::yes) && opt->HasFlag(Multiple::yes) && opt->CanParseList() && !dry_run_ && defer_ == DeferConversion::no) {
+        res = ParseOptionList(opt, name, arg);
+    } else if (opt->HasFlag(CommaSeparated::yes)) {
+        if (opt->HasFlag(Multiple::yes) && !dry_run_ && defer_ == DeferConversion::no) {
+            size_t num_elements = 1;
+            for (char const* p = arg.data(); (p = cl::impl::FindComma(p, arg.data() + arg.size())) != arg.data() + arg.size(); ++p) {
+                ++num_elements;
+            }
+            opt->Reserve(num_elements);
+        }
+
+        cl::impl::Split(arg, cl::impl::ByChar(','), [&](string_view s) {
+            res = Parse1(s);
+            if (res != Status::success) {
+                EmitDiag(Diagnostic::note, curr_index_, "in comma-separated argument '", arg, "'");
+                return false;
+            }
+            return true;
+        });
+    } else {
+        res = Parse1(arg);
+    }
 
-        if (opt->HasFlag(MayJoin::yes)) {
-            auto const n = static_cast<int>(name.size());
-            if (max_prefix_len_ < n) {
-                max_prefix_len_ = n;
-            }
+    if (res == Status::success) {
+        // If the current option has the StopParsing flag set, we're done.
+        if (opt->HasFlag(StopParsing::yes)) {
+            res = Status::done;
         }
+    }
 
-        options_.emplace_back(name, opt);
-
-        return true;
-    });
+    return res;
+}
 
-    return opt;
+template <typename It>
+void Cmdline::SetStableArg(string_view arg, std::string const& buf) {
+    bool const stable = cl::impl::HasPersistentArgs<It>::value && response_file_depth_ == 0 && arg.data() != buf.data();
+    stable_arg_ = stable ? arg : string_view{};
 }
 
-inline void Cmdline::Reset() {
-    diag_.clear();
-    curr_positional_ = 0;
-    curr_index_ = 0;
-    dashdash_ = false;
+inline void Cmdline::ReleasePersistedArgs(std::vector<std::unique_ptr<char[]>>& out) {
+    for (auto& copy : arg_copies_) {
+        out.push_back(std::move(copy));
+    }
+    arg_copies_.clear();
+}
 
-    ForEachUniqueOption([](OptionBase* opt) {
-        opt->count_ = 0;
-        return true;
-    });
+inline bool Cmdline::IsStableArg(string_view str) const {
+    auto const first = reinterpret_cast<uintptr_t>(stable_arg_.data());
+    auto const p = reinterpret_cast<uintptr_t>(str.data());
+    return stable_arg_.data() != nullptr && p >= first && p + str.size() <= first + stable_arg_.size();
 }
 
-template <typename It, typename EndIt>
-Cmdline::ParseResult<It> Cmdline::Parse(It curr, EndIt last, CheckMissingOptions check_missing) {
-    CL_ASSERT(curr_positional_ >= 0);
-    CL_ASSERT(curr_index_ >= 0);
+inline string_view Cmdline::PersistArg(string_view str) {
+    if (IsStableArg(str)) {
+        return str;
+    }
 
-    while (curr != last) {
-        // Make a copy of the current value.
-        // NB: This is actually only needed for InputIterator's...
-        auto const arg = cl::impl::ToUTF8(*curr);
+    std::unique_ptr<char[]> copy(new char[str.size() != 0 ? str.size() : 1]);
+    std::copy(str.begin(), str.end(), copy.get());
+    arg_copies_.push_back(std::move(copy));
 
-        Status const res = Handle1(arg, curr, last);
-        switch (res) {
-        case Status::success:
-            break;
-        case Status::done:
-            if (curr != last) {
-                ++curr;
-            }
-            break;
-        case Status::error:
-            return {curr, false};
-        case Status::ignored:
-            EmitDiag(Diagnostic::error, curr_index_, "unknown option '", arg, "'");
-            return {curr, false};
-        }
+    return string_view(arg_copies_.back().get(), str.size());
+}
 
-        // Handle1 might have changed CURR.
-        // Need to recheck if we're done.
-        if (res == Status::done || curr == last) {
-            break;
-        }
+inline bool cl::impl::ConvertTo<string_view>::operator()(ParseContext const& ctx, string_view& value) const {
+    CL_ASSERT(ctx.cmdline != nullptr);
 
-        ++curr;
-        ++curr_index_;
+    value = ctx.cmdline->PersistArg(ctx.arg);
+    return true;
+}
+
+inline void Cmdline::DeferArg(OptionBase const* opt, string_view name, string_view arg) {
+    // NAME and ARG might point into temporary buffers.
+    auto const id = static_cast<size_t>(opt->Id());
+    if (last_deferred_.size() <= id) {
+        last_deferred_.resize(counts_.size() > id ? counts_.size() : id + 1, -1);
     }
 
-    bool const success = (check_missing == CheckMissingOptions::yes)
-                             ? !AnyMissing()
-                             : true;
+    DeferredArg d;
+    d.option = opt;
+    d.target = target_;
+    d.index = curr_index_;
+    d.prev = last_deferred_[id];
+    d.name_data = nullptr;
+    d.name_offset = 0;
+    d.name_length = name.size();
+    if (IsStableArg(name)) {
+        d.name_data = name.data();
+    } else {
+        d.name_offset = deferred_text_.size();
+        deferred_text_.append(name.data(), name.size());
+    }
+    d.arg_data = nullptr;
+    d.arg_offset = 0;
+    d.arg_length = arg.size();
+    if (IsStableArg(arg)) {
+        d.arg_data = arg.data();
+    } else {
+        d.arg_offset = deferred_text_.size();
+        deferred_text_.append(arg.data(), arg.size());
+    }
+    d.failed = false;
 
-    return {curr, success};
+    last_deferred_[id] = static_cast<int>(deferred_.size());
+    deferred_.push_back(d);
 }
 
-template <typename Container>
-bool Cmdline::ParseArgs(Container const& args, CheckMissingOptions check_missing) {
-    using std::begin; // using ADL!
-    using std::end;   // using ADL!
+inline ParseContext Cmdline::DeferredContext(string_view text, DeferredArg const& d) {
+    ParseContext ctx;
 
-    return Parse(begin(args), end(args), check_missing).success;
+    ctx.name = d.name_data != nullptr ? string_view(d.name_data, d.name_length) : text.substr(d.name_offset, d.name_length);
+    ctx.arg = d.arg_data != nullptr ? string_view(d.arg_data, d.arg_length) : text.substr(d.arg_offset, d.arg_length);
+    ctx.index = d.index;
+    ctx.cmdline = this;
+    ctx.target = d.target;
+
+    return ctx;
 }
 
-inline bool Cmdline::AnyMissing() {
-    bool res = false;
-    ForEachUniqueOption([&](OptionBase* opt) {
-        if (opt->IsOccurrenceRequired()) {
-            EmitDiag(Diagnostic::error, -1, "option '", opt->Name(), "' is missing");
-            res = true;
-        }
-        return true;
+inline bool Cmdline::ConvertDeferred(string_view text, DeferredArg const& d) {
+    return ConvertDeferredWith(text, d, [&](ParseContext const& ctx) {
+        return schema_->parse_fns_[static_cast<size_t>(d.option->Id())](d.option, ctx);
     });
-
-    return res;
 }
 
-#if CL_WINDOWS_CONSOLE_COLORS && _WIN32
-
-inline void Cmdline::PrintDiag() const {
-    if (diag_.empty()) {
-        return;
-    }
-
-    auto const stderr_handle = GetStdHandle(STD_ERROR_HANDLE);
-    if (stderr_handle == NULL) {
-        return; // No console.
-    }
+inline bool Cmdline::ConvertDeferred(string_view text, DeferredArg const& d, cl::impl::ArgSlots& slots, size_t i) {
+    return ConvertDeferredWith(text, d, [&](ParseContext const& ctx) {
+        return slots.Convert(i, ctx);
+    });
+}
 
-    if (stderr_handle == INVALID_HANDLE_VALUE) {
-        return; // Error (Print without colors?!)
-    }
+template <typename Fn>
+bool Cmdline::WithDeferredArg(DeferredArg const& d, Fn fn) {
+    auto const stable_arg = stable_arg_;
+    stable_arg_ = d.arg_data != nullptr ? string_view(d.arg_data, d.arg_length) : string_view{};
 
-    CONSOLE_SCREEN_BUFFER_INFO sbi;
-    GetConsoleScreenBufferInfo(stderr_handle, &sbi);
+    bool const ok = fn();
 
-    auto const old_attributes = sbi.wAttributes;
+    stable_arg_ = stable_arg;
+    return ok;
+}
 
-    for (auto const& d : diag_) {
-        fflush(stderr);
+template <typename Fn>
+bool Cmdline::ConvertDeferredWith(string_view text, DeferredArg const& d, Fn parse) {
+    auto const ctx = DeferredContext(text, d);
 
-        fprintf(stderr, "%.*s: ", static_cast<int>(name_.size()), name_.data());
-        fflush(stderr);
+    auto const num_diagnostics = num_diag_;
 
-        switch (d.type) {
-        case Diagnostic::error:
-            SetConsoleTextAttribute(stderr_handle, FOREGROUND_RED | FOREGROUND_INTENSITY);
-            fprintf(stderr, "error:");
-            break;
-        case Diagnostic::warning:
-            SetConsoleTextAttribute(stderr_handle, FOREGROUND_RED | FOREGROUND_BLUE | FOREGROUND_INTENSITY);
-            fprintf(stderr, "warning:");
-            break;
-        case Diagnostic::note:
-            SetConsoleTextAttribute(stderr_handle, FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY);
-            fprintf(stderr, "note:");
-            break;
+    if (!WithDeferredArg(d, [&] { return CallParser(d.option, [&] { return parse(ctx); }); })) {
+        bool const diagnostic_emitted = num_diag_ > num_diagnostics;
+        if (!diagnostic_emitted) {
+            EmitDiag(Diagnostic::error, d.index, "invalid argument '", ctx.arg, "' for option '", ctx.name, "'");
         }
-        fflush(stderr);
-        SetConsoleTextAttribute(stderr_handle, old_attributes);
-        fprintf(stderr, " %s\n", d.message.c_str());
+        return false;
     }
+
+    return true;
 }
 
-#else
+template <typename T>
+bool Cmdline::ConvertLazy(DeferredArg const& d, T& value) {
+    auto const ctx = DeferredContext(deferred_text_, d);
 
-#if CL_ANSI_CONSOLE_COLORS
-#define CL_VT100_RESET   "\x1B[0m"
-#define CL_VT100_RED     "\x1B[31;1m"
-#define CL_VT100_MAGENTA "\x1B[35;1m"
-#define CL_VT100_CYAN    "\x1B[36;1m"
-#else
-#define CL_VT100_RESET
-#define CL_VT100_RED
-#define CL_VT100_MAGENTA
-#define CL_VT100_CYAN
-#endif
+    auto const num_diagnostics = num_diag_;
 
-inline void Cmdline::PrintDiag() const {
-    for (auto const& d : diag_) {
-        fprintf(stderr, "%.*s: ", static_cast<int>(name_.size()), name_.data());
+    if (!WithDeferredArg(d, [&] { return cl::impl::ConvertTo<T>{}(ctx, value); })) {
+        bool const diagnostic_emitted = num_diag_ > num_diagnostics;
+        if (!diagnostic_emitted) {
+            EmitDiag(Diagnostic::error, d.index, "invalid argument '", ctx.arg, "' for option '", ctx.name, "'");
+        }
+        return false;
+    }
 
-        switch (d.type) {
-        case Diagnostic::error:
-            fprintf(stderr, CL_VT100_RED "error:" CL_VT100_RESET " %s\n", d.message.c_str());
-            break;
-        case Diagnostic::warning:
-            fprintf(stderr, CL_VT100_MAGENTA "warning:" CL_VT100_RESET " %s\n", d.message.c_str());
-            break;
-        case Diagnostic::note:
-            fprintf(stderr, CL_VT100_CYAN "note:" CL_VT100_RESET " %s\n", d.message.c_str());
+    return true;
+}
+
+template <typename T, typename Fn>
+cl::impl::LazyValue<T> const* Cmdline::Memoize(OptionBase const* opt, bool all, Fn convert) {
+    auto const id = opt->Id();
+    auto const type = static_cast<void const*>(&cl::impl::TypeTag<T>::id);
+    auto const last = static_cast<size_t>(id) < last_deferred_.size() ? last_deferred_[static_cast<size_t>(id)] : -1;
+
+    LazyEntry* entry = nullptr;
+    for (auto& e : lazy_values_) {
+        if (e.id == id && e.type == type && e.all == all) {
+            entry = &e;
             break;
         }
     }
-}
 
-#undef CL_VT100_RESET
-#undef CL_VT100_RED
-#undef CL_VT100_MAGENTA
-#undef CL_VT100_CYAN
+    if (entry == nullptr) {
+        lazy_values_.push_back(LazyEntry{id, type, all, -2, std::unique_ptr<cl::impl::LazyValueBase>(new cl::impl::LazyValue<T>)});
+        entry = &lazy_values_.back();
+    }
 
-#endif
+    auto const lazy = static_cast<cl::impl::LazyValue<T>*>(entry->value.get());
+    if (entry->last != last) {
+        entry->last = last;
+        lazy->value = T{};
+        lazy->ok = convert(last, lazy->value);
+    }
 
-namespace impl {
+    return lazy;
+}
 
-inline size_t AppendSingleLine(std::string& out, string_view line, size_t indent, size_t column_width, size_t col, bool indent_first_piece) {
-    bool do_indent = indent_first_piece;
+template <typename T>
+T const* Cmdline::Get(string_view name) {
+    auto const opt = FindOption(name);
+    if (opt == nullptr) {
+        return nullptr;
+    }
 
-    cl::impl::Split(line, cl::impl::ByWords(column_width), [&](string_view piece) {
-        if (do_indent) {
-            out += '\n';
-            out.append(indent, ' ');
-            col = indent;
-        } else {
-            do_indent = true;
-        }
-        out.append(piece.data(), piece.size());
-        col += piece.size();
-        return true;
+    auto const lazy = Memoize<T>(opt, /*all*/ false, [&](int last, T& value) {
+        return last >= 0 && ConvertLazy(deferred_[static_cast<size_t>(last)], value);
     });
 
-    return col;
+    return lazy->ok ? &lazy->value : nullptr;
 }
 
-// Assumes: currently at column = 'indent'
-inline void AppendLines(std::string& out, string_view text, size_t indent, size_t column_width) {
-    CL_ASSERT(indent < column_width);
-
-    bool do_indent = false; // Do not indent the first line.
-
-    cl::impl::Split(text, cl::impl::ByLines(), [&](string_view line) {
-        // Find the position of the first tab-character in this line (if any).
-        auto const tab_pos = line.find('\t');
-        CL_ASSERT((tab_pos == string_view::npos || line.find('\t', tab_pos + 1) == string_view::npos) && "Only a single tab-character per line is allowed");
-
-        // Append the first (or only) part of this line.
-        auto const col = cl::impl::AppendSingleLine(out, line.substr(0, tab_pos), indent, column_width, /*col*/ indent, do_indent);
-
-        // If there is a tab-character, print the second half of this line.
-        if (tab_pos != string_view::npos) {
-            CL_ASSERT(col >= indent);
+template <typename T>
+std::vector<T> const* Cmdline::GetAll(string_view name) {
+    auto const opt = FindOption(name);
+    if (opt == nullptr) {
+        return nullptr;
+    }
 
-            auto const block_col  = (col - indent) % column_width;
-            auto const new_indent = indent + block_col;
-            auto const new_width  = column_width - block_col;
+    auto const lazy = Memoize<std::vector<T>>(opt, /*all*/ true, [&](int last, std::vector<T>& values) {
+        size_t n = 0;
+        for (int i = last; i >= 0; i = deferred_[static_cast<size_t>(i)].prev) {
+            ++n;
+        }
 
-            cl::impl::AppendSingleLine(out, line.substr(tab_pos + 1), new_indent, new_width, /*col (ignored)*/ 0, /*do_indent*/ false);
+        // Walk the list backwards, storing the values in place.
+        values.resize(n);
+        bool ok = true;
+        for (int i = last; i >= 0; i = deferred_[static_cast<size_t>(i)].prev) {
+            T value{}; // values[n] might be a proxy (std::vector<bool>)
+            if (ConvertLazy(deferred_[static_cast<size_t>(i)], value)) {
+                values[--n] = std::move(value);
+            } else {
+                --n;
+                ok = false;
+            }
         }
 
-        do_indent = true;
-        return true;
+        return ok;
     });
+
+    return lazy->ok ? &lazy->value : nullptr;
 }
 
-// Append the name of the option along with a short description of its argument (if any)
-// Note: not wrapped.
-inline void AppendUsage(std::string& out, OptionBase* opt, size_t indent) {
-    out.append(indent, ' ');
-    if (opt->HasFlag(Positional::yes)) {
-        out += '<';
-        out.append(opt->Name().data(), opt->Name().size());
-        out += '>';
-        if (opt->HasFlag(Multiple::yes)) {
-            out += "...";
-        }
-    } else {
-        out += "--";
-        out.append(opt->Name().data(), opt->Name().size());
-        if (opt->HasFlag(Arg::required) && opt->HasFlag(MayJoin::yes)) {
-            out += "<arg>";
-        } else if (opt->HasFlag(Arg::required)) {
-            out += " <arg>";
-        } else if (opt->HasFlag(Arg::optional)) {
-            out += "=<arg>";
+inline bool Cmdline::Convert() {
+    bool ok = true;
+
+    // The number of values of each option is known, so reserve once.
+    std::vector<size_t> num_values(static_cast<size_t>(schema_->num_ids_));
+    for (size_t i = num_converted_; i < deferred_.size(); ++i) {
+        ++num_values[static_cast<size_t>(deferred_[i].option->Id())];
+    }
+    for (size_t id = 0; id < num_values.size(); ++id) {
+        if (num_values[id] > 1) {
+            schema_->id_options_[id]->Reserve(num_values[id]);
         }
     }
-}
 
-inline void AppendDescr(std::string& out, OptionBase* opt, size_t indent, size_t descr_indent, size_t descr_width) {
-    auto const col0 = out.size();
-    CL_ASSERT(col0 == 0 || out[col0 - 1] == '\n');
+    for (size_t i = num_converted_; i < deferred_.size(); ++i) {
+        auto& d = deferred_[i];
+        if (!ConvertDeferred(deferred_text_, d)) {
+            // Same as if the parser had been called by Parse().
+            --counts_[static_cast<size_t>(d.option->Id())];
+            d.failed = true;
+            ok = false;
+        }
+    }
 
-    // Append the name of the option along with a short description of its argument (if any)
-    // Note: not wrapped.
-    AppendUsage(out, opt, indent);
+    num_converted_ = deferred_.size();
 
-    if (!opt->Descr().empty()) {
-        // Move to column 'descr_width'.
-        // Possibly on the next line.
-        auto const col     = out.size() - col0;
-        auto const wrap    = col >= descr_indent;
-        auto const nspaces = wrap ? descr_indent : descr_indent - col;
-        if (wrap) {
-            out += '\n';
+    if (auto const sub = sub_active_ ? sub_.get() : nullptr) {
+        if (!sub->Convert()) {
+            ok = false;
         }
-        out.append(nspaces, ' ');
-
-        // Append the options description.
-        cl::impl::AppendLines(out, opt->Descr(), descr_indent, descr_width);
     }
 
-    out += '\n';
+    return ok;
 }
 
-} // namespace impl
+template <typename Executor>
+bool Cmdline::Convert(Executor&& executor) {
+    size_t const first_arg = num_converted_;
+    size_t const num_args = deferred_.size() - first_arg;
 
-inline std::string Cmdline::FormatHelp(HelpFormat const& fmt) const {
-    CL_ASSERT(fmt.descr_indent > fmt.indent);
-    CL_ASSERT(fmt.descr_indent < SIZE_MAX);
+    // Sort the arguments by option, keeping the order of the arguments of
+    // each option.
+    std::vector<size_t> order(num_args); // Indices into deferred_
+    for (size_t i = 0; i < num_args; ++i) {
+        order[i] = first_arg + i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+        return deferred_[lhs].option->Id() < deferred_[rhs].option->Id();
+    });
 
-    auto const line_length = (fmt.line_length == 0) ? SIZE_MAX : fmt.line_length;
-    CL_ASSERT(line_length > fmt.descr_indent);
-    auto const descr_width = line_length - fmt.descr_indent;
+    // The arguments of an option are converted in order by a single task,
+    // unless the parser can convert them independently (see
+    // OptionBase::MakeArgSlots). Then each argument is converted into its own
+    // slot by its own task, and the values are stored in order afterwards.
+    struct Group {
+        size_t begin; // Index into order
+        size_t end;
+        std::unique_ptr<cl::impl::ArgSlots> slots;
+    };
+    struct Task {
+        size_t begin; // Index into order
+        size_t end;
+        Group const* group;
+    };
 
-    std::string out;
+    std::vector<Group> groups;
+    for (size_t k = 0; k < num_args; ++k) {
+        if (k == 0 || deferred_[order[k]].option != deferred_[order[k - 1]].option) {
+            groups.push_back(Group{k, k, nullptr});
+        }
+        ++groups.back().end;
+    }
 
-    out.append(Name().data(), Name().size());
-    out += " - ";
-    out.append(Descr().data(), Descr().size());
-    out += "\n\nUsage:\n";
-    out.append(fmt.indent, ' ');
-    out.append(Name().data(), Name().size());
-
-    std::string arg_descr = "\nArguments:\n";
-    std::string opt_descr = "\nOptions:\n";
-    std::string pos_descr = "\nPositional options:\n";
-
-    bool has_pos = false;
-    bool has_arg = false;
-    bool has_opt = false;
-    ForEachUniqueOption([&](OptionBase* opt) {
-        std::string* descr;
-
-        if (!opt->HasFlag(Required::no)) { // Required option, aka 'argument'.
-            has_arg = true;
-            descr = &arg_descr;
-
-            // Append this argument to the usage line.
-            cl::impl::AppendUsage(out, opt, 1);
-        } else if (!opt->HasFlag(Positional::yes)) {
-            has_opt = true;
-            descr = &opt_descr;
+    std::vector<Task> tasks;
+    for (auto& g : groups) {
+        if (g.end - g.begin > 1) {
+            g.slots = deferred_[order[g.begin]].option->MakeArgSlots(g.end - g.begin);
+        }
+        if (g.slots) {
+            for (size_t k = g.begin; k < g.end; ++k) {
+                tasks.push_back(Task{k, k + 1, &g});
+            }
         } else {
-            has_pos = true;
-            descr = &pos_descr;
+            tasks.push_back(Task{g.begin, g.end, &g});
         }
+    }
 
-        cl::impl::AppendDescr(*descr, opt, fmt.indent, fmt.descr_indent, descr_width);
-        return true;
+    size_t const num_tasks = tasks.size();
+
+    // The tasks collect their diagnostics in temporary Cmdlines. A Cmdline is
+    // only used by one task at a time, and is reused by the next task, so
+    // there are only as many as tasks run concurrently.
+    std::mutex pool_mutex;
+    std::vector<std::unique_ptr<Cmdline>> clis; // All temporary Cmdlines
+    std::vector<Cmdline*> idle;                  // Those not currently used by a task
+    std::vector<Cmdline*> task_cli(num_tasks);   // The Cmdline used by task T
+    std::vector<size_t> diag_begin(num_tasks);   // Number of diagnostics in task_cli[t] before task T
+    std::vector<size_t> diag_end(num_args);      // Number of diagnostics in the Cmdline of the task after order[k]
+    std::vector<char> failed(num_args);          // Indexed by k
+
+    executor(num_tasks, [&](size_t t) {
+        CL_ASSERT(t < num_tasks);
+
+        Cmdline* cli = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            if (idle.empty()) {
+                clis.emplace_back(new Cmdline(*schema_));
+                cli = clis.back().get();
+                cli->collect_diag_ = collect_diag_;
+            } else {
+                cli = idle.back();
+                idle.pop_back();
+            }
+        }
+
+        auto const& task = tasks[t];
+        task_cli[t] = cli;
+        diag_begin[t] = cli->diag_records_.size();
+
+        if (auto const slots = task.group->slots.get()) {
+            auto const k = task.begin;
+            failed[k] = cli->ConvertDeferred(deferred_text_, deferred_[order[k]], *slots, k - task.group->begin) ? 0 : 1;
+            diag_end[k] = cli->diag_records_.size();
+        } else {
+            if (task.end - task.begin > 1) {
+                deferred_[order[task.begin]].option->Reserve(task.end - task.begin);
+            }
+
+            for (size_t k = task.begin; k < task.end; ++k) {
+                failed[k] = cli->ConvertDeferred(deferred_text_, deferred_[order[k]]) ? 0 : 1;
+                diag_end[k] = cli->diag_records_.size();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        idle.push_back(cli);
     });
 
-    if (has_opt) {
-        out += " [options]";
-    }
-    out += '\n';
-    if (has_arg) {
-        out += arg_descr;
+    // Store the values converted into slots, in order.
+    for (auto const& g : groups) {
+        if (g.slots) {
+            deferred_[order[g.begin]].option->Reserve(g.end - g.begin);
+            for (size_t k = g.begin; k < g.end; ++k) {
+                if (!failed[k]) {
+                    g.slots->Store(k - g.begin);
+                }
+            }
+        }
     }
-    if (has_opt) {
-        out += opt_descr;
+
+    // Merge the diagnostics in the order of the arguments.
+    std::vector<size_t> position(num_args); // Inverse of order, minus first_arg
+    std::vector<size_t> task_of(num_args);  // Indexed by k
+    for (size_t t = 0; t < num_tasks; ++t) {
+        for (size_t k = tasks[t].begin; k < tasks[t].end; ++k) {
+            position[order[k] - first_arg] = k;
+            task_of[k] = t;
+        }
     }
-    if (has_pos) {
-        out += pos_descr;
+
+    // Values stored by PersistArg must outlive the temporary Cmdlines.
+    for (auto const& cli : clis) {
+        for (auto& copy : cli->arg_copies_) {
+            arg_copies_.push_back(std::move(copy));
+        }
     }
 
-    CL_ASSERT(cl::impl::IsUTF8(out.begin(), out.end()));
-    return out;
-}
+    bool ok = true;
+    for (size_t i = 0; i < num_args; ++i) {
+        auto const k = position[i];
+        auto const t = task_of[k];
+        auto const& cli = *task_cli[t];
+
+        size_t const first = (k == tasks[t].begin) ? diag_begin[t] : diag_end[k - 1];
+        for (size_t r = first; r < diag_end[k]; ++r) {
+            auto const& rec = cli.diag_records_[r];
+            auto const text = string_view(cli.diag_text_.data() + rec.offset, rec.length);
+            EmitDiagImpl(rec.type, rec.index, &text, 1);
+        }
 
-inline void Cmdline::PrintHelp(HelpFormat const& fmt) const {
-    auto const msg = FormatHelp(fmt);
-    fprintf(stderr, "%s\n", msg.c_str());
-}
+        if (failed[k]) {
+            --counts_[static_cast<size_t>(deferred_[first_arg + i].option->Id())];
+            deferred_[first_arg + i].failed = true;
+            ok = false;
+        }
+    }
 
-inline void Cmdline::DebugCheck() const
-{
-}
+    num_converted_ = deferred_.size();
 
-inline OptionBase* Cmdline::FindOption(string_view name) const {
-    for (auto&& p : options_) {
-        // NB: Don't skip positional options.
-        // Positional options have a name and might still be provided
-        // in the form "--name=value".
-        if (p.name == name) {
-            return p.option;
+    if (auto const sub = sub_active_ ? sub_.get() : nullptr) {
+        if (!sub->Convert(executor)) {
+            ok = false;
         }
     }
 
-    return nullptr;
+    return ok;
 }
 
-template <typename It, typename EndIt>
-Cmdline::Status Cmdline::Handle1(string_view optstr, It& curr, EndIt last) {
-    CL_ASSERT(curr != last);
+namespace impl {
 
-    // This cannot happen if we're parsing the main's argv[] array, but it might
-    // happen if we're parsing a user-supplied array of command line arguments.
-    if (optstr.empty()) {
-        return Status::success;
-    }
+// The layout of the blob written by Cmdline::Serialize:
+//
+//  "CLpr" | version | fingerprint | #ids | #args | #text | curr_positional
+//  count[#ids]
+//  {id, index, name_offset, name_length, arg_offset, arg_length}[#args]
+//  text[#text]
+//
+// All fields are 32-bit integers, except the 64-bit fingerprint, in native
+// byte order.
+constexpr uint32_t kReplayVersion = 1;
+constexpr size_t kReplayHeaderSize = 4 + 4 + 8 + 4 + 4 + 4 + 4;
+constexpr size_t kReplayArgSize = 6 * 4;
 
-    // Stop parsing if "--" has been found
-    if (optstr == "--" && !dashdash_) {
-        dashdash_ = true;
-        return Status::success;
-    }
+} // namespace impl
 
-    // This argument is considered to be positional if it doesn't start with
-    // '-', if it is "-" itself, or if we have seen "--" already, or if the
-    // argument doesn't look like a known option (see below).
-    bool const is_positional = (optstr[0] != '-' || optstr == "-" || dashdash_);
-    if (is_positional) {
-        return HandlePositional(optstr);
+inline bool Cmdline::Serialize(std::string& out) const {
+    if (defer_ != DeferConversion::yes || sub_active_) {
+        return false;
     }
 
-    auto const optstr_orig = optstr;
+    // Options might have been added since the last call to Parse().
+    auto const num_ids = static_cast<size_t>(schema_->num_ids_);
 
-    CL_ASSERT(optstr[0] == '-');
-    optstr.remove_prefix(1); // Remove the first dash.
+    // The names and arguments which have not been copied into deferred_text_
+    // are written to the blob, too.
+    size_t text_size = 0;
+    for (auto const& d : deferred_) {
+        text_size += d.name_length + d.arg_length;
+    }
 
-    // If the name starts with a single dash, this is a short option and might
-    // actually be an option group.
-    bool const is_short = (optstr[0] != '-');
-    if (!is_short) {
-        optstr.remove_prefix(1); // Remove the second dash.
+    out.reserve(out.size() + cl::impl::kReplayHeaderSize + 4 * num_ids + cl::impl::kReplayArgSize * deferred_.size() + text_size);
+
+    out.append("CLpr", 4);
+    cl::impl::AppendBinary(out, cl::impl::kReplayVersion);
+    cl::impl::AppendBinary(out, schema_->Fingerprint());
+    cl::impl::AppendBinary(out, static_cast<uint32_t>(num_ids));
+    cl::impl::AppendBinary(out, static_cast<uint32_t>(deferred_.size()));
+    cl::impl::AppendBinary(out, static_cast<uint32_t>(text_size));
+    cl::impl::AppendBinary(out, static_cast<int32_t>(curr_positional_));
+
+    // Write the counts before conversion: Replay() converts all arguments
+    // again, and uncounts those which fail again.
+    std::vector<uint32_t> counts(num_ids);
+    for (size_t id = 0; id < num_ids && id < counts_.size(); ++id) {
+        counts[id] = static_cast<uint32_t>(counts_[id]);
+    }
+    for (auto const& d : deferred_) {
+        if (d.failed) {
+            ++counts[static_cast<size_t>(d.option->Id())];
+        }
     }
 
-    // 1. Try to handle options like "-f" and "-f file"
-    Status res = HandleStandardOption(optstr, curr, last);
+    for (size_t id = 0; id < num_ids; ++id) {
+        cl::impl::AppendBinary(out, counts[id]);
+    }
 
-    // 2. Try to handle options like "-f=file"
-    if (res == Status::ignored) {
-        res = HandleOption(optstr);
+    size_t offset = 0;
+    for (auto const& d : deferred_) {
+        cl::impl::AppendBinary(out, static_cast<uint32_t>(d.option->Id()));
+        cl::impl::AppendBinary(out, static_cast<int32_t>(d.index));
+        cl::impl::AppendBinary(out, static_cast<uint32_t>(offset));
+        cl::impl::AppendBinary(out, static_cast<uint32_t>(d.name_length));
+        cl::impl::AppendBinary(out, static_cast<uint32_t>(offset + d.name_length));
+        cl::impl::AppendBinary(out, static_cast<uint32_t>(d.arg_length));
+        offset += d.name_length + d.arg_length;
     }
 
-    // 3. Try to handle options like "-Idir"
-    if (res == Status::ignored) {
-        res = HandlePrefix(optstr);
+    for (auto const& d : deferred_) {
+        out.append(d.name_data != nullptr ? d.name_data : deferred_text_.data() + d.name_offset, d.name_length);
+        out.append(d.arg_data != nullptr ? d.arg_data : deferred_text_.data() + d.arg_offset, d.arg_length);
     }
 
-    // 4. Try to handle options like "-xvf=file" and "-xvf file"
-    if (res == Status::ignored && is_short) {
-        res = HandleGroup(optstr, curr, last);
+    return true;
+}
+
+inline bool Cmdline::Replay(string_view blob) {
+    auto const invalid = [&] {
+        EmitDiag(Diagnostic::error, -1, "invalid command line blob");
+        return false;
+    };
+
+    if (blob.size() < cl::impl::kReplayHeaderSize || blob.substr(0, 4) != "CLpr") {
+        return invalid();
     }
 
-    // Otherwise this is an unknown option.
-    //
-    // 5. Try to handle this option as a positional option.
-    //    If there are no more (hungry) positional options, this is an error.
-    if (res == Status::ignored) {
-        res = HandlePositional(optstr_orig);
+    size_t pos = 4;
+    if (cl::impl::ReadBinary<uint32_t>(blob, pos) != cl::impl::kReplayVersion) {
+        return invalid();
+    }
+    if (cl::impl::ReadBinary<uint64_t>(blob, pos) != schema_->Fingerprint()) {
+        EmitDiag(Diagnostic::error, -1, "command line blob has been written for a different set of options");
+        return false;
     }
 
-    return res;
-}
+    // Options might have been added since the last call to Parse().
+    counts_.resize(static_cast<size_t>(schema_->num_ids_));
 
-inline Cmdline::Status Cmdline::HandlePositional(string_view optstr) {
-    auto const E = static_cast<int>(options_.size());
-    CL_ASSERT(curr_positional_ >= 0);
-    CL_ASSERT(curr_positional_ <= E);
+    uint64_t const num_ids = cl::impl::ReadBinary<uint32_t>(blob, pos);
+    uint64_t const num_args = cl::impl::ReadBinary<uint32_t>(blob, pos);
+    uint64_t const text_size = cl::impl::ReadBinary<uint32_t>(blob, pos);
+    auto const positional = cl::impl::ReadBinary<int32_t>(blob, pos);
 
-    for (; curr_positional_ != E; ++curr_positional_) { // find_if
-        auto opt = options_[static_cast<size_t>(curr_positional_)].option;
+    if (num_ids != counts_.size() ||
+        positional < 0 || static_cast<size_t>(positional) > schema_->positionals_.size() ||
+        blob.size() - pos != 4 * num_ids + cl::impl::kReplayArgSize * num_args + text_size) {
+        return invalid();
+    }
 
-        if (!opt->HasFlag(Positional::yes)) {
-            continue;
+    size_t const counts_pos = pos;
+    size_t const args_pos = counts_pos + 4 * static_cast<size_t>(num_ids);
+    auto const text = blob.substr(args_pos + cl::impl::kReplayArgSize * static_cast<size_t>(num_args));
+
+    // Validate all arguments and counts first.
+    std::vector<uint64_t> num_id_args(counts_.size());
+    pos = args_pos;
+    for (uint64_t i = 0; i < num_args; ++i) {
+        uint64_t const id = cl::impl::ReadBinary<uint32_t>(blob, pos);
+        pos += 4;
+        uint64_t const name_offset = cl::impl::ReadBinary<uint32_t>(blob, pos);
+        uint64_t const name_length = cl::impl::ReadBinary<uint32_t>(blob, pos);
+        uint64_t const arg_offset = cl::impl::ReadBinary<uint32_t>(blob, pos);
+        uint64_t const arg_length = cl::impl::ReadBinary<uint32_t>(blob, pos);
+        if (id >= num_ids || name_offset + name_length > text_size || arg_offset + arg_length > text_size) {
+            return invalid();
         }
-        if (!opt->IsOccurrenceAllowed()) {
-            continue;
+        ++num_id_args[static_cast<size_t>(id)];
+    }
+
+    // Each recorded argument is counted, and options which may only occur
+    // once are counted at most once.
+    pos = counts_pos;
+    for (size_t id = 0; id < counts_.size(); ++id) {
+        uint64_t const count = cl::impl::ReadBinary<uint32_t>(blob, pos);
+        uint64_t const total = count + static_cast<uint64_t>(counts_[id]);
+        if (count < num_id_args[id] || total > INT_MAX ||
+            (schema_->id_options_[id]->HasFlag(Multiple::no) && total > 1)) {
+            return invalid();
         }
+    }
 
-        // The argument of a positional option is the value specified on the
-        // command line.
-        return HandleOccurrence(opt, opt->Name(), optstr);
+    pos = counts_pos;
+    for (size_t id = 0; id < counts_.size(); ++id) {
+        auto const count = cl::impl::ReadBinary<uint32_t>(blob, pos);
+        counts_[id] += static_cast<int>(count);
+        if (count > 1 && defer_ == DeferConversion::no) {
+            schema_->id_options_[id]->Reserve(count);
+        }
     }
 
-    return Status::ignored;
-}
+    // The blob does not outlive this call.
+    stable_arg_ = {};
+    if (curr_positional_ < positional) {
+        curr_positional_ = positional;
+    }
 
-// If OPTSTR is the name of an option, handle the option.
-template <typename It, typename EndIt>
-Cmdline::Status Cmdline::HandleStandardOption(string_view optstr, It& curr, EndIt last) {
-    if (auto const opt = FindOption(optstr)) {
-        // OPTSTR is the name of an option, i.e. no argument was specified.
-        // If the option requires an argument, steal one from the command line.
-        return HandleOccurrence(opt, optstr, curr, last);
+    bool ok = true;
+    for (uint64_t i = 0; i < num_args; ++i) {
+        auto const id = static_cast<size_t>(cl::impl::ReadBinary<uint32_t>(blob, pos));
+
+        DeferredArg d;
+        d.option = schema_->id_options_[id];
+        d.target = target_;
+        d.index = cl::impl::ReadBinary<int32_t>(blob, pos);
+        d.prev = -1;
+        d.name_data = nullptr;
+        d.name_offset = cl::impl::ReadBinary<uint32_t>(blob, pos);
+        d.name_length = cl::impl::ReadBinary<uint32_t>(blob, pos);
+        d.arg_data = nullptr;
+        d.arg_offset = cl::impl::ReadBinary<uint32_t>(blob, pos);
+        d.arg_length = cl::impl::ReadBinary<uint32_t>(blob, pos);
+        d.failed = false;
+
+        if (defer_ == DeferConversion::yes) {
+            curr_index_ = d.index;
+            DeferArg(d.option, text.substr(d.name_offset, d.name_length), text.substr(d.arg_offset, d.arg_length));
+        } else if (!ConvertDeferred(text, d)) {
+            --counts_[id];
+            ok = false;
+        }
     }
 
-    return Status::ignored;
+    return ok;
 }
 
-// Look for an equal sign in OPTSTR and try to handle cases like "-f=file".
-inline Cmdline::Status Cmdline::HandleOption(string_view optstr) {
-    auto arg_start = optstr.find('=');
-
-    if (arg_start != string_view::npos) {
-        // Found an '=' sign. Extract the name of the option.
-        auto const name = optstr.substr(0, arg_start);
+inline Cmdline::Status Cmdline::ParseOptionList(OptionBase const* opt, string_view name, string_view arg) {
+    CL_ASSERT(opt->HasFlag(Multiple::yes));
 
-        if (auto const opt = FindOption(name)) {
-            // Ok, something like "-f=file".
+    ParseContext ctx;
 
-            // Discard the equals sign if this option may NOT join its value.
-            if (opt->HasFlag(MayJoin::no)) {
-                ++arg_start;
-            }
+    ctx.name = name;
+    ctx.arg = arg;
+    ctx.index = curr_index_;
+    ctx.cmdline = this;
+    ctx.target = target_;
 
-            return HandleOccurrence(opt, name, optstr.substr(arg_start));
-        }
-    }
+    auto const num_diagnostics = num_diag_;
 
-    return Status::ignored;
-}
+    size_t count = 0;
+    bool const ok = CallParser(opt, [&] { return opt->ParseList(ctx, count); });
 
-inline Cmdline::Status Cmdline::HandlePrefix(string_view optstr) {
-    // Scan over all known prefix lengths.
-    // Start with the longest to allow different prefixes like e.g. "-with" and
-    // "-without".
+    counts_[static_cast<size_t>(opt->Id())] += static_cast<int>(count);
 
-    auto n = static_cast<size_t>(max_prefix_len_);
-    if (n > optstr.size()) {
-        n = optstr.size();
+    if (ok) {
+        return Status::success;
     }
 
-    for (; n != 0; --n) {
-        auto const name = optstr.substr(0, n);
-        auto const opt = FindOption(name);
-
-        if (opt != nullptr && !opt->HasFlag(MayJoin::no)) {
-            return HandleOccurrence(opt, name, optstr.substr(n));
-        }
+    bool const diagnostic_emitted = num_diag_ > num_diagnostics;
+    if (!diagnostic_emitted) {
+        // Element number COUNT is invalid.
+        size_t i = 0;
+        cl::impl::Split(arg, cl::impl::ByChar(','), [&](string_view s) {
+            if (i++ != count) {
+                return true;
+            }
+            EmitDiag(Diagnostic::error, curr_index_, "invalid argument '", s, "' for option '", name, "'");
+            return false;
+        });
     }
 
-    return Status::ignored;
+    EmitDiag(Diagnostic::note, curr_index_, "in comma-separated argument '", arg, "'");
+    return Status::error;
 }
 
-template <typename It, typename EndIt>
-Cmdline::Status Cmdline::HandleGroup(string_view optstr, It& curr, EndIt last) {
-    //
-    // XXX:
-    // Remove and call FindOption() in the second loop again?!
-    //
-    std::vector<OptionBase*> group;
+template <typename It>
+std::vector<Completion> Cmdline::Complete(It first, It last, size_t cursor) {
+    Reset();
+    counts_.resize(static_cast<size_t>(schema_->num_ids_));
 
-    // First determine the largest prefix which is a valid option group.
-    for (size_t n = 0; n < optstr.size(); ++n) {
-        if (optstr[n] == '=') {
-            break;
-        }
+    auto const collect_diag = collect_diag_;
+    auto const response_files = response_files_;
 
-        auto const name = optstr.substr(n, 1);
-        auto const opt = FindOption(name);
+    collect_diag_ = CollectDiagnostics::no;
+    response_files_ = ResponseFiles::no;
+    dry_run_ = true;
 
-        if (opt == nullptr || opt->HasFlag(MayGroup::no)) {
-            return Status::ignored;
-        }
+    // The arguments before the cursor.
+    auto stop = first;
+    for (size_t i = 0; i < cursor && stop != last; ++i) {
+        ++stop;
+    }
 
-        group.push_back(opt);
+    // Parse these arguments to find out where the cursor is, skipping any
+    // invalid arguments.
+    std::string buf;
+    Status res = Status::success;
+    for (auto curr = first; curr != stop; ) {
+        pending_option_ = nullptr;
 
-        if (!opt->HasFlag(Arg::no)) {
-            // The option accepts an argument.
-            // This terminates the option group.
+        res = ParseArg(curr, stop, buf);
+        if (res == Status::done || curr == stop) {
             break;
         }
+
+        ++curr;
+        ++curr_index_;
     }
 
-    if (group.empty()) { // "-=" is invalid
-        return Status::ignored;
+    std::vector<Completion> out;
+
+    // If parsing stopped (see StopParsing), the remaining arguments are not
+    // ours to complete.
+    if (res != Status::done) {
+        auto const arg = (stop != last) ? cl::impl::ArgToUTF8(stop, buf) : string_view{};
+        // The arguments after the name of a sub-command belong to the sub-command.
+        Cmdline const* cmd = this;
+        while (cmd->Subcommand() != nullptr) {
+            cmd = cmd->Subcommand();
+        }
+
+        cmd->CompleteArgument(arg, pending_option_, out);
     }
 
-    // Then process all options.
-    for (size_t n = 0; n < group.size(); ++n) {
-        auto const name = optstr.substr(n, 1);
-        auto const opt = group[n];
+    collect_diag_ = collect_diag;
+    response_files_ = response_files;
+    dry_run_ = false;
+    pending_option_ = nullptr;
 
-        CL_ASSERT(opt != nullptr);
-        CL_ASSERT(opt->HasFlag(MayGroup::yes));
+    Reset();
+    return out;
+}
 
-        if (n + 1 != group.size() || group.size() == optstr.size()) {
-            // This is either an option which does not allow an argument (which may
-            // or may not be the last option in the group), or it is the last option and
-            // an argument has not been provided.
-            // In case the option has the HasArg::required flag set, HandleOccurrence
-            // will try to get an argument from the command line.
-            if (Status::success != HandleOccurrence(opt, name, curr, last)) {
-                return Status::error;
+inline void Cmdline::CompleteArgument(string_view arg, OptionBase const* pending, std::vector<Completion>& out) const {
+    std::vector<string_view> values;
+
+    // Appends the arguments of OPT which start with VALUE_PREFIX.
+    auto const add_values = [&](OptionBase const* opt, string_view text_prefix, string_view value_prefix) {
+        values.clear();
+        opt->CompleteArgument(value_prefix, values);
+        for (auto const& v : values) {
+            std::string text(text_prefix.data(), text_prefix.size());
+            text.append(v.data(), v.size());
+            out.emplace_back(Completion::value, std::move(text), opt);
+        }
+    };
+
+    // The previous argument is an option which requires an argument: "-f <file>".
+    if (pending != nullptr) {
+        add_values(pending, {}, arg);
+        return;
+    }
+
+    if (!dashdash_ && !arg.empty() && arg[0] == '-') {
+        auto name = arg.substr(1);
+        if (!name.empty() && name[0] == '-') {
+            name.remove_prefix(1);
+        }
+        auto const dashes = arg.substr(0, arg.size() - name.size());
+
+        auto const eq = name.find('=');
+        if (eq != string_view::npos) {
+            // "-f=<file>"
+            for (auto cmd = this; cmd != nullptr; cmd = cmd->parent_) {
+                if (auto const opt = cmd->schema_->FindOption(name.substr(0, eq))) {
+                    add_values(opt, arg.substr(0, dashes.size() + eq + 1), name.substr(eq + 1));
+                    break;
+                }
             }
-        } else {
-            // This is the last option in the group and the argument is the rest of optstr.
-            // In case an argument is not allowed, HandleOccurrence will emit an error.
-            size_t arg_start = n + 1;
+            return;
+        }
 
-            if (opt->HasFlag(MayJoin::no)) {
-                // The option may not join its argument.
-                // If the next character is an '=', this is like "--f=filename",
-                // so discard the equals sign.
-                // Otherwise this is an error.
-                if (optstr[arg_start] != '=') {
-                    EmitDiag(Diagnostic::error, curr_index_, "option '", name, "' must not join its argument");
-                    return Status::error;
+        // Including the global options of the enclosing commands.
+        for (auto cmd = this; cmd != nullptr; cmd = cmd->parent_) {
+            cmd->schema_->ForEachNameWithPrefix(name, [&](string_view n, OptionBase const* opt) {
+                if (opt->HasFlag(Positional::yes)) {
+                    return;
                 }
+                std::string text(dashes.data(), dashes.size());
+                text.append(n.data(), n.size());
+                out.emplace_back(Completion::name, std::move(text), opt);
+            });
+        }
+        return;
+    }
 
-                ++arg_start;
+    if (!dashdash_) {
+        for (auto const& entry : schema_->subcommands_) {
+            if (cl::impl::StartsWith(entry.name, arg)) {
+                out.emplace_back(Completion::command, entry.name, nullptr);
             }
-
-            return HandleOccurrence(opt, name, optstr.substr(arg_start));
         }
     }
 
-    return Status::success;
-}
+    // The next positional option. See HandlePositional.
+    auto const& positionals = schema_->positionals_;
+    for (size_t i = static_cast<size_t>(curr_positional_); i < positionals.size(); ++i) {
+        auto const id = static_cast<size_t>(positionals[i]);
+        if (!IsOccurrenceAllowed(id)) {
+            continue;
+        }
 
-template <typename It, typename EndIt>
-Cmdline::Status Cmdline::HandleOccurrence(OptionBase* opt, string_view name, It& curr, EndIt last) {
-    CL_ASSERT(curr != last);
+        auto const opt = schema_->id_options_[id];
 
-    // We get here if no argument was specified.
-    // If an argument is required, try to steal one from the command line.
+        add_values(opt, {}, arg);
+        if (values.empty() && arg.empty()) {
+            std::string text = "<";
+            text.append(opt->Name().data(), opt->Name().size());
+            text += '>';
+            out.emplace_back(Completion::placeholder, std::move(text), opt);
+        }
+        break;
+    }
+}
 
-    if (!opt->HasFlag(Arg::required)) {
-        return ParseOptionArgument(opt, name, {});
+template <typename Fn>
+bool Schema::ForEachUniqueOption(Fn fn) const {
+    for (auto const opt : id_options_) {
+        if (!fn(opt)) {
+            return false;
+        }
     }
 
-    // If the option requires an argument, steal one from the command line.
-    ++curr;
-    ++curr_index_;
+    return true;
+}
 
-    if (curr != last) {
-        auto const arg = cl::impl::ToUTF8(*curr);
+inline void Cmdline::EmitDiagImpl(Diagnostic::Type type, int index, string_view const* strings, int num_strings) {
+    ++num_diag_;
+#if CL_ENABLE_STATS
+    ++stats_.diagnostics;
+#endif
 
-#if 1
-        // If the string is of the form "--K=V" and "K" is the name of
-        // an option, emit a warning.
-        if (arg.size() >= 2 && arg[0] == '-') {
-            auto n = string_view(arg);
-            n.remove_prefix(1);
-            if (n[0] == '-') {
-                n.remove_prefix(1);
-            }
-            n = n.substr(0, n.find('='));
+    // Diagnostics of sub-commands are collected by the top-level parser.
+    if (parent_ != nullptr) {
+        parent_->EmitDiagImpl(type, index, strings, num_strings);
+        return;
+    }
 
-            if (FindOption(n) != nullptr) {
-                EmitDiag(Diagnostic::warning, curr_index_, "option '", n, "' is used as an argument for option '", name, "'");
-                EmitDiag(Diagnostic::note, curr_index_, "use '--", name, opt->HasFlag(MayJoin::yes) ? "" : "=", arg, "' to suppress this warning");
-            }
-        }
-#endif
+    if (collect_diag_ == CollectDiagnostics::no) {
+        return;
+    }
 
-        return ParseOptionArgument(opt, name, arg);
+    size_t const offset = diag_text_.size();
+    for (int i = 0; i < num_strings; ++i) {
+        auto s = strings[i];
+        CL_ASSERT(cl::impl::IsUTF8(s.begin(), s.end()));
+        diag_text_.append(s.data(), s.size());
     }
 
-    EmitDiag(Diagnostic::error, curr_index_, "option '", name, "' requires an argument");
-    return Status::error;
+    diag_records_.push_back({type, index, offset, diag_text_.size() - offset});
+
+    //fprintf(stderr, "%s\n", text.c_str());
 }
 
-inline Cmdline::Status Cmdline::HandleOccurrence(OptionBase* opt, string_view name, string_view arg) {
-    // An argument was specified for OPT.
+namespace impl {
 
-    if (opt->HasFlag(Positional::no) && opt->HasFlag(Arg::no)) {
-        EmitDiag(Diagnostic::error, curr_index_, "option '", name, "' does not accept an argument");
-        return Status::error;
-    }
+// Calls PARSE(cli, buffer, i) for all command lines I in [0, NUM_LINES) using
+// multiple threads, and collects the results. CLI and BUFFER (a std::string)
+// are reused by each thread.
+// The lines are handed out to the threads in chunks, using a shared atomic
+// counter, so that threads which finish early take over the remaining work.
+template <typename ParseFn>
+void RunBatch(Schema const& schema, size_t num_lines, ParseFn parse, BatchResults& results, BatchOptions const& options) {
+    struct LineDiag {
+        size_t line;
+        Diagnostic diag;
+    };
 
-    return ParseOptionArgument(opt, name, arg);
-}
+    results.success.assign(num_lines, 0);
+    results.diag_offsets.assign(num_lines + 1, 0);
+    results.diags.clear();
+    results.arg_copies.clear();
 
-inline Cmdline::Status Cmdline::ParseOptionArgument(OptionBase* opt, string_view name, string_view arg) {
-    auto Parse1 = [&](string_view arg1) {
-        if (!opt->IsOccurrenceAllowed()) {
-            // Use opt->Name() instead of name here.
-            // This gives slightly nicer error messages in case an option has
-            // multiple names.
-            EmitDiag(Diagnostic::error, curr_index_, "option '", opt->Name(), "' already specified");
-            return Status::error;
-        }
+    size_t const chunk_size = options.chunk_size != 0 ? options.chunk_size : 1;
+    size_t const num_chunks = (num_lines + chunk_size - 1) / chunk_size;
 
-        ParseContext ctx;
+    size_t num_threads = options.num_threads;
+    if (num_threads == 0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+    if (num_threads > num_chunks) {
+        num_threads = num_chunks;
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
 
-        ctx.name = name;
-        ctx.arg = arg1;
-        ctx.index = curr_index_;
-        ctx.cmdline = this;
+    std::atomic<size_t> next_chunk{0};
+    std::vector<std::vector<LineDiag>> diags(num_threads); // Per thread
+    std::vector<std::vector<std::unique_ptr<char[]>>> arg_copies(num_threads); // Per thread
 
-        //
-        // XXX:
-        // Implement a better way to determine if a diagnostic should be emitted here...
-        //
-        auto const num_diagnostics = diag_.size();
+    auto const worker = [&](size_t t) {
+        Cmdline cli(schema);
+        std::string buffer;
 
-        if (!opt->Parse(ctx)) {
-            bool const diagnostic_emitted = diag_.size() > num_diagnostics;
-            if (!diagnostic_emitted) {
-                EmitDiag(Diagnostic::error, curr_index_, "invalid argument '", arg1, "' for option '", name, "'");
+        for (;;) {
+            size_t const chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+            if (chunk >= num_chunks) {
+                break;
             }
 
-            return Status::error;
-        }
-
-        ++opt->count_;
-        return Status::success;
-    };
+            size_t const first = chunk * chunk_size;
+            size_t const last = (num_lines - first < chunk_size) ? num_lines : first + chunk_size;
+            for (size_t i = first; i != last; ++i) {
+                cli.Reset();
+                results.success[i] = parse(cli, buffer, i) ? 1 : 0;
 
-    Status res = Status::success;
+                auto const& line_diags = cli.Diag();
+                results.diag_offsets[i + 1] = line_diags.size();
+                for (auto const& d : line_diags) {
+                    diags[t].push_back({i, d});
+                }
 
-    if (opt->HasFlag(CommaSeparated::yes)) {
-        cl::impl::Split(arg, cl::impl::ByChar(','), [&](string_view s) {
-            res = Parse1(s);
-            if (res != Status::success) {
-                EmitDiag(Diagnostic::note, curr_index_, "in comma-separated argument '", arg, "'");
-                return false;
+                // Keep the values of string_view targets alive.
+                cli.ReleasePersistedArgs(arg_copies[t]);
             }
-            return true;
-        });
-    } else {
-        res = Parse1(arg);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for (size_t t = 1; t < num_threads; ++t) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
     }
 
-    if (res == Status::success) {
-        // If the current option has the StopParsing flag set, we're done.
-        if (opt->HasFlag(StopParsing::yes)) {
-            res = Status::done;
+    for (auto& list : arg_copies) {
+        for (auto& copy : list) {
+            results.arg_copies.push_back(std::move(copy));
         }
     }
 
-    return res;
-}
-
-template <typename Fn>
-bool Cmdline::ForEachUniqueOption(Fn fn) const {
-    auto I = options_.begin();
-    auto const E = options_.end();
-
-    if (I == E) {
-        return true;
+    // Each line has been parsed by a single thread, in order.
+    for (size_t i = 0; i < num_lines; ++i) {
+        results.diag_offsets[i + 1] += results.diag_offsets[i];
     }
 
-    for (;;) {
-        if (!fn(I->option)) {
-            return false;
-        }
-
-        // Skip duplicate options.
-        auto const curr_opt = I->option;
-        for (;;) {
-            if (++I == E) {
-                return true;
-            }
-            if (I->option != curr_opt) {
-                break;
+    results.diags.resize(results.diag_offsets[num_lines]);
+    for (auto& list : diags) {
+        size_t line = SIZE_MAX;
+        size_t pos = 0;
+        for (auto& d : list) {
+            if (d.line != line) {
+                line = d.line;
+                pos = results.diag_offsets[line];
             }
+            results.diags[pos++] = std::move(d.diag);
         }
     }
 }
 
-inline void Cmdline::EmitDiagImpl(Diagnostic::Type type, int index, string_view const* strings, int num_strings) {
-    diag_.emplace_back(type, index, std::string{});
+} // namespace impl
 
-    auto& text = diag_.back().message;
-    for (int i = 0; i < num_strings; ++i) {
-        auto s = strings[i];
-        CL_ASSERT(cl::impl::IsUTF8(s.begin(), s.end()));
-        text.append(s.data(), s.size());
-    }
+template <typename Lines, typename TargetFn>
+void ParseBatch(Schema const& schema, Lines const& lines, TargetFn target, BatchResults& results, BatchOptions const& options) {
+    using std::begin;
+    using std::end;
 
-    //fprintf(stderr, "%s\n", text.c_str());
+    auto const first = begin(lines);
+    size_t const num_lines = static_cast<size_t>(end(lines) - first);
+
+    cl::impl::RunBatch(schema, num_lines, [&](Cmdline& cli, std::string& buffer, size_t i) {
+        cli.SetTarget(target(i));
+
+        auto const args = cl::TokenizeUnix(string_view(first[static_cast<std::ptrdiff_t>(i)]), buffer);
+        return cli.Parse(args.begin(), args.end(), options.check_missing).success;
+    }, results, options);
+}
+
+template <typename ArgLists, typename TargetFn>
+void ParseBatchArgs(Schema const& schema, ArgLists const& lines, TargetFn target, BatchResults& results, BatchOptions const& options) {
+    using std::begin;
+    using std::end;
+
+    auto const first = begin(lines);
+    size_t const num_lines = static_cast<size_t>(end(lines) - first);
+
+    cl::impl::RunBatch(schema, num_lines, [&](Cmdline& cli, std::string& /*buffer*/, size_t i) {
+        cli.SetTarget(target(i));
+        return cli.ParseArgs(first[static_cast<std::ptrdiff_t>(i)], options.check_missing);
+    }, results, options);
 }
 
 } // namespace cl
@@ -0,0 +1,496 @@
+// Micro-benchmarks for the parser hot paths.
+//
+// Prints one JSON object with the results to stdout, e.g.
+//
+//  {"benchmarks": [
+//    {"name": "many_options", "iterations": 12345, "ns_per_op": 1234.5, "ops_per_sec": 810044.5, "allocs_per_op": 0.0},
+//    ...
+//  ]}
+//
+// Options:
+//  --filter=STR     Only run benchmarks whose name contains STR
+//  --min-time=SEC   Minimum running time of each benchmark (default 0.25)
+
+#include "Cmdline.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// Allocation counting
+//------------------------------------------------------------------------------
+
+static std::atomic<size_t> num_allocs{0};
+
+// GCC does not know that the operators below belong together.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+    ++num_allocs;
+    if (void* p = std::malloc(size != 0 ? size : 1)) {
+        return p;
+    }
+    std::abort();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+//------------------------------------------------------------------------------
+// Runner
+//------------------------------------------------------------------------------
+
+using Clock = std::chrono::steady_clock;
+
+static std::string filter;
+static double min_time = 0.25;
+static bool first_result = true;
+static size_t sink = 0; // Keeps the results alive
+
+// Runs FN repeatedly for at least min_time seconds and prints the results.
+// FN returns false on error. BYTES is the size of the input processed by a
+// single call of FN, or 0.
+template <typename Fn>
+static void Run(char const* name, size_t bytes, Fn fn) {
+    if (!filter.empty() && std::strstr(name, filter.c_str()) == nullptr) {
+        return;
+    }
+
+    // Warm up and check the benchmark.
+    if (!fn()) {
+        std::fprintf(stderr, "benchmark '%s' failed\n", name);
+        std::exit(1);
+    }
+
+    size_t iterations = 0;
+    size_t batch = 1;
+    double seconds = 0.0;
+
+    auto const allocs_start = num_allocs.load();
+    auto const start = Clock::now();
+    for (;;) {
+        for (size_t i = 0; i < batch; ++i) {
+            if (fn()) {
+                ++sink;
+            }
+        }
+        iterations += batch;
+
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (seconds >= min_time) {
+            break;
+        }
+        if (batch < 65536) {
+            batch *= 2;
+        }
+    }
+    auto const allocs = num_allocs.load() - allocs_start;
+
+    auto const n = static_cast<double>(iterations);
+
+    std::printf("%s\n    {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.1f, \"ops_per_sec\": %.1f, \"allocs_per_op\": %.2f",
+        first_result ? "" : ",",
+        name,
+        iterations,
+        seconds * 1e9 / n,
+        n / seconds,
+        static_cast<double>(allocs) / n);
+    if (bytes != 0) {
+        std::printf(", \"mb_per_sec\": %.1f", static_cast<double>(bytes) * n / seconds / (1024.0 * 1024.0));
+    }
+    std::printf("}");
+    std::fflush(stdout);
+
+    first_result = false;
+}
+
+// Parses ARGS using CLI.
+template <typename Args>
+static bool ParseOnce(cl::Cmdline& cli, Args const& args) {
+    cli.Reset();
+    return cli.Parse(args.begin(), args.end()).success;
+}
+
+//------------------------------------------------------------------------------
+// Benchmarks
+//------------------------------------------------------------------------------
+
+// 1000 options, 64 arguments of the form "--option-N=V".
+static void BenchManyOptions() {
+    static constexpr int kNumOptions = 1000;
+
+    std::vector<std::string> names;
+    std::vector<int> values(kNumOptions);
+    for (int i = 0; i < kNumOptions; ++i) {
+        names.push_back("option-" + std::to_string(i));
+    }
+
+    cl::Cmdline cli("bench", "");
+    cli.SetCollectDiagnostics(cl::CollectDiagnostics::no);
+    for (int i = 0; i < kNumOptions; ++i) {
+        cli.Add(names[static_cast<size_t>(i)].c_str(), "", cl::Arg::required | cl::Multiple::yes, cl::Var(values[static_cast<size_t>(i)]));
+    }
+
+    std::vector<std::string> strings;
+    for (int i = 0; i < 64; ++i) {
+        strings.push_back("--option-" + std::to_string((i * 617) % kNumOptions) + "=" + std::to_string(i));
+    }
+
+    std::vector<char const*> args;
+    for (auto const& s : strings) {
+        args.push_back(s.c_str());
+    }
+
+    Run("many_options", 0, [&] { return ParseOnce(cli, args); });
+
+    // Same with wide-char arguments, which must be converted to UTF-8.
+    std::vector<std::wstring> wstrings;
+    for (auto const& s : strings) {
+        wstrings.emplace_back(s.begin(), s.end());
+    }
+
+    std::vector<wchar_t const*> wargs;
+    for (auto const& s : wstrings) {
+        wargs.push_back(s.c_str());
+    }
+
+    Run("wide_argv", 0, [&] { return ParseOnce(cli, wargs); });
+
+    // Same arguments, restored from a blob written by Serialize().
+    cl::Cmdline recorder(cli.GetSchema());
+    recorder.SetDeferConversion(cl::DeferConversion::yes);
+    std::string blob;
+    if (!recorder.Parse(args.begin(), args.end()) || !recorder.Serialize(blob)) {
+        std::fprintf(stderr, "failed to serialize the command line\n");
+        std::exit(1);
+    }
+
+    Run("replay", blob.size(), [&] {
+        cli.Reset();
+        return cli.Replay(blob);
+    });
+}
+
+// 100 options with long names which may join their arguments.
+static void BenchLongPrefixNames() {
+    static constexpr int kNumOptions = 100;
+
+    std::vector<std::string> names;
+    for (int i = 0; i < kNumOptions; ++i) {
+        names.push_back("a-rather-long-option-name-prefix-" + std::to_string(i) + "-");
+    }
+
+    size_t total = 0;
+
+    cl::Cmdline cli("bench", "");
+    cli.SetCollectDiagnostics(cl::CollectDiagnostics::no);
+    for (auto const& name : names) {
+        cli.Add(name.c_str(), "", cl::Arg::required | cl::MayJoin::yes | cl::Multiple::yes,
+            [&](cl::ParseContext const& ctx) { total += ctx.arg.size(); });
+    }
+
+    std::vector<std::string> strings;
+    for (int i = 0; i < 64; ++i) {
+        strings.push_back("--" + names[static_cast<size_t>((i * 37) % kNumOptions)] + "value" + std::to_string(i));
+    }
+
+    std::vector<char const*> args;
+    for (auto const& s : strings) {
+        args.push_back(s.c_str());
+    }
+
+    Run("long_prefix_names", 0, [&] { return ParseOnce(cli, args); });
+    sink += total;
+}
+
+// 52 single-letter flags, grouped into 16 arguments of 52 letters each.
+static void BenchGroupedFlags() {
+    static char const kLetters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    static constexpr size_t kNumLetters = sizeof(kLetters) - 1;
+
+    std::vector<std::string> names;
+    for (size_t i = 0; i < kNumLetters; ++i) {
+        names.push_back(std::string(1, kLetters[i]));
+    }
+
+    int count = 0;
+
+    cl::Cmdline cli("bench", "");
+    cli.SetCollectDiagnostics(cl::CollectDiagnostics::no);
+    for (auto const& name : names) {
+        cli.Add(name.c_str(), "", cl::MayGroup::yes | cl::Multiple::yes,
+            [&](cl::ParseContext const&) { ++count; });
+    }
+
+    std::string const group = std::string("-") + kLetters;
+    std::vector<char const*> args(16, group.c_str());
+
+    Run("grouped_flags", 0, [&] { return ParseOnce(cli, args); });
+    sink += static_cast<size_t>(count);
+}
+
+// A single argument with 4096 comma-separated integers.
+static void BenchCommaSeparatedList() {
+    std::vector<int> ints;
+
+    cl::Cmdline cli("bench", "");
+    cli.SetCollectDiagnostics(cl::CollectDiagnostics::no);
+    cli.Add("i|ints", "", cl::Arg::required | cl::Multiple::yes | cl::CommaSeparated::yes, cl::Var(ints));
+
+    std::string arg = "--ints=";
+    for (int i = 0; i < 4096; ++i) {
+        if (i != 0) {
+            arg += ',';
+        }
+        arg += std::to_string(i * 7919);
+    }
+
+    std::vector<char const*> args{arg.c_str()};
+
+    Run("comma_separated_list", arg.size(), [&] {
+        ints.clear();
+        return ParseOnce(cli, args) && ints.size() == 4096;
+    });
+}
+
+// A Map with 4096 keys, 64 arguments.
+static void BenchLargeMap() {
+    static constexpr int kNumKeys = 4096;
+
+    std::vector<std::string> keys;
+    for (int i = 0; i < kNumKeys; ++i) {
+        keys.push_back("key-" + std::to_string(i * 104729));
+    }
+
+    std::vector<std::pair<cl::string_view, int>> entries;
+    for (int i = 0; i < kNumKeys; ++i) {
+        entries.emplace_back(keys[static_cast<size_t>(i)], i);
+    }
+
+    int value = 0;
+
+    cl::Cmdline cli("bench", "");
+    cli.SetCollectDiagnostics(cl::CollectDiagnostics::no);
+    cli.Add("k|key", "", cl::Arg::required | cl::Multiple::yes, cl::Map(value, std::move(entries)));
+
+    std::vector<std::string> strings;
+    for (int i = 0; i < 64; ++i) {
+        strings.push_back("--key=" + keys[static_cast<size_t>((i * 1597) % kNumKeys)]);
+    }
+
+    std::vector<char const*> args;
+    for (auto const& s : strings) {
+        args.push_back(s.c_str());
+    }
+
+    Run("large_map", 0, [&] { return ParseOnce(cli, args); });
+    sink += static_cast<size_t>(value);
+}
+
+// Suggestions for a misspelled option (400 options) and a misspelled Map key
+// (2000 keys).
+static void BenchSuggestions() {
+    static constexpr int kNumOptions = 400;
+    static constexpr int kNumKeys = 2000;
+
+    std::vector<std::string> names;
+    for (int i = 0; i < kNumOptions; ++i) {
+        names.push_back("feature-" + std::to_string(i * 7919) + "-enabled");
+    }
+
+    std::vector<std::string> keys;
+    for (int i = 0; i < kNumKeys; ++i) {
+        keys.push_back("target-" + std::to_string(i * 104729));
+    }
+
+    std::vector<std::pair<cl::string_view, int>> entries;
+    for (int i = 0; i < kNumKeys; ++i) {
+        entries.emplace_back(keys[static_cast<size_t>(i)], i);
+    }
+
+    bool flag = false;
+    int value = 0;
+
+    cl::Cmdline cli("bench", "");
+    for (auto const& name : names) {
+        cli.Add(name.c_str(), "", cl::Multiple::yes, cl::Var(flag));
+    }
+    cli.Add("target", "", cl::Arg::required | cl::Multiple::yes, cl::Map(value, std::move(entries)));
+
+    std::string const option = "--featur-" + std::to_string(123 * 7919) + "-enabled";
+    std::string const key = "--target=targt-" + std::to_string(1234 * 104729);
+
+    std::vector<char const*> option_args{option.c_str()};
+    std::vector<char const*> key_args{key.c_str()};
+
+    Run("suggest_option", 0, [&] { return !ParseOnce(cli, option_args) && cli.Diag().size() > 1; });
+    Run("suggest_map_key", 0, [&] { return !ParseOnce(cli, key_args) && cli.Diag().size() > 1; });
+}
+
+// 10000 command line strings, tokenized and parsed by ParseBatch.
+static void BenchBatch() {
+    static constexpr size_t kNumLines = 10000;
+
+    struct Record {
+        int level = 0;
+        std::vector<std::string> files;
+        bool verbose = false;
+    };
+
+    cl::Schema schema("bench", "");
+    schema.Add("level", "", cl::Arg::required, cl::Field(&Record::level));
+    schema.Add("v|verbose", "", cl::Arg::no, cl::Field(&Record::verbose));
+    schema.Add("files", "", cl::Positional::yes | cl::Multiple::yes, cl::Field(&Record::files));
+
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < kNumLines; ++i) {
+        lines.push_back("--level=" + std::to_string(i % 10) + " -v 'input file " + std::to_string(i) + "' output.txt");
+    }
+
+    size_t bytes = 0;
+    for (auto const& line : lines) {
+        bytes += line.size();
+    }
+
+    std::vector<Record> records(kNumLines);
+    cl::BatchResults results;
+
+    auto const run = [&](size_t num_threads) {
+        for (auto& r : records) {
+            r.files.clear();
+        }
+
+        cl::BatchOptions options;
+        options.num_threads = num_threads;
+
+        cl::ParseBatch(schema, lines, [&](size_t i) { return &records[i]; }, results, options);
+        return results.diags.empty() && records.back().files.size() == 2;
+    };
+
+    Run("batch_1_thread", bytes, [&] { return run(1); });
+    Run("batch_all_threads", bytes, [&] { return run(0); });
+}
+
+// 4 MB of command line text.
+static void BenchTokenizer() {
+    std::string str;
+    while (str.size() < 4 * 1024 * 1024) {
+        str += "--plain-option=value \"quoted argument with spaces\" 'single quoted' back\\\"slash\\\\es ";
+    }
+
+    std::string buffer;
+
+    Run("tokenize_unix", str.size(), [&] {
+        size_t n = 0;
+        for (auto const arg : cl::TokenizeUnix(str, buffer)) {
+            n += arg.size();
+        }
+        sink += n;
+        return n != 0;
+    });
+
+    Run("tokenize_windows", str.size(), [&] {
+        size_t n = 0;
+        for (auto const arg : cl::TokenizeWindows(str, buffer, cl::ParseProgramName::no)) {
+            n += arg.size();
+        }
+        sink += n;
+        return n != 0;
+    });
+}
+
+// The help message of 600 sub-commands with 20 options each, in all styles.
+static void BenchHelp() {
+    static constexpr int kNumCommands = 600;
+    static constexpr int kNumOptions = 20;
+
+    std::string const descr =
+        "Sets the value of this option. The value is used by the sub-command when processing the input files,\n"
+        "unless it is overridden by an environment variable or the configuration file.";
+
+    std::vector<std::string> names;
+    for (int i = 0; i < kNumOptions; ++i) {
+        names.push_back("option-" + std::to_string(i));
+    }
+
+    bool flag = false;
+
+    std::vector<std::unique_ptr<cl::Schema>> schemas;
+    for (int c = 0; c < kNumCommands; ++c) {
+        schemas.emplace_back(new cl::Schema("command", descr.c_str()));
+        for (auto const& name : names) {
+            schemas.back()->Add(name.c_str(), descr.c_str(), cl::Arg::optional, cl::Var(flag));
+        }
+    }
+
+    size_t bytes = 0;
+    auto const run = [&](cl::HelpStyle style) {
+        cl::Schema::HelpFormat fmt;
+        fmt.style = style;
+
+        size_t n = 0;
+        for (auto const& schema : schemas) {
+            schema->WriteHelp([&](cl::string_view chunk) { n += chunk.size(); }, fmt);
+        }
+        bytes = n;
+        sink += n;
+        return n != 0;
+    };
+
+    run(cl::HelpStyle::text);
+    Run("help_text", bytes, [&] { return run(cl::HelpStyle::text); });
+    run(cl::HelpStyle::man);
+    Run("help_man", bytes, [&] { return run(cl::HelpStyle::man); });
+    run(cl::HelpStyle::markdown);
+    Run("help_markdown", bytes, [&] { return run(cl::HelpStyle::markdown); });
+}
+
+int main(int argc, char* argv[])
+{
+    cl::Cmdline cli("Benchmark", "Runs the parser micro-benchmarks");
+
+    cli.Add("filter", "Only run benchmarks whose name contains the given string",
+        cl::Arg::required,
+        cl::Var(filter));
+
+    cli.Add("min-time", "Minimum running time of each benchmark in seconds",
+        cl::Arg::required,
+        cl::Var(min_time, cl::check::GreaterThan(0.0)));
+
+    auto const res = cli.Parse(argv + 1, argv + argc);
+    cli.PrintDiag();
+    if (!res) {
+        cli.PrintHelp();
+        return -1;
+    }
+
+    std::printf("{\"benchmarks\": [");
+
+    BenchManyOptions();
+    BenchLongPrefixNames();
+    BenchGroupedFlags();
+    BenchCommaSeparatedList();
+    BenchLargeMap();
+    BenchSuggestions();
+    BenchBatch();
+    BenchTokenizer();
+    BenchHelp();
+
+    std::printf("\n]}\n");
+
+    return sink == 0 ? 1 : 0;
+}
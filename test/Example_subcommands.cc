@@ -6,76 +6,52 @@
 // Example from
 // https://github.com/muellan/clipp
 
-enum class mode {make, find, help};
 static std::vector<std::string> input;
 static std::string dict;
 static std::string out;
 static bool split = false;
 static bool progr = false;
 
-using ArgIterator = char const* const*;
-using ParseResult = cl::Cmdline::ParseResult<ArgIterator>;
-
-static ParseResult Parse(cl::Cmdline& cli, ArgIterator next, ArgIterator last)
-{
-    auto const res = cli.Parse(next, last);
-    cli.PrintDiag();
-    if (!res) {
-        cli.PrintHelp();
-    }
-    return res;
-}
-
-static ParseResult ParseMakeCommand(ArgIterator next, ArgIterator last)
+static void AddMakeCommand(cl::Cmdline& cli)
 {
-    cl::Cmdline cli("finder make", "Make a new finder");
-
     cli.Add("wordfile", "", cl::Positional::yes | cl::Arg::required | cl::Required::yes | cl::Multiple::yes, cl::Var(input));
     cli.Add("dict", "", cl::Arg::required | cl::Required::yes, cl::Var(dict));
     cli.Add("progress", "show progress", {}, cl::Var(progr));
-
-    return Parse(cli, next, last);
 }
 
-static ParseResult ParseFindCommand(ArgIterator next, ArgIterator last)
+static void AddFindCommand(cl::Cmdline& cli)
 {
-    cl::Cmdline cli("finder find", "Find an existing finder");
-
     cli.Add("infile", "", cl::Required::yes | cl::Multiple::yes | cl::Arg::required | cl::Positional::yes, cl::Var(input));
     cli.Add("dict", "", cl::Arg::required | cl::Required::yes, cl::Var(dict));
     cli.Add("o", "write to file instead of stdout", cl::Arg::required, cl::Var(out));
     cli.Add("split|nosplit", "(do not) split output", {}, cl::Flag(split, /*inverse_prefix*/ "no"));
-
-    return Parse(cli, next, last);
 }
 
-static bool ParseCommandLine(ArgIterator next, ArgIterator last)
+static bool ParseCommandLine(char const* const* next, char const* const* last)
 {
-    using Command = ParseResult (*)(ArgIterator, ArgIterator);
-    Command mode = nullptr;
-
     cl::Cmdline cli("finder", "");
 
+    // Global options. These may also be used after the name of the sub-command.
     cli.Add("v|version", "show version", cl::Arg::no, [](cl::ParseContext const& /*ctx*/) { printf("version 1.0\n"); });
-    cli.Add("mode",
-        "Can be make|find|help\n"
-        "  <make>  \tMake a new finder?!\n"
-        "  <find>  \tFind an existing finder.\n"
-        "  <help>  \tShow help menu",
-        cl::Required::yes | cl::Positional::yes | cl::StopParsing::yes,
-        cl::Map(mode, { {"make", ParseMakeCommand},
-                        {"find", ParseFindCommand},
-                        {"help", nullptr} }));
 
-    if (auto const res = Parse(cli, next, last))
-    {
-        if (mode)
-            mode(res.next, last);
-        else
-            cli.PrintHelp();
+    // The options of a sub-command are only added if the sub-command is used.
+    cli.AddSubcommand("make", "Make a new finder", AddMakeCommand);
+    cli.AddSubcommand("find", "Find an existing finder", AddFindCommand);
+    cli.AddSubcommand("help", "Show help menu", [](cl::Cmdline& /*cli*/) {});
+
+    bool const success = cli.Parse(next, last).success;
+    cli.PrintDiag();
+
+    auto const sub = cli.Subcommand();
+    if (!success || sub == nullptr || sub->Name() == "help") {
+        cli.PrintHelp();
+        if (sub != nullptr && sub->Name() != "help") {
+            sub->PrintHelp();
+        }
+        return false;
     }
 
-    return false;
+    return true;
 }
 
 int main(int argc, char* argv[])
@@ -2,10 +2,17 @@
 //#define CL_WINDOWS_CONSOLE_COLORS 1
 #include "Cmdline.h"
 
+#include <atomic>
+#include <cerrno>
 #include <cstdint>
 #include <climits>
+#include <clocale>
+#include <cstdio>
+#include <cstring>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "doctest.h"
 
@@ -1809,3 +1816,2338 @@ TEST_CASE("StrTo int")
     Test(cl::string_view("1234", 2), 12);
     Test(cl::string_view("12xx", 2), 12);
 }
+
+TEST_CASE("Many options")
+{
+    constexpr int N = 500;
+
+    std::vector<std::string> names;
+    for (int i = 0; i < N; ++i) {
+        names.push_back("option-" + std::to_string(i) + "|o" + std::to_string(i));
+    }
+
+    std::vector<int> values(N, -1);
+    std::string pos;
+
+    cl::Cmdline cli("test", "test");
+    for (int i = 0; i < N; ++i) {
+        cli.Add(names[static_cast<size_t>(i)].c_str(), "", cl::Arg::required, cl::Var(values[static_cast<size_t>(i)]));
+    }
+    cli.Add("pos", "", cl::Positional::yes, cl::Var(pos));
+
+    CHECK(true == ParseArgs(cli, {"--option-0=10", "-o499", "20", "--option-250", "30", "--pos=p"}));
+    CHECK(values[0] == 10);
+    CHECK(values[499] == 20);
+    CHECK(values[250] == 30);
+    CHECK(values[1] == -1);
+    CHECK(pos == "p");
+
+    // Unknown options are handled as positional arguments.
+    cli.Reset();
+    CHECK(true == ParseArgs(cli, {"--option-500=1"}));
+    CHECK(pos == "--option-500=1");
+    CHECK(false == ParseArgs(cli, {"--o"}));
+}
+
+static constexpr cl::OptionSpec kTestSpecs[] = {
+    {"v|verbose", "Verbose output", cl::Multiple::yes},
+    {"o|output", "Output file", cl::Arg::required},
+    {"I", "Include directories", cl::Multiple::yes | cl::Arg::required | cl::MayJoin::yes},
+    {"input", "Input file", cl::Positional::yes | cl::Required::yes},
+};
+
+#if CL_HAS_CONSTEXPR14
+static constexpr
+#else
+static const
+#endif
+auto kTestTable = cl::MakeOptionTable<cl::CountOptionNames(kTestSpecs)>(kTestSpecs);
+
+#if CL_HAS_CONSTEXPR14
+static_assert(sizeof(kTestTable.names) / sizeof(kTestTable.names[0]) == 6, "");
+static_assert(kTestTable.names[1].size == 7, "");
+static_assert(kTestTable.names[3].option == 1, "");
+#endif
+
+TEST_CASE("Option table")
+{
+    int verbose = 0;
+    std::string output;
+    std::vector<std::string> include_dirs;
+    std::string input;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add(kTestTable,
+            [&](cl::ParseContext const&) { ++verbose; },
+            cl::Var(output),
+            cl::Var(include_dirs),
+            cl::Var(input));
+
+    CHECK(true == ParseArgs(cli, {"-v", "--verbose", "-o", "out", "-Ia", "-I", "b", "in"}));
+    CHECK(verbose == 2);
+    CHECK(output == "out");
+    CHECK(include_dirs.size() == 2);
+    CHECK(include_dirs[0] == "a");
+    CHECK(include_dirs[1] == "b");
+    CHECK(input == "in");
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"-v"})); // input is missing
+
+    // Options from tables may be combined with other options.
+    bool flag = false;
+    cli.Add("f|flag", "", {}, cl::Var(flag));
+    cli.Reset();
+    CHECK(true == ParseArgs(cli, {"--flag", "--input=x", "--output=y"}));
+    CHECK(flag == true);
+    CHECK(input == "x");
+    CHECK(output == "y");
+}
+
+TEST_CASE("Longest prefix")
+{
+    std::string with;
+    std::string without;
+    std::string cov;
+    bool f = false;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("with-", "", cl::Arg::required | cl::MayJoin::yes, cl::Var(with));
+    cli.Add("without-", "", cl::Arg::required | cl::MayJoin::yes, cl::Var(without));
+    cli.Add("fsanitize-coverage=", "", cl::Arg::required | cl::MayJoin::yes, cl::Var(cov));
+    cli.Add("f", "", cl::MayGroup::yes, cl::Var(f));
+
+    CHECK(true == ParseArgs(cli, {"-with-abc", "-without-def", "-fsanitize-coverage=trace-pc"}));
+    CHECK(with == "abc");
+    CHECK(without == "def");
+    CHECK(cov == "trace-pc");
+    CHECK(f == false);
+
+    cli.Reset();
+    CHECK(true == ParseArgs(cli, {"-with-", "-without-"}));
+    CHECK(with == "-without-");
+    CHECK(without == "def");
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"-withou"})); // unknown option
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"-fsanitize"})); // unknown option
+}
+
+TEST_CASE("Zero-copy arguments")
+{
+    char const* a_data = nullptr;
+    char const* p_data = nullptr;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("a", "", cl::Arg::required | cl::Multiple::yes, [&](cl::ParseContext const& ctx) { a_data = ctx.arg.data(); });
+    cli.Add("p", "", cl::Positional::yes | cl::Multiple::yes, [&](cl::ParseContext const& ctx) { p_data = ctx.arg.data(); });
+
+    SUBCASE("argv")
+    {
+        char const* argv[] = {"-a=eins", "-a", "zwei", "drei"};
+
+        CHECK(true == cli.Parse(argv, argv + 1).success);
+        CHECK(a_data == argv[0] + 3);
+        CHECK(true == cli.Parse(argv + 1, argv + 4).success);
+        CHECK(a_data == argv[2]);
+        CHECK(p_data == argv[3]);
+    }
+
+    SUBCASE("vector<string>")
+    {
+        std::vector<std::string> const args = {"-a", "eins", "zwei"};
+
+        CHECK(true == cli.ParseArgs(args));
+        CHECK(a_data == args[1].data());
+        CHECK(p_data == args[2].data());
+    }
+
+    SUBCASE("invalid UTF-8")
+    {
+        char const* argv[] = {"-a", "\xFF"};
+
+        CHECK(true == cli.Parse(argv, argv + 2).success);
+        CHECK(a_data != argv[1]); // converted (U+FFFD)
+    }
+
+    CHECK(cl::impl::HasStableArgs<char**>::value);
+    CHECK(cl::impl::HasStableArgs<char const* const*>::value);
+    CHECK(cl::impl::HasStableArgs<std::vector<std::string>::const_iterator>::value);
+    CHECK(cl::impl::HasStableArgs<cl::string_view*>::value);
+    CHECK(!cl::impl::HasStableArgs<wchar_t**>::value);
+    CHECK(!cl::impl::HasStableArgs<fancy_iterator<char>>::value);
+}
+
+TEST_CASE("UTF fast paths")
+{
+    static char const* const kInserts[] = {"\xC3\xA4", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\xFF", "\xC3", "\xED\xA0\x80"};
+
+    for (size_t len = 0; len < 40; ++len)
+    {
+        for (size_t pos = 0; pos <= len; ++pos)
+        {
+            for (auto const* insert : kInserts)
+            {
+                std::string str(len, 'x');
+                str.insert(pos, insert);
+
+                // Compare the pointer code paths with the generic iterator code paths.
+                std::string const& cstr = str;
+                CHECK(cl::impl::IsUTF8(cstr.data(), cstr.data() + cstr.size()) == cl::impl::IsUTF8(cstr.begin(), cstr.end()));
+
+                std::string expected;
+                cl::impl::AppendUTF8(expected, cstr.begin(), cstr.end());
+                std::string actual;
+                cl::impl::AppendUTF8(actual, cstr.data(), cstr.data() + cstr.size());
+                CHECK(actual == expected);
+            }
+
+            std::u16string wstr(len, u'x');
+            wstr.insert(pos, u"ä\U0001F600");
+            wstr.insert(wstr.begin() + static_cast<std::ptrdiff_t>(pos / 2), static_cast<char16_t>(0xD800)); // unpaired surrogate
+
+            std::u16string const& cwstr = wstr;
+            std::string expected;
+            cl::impl::AppendUTF8(expected, cwstr.begin(), cwstr.end());
+            std::string actual;
+            cl::impl::AppendUTF8(actual, cwstr.data(), cwstr.data() + cwstr.size());
+            CHECK(actual == expected);
+        }
+    }
+
+    std::string const valid = std::string(100, 'a') + "\xC3\xA4";
+    CHECK(cl::impl::IsUTF8(valid.data(), valid.data() + valid.size()));
+    std::string const invalid = std::string(100, 'a') + "\x80";
+    CHECK(!cl::impl::IsUTF8(invalid.data(), invalid.data() + invalid.size()));
+}
+
+TEST_CASE("Tokenize in place")
+{
+    std::string buffer;
+
+    SUBCASE("Unix")
+    {
+        std::vector<cl::string_view> args;
+        for (auto arg : cl::TokenizeUnix(R"(  a "b c" 'd '"e"\ f)", buffer))
+            args.push_back(arg);
+
+        REQUIRE(args.size() == 3);
+        CHECK(args[0] == "a");
+        CHECK(args[1] == "b c");
+        CHECK(args[2] == "d e f");
+        CHECK(args[0].data() == buffer.data());
+
+        CHECK(cl::TokenizeUnix("x y").size() == 2);
+    }
+
+    SUBCASE("Windows")
+    {
+        std::vector<cl::string_view> args;
+        for (auto arg : cl::TokenizeWindows(R"(test "a\"b c" d\\\"e)", buffer))
+            args.push_back(arg);
+
+        REQUIRE(args.size() == 3);
+        CHECK(args[0] == "test");
+        CHECK(args[1] == "a\"b c");
+        CHECK(args[2] == "d\\\"e");
+    }
+
+    SUBCASE("Parse")
+    {
+        std::string a;
+        std::vector<std::string> p;
+
+        cl::Cmdline cli("test", "test");
+        cli.Add("a", "", cl::Arg::required, [&](cl::ParseContext const& ctx) {
+            CHECK(ctx.arg.data() >= buffer.data());
+            CHECK(ctx.arg.data() < buffer.data() + buffer.size());
+            a.assign(ctx.arg.data(), ctx.arg.size());
+        });
+        cli.Add("p", "", cl::Positional::yes | cl::Multiple::yes, cl::Var(p));
+
+        for (int i = 0; i < 2; ++i)
+        {
+            cli.Reset();
+
+            auto const args = cl::TokenizeUnix(R"(-a "x y" one 'two')", buffer);
+            p.clear();
+            CHECK(true == cli.Parse(args.begin(), args.end()).success);
+            CHECK(a == "x y");
+            REQUIRE(p.size() == 2);
+            CHECK(p[0] == "one");
+            CHECK(p[1] == "two");
+        }
+    }
+
+    CHECK(cl::impl::HasStableArgs<cl::TokenIterator>::value);
+}
+
+static void WriteFile(char const* path, char const* contents)
+{
+    std::FILE* file = std::fopen(path, "wb");
+    REQUIRE(file != nullptr);
+    std::fputs(contents, file);
+    std::fclose(file);
+}
+
+TEST_CASE("Response files")
+{
+    WriteFile("cl_test_rsp1.txt", "-a 1\n  'b '\"c\"\n@cl_test_rsp2.txt\nlast");
+    WriteFile("cl_test_rsp2.txt", "-a 2 x");
+    WriteFile("cl_test_rsp3.txt", "@cl_test_rsp3.txt");
+    WriteFile("cl_test_rsp4.txt", "x\n\n  -a\n  foo\n");
+    WriteFile("cl_test_rsp5.txt", "");
+    WriteFile("cl_test_rsp6.txt", "-a 1 @cl_test_rsp7.txt rest");
+    WriteFile("cl_test_rsp7.txt", "x --stop -a\n5");
+
+    std::vector<int> a;
+    std::vector<std::string> p;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("a", "", cl::Arg::required | cl::Multiple::yes, cl::Var(a));
+    cli.Add("p", "", cl::Positional::yes | cl::Multiple::yes, cl::Var(p));
+
+    SUBCASE("disabled")
+    {
+        CHECK(true == ParseArgs(cli, {"@cl_test_rsp1.txt"}));
+        REQUIRE(p.size() == 1);
+        CHECK(p[0] == "@cl_test_rsp1.txt");
+    }
+
+    SUBCASE("nested")
+    {
+        cli.SetResponseFiles(cl::ResponseFiles::unix_quoting);
+
+        char const* argv[] = {"first", "@cl_test_rsp1.txt", "-a", "3", "@cl_test_rsp5.txt", "--", "@cl_test_rsp1.txt"};
+        CHECK(true == cli.Parse(argv, argv + 7).success);
+        CHECK(a == std::vector<int>{1, 2, 3});
+        CHECK(p == std::vector<std::string>{"first", "b c", "x", "last", "@cl_test_rsp1.txt"});
+    }
+
+    SUBCASE("recursion limit")
+    {
+        cli.SetResponseFiles(cl::ResponseFiles::unix_quoting, 4);
+
+        CHECK(false == ParseArgs(cli, {"@cl_test_rsp3.txt"}));
+        REQUIRE(cli.Diag().size() == 5);
+        CHECK(cli.Diag()[0].type == cl::Diagnostic::error);
+        CHECK(cli.Diag()[4].message == "in response file 'cl_test_rsp3.txt', line 1");
+    }
+
+    SUBCASE("missing file")
+    {
+        cli.SetResponseFiles(cl::ResponseFiles::unix_quoting);
+
+        CHECK(false == ParseArgs(cli, {"@cl_test_rsp_missing.txt"}));
+        REQUIRE(cli.Diag().size() == 1);
+        CHECK(cli.Diag()[0].message == "cannot read response file 'cl_test_rsp_missing.txt'");
+    }
+
+    SUBCASE("line numbers")
+    {
+        cli.SetResponseFiles(cl::ResponseFiles::windows_quoting);
+
+        CHECK(false == ParseArgs(cli, {"-a", "1", "@cl_test_rsp4.txt"}));
+        REQUIRE(cli.Diag().size() == 2);
+        CHECK(cli.Diag()[0].index == 2);
+        CHECK(cli.Diag()[1].type == cl::Diagnostic::note);
+        CHECK(cli.Diag()[1].message == "in response file 'cl_test_rsp4.txt', line 4");
+        CHECK(p == std::vector<std::string>{"x"});
+    }
+
+    SUBCASE("stop parsing")
+    {
+        cli.SetResponseFiles(cl::ResponseFiles::unix_quoting);
+        cli.Add("stop", "", cl::StopParsing::yes, [](cl::ParseContext const&) {});
+
+        char const* argv[] = {"@cl_test_rsp6.txt", "after"};
+        auto const res = cli.Parse(argv, argv + 2);
+        CHECK(true == res.success);
+        CHECK(res.next == argv + 1);
+        CHECK(a == std::vector<int>{1});
+        CHECK(p == std::vector<std::string>{"x"});
+        CHECK(cli.UnparsedFileArgs() == std::vector<std::string>{"-a", "5", "rest"});
+
+        cli.Reset();
+        CHECK(cli.UnparsedFileArgs().empty());
+    }
+
+    std::remove("cl_test_rsp1.txt");
+    std::remove("cl_test_rsp2.txt");
+    std::remove("cl_test_rsp3.txt");
+    std::remove("cl_test_rsp4.txt");
+    std::remove("cl_test_rsp5.txt");
+    std::remove("cl_test_rsp6.txt");
+    std::remove("cl_test_rsp7.txt");
+}
+
+namespace {
+
+class CountingResource : public cl::memory_resource
+{
+public:
+    int num_allocs = 0;
+    int num_live = 0;
+    size_t num_bytes = 0;
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        ++num_allocs;
+        ++num_live;
+        num_bytes += bytes;
+        return cl::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        --num_live;
+        cl::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(cl::memory_resource const& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+} // namespace
+
+TEST_CASE("Memory resource")
+{
+    SUBCASE("counting")
+    {
+        CountingResource resource;
+        {
+            int a = 0;
+            cl::Cmdline cli("test", "test", &resource);
+            cli.Add("a|aa", "", cl::Arg::required, cl::Var(a));
+            cli.Add("I", "", cl::MayJoin::yes | cl::Arg::required, [](cl::ParseContext const&) {});
+            cli.Add(std::make_unique<cl::Option<decltype(cl::Var(a))>>("b", "", cl::OptionFlags{}, cl::Var(a)));
+
+            CHECK(resource.num_allocs > 0);
+            CHECK(true == ParseArgs(cli, {"-a", "42", "-Ifoo"}));
+            CHECK(a == 42);
+        }
+        CHECK(resource.num_live == 0);
+    }
+
+    SUBCASE("monotonic")
+    {
+        alignas(std::max_align_t) char buffer[1024];
+        cl::monotonic_buffer_resource resource(buffer, sizeof(buffer));
+
+        std::vector<std::string> names;
+        for (int i = 0; i < 100; ++i)
+            names.push_back("opt" + std::to_string(i));
+
+        std::vector<std::string> p;
+        cl::Cmdline cli("test", "test", &resource);
+        for (auto const& name : names) // exhaust the initial buffer
+            cli.Add(name.c_str(), "", cl::Arg::no, [](cl::ParseContext const&) {});
+        cli.Add("p", "", cl::Positional::yes | cl::Multiple::yes, cl::Var(p));
+
+        CHECK(true == ParseArgs(cli, {"-opt7", "x", "-opt99"}));
+        CHECK(p == std::vector<std::string>{"x"});
+    }
+}
+
+TEST_CASE("Shared schema")
+{
+    struct Options {
+        int a = 0;
+        std::string b;
+        std::vector<std::string> p;
+    };
+
+    cl::Schema schema("test", "test");
+    schema.Add("a", "", cl::Arg::required | cl::Required::yes, cl::Field(&Options::a, cl::check::GreaterEqual(0)));
+    schema.Add("b", "", cl::Arg::required, cl::Field(&Options::b));
+    schema.Add("p", "", cl::Positional::yes | cl::Multiple::yes, cl::Field(&Options::p));
+
+    CHECK(schema.NumUniqueOptions() == 3);
+    CHECK(schema.FindOption("b") != nullptr);
+    CHECK(schema.FindOption("c") == nullptr);
+
+    cl::Cmdline cli(schema);
+    CHECK(cli.Name() == "test");
+
+    for (int i = 0; i < 3; ++i)
+    {
+        Options opts;
+
+        cli.Reset();
+        cli.SetTarget(&opts);
+
+        auto const a = std::to_string(i);
+        CHECK(true == ParseArgs(cli, {"-a", a.c_str(), "x", "-b", "y", "z"}));
+        CHECK(opts.a == i);
+        CHECK(opts.b == "y");
+        CHECK(opts.p == std::vector<std::string>{"x", "z"});
+        CHECK(cli.Count("a") == 1);
+        CHECK(cli.Count("p") == 2);
+        CHECK(cli.Count("c") == -1);
+    }
+
+    SUBCASE("independent state")
+    {
+        Options opts1;
+        Options opts2;
+
+        cl::Cmdline cli1(schema);
+        cl::Cmdline cli2(schema);
+        cli1.SetTarget(&opts1);
+        cli2.SetTarget(&opts2);
+
+        CHECK(true == ParseArgs(cli1, {"-a", "1"}));
+        CHECK(false == ParseArgs(cli2, {"-b", "2"}));
+        CHECK(false == ParseArgs(cli1, {"-a", "1"})); // already specified
+        CHECK(cli1.Diag().size() == 1);
+        REQUIRE(cli2.Diag().size() == 1);
+        CHECK(cli2.Diag()[0].message == "option 'a' is missing");
+        CHECK(opts1.a == 1);
+        CHECK(opts2.b == "2");
+    }
+}
+
+TEST_CASE("Concurrent parsing")
+{
+    struct Options {
+        int n = 0;
+        std::vector<int> list;
+        std::string s;
+    };
+
+    cl::Schema schema("test", "test");
+    schema.Add("n", "", cl::Arg::required | cl::Required::yes, cl::Field(&Options::n));
+    schema.Add("l", "", cl::Arg::required | cl::CommaSeparated::yes | cl::Multiple::yes, cl::Field(&Options::list));
+    schema.Add("s", "", cl::Positional::yes, cl::Field(&Options::s));
+
+    constexpr int kNumThreads = 8;
+    constexpr int kNumIterations = 500;
+
+    std::atomic<int> num_failures{0};
+
+    auto worker = [&](int thread_index) {
+        cl::Cmdline cli(schema);
+        for (int i = 0; i < kNumIterations; ++i) {
+            Options opts;
+            cli.Reset();
+            cli.SetTarget(&opts);
+
+            auto const n = std::to_string(thread_index * kNumIterations + i);
+            char const* argv[] = {"-n", n.c_str(), "-l=1,2", "-l", "3", "str"};
+
+            bool const ok = cli.Parse(argv, argv + 6).success &&
+                            opts.n == thread_index * kNumIterations + i &&
+                            opts.list == std::vector<int>{1, 2, 3} &&
+                            opts.s == "str" &&
+                            cli.Count("l") == 3;
+            if (!ok)
+                ++num_failures;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kNumThreads; ++t)
+        threads.emplace_back(worker, t);
+    for (auto& t : threads)
+        t.join();
+
+    CHECK(num_failures == 0);
+}
+
+TEST_CASE("Floating-point conversion")
+{
+    auto const parse = [](char const* str, double& value) {
+        return cl::impl::StrToFloatingPoint(str, str + std::strlen(str), value);
+    };
+
+    static char const* const kInputs[] = {
+        "0", "-0", "1", "+1", "-1", "0.1", "1.5", "-2.25e3", "1e22", "1e23", "1e25", "123456789012345678",
+        "9007199254740993", "0.000001", "1e-22", "1e-23", "3.14159265358979323846", "2.2250738585072014e-308",
+        "1.7976931348623157e308", "0x1.8p1", "inf", "-infinity", "1e+5", "1.e2", ".5", "5.",
+        "1234567890123456789", "12345678901234567890", "0.1e-0",
+    };
+
+    for (auto const* str : kInputs) {
+        CAPTURE(str);
+
+        double value = 0;
+        auto const res = parse(str, value);
+        char* end = nullptr;
+        double const expected = std::strtod(str, &end);
+
+        CHECK(res.ec == cl::impl::ParseNumberStatus::success);
+        CHECK(res.ptr == end);
+        CHECK(std::memcmp(&value, &expected, sizeof(double)) == 0);
+    }
+
+    // Compare against strtod for many numbers which take the fast path.
+    uint64_t state = 12345;
+    for (int i = 0; i < 10000; ++i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+
+        char str[64];
+        std::snprintf(str, sizeof(str), "%llue%d", static_cast<unsigned long long>(state >> (state % 40)), static_cast<int>(state % 45) - 22);
+        CAPTURE(str);
+
+        double value = 0;
+        REQUIRE(parse(str, value).ec == cl::impl::ParseNumberStatus::success);
+        double const expected = std::strtod(str, nullptr);
+        CHECK(std::memcmp(&value, &expected, sizeof(double)) == 0);
+
+        errno = 0;
+        float const fexpected = std::strtof(str, nullptr);
+        if (errno == ERANGE) {
+            continue;
+        }
+
+        float fvalue = 0;
+        REQUIRE(cl::impl::StrToFloatingPoint(str, str + std::strlen(str), fvalue).ec == cl::impl::ParseNumberStatus::success);
+        CHECK(std::memcmp(&fvalue, &fexpected, sizeof(float)) == 0);
+    }
+
+    std::vector<double> values;
+    cl::Cmdline cli("test", "test");
+    cli.Add("v", "", cl::Arg::required | cl::CommaSeparated::yes | cl::Multiple::yes, cl::Var(values));
+    CHECK(true == ParseArgs(cli, {"-v", "1.5,-2,3e2,0.25"}));
+    CHECK(values == std::vector<double>{1.5, -2.0, 300.0, 0.25});
+    CHECK(false == ParseArgs(cli, {"-v", "1.5x"}));
+}
+
+TEST_CASE("Character conversion")
+{
+    char c = 0;
+    char16_t c16 = 0;
+    char32_t c32 = 0;
+    wchar_t wc = 0;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("c", "", cl::Arg::required | cl::Multiple::yes, cl::Var(c));
+    cli.Add("c16", "", cl::Arg::required | cl::Multiple::yes, cl::Var(c16));
+    cli.Add("c32", "", cl::Arg::required | cl::Multiple::yes, cl::Var(c32));
+    cli.Add("wc", "", cl::Arg::required | cl::Multiple::yes, cl::Var(wc));
+
+    CHECK(true == ParseArgs(cli, {"-c", "x"}));
+    CHECK(c == 'x');
+    CHECK(false == ParseArgs(cli, {"-c", "xy"}));
+    CHECK(false == ParseArgs(cli, {"-c", ""}));
+    CHECK(false == ParseArgs(cli, {"-c", u8"ä"}));
+    CHECK(true == ParseArgs(cli, {"-c16", u8"ä"}));
+    CHECK(c16 == u'ä');
+    CHECK(false == ParseArgs(cli, {"-c16", u8"\U0001F600"}));
+    CHECK(true == ParseArgs(cli, {"-c32", u8"\U0001F600"}));
+    CHECK(c32 == U'\U0001F600');
+    CHECK(true == ParseArgs(cli, {"-wc", u8"€"}));
+    CHECK(wc == L'€');
+}
+
+TEST_CASE("Comma-separated integer lists")
+{
+    std::vector<int> ints;
+    std::vector<int64_t> i64s;
+    std::vector<uint8_t> u8s;
+    std::set<int> set;
+    std::vector<int> small;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("i", "", cl::Arg::required | cl::CommaSeparated::yes | cl::Multiple::yes, cl::Var(ints));
+    cli.Add("l", "", cl::Arg::required | cl::CommaSeparated::yes | cl::Multiple::yes, cl::Var(i64s));
+    cli.Add("u", "", cl::Arg::required | cl::CommaSeparated::yes | cl::Multiple::yes, cl::Var(u8s));
+    cli.Add("s", "", cl::Arg::required | cl::CommaSeparated::yes | cl::Multiple::yes, cl::Var(set));
+    cli.Add("r", "", cl::Arg::required | cl::CommaSeparated::yes | cl::Multiple::yes, cl::Var(small, cl::check::InRange(0, 9)));
+
+    CHECK(true == ParseArgs(cli, {"-i", "1,-2,0x10,010,+5,0,-0,2147483647,-2147483648", "-i", "7"}));
+    CHECK(ints == std::vector<int>{1, -2, 16, 8, 5, 0, 0, 2147483647, -2147483647 - 1, 7});
+    CHECK(cli.Count("i") == 10);
+
+    CHECK(true == ParseArgs(cli, {"-l", "9223372036854775807,-9223372036854775808,1234567890123456789"}));
+    CHECK(i64s == std::vector<int64_t>{INT64_MAX, INT64_MIN, 1234567890123456789});
+
+    CHECK(true == ParseArgs(cli, {"-s", "3,1,2,1"}));
+    CHECK(set == std::set<int>{1, 2, 3});
+
+    cli.Reset();
+    ints.clear();
+    CHECK(false == ParseArgs(cli, {"-i", "1,2,x,4"}));
+    CHECK(ints == std::vector<int>{1, 2});
+    CHECK(cli.Count("i") == 2);
+    REQUIRE(cli.Diag().size() == 2);
+    CHECK(cli.Diag()[0].message == "invalid argument 'x' for option 'i'");
+    CHECK(cli.Diag()[1].message == "in comma-separated argument '1,2,x,4'");
+
+    cli.Reset();
+    ints.clear();
+    CHECK(false == ParseArgs(cli, {"-i", "1,2147483648"}));
+    CHECK(ints == std::vector<int>{1});
+    CHECK(false == ParseArgs(cli, {"-i", "1,,2"}));
+    CHECK(false == ParseArgs(cli, {"-i", "1,"}));
+    CHECK(false == ParseArgs(cli, {"-i", "1-"}));
+    CHECK(false == ParseArgs(cli, {"-u", "255,256"}));
+    CHECK(false == ParseArgs(cli, {"-u", "-1"}));
+    CHECK(u8s == std::vector<uint8_t>{255});
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"-r", "1,2,10,3"}));
+    CHECK(small == std::vector<int>{1, 2});
+
+    // Long lists are parsed in batches.
+    std::string list;
+    std::vector<int64_t> expected;
+    uint64_t state = 1;
+    for (int k = 0; k < 100000; ++k) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        auto const v = static_cast<int64_t>(state) >> (state % 64);
+        expected.push_back(v);
+        if (k != 0) {
+            list += ',';
+        }
+        list += std::to_string(v);
+    }
+
+    cli.Reset();
+    i64s.clear();
+    CHECK(true == ParseArgs(cli, {"-l", list.c_str()}));
+    CHECK(i64s == expected);
+    CHECK(cli.Count("l") == 100000);
+}
+
+TEST_CASE("Large maps")
+{
+    std::vector<std::string> keys;
+    for (int i = 0; i < 2000; ++i) {
+        keys.push_back("K" + std::to_string(i * 7919 % 2000));
+    }
+
+    std::vector<std::pair<cl::string_view, int>> entries;
+    for (auto const& key : keys) {
+        entries.emplace_back(key, std::stoi(key.substr(1)));
+    }
+    entries.emplace_back("K0", -1); // The first entry wins.
+
+    int value = 0;
+    cl::Cmdline cli("test", "test");
+    cli.Add("m", "", cl::Arg::required | cl::Multiple::yes, cl::Map(value, entries));
+
+    for (int i = 0; i < 2000; i += 37) {
+        auto const arg = "K" + std::to_string(i);
+        CHECK(true == ParseArgs(cli, {"-m", arg.c_str()}));
+        CHECK(value == i);
+    }
+    CHECK(true == ParseArgs(cli, {"-m", "K0"}));
+    CHECK(value == 0);
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"-m", "K1000x"}));
+    REQUIRE(cli.Diag().size() == 5);
+    CHECK(cli.Diag()[0].message == "invalid argument 'K1000x' for option 'm'");
+    CHECK(cli.Diag()[1].message == "could be 'K1000'"); // Nearest first
+    CHECK(cli.Diag()[2].message == "could be 'K100'");
+    CHECK(cli.Diag()[3].message == "could be 'K1001'");
+    CHECK(cli.Diag()[4].message == "(1998 more)");
+
+    // Without similar keys, the keys next to the argument are listed.
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"-m", "K1000xyz"}));
+    REQUIRE(cli.Diag().size() == 10);
+    CHECK(cli.Diag()[4].message == "could be 'K1000'");
+    CHECK(cli.Diag()[5].message == "could be 'K1001'");
+    CHECK(cli.Diag()[9].message == "(1993 more)");
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"-m", "A"}));
+    REQUIRE(cli.Diag().size() == 10);
+    CHECK(cli.Diag()[1].message == "could be 'K0'");
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"-m", "Z"}));
+    REQUIRE(cli.Diag().size() == 10);
+    CHECK(cli.Diag()[8].message == "could be 'K999'");
+
+    // Small maps still list all keys, in order.
+    cl::Cmdline small("test", "test");
+    small.Add("m", "", cl::Arg::required, cl::Map(value, {{"b", 1}, {"a", 2}}));
+    CHECK(false == ParseArgs(small, {"-m", "c"}));
+    REQUIRE(small.Diag().size() == 3);
+    CHECK(small.Diag()[1].message == "could be 'b'");
+    CHECK(small.Diag()[2].message == "could be 'a'");
+}
+
+TEST_CASE("Collect diagnostics")
+{
+    int i = 0;
+    cl::Cmdline cli("test", "test");
+    cli.Add("i", "", cl::Arg::required, cl::Var(i));
+
+    CHECK(false == ParseArgs(cli, {"-i", "x"}));
+    REQUIRE(cli.Diag().size() == 1);
+    CHECK(cli.Diag()[0].type == cl::Diagnostic::error);
+    CHECK(cli.Diag()[0].index == 1);
+    CHECK(cli.Diag()[0].message == "invalid argument 'x' for option 'i'");
+
+    // Diag() picks up messages emitted after the last call.
+    cli.EmitDiag(cl::Diagnostic::note, 2, "a", "b", "c");
+    REQUIRE(cli.Diag().size() == 2);
+    CHECK(cli.Diag()[0].message == "invalid argument 'x' for option 'i'");
+    CHECK(cli.Diag()[1].message == "abc");
+    CHECK(cli.Diag()[1].index == 2);
+
+    cli.Reset();
+    CHECK(cli.Diag().empty());
+
+    cli.SetCollectDiagnostics(cl::CollectDiagnostics::no);
+    CHECK(false == ParseArgs(cli, {"-i", "x"}));
+    CHECK(false == ParseArgs(cli, {"-j"}));
+    CHECK(cli.Diag().empty());
+    cli.PrintDiag();
+
+    cli.Reset();
+    cli.SetCollectDiagnostics(cl::CollectDiagnostics::yes);
+    CHECK(true == ParseArgs(cli, {"-i", "1"}));
+    CHECK(i == 1);
+    CHECK(cli.Diag().empty());
+}
+
+TEST_CASE("Help cache")
+{
+    bool a = false;
+    bool b = false;
+
+    cl::Cmdline cli("test", "test program");
+    cli.Add("a", "first option", cl::Arg::no, cl::Var(a));
+
+    auto const help1 = cli.FormatHelp();
+    CHECK(help1.find("--a") != std::string::npos);
+    CHECK(cli.FormatHelp() == help1);
+
+    std::string streamed;
+    int calls = 0;
+    cli.FormatHelp([&](cl::string_view s) { streamed.append(s.data(), s.size()); ++calls; });
+    CHECK(streamed == help1);
+    CHECK(calls == 1);
+
+    cl::Cmdline::HelpFormat fmt;
+    fmt.descr_indent = 10;
+    auto const help2 = cli.FormatHelp(fmt);
+    CHECK(help2 != help1);
+    CHECK(cli.FormatHelp() == help1);
+    CHECK(cli.FormatHelp(fmt) == help2);
+
+    // Adding an option invalidates the cache.
+    cli.Add("b", "second option", cl::Arg::no, cl::Var(b));
+    auto const help3 = cli.FormatHelp();
+    CHECK(help3 != help1);
+    CHECK(help3.find("--b") != std::string::npos);
+
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatches{0};
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&] {
+            for (int k = 0; k < 100; ++k) {
+                cl::Cmdline::HelpFormat f;
+                f.line_length = static_cast<size_t>(60 + k % 8);
+                std::string s;
+                cli.GetSchema().FormatHelp([&](cl::string_view v) { s.assign(v.data(), v.size()); }, f);
+                if (s.empty()) {
+                    ++mismatches;
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    CHECK(mismatches == 0);
+}
+
+TEST_CASE("Completion")
+{
+    enum class Color { red, green, blue };
+
+    Color color = Color::red;
+    std::string output;
+    bool verbose = false;
+    std::vector<std::string> files;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("color", "", cl::Arg::required, cl::Map(color, {{"red", Color::red}, {"green", Color::green}, {"blue", Color::blue}}));
+    cli.Add("o|output", "", cl::Arg::required, cl::Var(output));
+    cli.Add("v|verbose", "", cl::Arg::no | cl::MayGroup::yes, cl::Var(verbose));
+    cli.Add("file", "", cl::Positional::yes | cl::Multiple::yes, cl::Var(files));
+
+    auto const complete = [&](std::vector<char const*> const& args, size_t cursor) {
+        std::vector<std::string> texts;
+        for (auto const& c : cli.Complete(args.begin(), args.end(), cursor)) {
+            texts.push_back(c.text);
+        }
+        return texts;
+    };
+
+    using Texts = std::vector<std::string>;
+
+    CHECK(complete({"--"}, 0) == Texts{"--color", "--o", "--output", "--v", "--verbose"});
+    CHECK(complete({"--ver"}, 0) == Texts{"--verbose"});
+    CHECK(complete({"-o"}, 0) == Texts{"-o", "-output"});
+    CHECK(complete({"--x"}, 0) == Texts{});
+    CHECK(complete({"--color", "g"}, 1) == Texts{"green"});
+    CHECK(complete({"--color"}, 1) == Texts{"blue", "green", "red"});
+    CHECK(complete({"--color=b"}, 0) == Texts{"--color=blue"});
+    CHECK(complete({"-v", "--color", "r", "x"}, 2) == Texts{"red"});
+    CHECK(complete({"-o", "out", "--co"}, 2) == Texts{"--color"});
+    CHECK(complete({"-o", "--co"}, 1) == Texts{}); // "--co" is the argument of "-o"
+    CHECK(complete({"a"}, 1) == Texts{"<file>"});
+    CHECK(complete({"--", "--co"}, 1) == Texts{});
+
+    // The parsers are not called.
+    CHECK(output.empty());
+    CHECK(files.empty());
+    CHECK(color == Color::red);
+    CHECK(cli.Count("color") == 0);
+}
+
+TEST_CASE("Subcommands")
+{
+    bool verbose = false;
+    std::string dict;
+    std::vector<std::string> files;
+    int num_inits = 0;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("v|verbose", "", cl::Arg::no | cl::Multiple::yes, cl::Var(verbose));
+
+    cli.AddSubcommand("make", "Make something", [&](cl::Cmdline& sub) {
+        ++num_inits;
+        sub.Add("dict", "", cl::Arg::required | cl::Required::yes, cl::Var(dict));
+        sub.Add("file", "", cl::Positional::yes | cl::Multiple::yes, cl::Var(files));
+    });
+    cli.AddSubcommand("find", "Find something", [&](cl::Cmdline& sub) {
+        ++num_inits;
+        sub.Add("o", "", cl::Arg::required, cl::Var(dict));
+    });
+
+    std::vector<std::string> names;
+    for (int i = 0; i < 600; ++i) {
+        names.push_back("cmd" + std::to_string(i));
+    }
+    for (auto const& name : names) {
+        cli.AddSubcommand(name.c_str(), "", [&](cl::Cmdline& /*sub*/) { ++num_inits; });
+    }
+
+    CHECK(cli.Subcommand() == nullptr);
+    CHECK(true == ParseArgs(cli, {"-v", "make", "--dict", "d", "a", "-v", "b"}));
+    REQUIRE(cli.Subcommand() != nullptr);
+    CHECK(cli.Subcommand()->Name() == "make");
+    CHECK(num_inits == 1);
+    CHECK(verbose);
+    CHECK(dict == "d");
+    CHECK(files == std::vector<std::string>{"a", "b"});
+    CHECK(cli.Count("v") == 2);
+    CHECK(cli.Subcommand()->Count("dict") == 1);
+
+    // The sub-command parser is reused.
+    cli.Reset();
+    CHECK(cli.Subcommand() == nullptr);
+    files.clear();
+    CHECK(true == ParseArgs(cli, {"make", "--dict=x"}));
+    CHECK(num_inits == 1);
+    CHECK(dict == "x");
+    CHECK(files.empty());
+
+    // Diagnostics are emitted to the top-level parser.
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"find", "-o", "x", "--unknown"}));
+    REQUIRE(cli.Diag().size() == 1);
+    CHECK(cli.Diag()[0].message == "unknown option '--unknown'");
+    CHECK(cli.Diag()[0].index == 3);
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"make"}));
+    REQUIRE(cli.Diag().size() == 1);
+    CHECK(cli.Diag()[0].message == "option 'dict' is missing");
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"find", "--dict", "d"}));
+    CHECK(num_inits == 2); // The schema of each sub-command is only built once.
+    CHECK(cli.Diag()[0].message == "unknown option '--dict'");
+
+    cli.Reset();
+    CHECK(true == ParseArgs(cli, {"cmd599"}));
+    CHECK(num_inits == 3);
+    CHECK(cli.Subcommand()->Name() == "cmd599");
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"nocmd"}));
+    CHECK(cli.Subcommand() == nullptr);
+
+    // A sub-command name after "--" is a positional argument.
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"--", "make"}));
+    CHECK(cli.Subcommand() == nullptr);
+
+    auto const complete = [&](std::vector<char const*> const& args, size_t cursor) {
+        std::vector<std::string> texts;
+        for (auto const& c : cli.Complete(args.begin(), args.end(), cursor)) {
+            texts.push_back(c.text);
+        }
+        return texts;
+    };
+
+    using Texts = std::vector<std::string>;
+
+    CHECK(complete({"ma"}, 0) == Texts{"make"});
+    CHECK(complete({"make", "--d"}, 1) == Texts{"--dict"});
+    CHECK(complete({"make", "--"}, 1) == Texts{"--dict", "--v", "--verbose"});
+    CHECK(complete({"make", "-v", "--dict"}, 3) == Texts{});
+    CHECK(cli.Subcommand() == nullptr);
+
+    auto const help = cli.FormatHelp();
+    CHECK(help.find("Commands:") != std::string::npos);
+    CHECK(help.find("Make something") != std::string::npos);
+}
+
+TEST_CASE("Option sets")
+{
+    int verbose = 0;
+    std::string output;
+    std::vector<std::string> include_dirs;
+    std::string input;
+
+    auto set = cl::MakeOptionSet(kTestSpecs,
+        [&](cl::ParseContext const&) { ++verbose; },
+        cl::Var(output),
+        cl::Var(include_dirs),
+        cl::Var(input));
+
+    static_assert(decltype(set)::size() == 4, "");
+    static_assert(!std::is_copy_constructible<decltype(set)>::value, "");
+    static_assert(!std::is_move_assignable<decltype(set)>::value, "");
+
+    cl::Cmdline cli("test", "test");
+    cli.Add(set);
+
+    CHECK(set.Get<0>().Id() == 0);
+    CHECK(set.Get<3>().Id() == 3);
+    CHECK(set.Get<1>().Name() == "o|output");
+
+    CHECK(true == ParseArgs(cli, {"-v", "--verbose", "-o", "out", "-Ia", "-I", "b", "in"}));
+    CHECK(verbose == 2);
+    CHECK(output == "out");
+    CHECK(include_dirs.size() == 2);
+    CHECK(include_dirs[0] == "a");
+    CHECK(include_dirs[1] == "b");
+    CHECK(input == "in");
+    CHECK(cli.Count(&set.Get<0>()) == 2);
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"-v"})); // input is missing
+
+    // Option sets may be combined with other options.
+    int level = 0;
+    bool flag = false;
+    cli.Add("level", "", cl::Arg::required, cl::Var(level));
+    cl::Option<decltype(cl::Var(flag))> flag_opt("f|flag", "", {}, cl::Var(flag));
+    cli.Add(&flag_opt);
+
+    cli.Reset();
+    CHECK(true == ParseArgs(cli, {"--flag", "--level=3", "--input=x", "--output=y"}));
+    CHECK(flag);
+    CHECK(level == 3);
+    CHECK(input == "x");
+    CHECK(output == "y");
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"--level=x", "in"}));
+    CHECK(cli.Diag()[0].message == "invalid argument 'x' for option 'level'");
+}
+
+TEST_CASE("Positional options")
+{
+    std::string a;
+    std::vector<std::string> b;
+    std::string c;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("a|first", "", cl::Positional::yes | cl::Required::yes, cl::Var(a));
+    cli.Add("x", "", {}, [](cl::ParseContext const&) {});
+    cli.Add("b", "", cl::Positional::yes | cl::Multiple::yes | cl::Required::yes, cl::Var(b));
+    cli.Add("c", "", cl::Positional::yes | cl::Required::yes, cl::Var(c));
+
+    // The first positional option which allows another occurrence is used.
+    CHECK(false == ParseArgs(cli, {"1", "-x", "2", "3"}));
+    CHECK(a == "1");
+    CHECK(b == std::vector<std::string>{"2", "3"});
+    CHECK(c.empty());
+    REQUIRE(cli.Diag().size() == 1);
+    CHECK(cli.Diag()[0].message == "option 'c' is missing");
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {}));
+    REQUIRE(cli.Diag().size() == 3);
+    CHECK(cli.Diag()[0].message == "option 'a|first' is missing");
+    CHECK(cli.Diag()[1].message == "option 'b' is missing");
+    CHECK(cli.Diag()[2].message == "option 'c' is missing");
+
+    cli.Reset();
+    CHECK(true == ParseArgs(cli, {"--c=z", "--first=y", "w"}));
+    CHECK(c == "z");
+    CHECK(a == "y");
+    CHECK(b.back() == "w");
+}
+
+#if CL_ENABLE_STATS
+TEST_CASE("Parse statistics")
+{
+    int i = 0;
+    bool a = false;
+    bool b = false;
+    std::string dir;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("i", "", cl::Arg::required | cl::Multiple::yes | cl::CommaSeparated::yes, cl::Var(i));
+    cli.Add("a", "", cl::MayGroup::yes, cl::Var(a));
+    cli.Add("b", "", cl::MayGroup::yes, cl::Var(b));
+    cli.Add("I", "", cl::Arg::required | cl::MayJoin::yes, cl::Var(dir));
+
+    CHECK(true == ParseArgs(cli, {"-i", "1,2", "-ab", "-Idir"}));
+
+    auto const& stats = cli.Stats();
+    CHECK(stats.num_parse_calls == 1);
+    CHECK(stats.num_args == 4);
+    CHECK(stats.find_option_calls > 0);
+    CHECK(stats.find_option_probes >= stats.find_option_calls);
+    CHECK(stats.prefix_fallbacks == 2); // "-ab" and "-Idir"
+    CHECK(stats.group_fallbacks == 1);
+    CHECK(stats.diagnostics == 0);
+    REQUIRE(stats.options.size() == 4);
+    CHECK(stats.options[0].name == "i");
+    CHECK(stats.options[0].calls == 2); // Once for each element
+    CHECK(stats.options[1].calls == 1);
+    CHECK(stats.options[2].calls == 1);
+    CHECK(stats.options[3].calls == 1);
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"-i", "x"}));
+    CHECK(cli.Stats().num_parse_calls == 2);
+    CHECK(cli.Stats().diagnostics == 2); // Error and note
+    CHECK(cli.Stats().options[0].calls == 3);
+
+    auto const utf8_bytes = cli.Stats().utf8_bytes;
+    std::vector<std::wstring> const wargs = {L"-a"};
+    cli.Reset();
+    CHECK(cli.Parse(wargs.begin(), wargs.end(), cl::CheckMissingOptions::no).success);
+    CHECK(cli.Stats().utf8_bytes == utf8_bytes + 2);
+
+    static_cast<void>(cli.FormatHelp());
+
+    auto const json = cli.Stats().ToJSON();
+    CHECK(json.find("\"num_parse_calls\": 3") != std::string::npos);
+    CHECK(json.find("{\"name\": \"I\", \"calls\": 1, ") != std::string::npos);
+
+    cli.ResetStats();
+    CHECK(cli.Stats().num_parse_calls == 0);
+    CHECK(cli.Stats().options.empty());
+}
+#endif
+
+TEST_CASE("Option precedence")
+{
+    std::string ab;
+    bool a = false;
+    bool b = false;
+    std::string with;
+    std::string without;
+    std::string join;
+    std::vector<double> numbers;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("ab", "", cl::Arg::optional, cl::Var(ab));
+    cli.Add("a", "", cl::MayGroup::yes, cl::Var(a));
+    cli.Add("b", "", cl::MayGroup::yes, cl::Var(b));
+    cli.Add("with", "", cl::Arg::required | cl::MayJoin::yes, cl::Var(with));
+    cli.Add("without", "", cl::Arg::required | cl::MayJoin::yes, cl::Var(without));
+    cli.Add("j", "", cl::Arg::required | cl::MayJoin::yes, cl::Var(join));
+    cli.Add("numbers", "", cl::Positional::yes | cl::Multiple::yes, cl::Var(numbers));
+
+    // The name of an option wins over an option group.
+    CHECK(true == ParseArgs(cli, {"-ab"}));
+    CHECK(ab.empty());
+    CHECK(cli.Count("ab") == 1);
+    CHECK(!a);
+    CHECK(cli.Count("a") == 0);
+
+    // "-name=value" wins over a prefix.
+    cli.Reset();
+    CHECK(true == ParseArgs(cli, {"-ab=x"}));
+    CHECK(ab == "x");
+
+    // The longest prefix is used.
+    cli.Reset();
+    CHECK(true == ParseArgs(cli, {"-withx", "-withouty"}));
+    CHECK(with == "x");
+    CHECK(without == "y");
+
+    // Options which may join their argument keep the '='.
+    cli.Reset();
+    CHECK(true == ParseArgs(cli, {"-j=1"}));
+    CHECK(join == "=1");
+
+    // Option groups.
+    cli.Reset();
+    CHECK(true == ParseArgs(cli, {"-ba"}));
+    CHECK(a);
+    CHECK(b);
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"-bax"}));
+
+    // Negative numbers are not options.
+    cli.Reset();
+    numbers.clear();
+    CHECK(true == ParseArgs(cli, {"-3.5", "-1e3"}));
+    CHECK(numbers == std::vector<double>{-3.5, -1000.0});
+}
+
+static void SetEnv(char const* name, char const* value)
+{
+#if _WIN32
+    _putenv_s(name, value != nullptr ? value : "");
+#else
+    if (value != nullptr) {
+        setenv(name, value, 1);
+    } else {
+        unsetenv(name);
+    }
+#endif
+}
+
+TEST_CASE("Environment and config files")
+{
+    std::string output;
+    int level = 0;
+    bool verbose = false;
+    std::vector<int> ints;
+    std::string server_host;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("o|output-dir", "", cl::Arg::required, cl::Var(output));
+    cli.Add("level", "", cl::Arg::required, cl::Var(level));
+    cli.Add("v|verbose", "", {}, cl::Var(verbose));
+    cli.Add("i|ints", "", cl::Arg::required | cl::Multiple::yes | cl::CommaSeparated::yes, cl::Var(ints));
+    cli.Add("server.host", "", cl::Arg::required | cl::Required::yes, cl::Var(server_host));
+
+    SetEnv("CLTEST_OUTPUT_DIR", "env-out");
+    SetEnv("CLTEST_LEVEL", "2");
+    SetEnv("CLTEST_VERBOSE", "0");
+    SetEnv("CLTEST_INTS", "1,2");
+
+    // The command line takes precedence.
+    std::vector<char const*> const args = {"--level=5"};
+    CHECK(cli.Parse(args.begin(), args.end(), cl::CheckMissingOptions::no).success);
+    CHECK(true == cli.ParseEnv("CLTEST_"));
+    CHECK(output == "env-out");
+    CHECK(level == 5);
+    CHECK(!verbose);
+    CHECK(cli.Count("verbose") == 0);
+    CHECK(ints == std::vector<int>{1, 2});
+    CHECK(cli.Count("ints") == 2);
+
+    char const* const config =
+        "# comment\n"
+        "level = 7\n"
+        "verbose = true\n"
+        "ints = [3, \"4\", 5,]  # comment\n"
+        "output-dir = 'ignored'\n"
+        "\n"
+        "[server]\n"
+        "  host = \"example.com\\t\"\n";
+
+    CHECK(true == cli.ParseConfig(config));
+    CHECK(level == 5);
+    CHECK(verbose);
+    CHECK(ints == std::vector<int>{1, 2}); // Already set from the environment
+    CHECK(output == "env-out");
+    CHECK(server_host == "example.com\t");
+    CHECK(false == cli.AnyMissing());
+
+    // Values are only used for options which have not been specified.
+    cli.Reset();
+    ints.clear();
+    SetEnv("CLTEST_INTS", nullptr);
+    SetEnv("CLTEST_VERBOSE", "x");
+    CHECK(false == cli.ParseEnv("CLTEST_"));
+    REQUIRE(cli.Diag().size() == 2);
+    CHECK(cli.Diag()[0].message == "invalid argument 'x' for option 'verbose'");
+    CHECK(cli.Diag()[1].message == "in environment variable 'CLTEST_VERBOSE'");
+    CHECK(true == cli.ParseConfig(config));
+    CHECK(ints == std::vector<int>{3, 4, 5});
+    CHECK(level == 2);
+
+    cli.Reset();
+    CHECK(false == cli.ParseConfig("a = 1\n[x\nlevel\nlevel = \"1\n", "test.ini"));
+    REQUIRE(cli.Diag().size() == 8);
+    CHECK(cli.Diag()[0].message == "unknown option 'a'");
+    CHECK(cli.Diag()[1].message == "in config file 'test.ini', line 1");
+    CHECK(cli.Diag()[2].message == "expected ']'");
+    CHECK(cli.Diag()[4].message == "expected 'name = value'");
+    CHECK(cli.Diag()[6].message == "invalid value");
+    CHECK(cli.Diag()[7].message == "in config file 'test.ini', line 4");
+
+    SetEnv("CLTEST_OUTPUT_DIR", nullptr);
+    SetEnv("CLTEST_LEVEL", nullptr);
+    SetEnv("CLTEST_VERBOSE", nullptr);
+}
+
+TEST_CASE("Config file cache")
+{
+    int level = 0;
+    std::vector<std::string> names;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("level", "", cl::Arg::required, cl::Var(level));
+    cli.Add("name", "", cl::Arg::required | cl::Multiple::yes, cl::Var(names));
+
+    std::remove("cl_test_config.cache");
+    WriteFile("cl_test_config.ini", "level = 1\nname = [a, b]\n");
+
+    CHECK(true == cli.ParseConfigFile("cl_test_config.ini", "cl_test_config.cache"));
+    CHECK(level == 1);
+    CHECK(names == std::vector<std::string>{"a", "b"});
+
+    // The cache is used if the file did not change.
+    cli.Reset();
+    level = 0;
+    names.clear();
+    CHECK(true == cli.ParseConfigFile("cl_test_config.ini", "cl_test_config.cache"));
+    CHECK(level == 1);
+    CHECK(names == std::vector<std::string>{"a", "b"});
+
+#if !_WIN32
+    {
+        std::FILE* const file = std::fopen("cl_test_config.cache", "rb");
+        CHECK(file != nullptr);
+        if (file != nullptr) {
+            std::fclose(file);
+        }
+    }
+#endif
+
+    // A modified file is parsed again.
+    WriteFile("cl_test_config.ini", "level = 22\nname = c, d\n");
+    cli.Reset();
+    names.clear();
+    CHECK(true == cli.ParseConfigFile("cl_test_config.ini", "cl_test_config.cache"));
+    CHECK(level == 22);
+    CHECK(names == std::vector<std::string>{"c, d"});
+
+    // Invalid caches are ignored.
+    WriteFile("cl_test_config.cache", "CLcf garbage");
+    cli.Reset();
+    level = 0;
+    CHECK(true == cli.ParseConfigFile("cl_test_config.ini", "cl_test_config.cache"));
+    CHECK(level == 22);
+
+    // Schema errors are reported for cached files, too.
+    cl::Cmdline other("test", "test");
+    other.Add("level", "", cl::Arg::required, cl::Var(level));
+    CHECK(false == other.ParseConfigFile("cl_test_config.ini", "cl_test_config.cache"));
+    REQUIRE(other.Diag().size() == 2);
+    CHECK(other.Diag()[0].message == "unknown option 'name'");
+    CHECK(other.Diag()[1].message == "in config file 'cl_test_config.ini', line 2");
+
+    CHECK(false == cli.ParseConfigFile("cl_test_no_such_file.ini"));
+
+    std::remove("cl_test_config.ini");
+    std::remove("cl_test_config.cache");
+}
+
+TEST_CASE("Deferred conversion")
+{
+    int level = 0;
+    std::vector<int> ints;
+    std::vector<std::string> names;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("level", "", cl::Arg::required, cl::Var(level));
+    cli.Add("i", "", cl::Arg::required | cl::Multiple::yes | cl::CommaSeparated::yes, cl::Var(ints));
+    cli.Add("name", "", cl::Arg::required | cl::Multiple::yes, cl::Var(names));
+    cli.SetDeferConversion(cl::DeferConversion::yes);
+
+    // Values are not changed before Convert().
+    CHECK(true == ParseArgs(cli, {"--level=3", "--name=a", "-i=1,2", "--name=b", "-i", "3"}));
+    CHECK(level == 0);
+    CHECK(ints.empty());
+    CHECK(names.empty());
+
+    CHECK(true == cli.Convert());
+    CHECK(level == 3);
+    CHECK(ints == std::vector<int>{1, 2, 3});
+    CHECK(names == std::vector<std::string>{"a", "b"});
+
+    // Nothing left to convert.
+    CHECK(true == cli.Convert());
+    CHECK(ints.size() == 3);
+
+    // Diagnostics have the index of the original argument.
+    auto const check_invalid = [&](cl::Cmdline const& c) {
+        REQUIRE(c.Diag().size() == 2);
+        CHECK(c.Diag()[0].index == 1);
+        CHECK(c.Diag()[0].message == "invalid argument 'x' for option 'i'");
+        CHECK(c.Diag()[1].index == 3);
+        CHECK(c.Diag()[1].message == "invalid argument 'y' for option 'level'");
+    };
+
+    cli.Reset();
+    ints.clear();
+    names.clear();
+    CHECK(true == ParseArgs(cli, {"--name=a", "-i=4,x", "--name=b", "--level=y", "-i=5"}));
+    CHECK(cli.Diag().empty());
+    CHECK(false == cli.Convert());
+    check_invalid(cli);
+    CHECK(ints == std::vector<int>{4, 5});
+    CHECK(names == std::vector<std::string>{"a", "b"});
+
+    // Same with a parallel conversion.
+    auto const executor = [](size_t n, auto const& task) {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < n; ++i) {
+            threads.emplace_back(task, i);
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    };
+
+    cli.Reset();
+    ints.clear();
+    names.clear();
+    CHECK(true == ParseArgs(cli, {"--name=a", "-i=4,x", "--name=b", "--level=y", "-i=5"}));
+    CHECK(false == cli.Convert(executor));
+    check_invalid(cli);
+    CHECK(ints == std::vector<int>{4, 5});
+    CHECK(names == std::vector<std::string>{"a", "b"});
+
+    cli.Reset();
+    ints.clear();
+    names.clear();
+    CHECK(true == ParseArgs(cli, {"--level=7", "--name=a", "-i=1,2", "--name=b", "-i", "3"}));
+    CHECK(true == cli.Convert(executor));
+    CHECK(cli.Diag().empty());
+    CHECK(level == 7);
+    CHECK(ints == std::vector<int>{1, 2, 3});
+    CHECK(names == std::vector<std::string>{"a", "b"});
+
+    // A serial executor, which reuses the temporary Cmdline of the first task
+    // for all other tasks.
+    auto const serial = [](size_t n, auto const& task) {
+        for (size_t i = n; i-- > 0; ) {
+            task(i);
+        }
+    };
+
+    cli.Reset();
+    ints.clear();
+    names.clear();
+    CHECK(true == ParseArgs(cli, {"--name=a", "-i=4,x", "--name=b", "--level=y", "-i=5"}));
+    CHECK(false == cli.Convert(serial));
+    check_invalid(cli);
+    CHECK(ints == std::vector<int>{4, 5});
+    CHECK(names == std::vector<std::string>{"a", "b"});
+}
+
+TEST_CASE("Lazy values")
+{
+    int calls = 0;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("threads", "", cl::Arg::required | cl::Multiple::yes, [&](cl::ParseContext const&) { ++calls; });
+    cli.Add("name", "", cl::Arg::required | cl::Multiple::yes, [&](cl::ParseContext const&) { ++calls; });
+    cli.Add("version", "", cl::StopParsing::yes, [&](cl::ParseContext const&) { ++calls; });
+    cli.SetDeferConversion(cl::DeferConversion::yes);
+
+    CHECK(true == ParseArgs(cli, {"--threads=4", "--name=a", "--threads=x", "--name=b", "--threads=8"}));
+    CHECK(calls == 0);
+
+    auto const threads = cli.Get<int>("threads");
+    REQUIRE(threads != nullptr);
+    CHECK(*threads == 8);
+    CHECK(cli.Get<int>("threads") == threads); // memoized
+    CHECK(cli.Get<std::string>("threads") != nullptr);
+    CHECK(*cli.Get<std::string>("threads") == "8");
+    CHECK(cli.Diag().empty());
+
+    auto const names = cli.GetAll<std::string>("name");
+    REQUIRE(names != nullptr);
+    CHECK(*names == std::vector<std::string>{"a", "b"});
+
+    // Not specified.
+    CHECK(cli.Get<bool>("version") == nullptr);
+    REQUIRE(cli.GetAll<bool>("version") != nullptr);
+    CHECK(cli.GetAll<bool>("version")->empty());
+    // Unknown option.
+    CHECK(cli.Get<int>("no-such-option") == nullptr);
+
+    // Invalid arguments are reported with their original index.
+    CHECK(cli.GetAll<int>("threads") == nullptr);
+    REQUIRE(cli.Diag().size() == 1);
+    CHECK(cli.Diag()[0].index == 2);
+    CHECK(cli.Diag()[0].message == "invalid argument 'x' for option 'threads'");
+    CHECK(calls == 0);
+
+    // New occurrences invalidate the memoized values.
+    CHECK(true == ParseArgs(cli, {"--threads=16", "--version", "--name=c"}));
+    REQUIRE(cli.Get<int>("threads") != nullptr);
+    CHECK(*cli.Get<int>("threads") == 16);
+    REQUIRE(cli.GetAll<std::string>("name") != nullptr);
+    CHECK(*cli.GetAll<std::string>("name") == std::vector<std::string>{"a", "b"});
+    REQUIRE(cli.Get<bool>("version") != nullptr);
+    CHECK(*cli.Get<bool>("version") == true);
+    CHECK(calls == 0);
+
+    // Convert() still calls the parsers. "--name=c" follows "--version" and
+    // has not been parsed.
+    CHECK(true == cli.Convert());
+    CHECK(calls == 7);
+
+    cli.Reset();
+    CHECK(cli.Get<int>("threads") == nullptr);
+}
+
+TEST_CASE("Serialize and replay")
+{
+    struct Values {
+        int level = 0;
+        std::vector<std::string> names;
+        std::string file;
+    };
+
+    auto const add_options = [](cl::Cmdline& cli, Values& v) {
+        cli.Add("level", "", cl::Arg::required, cl::Var(v.level));
+        cli.Add("n|name", "", cl::Arg::required | cl::Multiple::yes | cl::MayJoin::yes, cl::Var(v.names));
+        cli.Add("file", "", cl::Positional::yes, cl::Var(v.file));
+    };
+
+    Values v1;
+    cl::Cmdline cli1("test", "test");
+    add_options(cli1, v1);
+    cli1.SetDeferConversion(cl::DeferConversion::yes);
+
+    std::string blob;
+    CHECK(true == cli1.Serialize(blob)); // Nothing recorded yet
+    blob.clear();
+
+    CHECK(true == ParseArgs(cli1, {"--level=3", "-na", "input.txt", "--name", "b"}));
+    CHECK(true == cli1.Serialize(blob));
+
+    // Replay into a Cmdline with the same options.
+    Values v2;
+    cl::Cmdline cli2("test", "test");
+    add_options(cli2, v2);
+    CHECK(cli1.GetSchema().Fingerprint() == cli2.GetSchema().Fingerprint());
+
+    CHECK(true == cli2.Replay(blob));
+    CHECK(cli2.Diag().empty());
+    CHECK(v2.level == 3);
+    CHECK(v2.names == std::vector<std::string>{"a", "b"});
+    CHECK(v2.file == "input.txt");
+    CHECK(cli2.Count("level") == 1);
+    CHECK(cli2.Count("name") == 2);
+    CHECK(cli2.Count("file") == 1);
+
+    // Arguments are only recorded with DeferConversion::yes.
+    std::string blob2;
+    CHECK(false == cli2.Serialize(blob2));
+
+    // The positional option has been consumed.
+    CHECK(false == ParseArgs(cli2, {"other.txt"}));
+
+    // Replay into a Cmdline which defers the conversion.
+    Values v3;
+    cl::Cmdline cli3("test", "test");
+    add_options(cli3, v3);
+    cli3.SetDeferConversion(cl::DeferConversion::yes);
+    CHECK(true == cli3.Replay(blob));
+    CHECK(v3.level == 0);
+    REQUIRE(cli3.Get<int>("level") != nullptr);
+    CHECK(*cli3.Get<int>("level") == 3);
+    CHECK(true == cli3.Convert());
+    CHECK(v3.names == std::vector<std::string>{"a", "b"});
+
+    // The blob of the replayed Cmdline is the same.
+    std::string blob3;
+    CHECK(true == cli3.Serialize(blob3));
+    CHECK(blob3 == blob);
+
+    // Different options.
+    int level = 0;
+    cl::Cmdline other("test", "test");
+    other.Add("level", "", cl::Arg::required | cl::Multiple::yes, cl::Var(level));
+    CHECK(cli1.GetSchema().Fingerprint() != other.GetSchema().Fingerprint());
+    CHECK(false == other.Replay(blob));
+    REQUIRE(other.Diag().size() == 1);
+    CHECK(other.Diag()[0].message == "command line blob has been written for a different set of options");
+    CHECK(level == 0);
+
+    // Invalid blobs.
+    Values v4;
+    cl::Cmdline cli4("test", "test");
+    add_options(cli4, v4);
+    CHECK(false == cli4.Replay(cl::string_view(blob.data(), blob.size() - 1)));
+    CHECK(false == cli4.Replay("CLpr"));
+    std::string corrupt = blob;
+    corrupt[32 + 4 * 3] = 99; // Id of the first argument
+    CHECK(false == cli4.Replay(corrupt));
+    CHECK(cli4.Diag().size() == 3);
+    CHECK(cli4.Diag()[2].message == "invalid command line blob");
+    CHECK(cli4.Count("level") == 0);
+    CHECK(v4.level == 0);
+}
+
+TEST_CASE("Suggestions")
+{
+    bool flag = false;
+    std::string file;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("verbose", "", cl::Arg::no, cl::Var(flag));
+    cli.Add("version", "", cl::Arg::no, cl::Var(flag));
+    cli.Add("o|output", "", cl::Arg::required, cl::Var(file));
+    cli.Add("color", "", cl::Arg::no, cl::Var(flag));
+    cli.Add("colour", "", cl::Arg::no, cl::Var(flag));
+
+    CHECK(false == ParseArgs(cli, {"--verbos"}));
+    REQUIRE(cli.Diag().size() == 2);
+    CHECK(cli.Diag()[0].message == "unknown option '--verbos'");
+    CHECK(cli.Diag()[1].type == cl::Diagnostic::note);
+    CHECK(cli.Diag()[1].index == 0);
+    CHECK(cli.Diag()[1].message == "did you mean '--verbose'?");
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"--colours"}));
+    REQUIRE(cli.Diag().size() == 3);
+    CHECK(cli.Diag()[1].message == "did you mean '--colour'?"); // Nearest first
+    CHECK(cli.Diag()[2].message == "did you mean '--color'?");
+
+    // The dashes and the argument of the option are kept.
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"-ouptut=x"}));
+    REQUIRE(cli.Diag().size() == 2);
+    CHECK(cli.Diag()[1].message == "did you mean '-output'?");
+
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"--xyz"}));
+    CHECK(cli.Diag().size() == 1);
+
+    // Options added later are suggested, too.
+    cli.Add("verbosity", "", cl::Arg::required, cl::Var(file));
+    cli.Reset();
+    CHECK(false == ParseArgs(cli, {"--verbosty"}));
+    REQUIRE(cli.Diag().size() == 3);
+    CHECK(cli.Diag()[1].message == "did you mean '--verbosity'?");
+    CHECK(cli.Diag()[2].message == "did you mean '--verbose'?");
+
+    std::vector<cl::string_view> names;
+    cli.GetSchema().SuggestOptions("vrsion", 1, names);
+    CHECK(names == std::vector<cl::string_view>{"version"});
+
+    // Positional options are not suggested.
+    cli.Add("outline", "", cl::Positional::yes, cl::Var(file));
+    names.clear();
+    cli.GetSchema().SuggestOptions("outlie", 3, names);
+    CHECK(names.empty());
+
+    // Config files.
+    cli.Reset();
+    CHECK(false == cli.ParseConfig("verbse = true\n"));
+    REQUIRE(cli.Diag().size() == 3);
+    CHECK(cli.Diag()[1].message == "did you mean 'verbose'?");
+    CHECK(cli.Diag()[2].message == "in config file 'config', line 1");
+}
+
+TEST_CASE("Batch parsing")
+{
+    struct Record {
+        int n = 0;
+        std::string s;
+    };
+
+    cl::Schema schema("test", "test");
+    schema.Add("n", "", cl::Arg::required | cl::Required::yes, cl::Field(&Record::n));
+    schema.Add("s", "", cl::Positional::yes, cl::Field(&Record::s));
+
+    constexpr size_t kNumLines = 1000;
+
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < kNumLines; ++i) {
+        if (i % 100 == 7) {
+            lines.push_back("-n x 'file " + std::to_string(i) + "'"); // invalid
+        } else {
+            lines.push_back("-n " + std::to_string(i) + " 'file " + std::to_string(i) + "'");
+        }
+    }
+
+    for (size_t num_threads : {size_t{1}, size_t{4}}) {
+        std::vector<Record> records(kNumLines);
+
+        cl::BatchOptions options;
+        options.num_threads = num_threads;
+        options.chunk_size = 16;
+
+        cl::BatchResults results;
+        cl::ParseBatch(schema, lines, [&](size_t i) { return &records[i]; }, results, options);
+
+        REQUIRE(results.size() == kNumLines);
+        size_t num_failed = 0;
+        for (size_t i = 0; i < kNumLines; ++i) {
+            if (i % 100 == 7) {
+                ++num_failed;
+                CHECK(results.success[i] == 0);
+                REQUIRE(results.NumDiags(i) == 1);
+                CHECK(results.Diag(i, 0).index == 1);
+                CHECK(results.Diag(i, 0).message == "invalid argument 'x' for option 'n'");
+            } else {
+                CHECK(results.success[i] == 1);
+                CHECK(results.NumDiags(i) == 0);
+                CHECK(records[i].n == static_cast<int>(i));
+                CHECK(records[i].s == "file " + std::to_string(i));
+            }
+        }
+        CHECK(num_failed == 10);
+        CHECK(results.diags.size() == 10);
+    }
+
+    // Pre-tokenized arguments.
+    std::vector<std::vector<std::string>> arg_lists{{"-n", "1", "a"}, {"b"}, {}, {"-n", "4"}};
+    std::vector<Record> records(arg_lists.size());
+
+    cl::BatchResults results;
+    cl::ParseBatchArgs(schema, arg_lists, [&](size_t i) { return &records[i]; }, results);
+    REQUIRE(results.size() == 4);
+    CHECK(results.success == std::vector<uint8_t>{1, 0, 0, 1});
+    CHECK(results.NumDiags(1) == 1);
+    CHECK(results.Diag(1, 0).message == "option 'n' is missing");
+    CHECK(records[0].n == 1);
+    CHECK(records[0].s == "a");
+    CHECK(records[3].n == 4);
+
+    // Empty batches.
+    cl::ParseBatchArgs(schema, std::vector<std::vector<std::string>>{}, [](size_t) { return nullptr; }, results);
+    CHECK(results.size() == 0);
+    CHECK(results.diag_offsets.size() == 1);
+}
+
+TEST_CASE("String views and reserve hints")
+{
+    cl::string_view name;
+    std::vector<cl::string_view> includes;
+    std::vector<std::string> libs;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("name", "", cl::Arg::required, cl::Var(name));
+    cli.Add("I", "", cl::Arg::required | cl::Multiple::yes | cl::MayJoin::yes, cl::Var(includes));
+    cli.Add("l", "", cl::Arg::required | cl::Multiple::yes | cl::CommaSeparated::yes, cl::Var(libs));
+
+    SUBCASE("argv")
+    {
+        char const* argv[] = {"--name=eins", "-Izwei", "-I", "drei"};
+
+        CHECK(true == cli.Parse(argv, argv + 4).success);
+        CHECK(name == "eins");
+        CHECK(name.data() == argv[0] + 7);
+        REQUIRE(includes.size() == 2);
+        CHECK(includes[0].data() == argv[1] + 2);
+        CHECK(includes[1].data() == argv[3]);
+    }
+
+    SUBCASE("vector<string>")
+    {
+        std::vector<std::string> const args = {"--name", "eins", "-Izwei"};
+
+        CHECK(true == cli.ParseArgs(args));
+        CHECK(name.data() == args[1].data());
+        REQUIRE(includes.size() == 1);
+        CHECK(includes[0].data() == args[2].data() + 2);
+    }
+
+    SUBCASE("copied")
+    {
+        CHECK(true == ParseArgs(cli, {"--name", "eins", "-Izwei"}));
+        // The temporary arguments are gone; the views refer to the copies.
+        CHECK(name == "eins");
+        REQUIRE(includes.size() == 1);
+        CHECK(includes[0] == "zwei");
+
+        CHECK(cli.PersistArg("") == "");
+    }
+
+    SUBCASE("deferred")
+    {
+        std::vector<std::string> const args = {"--name", "eins", "-Izwei", "-Idrei"};
+
+        cli.SetDeferConversion(cl::DeferConversion::yes);
+        CHECK(true == cli.ParseArgs(args));
+        CHECK(true == cli.Convert([](size_t n, auto const& task) {
+            for (size_t i = 0; i < n; ++i) {
+                task(i);
+            }
+        }));
+        CHECK(name == "eins");
+        REQUIRE(includes.size() == 2);
+        CHECK(includes[0] == "zwei");
+        CHECK(includes[1] == "drei");
+    }
+
+    SUBCASE("reserve")
+    {
+        CHECK(true == ParseArgs(cli, {"-l", "a,b,c,d,e,f,g,h,i"}));
+        CHECK(libs.size() == 9);
+        CHECK(libs.capacity() == 9);
+
+        std::vector<int> ints;
+        cl::Cmdline cli2("test", "test");
+        cli2.Add("i", "", cl::Positional::yes | cl::Multiple::yes, cl::Var(ints));
+        cli2.SetDeferConversion(cl::DeferConversion::yes);
+        CHECK(true == ParseArgs(cli2, {"1", "2", "3", "4", "5"}));
+        CHECK(true == cli2.Convert());
+        CHECK(ints.size() == 5);
+        CHECK(ints.capacity() == 5);
+    }
+}
+
+TEST_CASE("Help styles")
+{
+    bool v = false;
+    std::string output;
+    std::vector<std::string> files;
+
+    cl::Cmdline cli("tool", "Does things");
+    cli.Add("o|output", "Output file.\n.dot -x a\\b", cl::Arg::required | cl::Required::yes, cl::Var(output));
+    cli.Add("v", "Be _very_ verbose", cl::Arg::no, cl::Var(v));
+    cli.Add("files", "Input files", cl::Positional::yes | cl::Multiple::yes, cl::Var(files));
+
+    auto const write = [&](cl::HelpStyle style) {
+        cl::Cmdline::HelpFormat fmt;
+        fmt.style = style;
+        std::string s;
+        cli.WriteHelp([&](cl::string_view chunk) { s.append(chunk.data(), chunk.size()); }, fmt);
+        return s;
+    };
+
+    SUBCASE("text")
+    {
+        CHECK(write(cl::HelpStyle::text) == cli.FormatHelp());
+        CHECK(cli.FormatHelp() ==
+            "tool - Does things\n"
+            "\n"
+            "Usage:\n"
+            "  tool --o|output <arg> [options]\n"
+            "\n"
+            "Arguments:\n"
+            "  --o|output <arg>         Output file.\n"
+            "                           .dot -x a\\b\n"
+            "\n"
+            "Options:\n"
+            "  --v                      Be _very_ verbose\n"
+            "\n"
+            "Positional options:\n"
+            "  <files>...               Input files\n");
+    }
+
+    SUBCASE("man")
+    {
+        auto const man = write(cl::HelpStyle::man);
+        CHECK(man ==
+            ".TH \"tool\" 1\n"
+            ".SH NAME\n"
+            "tool \\- Does things\n"
+            ".SH SYNOPSIS\n"
+            "\\fBtool\\fR \\fB\\-\\-o|output\\fR \\fIarg\\fR [\\fIoptions\\fR]\n"
+            ".SH ARGUMENTS\n"
+            ".TP\n"
+            "\\fB\\-\\-o|output\\fR \\fIarg\\fR\n"
+            "Output file.\n"
+            ".br\n"
+            "\\&.dot \\-x a\\eb\n"
+            ".SH OPTIONS\n"
+            ".TP\n"
+            "\\fB\\-\\-v\\fR\n"
+            "Be _very_ verbose\n"
+            ".SH \"POSITIONAL OPTIONS\"\n"
+            ".TP\n"
+            "\\fIfiles\\fR...\n"
+            "Input files\n");
+
+        cl::Cmdline::HelpFormat fmt;
+        fmt.style = cl::HelpStyle::man;
+        CHECK(cli.FormatHelp(fmt) == man);
+    }
+
+    SUBCASE("markdown")
+    {
+        CHECK(write(cl::HelpStyle::markdown) ==
+            "# tool\n"
+            "\n"
+            "Does things\n"
+            "\n"
+            "## Usage\n"
+            "\n"
+            "```\n"
+            "tool --o|output <arg> [options]\n"
+            "```\n"
+            "\n"
+            "## Arguments\n"
+            "\n"
+            "- `--o|output <arg>`: Output file.\\\n"
+            "  .dot -x a\\\\b\n"
+            "\n"
+            "## Options\n"
+            "\n"
+            "- `--v`: Be \\_very\\_ verbose\n"
+            "\n"
+            "## Positional options\n"
+            "\n"
+            "- `<files>...`: Input files\n");
+    }
+
+    SUBCASE("sub-commands")
+    {
+        cli.AddSubcommand("run", "Runs it", [](cl::Cmdline&) {});
+
+        auto const text = cli.FormatHelp();
+        CHECK(text.find("  tool --o|output <arg> [options] <command> [args...]\n") != std::string::npos);
+        CHECK(text.find("\nCommands:\n  run                      Runs it\n") != std::string::npos);
+        CHECK(write(cl::HelpStyle::man).find(".SH COMMANDS\n.TP\n\\fBrun\\fR\nRuns it\n") != std::string::npos);
+        CHECK(write(cl::HelpStyle::markdown).find("\n## Commands\n\n- `run`: Runs it\n") != std::string::npos);
+    }
+
+    SUBCASE("large")
+    {
+        std::vector<std::string> names;
+        for (int i = 0; i < 100; ++i) {
+            names.push_back("option-" + std::to_string(i));
+        }
+        for (auto const& name : names) {
+            cli.Add(name.c_str(), "A rather long description, which is wrapped into multiple lines", cl::Arg::no, cl::Var(v));
+        }
+
+        // Written in chunks.
+        int calls = 0;
+        std::string streamed;
+        cli.WriteHelp([&](cl::string_view chunk) { streamed.append(chunk.data(), chunk.size()); ++calls; });
+        CHECK(calls > 1);
+        CHECK(streamed == cli.FormatHelp());
+    }
+}
+
+TEST_CASE("Help wrapping")
+{
+    CHECK(cl::impl::DisplayWidth("abc") == 3);
+    CHECK(cl::impl::DisplayWidth("\xC3\xA4\xC3\xB6\xC3\xBC") == 3); // U+00E4 U+00F6 U+00FC
+    CHECK(cl::impl::DisplayWidth("e\xCC\x81") == 1);                 // e U+0301
+    CHECK(cl::impl::DisplayWidth("\xE6\x97\xA5\xE6\x9C\xAC") == 4); // U+65E5 U+672C
+
+    bool a = false;
+
+    cl::Cmdline::HelpFormat fmt;
+    fmt.indent = 2;
+    fmt.descr_indent = 6;
+    fmt.line_length = 16;
+
+    auto const descr_of = [&](char const* descr) {
+        cl::Cmdline c("test", "test");
+        c.Add("a", descr, cl::Arg::no, cl::Var(a));
+        auto const help = c.FormatHelp(fmt);
+        auto const pos = help.find("--a");
+        REQUIRE(pos != std::string::npos);
+        return help.substr(pos + 3);
+    };
+
+    // Widths are measured in columns, not in bytes.
+    CHECK(descr_of("\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4 \xC3\xB6\xC3\xB6\xC3\xB6\xC3\xB6 \xC3\xBC") ==
+        " \xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4 \xC3\xB6\xC3\xB6\xC3\xB6\xC3\xB6\n      \xC3\xBC\n");
+    CHECK(descr_of("\xE6\x97\xA5\xE6\x9C\xAC \xE6\x97\xA5\xE6\x9C\xAC \xE6\x97\xA5") ==
+        " \xE6\x97\xA5\xE6\x9C\xAC \xE6\x97\xA5\xE6\x9C\xAC\n      \xE6\x97\xA5\n");
+
+    // Long words are broken between codepoints.
+    CHECK(descr_of("\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4") ==
+        " \xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\n      \xC3\xA4\xC3\xA4\n");
+
+    // The text following a tab-character is indented to the column of the tab.
+    CHECK(descr_of("-x \tfirst second third") == " -x first\n         second\n         third\n");
+    // ... unless the remaining space is too small.
+    CHECK(descr_of("abcdefgh\textralong") == " abcdefgh\n      extralong\n");
+
+    // Line breaks and spaces at the start of a line are kept.
+    CHECK(descr_of("one\n  two") == " one\n        two\n");
+}
+
+TEST_CASE("Batch parsing with string views")
+{
+    struct Record {
+        cl::string_view name;
+        std::vector<cl::string_view> tags;
+    };
+
+    cl::Schema schema("test", "test");
+    schema.Add("name", "", cl::Arg::required, cl::Field(&Record::name));
+    schema.Add("tag", "", cl::Arg::required | cl::Multiple::yes, cl::Field(&Record::tags));
+
+    constexpr size_t kNumLines = 200;
+
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < kNumLines; ++i) {
+        lines.push_back("--name 'record " + std::to_string(i) + "' --tag=a" + std::to_string(i) + " --tag=b");
+    }
+
+    std::vector<Record> records(kNumLines);
+    cl::BatchResults results;
+
+    cl::BatchOptions options;
+    options.num_threads = 4;
+    options.chunk_size = 8;
+
+    // The tokens live in a buffer which is reused for each line, so the views
+    // must refer to copies which are kept alive by RESULTS.
+    cl::ParseBatch(schema, lines, [&](size_t i) { return &records[i]; }, results, options);
+    REQUIRE(results.diags.empty());
+    CHECK(!results.arg_copies.empty());
+
+    for (size_t i = 0; i < kNumLines; ++i) {
+        CHECK(records[i].name == "record " + std::to_string(i));
+        REQUIRE(records[i].tags.size() == 2);
+        CHECK(records[i].tags[0] == "a" + std::to_string(i));
+        CHECK(records[i].tags[1] == "b");
+    }
+
+    // Already tokenized arguments are owned by the caller and not copied.
+    std::vector<std::vector<std::string>> arg_lists;
+    for (size_t i = 0; i < kNumLines; ++i) {
+        arg_lists.push_back({"--name", "record " + std::to_string(i)});
+    }
+
+    cl::ParseBatchArgs(schema, arg_lists, [&](size_t i) { return &records[i]; }, results, options);
+    REQUIRE(results.diags.empty());
+    CHECK(results.arg_copies.empty());
+    for (size_t i = 0; i < kNumLines; ++i) {
+        CHECK(records[i].name.data() == arg_lists[i][1].data());
+    }
+}
+
+TEST_CASE("Mutable parsers")
+{
+    int calls = 0;
+    std::vector<int> seen;
+
+    cl::Cmdline cli("test", "test");
+    // A non-const-callable lambda with its own state.
+    cli.Add("a", "", cl::Arg::no | cl::Multiple::yes, [&seen, n = 0](cl::ParseContext const&) mutable {
+        seen.push_back(++n);
+        return true;
+    });
+    cli.Add("b", "", cl::Arg::no, [&calls](cl::ParseContext const&) mutable { ++calls; });
+
+    CHECK(true == ParseArgs(cli, {"-a", "-b", "-a"}));
+    CHECK(seen == std::vector<int>{1, 2});
+    CHECK(calls == 1);
+}
+
+TEST_CASE("Parallel conversion of the arguments of one option")
+{
+    int level = 0;
+    std::vector<std::string> inputs;
+    std::atomic<int> checks{0};
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("level", "", cl::Arg::required, cl::Var(level));
+    cli.Add("input", "", cl::Arg::required | cl::Multiple::yes, cl::Var(inputs, [&](cl::ParseContext const&, std::string const& value) {
+        ++checks;
+        return value[0] != 'x';
+    }));
+    cli.SetDeferConversion(cl::DeferConversion::yes);
+
+    std::vector<std::string> args;
+    for (int i = 0; i < 200; ++i) {
+        args.push_back((i % 50 == 7 ? "--input=x" : "--input=") + std::to_string(i));
+    }
+    args.push_back("--level=3");
+    CHECK(true == cli.ParseArgs(args));
+
+    size_t num_tasks = 0;
+    CHECK(false == cli.Convert([&](size_t n, auto const& task) {
+        num_tasks = n;
+        std::atomic<size_t> next{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&] {
+                for (size_t i; (i = next++) < n; ) {
+                    task(i);
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    }));
+
+    // One task for each argument of --input, and one for --level.
+    CHECK(num_tasks == 201);
+    CHECK(checks == 200);
+    CHECK(level == 3);
+
+    // The valid values are stored in order.
+    REQUIRE(inputs.size() == 196);
+    CHECK(inputs[0] == "0");
+    CHECK(inputs[7] == "8");
+    CHECK(inputs[195] == "199");
+
+    // The diagnostics are in the order of the arguments.
+    REQUIRE(cli.Diag().size() == 4);
+    CHECK(cli.Diag()[0].index == 7);
+    CHECK(cli.Diag()[0].message == "invalid argument 'x7' for option 'input'");
+    CHECK(cli.Diag()[1].index == 57);
+    CHECK(cli.Diag()[2].index == 107);
+    CHECK(cli.Diag()[3].index == 157);
+}
+
+TEST_CASE("Floating-point conversion ignores the locale")
+{
+    if (std::setlocale(LC_NUMERIC, "de_DE.UTF-8") == nullptr && std::setlocale(LC_NUMERIC, "de_DE") == nullptr) {
+        return; // Locale not installed
+    }
+
+    auto const parse = [](char const* str, double& value) {
+        return cl::impl::StrToFloatingPoint(str, str + std::strlen(str), value);
+    };
+
+    // These do not take the fast path.
+    double value = 0;
+    auto res = parse("12345678901234567890.5", value);
+    CHECK(res.ec == cl::impl::ParseNumberStatus::success);
+    CHECK(*res.ptr == '\0');
+    CHECK(value == 12345678901234567890.5);
+
+    res = parse("12345678901234567890,5", value);
+    CHECK(*res.ptr == ',');
+
+    std::setlocale(LC_NUMERIC, "C");
+}
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#elif defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable: 4996)
+#endif
+
+TEST_CASE("Deprecated OptionBase::Count")
+{
+    cl::Cmdline cli("test", "test");
+    auto const a = cli.Add("a", "", cl::Arg::no | cl::Multiple::yes, [](cl::ParseContext const&) {});
+    auto const b = cli.Add("b", "", cl::Arg::no, [](cl::ParseContext const&) {});
+
+    CHECK(true == ParseArgs(cli, {"-a", "-a"}));
+    CHECK(a->Count() == 2);
+    CHECK(b->Count() == 0);
+    CHECK(a->Count() == cli.Count(a));
+}
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#elif defined(_MSC_VER)
+#pragma warning(pop)
+#endif
+
+TEST_CASE("Shared sub-command schemas")
+{
+    int num_inits = 0;
+
+    CountingResource resource;
+    {
+        cl::Schema schema("test", "test", &resource);
+        schema.AddSubcommand("run", "", [&](cl::Cmdline& sub) {
+            ++num_inits;
+            sub.Add("n", "", cl::Arg::required, [](cl::ParseContext const&) {});
+        });
+
+        cl::Cmdline cli1(schema);
+        cl::Cmdline cli2(schema);
+
+        auto const num_allocs = resource.num_allocs;
+        CHECK(true == ParseArgs(cli1, {"run", "-n=1"}));
+        CHECK(resource.num_allocs > num_allocs); // The sub-command schema uses the resource.
+        CHECK(true == ParseArgs(cli2, {"run", "-n=2"}));
+        CHECK(num_inits == 1);
+
+        REQUIRE(cli1.Subcommand() != nullptr);
+        REQUIRE(cli2.Subcommand() != nullptr);
+        CHECK(&cli1.Subcommand()->GetSchema() == &cli2.Subcommand()->GetSchema());
+        CHECK(&cli1.Subcommand()->GetSchema() == &schema.SubcommandSchema(0));
+        CHECK(cli1.Subcommand()->Count("n") == 1);
+        CHECK(cli2.Subcommand()->Count("n") == 1);
+    }
+    CHECK(resource.num_live == 0);
+}
+
+TEST_CASE("Adding many options")
+{
+    constexpr size_t kNumOptions = 10000;
+
+    std::vector<std::string> names;
+    for (size_t i = 0; i < kNumOptions; ++i) {
+        names.push_back("option" + std::to_string(i));
+    }
+
+    CountingResource resource;
+    {
+        cl::Schema schema("test", "test", &resource);
+        for (auto const& name : names) {
+            schema.Add(name.c_str(), "", cl::OptionFlags{}, [](cl::ParseContext const&) {});
+        }
+        CHECK(schema.FindOption("option9999") != nullptr);
+
+        // The storage grows geometrically. Growing it by one element for each
+        // option would request hundreds of MB here.
+        CHECK(resource.num_bytes < 1000 * kNumOptions);
+    }
+    CHECK(resource.num_live == 0);
+}
+
+TEST_CASE("Replay after a failed conversion")
+{
+    auto const add_options = [](cl::Cmdline& cli, int& n) {
+        cli.Add("n", "", cl::Arg::required, cl::Var(n));
+    };
+
+    int n1 = 0;
+    cl::Cmdline cli1("test", "test");
+    add_options(cli1, n1);
+    cli1.SetDeferConversion(cl::DeferConversion::yes);
+    CHECK(true == ParseArgs(cli1, {"-n=x"}));
+    CHECK(false == cli1.Convert());
+    CHECK(cli1.Count("n") == 0);
+
+    std::string blob;
+    CHECK(true == cli1.Serialize(blob));
+
+    // The argument fails again, and the option is not counted.
+    int n2 = 0;
+    cl::Cmdline cli2("test", "test");
+    add_options(cli2, n2);
+    CHECK(false == cli2.Replay(blob));
+    CHECK(cli2.Count("n") == 0);
+    REQUIRE(cli2.Diag().size() == 1);
+    CHECK(cli2.Diag()[0].message == "invalid argument 'x' for option 'n'");
+
+    // A valid occurrence is still allowed.
+    CHECK(true == ParseArgs(cli2, {"-n=2"}));
+    CHECK(n2 == 2);
+    CHECK(cli2.Count("n") == 1);
+
+    // The counts must match the recorded arguments.
+    auto const count_pos = 32; // The count of "n", after the header
+    std::string corrupt = blob;
+    corrupt[count_pos] = 0; // Fewer occurrences than arguments
+    cl::Cmdline cli3("test", "test");
+    add_options(cli3, n2);
+    CHECK(false == cli3.Replay(corrupt));
+    CHECK(cli3.Diag().back().message == "invalid command line blob");
+
+    corrupt[count_pos] = 2; // "n" may only occur once
+    CHECK(false == cli3.Replay(corrupt));
+    CHECK(cli3.Diag().back().message == "invalid command line blob");
+    CHECK(cli3.Count("n") == 0);
+
+    // Nor may it be replayed twice.
+    CHECK(false == cli2.Replay(blob));
+    CHECK(cli2.Diag().back().message == "invalid command line blob");
+    CHECK(cli2.Count("n") == 1);
+}
+
+namespace {
+
+// A subclass written before OptionBase::Parse became const.
+class LegacyOption final : public cl::OptionBase {
+public:
+    int calls = 0;
+
+    explicit LegacyOption(char const* name) : OptionBase(name, "", cl::OptionFlags{} | cl::Arg::optional | cl::Multiple::yes) {}
+
+private:
+    bool Parse(cl::ParseContext const& ctx) override {
+        ++calls;
+        return ctx.arg != "x";
+    }
+};
+
+class ConstOption final : public cl::OptionBase {
+public:
+    mutable std::atomic<int> calls{0};
+
+    explicit ConstOption(char const* name) : OptionBase(name, "", cl::OptionFlags{}) {}
+
+private:
+    bool Parse(cl::ParseContext const& /*ctx*/) const override {
+        ++calls;
+        return true;
+    }
+};
+
+} // namespace
+
+TEST_CASE("OptionBase subclasses")
+{
+    cl::Cmdline cli("test", "test");
+    auto const legacy = cli.Add(std::make_unique<LegacyOption>("a"));
+    auto const modern = cli.Add(std::make_unique<ConstOption>("b"));
+
+    CHECK(true == ParseArgs(cli, {"-a", "-a=y", "-b"}));
+    CHECK(static_cast<LegacyOption const*>(legacy)->calls == 2);
+    CHECK(static_cast<ConstOption const*>(modern)->calls == 1);
+
+    CHECK(false == ParseArgs(cli, {"-a=x"}));
+    CHECK(static_cast<LegacyOption const*>(legacy)->calls == 3);
+}
+
+TEST_CASE("Deferred arguments in the caller's storage")
+{
+    cl::string_view name;
+    std::string file;
+
+    cl::Cmdline cli("test", "test");
+    cli.Add("name", "", cl::Arg::required, cl::Var(name));
+    cli.Add("file", "", cl::Positional::yes, cl::Var(file));
+    cli.SetDeferConversion(cl::DeferConversion::yes);
+
+    // The arguments of main's argv are not copied, neither when recorded nor
+    // when converted.
+    char const* argv[] = {"--name=abc", "input.txt"};
+    CHECK(true == cli.Parse(argv, argv + 2).success);
+    CHECK(true == cli.Convert());
+    CHECK(name.data() == argv[0] + 7);
+    CHECK(file == "input.txt");
+
+    std::string blob;
+    CHECK(true == cli.Serialize(blob));
+
+    cl::string_view name2;
+    std::string file2;
+    cl::Cmdline cli2("test", "test");
+    cli2.Add("name", "", cl::Arg::required, cl::Var(name2));
+    cli2.Add("file", "", cl::Positional::yes, cl::Var(file2));
+    cli2.SetDeferConversion(cl::DeferConversion::yes);
+    CHECK(true == cli2.Replay(blob));
+    blob.assign(blob.size(), '\0');
+    CHECK(true == cli2.Convert());
+    CHECK(name2 == "abc");
+    CHECK(file2 == "input.txt");
+
+    // Tokens are copied.
+    char buffer[] = "--name=xyz";
+    cli.Reset();
+    auto const args = cl::TokenizeUnixInPlace(buffer, buffer + 10);
+    CHECK(true == cli.Parse(args.begin(), args.end()).success);
+    buffer[7] = '_';
+    CHECK(true == cli.Convert());
+    CHECK(name == "xyz");
+}